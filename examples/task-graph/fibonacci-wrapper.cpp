@@ -0,0 +1,45 @@
+#include <cstdio>
+#include <cstdlib>
+
+#include "api/otter-task-graph/otter-task-graph-wrapper.hpp"
+
+static constexpr otter::Label fib_label = "fib(%d)";
+
+// The parent is passed down directly, so no task pool is needed
+static int fib(otter::Task &parent, int n) {
+  if (n < 2)
+    return n;
+  int i, j;
+  {
+    otter::Task child(parent, fib_label, n - 1);
+    i = fib(child, n - 1);
+  }
+  {
+    otter::Task child(parent, fib_label, n - 2);
+    j = fib(child, n - 2);
+  }
+  parent.wait_for(otter_sync_children);
+  return i + j;
+}
+
+int main(int argc, char *argv[]) {
+  if (argc != 2) {
+    fprintf(stderr, "usage: %s n\n", argv[0]);
+    return 1;
+  }
+  int n = atoi(argv[1]);
+  int fibn = 0;
+  {
+    otter::Trace trace;
+    char phase_name[256] = {0};
+    snprintf(&phase_name[0], 255, "calculate fib(%d)", n);
+    otter::Phase phase(phase_name);
+    {
+      otter::Task root(fib_label, n);
+      fibn = fib(root, n);
+    }
+    phase.wait_for(otter_sync_children);
+  }
+  printf("fib(%d) = %d\n", n, fibn);
+  return 0;
+}
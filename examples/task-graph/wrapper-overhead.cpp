@@ -0,0 +1,109 @@
+/* Compares the cost per task of the C++ wrapper with that of the C API calls it
+   stands for, of a plain label looked up by its compile-time hash, of tasks
+   created as one batch, and of a task while tracing is stopped. Run with OTTER_SINK=null to measure the instrumentation alone.
+
+     wrapper-overhead [tasks] [repeats]
+*/
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+
+#include "api/otter-task-graph/otter-task-graph-wrapper.hpp"
+
+using clock_type = std::chrono::steady_clock;
+
+static constexpr otter::Label leaf_label = "leaf";
+
+template <typename F> static double ns_per_task(int tasks, F &&loop) {
+  auto start = clock_type::now();
+  loop();
+  std::chrono::duration<double, std::nano> elapsed = clock_type::now() - start;
+  return elapsed.count() / tasks;
+}
+
+int main(int argc, char *argv[]) {
+  int tasks = argc > 1 ? atoi(argv[1]) : 1000000;
+  int repeats = argc > 2 ? atoi(argv[2]) : 5;
+  if (tasks <= 0 || repeats <= 0) {
+    fprintf(stderr, "usage: %s [tasks] [repeats]\n", argv[0]);
+    return 1;
+  }
+
+  double c_api = 1e300, wrapper = 1e300, c_plain = 1e300, hashed = 1e300,
+         batch = 1e300, stopped = 1e300, disabled = 1e300;
+  volatile int sink = 0;
+  {
+    otter::Trace trace;
+    otter::Task root("root");
+    otter_task_context *parent = root.handle();
+    /* Alternate the loops so that neither benefits from running later */
+    for (int r = 0; r < repeats; r++) {
+      c_api = std::min(c_api, ns_per_task(tasks, [&] {
+        for (int i = 0; i < tasks; i++) {
+          otter_task_context *task = otterTaskInitialise(
+              parent, -1, otter_no_add_to_pool, true, __FILE__, __func__,
+              __LINE__, "leaf %d", i & 7);
+          task = otterTaskStart(task, __FILE__, __func__, __LINE__);
+          otterTaskEnd(task, __FILE__, __func__, __LINE__);
+        }
+      }));
+      wrapper = std::min(wrapper, ns_per_task(tasks, [&] {
+        for (int i = 0; i < tasks; i++) {
+          otter::Task task(root, "leaf %d", i & 7);
+        }
+      }));
+      c_plain = std::min(c_plain, ns_per_task(tasks, [&] {
+        for (int i = 0; i < tasks; i++) {
+          otter_task_context *task = otterTaskInitialise(
+              parent, -1, otter_no_add_to_pool, true, __FILE__, __func__,
+              __LINE__, "leaf");
+          task = otterTaskStart(task, __FILE__, __func__, __LINE__);
+          otterTaskEnd(task, __FILE__, __func__, __LINE__);
+        }
+      }));
+      hashed = std::min(hashed, ns_per_task(tasks, [&] {
+        for (int i = 0; i < tasks; i++) {
+          otter::Task task(root, leaf_label);
+        }
+      }));
+      batch = std::min(batch, ns_per_task(tasks, [&] {
+        otter::TaskBatch leaves(root, tasks, "leaf");
+        for (otter::Task task : leaves) {
+        }
+      }));
+      root.wait_for(otter_sync_children);
+    }
+    otterTraceStop();
+    for (int r = 0; r < repeats; r++) {
+      stopped = std::min(stopped, ns_per_task(tasks, [&] {
+        for (int i = 0; i < tasks; i++) {
+          otter::Task task(root, "leaf %d", i & 7);
+        }
+      }));
+    }
+    otterTraceStart();
+    otter::BasicTask<false> untraced_root("root");
+    for (int r = 0; r < repeats; r++) {
+      disabled = std::min(disabled, ns_per_task(tasks, [&] {
+        for (int i = 0; i < tasks; i++) {
+          otter::BasicTask<false> task(untraced_root, "leaf %d", i & 7);
+          sink = sink + 1;
+        }
+      }));
+    }
+  }
+
+  printf("%-30s %d x %d\n", "Tasks x repeats:", tasks, repeats);
+  printf("%-30s %.1f\n", "C API (ns/task):", c_api);
+  printf("%-30s %.1f\n", "Wrapper (ns/task):", wrapper);
+  printf("%-30s %+.1f%%\n", "Wrapper overhead:",
+         100.0 * (wrapper - c_api) / c_api);
+  printf("%-30s %.1f\n", "C API, plain label (ns/task):", c_plain);
+  printf("%-30s %.1f\n", "Hashed label (ns/task):", hashed);
+  printf("%-30s %.1f\n", "Batch wrapper (ns/task):", batch);
+  printf("%-30s %.1f\n", "Stopped wrapper (ns/task):", stopped);
+  printf("%-30s %.1f\n", "Disabled wrapper (ns/task):", disabled);
+  return 0;
+}
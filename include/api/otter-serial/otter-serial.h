@@ -108,6 +108,19 @@ void otterTraceStart(void);
  */
 void otterTraceStop(void);
 
+/**
+ * @brief Write the events held by the flight recorder to the trace.
+ *
+ * With `OTTER_SINK=flight`, Otter keeps only each thread's most recent events
+ * in memory and writes nothing to the trace until a dump is requested by this
+ * function, by `SIGUSR1` or by beginning the phase named in
+ * `OTTER_FLIGHT_DUMP_PHASE`. Each thread writes its events the next time it
+ * records an event, or when it ends.
+ *
+ * Does nothing if the flight recorder isn't in use.
+ */
+void otterTraceDump(void);
+
 /**
  * @brief Indicate the start of a region which could be executed in parallel.
  *
@@ -212,42 +225,45 @@ void otterLoopBegin(void);
 /**
  * @brief Indicate the end of a loop.
  *
- * Counterpart to `otterLoopBegin()`.
+ * Counterpart to `otterLoopBegin()`. Records a `loop-end` event carrying the
+ * statistics of the loop's iterations, if any were recorded.
  *
  * @see `otterLoopBegin()`
+ * @see `otterLoopIterationBegin()`
  *
  */
 void otterLoopEnd(void);
 
 /**
- * @brief Indicate the beginning of a loop iteration. [TODO]
+ * @brief Indicate the beginning of a loop iteration.
  *
  * Indicate that code enclosed by a matching `otterLoopIterationEnd()`
- * represents one iteration of an enclosing loop.
- *
- * @warning This function is currently a stub; it is defined but has yet to be
- * fully implemented.
+ * represents one iteration of the innermost enclosing loop.
  *
  *
  * ## Usage
  *
  * - Must be matched by a corresponding `otterLoopIterationEnd()` call.
+ * - Must be called between `otterLoopBegin()` and `otterLoopEnd()`.
  *
  *
  * ## Semantics
  *
- * - None (stub function).
+ * Iterations are not recorded as events. Instead the loop counts its
+ * iterations and keeps their total, shortest and longest duration and a
+ * histogram of their durations, which are recorded with the `loop-end` event.
+ * If `OTTER_LOOP_SAMPLE=N` is set, every Nth iteration of each loop, starting
+ * with the first, is also recorded as a `loop-iteration` event.
  *
  */
 void otterLoopIterationBegin(void);
 
 /**
- * @brief Indicate the end of a loop iteration. [TODO]
+ * @brief Indicate the end of a loop iteration.
  *
  * Counterpart to `otterLoopIterationBegin()`.
  *
- * @warning This function is currently a stub; it is defined but has yet to be
- * fully implemented.
+ * @see `otterLoopIterationBegin()`
  *
  */
 void otterLoopIterationEnd(void);
@@ -399,6 +415,9 @@ void otterSynchroniseDescendantTasksEnd(void);
  * Creates a meta-region to nest all other regions encountered within it. Phases
  * may themselves be nested.
  *
+ * With `OTTER_SINK=compact` and `OTTER_SEGMENT_PHASES=N`, every Nth phase also
+ * begins a new segment of the trace.
+ *
  *
  * @param name A unique identifier for this phase
  *
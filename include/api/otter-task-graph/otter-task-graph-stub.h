@@ -44,6 +44,7 @@
 #define OTTER_DECLARE_HANDLE(...)
 #define OTTER_INIT_TASK(...)
 #define OTTER_DEFINE_TASK(...)
+#define OTTER_INIT_TASK_BATCH(...)
 #define OTTER_POOL_ADD(...)
 #define OTTER_POOL_POP(...)
 #define OTTER_POOL_BORROW(...)
@@ -51,11 +52,14 @@
 #define OTTER_POOL_DECL_BORROW(...)
 #define OTTER_TASK_START(...)
 #define OTTER_TASK_END(...)
+#define OTTER_TASK_START_BATCH(...)
+#define OTTER_TASK_END_BATCH(...)
 #define OTTER_TASK_WAIT_FOR(...)
 #define OTTER_TASK_WAIT_START(...)
 #define OTTER_TASK_WAIT_END(...)
 #define OTTER_PHASE_BEGIN(...)
 #define OTTER_PHASE_END(...)
 #define OTTER_PHASE_SWITCH(...)
+#define OTTER_TRACING() 0
 
 #endif // OTTER_TASK_GRAPH_STUB_H
@@ -3,6 +3,16 @@
  * @author Adam Tuft
  * @brief Provides macros for accessing the Otter task-graph API for the purpose
  * of annotating user code.
+ *
+ * Except for OTTER_INITIALISE() and OTTER_FINALISE(), each macro which calls
+ * into Otter first tests OTTER_TRACING() inline and does nothing while tracing
+ * is stopped, without evaluating its arguments. A macro which assigns a task
+ * handle assigns OTTER_NULL_TASK instead, and OTTER_TASK_START() leaves the
+ * handle unchanged. The macros which end a task or a phase, and
+ * OTTER_PHASE_BEGIN() which they are matched with, always call into Otter, so
+ * that a task or phase still open when tracing stops is ended. So do
+ * OTTER_PHASE_CURRENT() and OTTER_PHASE_ADOPT(), so that an adopted phase is
+ * always released.
  * @version 0.1
  * @date 2023-05-15
  *
@@ -19,6 +29,7 @@
 #define OTTER_DECLARE_HANDLE(...)
 #define OTTER_INIT_TASK(...)
 #define OTTER_DEFINE_TASK(...)
+#define OTTER_INIT_TASK_BATCH(...)
 #define OTTER_POOL_ADD(...)
 #define OTTER_POOL_POP(...)
 #define OTTER_POOL_DECL_POP(...)
@@ -26,12 +37,17 @@
 #define OTTER_POOL_DECL_BORROW(...)
 #define OTTER_TASK_START(...)
 #define OTTER_TASK_END(...)
+#define OTTER_TASK_START_BATCH(...)
+#define OTTER_TASK_END_BATCH(...)
 #define OTTER_TASK_WAIT_FOR(...)
 #define OTTER_TASK_WAIT_START(...)
 #define OTTER_TASK_WAIT_END(...)
 #define OTTER_PHASE_BEGIN(...)
 #define OTTER_PHASE_END(...)
 #define OTTER_PHASE_SWITCH(...)
+#define OTTER_PHASE_CURRENT(...)
+#define OTTER_PHASE_ADOPT(...)
+#define OTTER_TRACING() 0
 
 #else
 
@@ -59,6 +75,10 @@
 
 #define OTTER_SOURCE_LOCATION() __FILE__, __func__, __LINE__
 
+/* Make a call into Otter only while tracing, otherwise evaluate to otherwise */
+#define OTTER_IMPL_IF_TRACING(call, otherwise)                                 \
+  (OTTER_TRACING() ? (call) : (otherwise))
+
 // @endcond
 
 /**
@@ -113,9 +133,11 @@
  *
  */
 #define OTTER_INIT_TASK(task, parent, add_to_pool, label, ...)                 \
-  task = otterTaskInitialise(parent, -1, add_to_pool, true,                    \
-                             OTTER_SOURCE_LOCATION(),                          \
-                             label OTTER_IMPL_PASS_ARGS(__VA_ARGS__))
+  task = OTTER_IMPL_IF_TRACING(                                                \
+      otterTaskInitialise(parent, -1, add_to_pool, true,                       \
+                          OTTER_SOURCE_LOCATION(),                             \
+                          label OTTER_IMPL_PASS_ARGS(__VA_ARGS__)),            \
+      OTTER_NULL_TASK)
 
 /**
  * @brief Declare and initialise a new task handle in the current scope.
@@ -146,6 +168,34 @@
   OTTER_INIT_TASK(task, parent, add_to_pool,                                   \
                   label OTTER_IMPL_PASS_ARGS(__VA_ARGS__))
 
+/**
+ * @brief Initialise `n` sibling tasks with the same label, storing their
+ * handles in the array \p tasks, and record their creation as one event. While
+ * tracing is stopped, each handle is set to #OTTER_NULL_TASK instead.
+ *
+ * If \p parent is a valid task handle, the new tasks are its children.
+ * Otherwise they are children of the current phase.
+ *
+ * @param tasks: An array of at least \p n task handles.
+ * @param n: The number of tasks.
+ * @param parent: The handle of the parent task, or #OTTER_NULL_TASK.
+ * @param label: A `printf`-like format string for the tasks' label
+ * @param ...: Variadic arguments for use with \p label.
+ *
+ * @see otterTaskInitialiseBatch
+ */
+#define OTTER_INIT_TASK_BATCH(tasks, n, parent, label, ...)                    \
+  do {                                                                         \
+    if (OTTER_TRACING()) {                                                     \
+      otterTaskInitialiseBatch(parent, n, -1, tasks, OTTER_SOURCE_LOCATION(),  \
+                               label OTTER_IMPL_PASS_ARGS(__VA_ARGS__));       \
+    } else {                                                                   \
+      for (size_t otter_impl_k = 0; otter_impl_k < (size_t)(n);                \
+           otter_impl_k++)                                                     \
+        (tasks)[otter_impl_k] = OTTER_NULL_TASK;                               \
+    }                                                                          \
+  } while (0)
+
 /**
  * @brief Add a task handle to the task pool with the given label.
  *
@@ -158,7 +208,9 @@
  *
  */
 #define OTTER_POOL_ADD(task, label, ...)                                       \
-  otterTaskPushLabel(task, label OTTER_IMPL_PASS_ARGS(__VA_ARGS__))
+  OTTER_IMPL_IF_TRACING(                                                       \
+      otterTaskPushLabel(task, label OTTER_IMPL_PASS_ARGS(__VA_ARGS__)),       \
+      (void)0)
 
 /**
  * @brief Remove a task from the task pool with the given label. \p task is
@@ -173,7 +225,9 @@
  *
  */
 #define OTTER_POOL_POP(task, label, ...)                                       \
-  task = otterTaskPopLabel(label OTTER_IMPL_PASS_ARGS(__VA_ARGS__))
+  task = OTTER_IMPL_IF_TRACING(                                                \
+      otterTaskPopLabel(label OTTER_IMPL_PASS_ARGS(__VA_ARGS__)),              \
+      OTTER_NULL_TASK)
 
 /**
  * @brief Borrow a task from the task pool with the given label. \p task is
@@ -193,7 +247,9 @@
  *
  */
 #define OTTER_POOL_BORROW(task, label, ...)                                    \
-  task = otterTaskBorrowLabel(label OTTER_IMPL_PASS_ARGS(__VA_ARGS__))
+  task = OTTER_IMPL_IF_TRACING(                                                \
+      otterTaskBorrowLabel(label OTTER_IMPL_PASS_ARGS(__VA_ARGS__)),           \
+      OTTER_NULL_TASK)
 
 /**
  * @brief Declare a handle in the current scope, assigning a task removed from
@@ -272,7 +328,8 @@
  * @see #OTTER_TASK_END
  */
 #define OTTER_TASK_START(task)                                                 \
-  task = otterTaskStart(task, OTTER_SOURCE_LOCATION())
+  task = OTTER_IMPL_IF_TRACING(otterTaskStart(task, OTTER_SOURCE_LOCATION()),  \
+                               task)
 
 /**
  * @brief Counterpart to `OTTER_TASK_START()`, indicating the end of the code
@@ -285,7 +342,34 @@
  *
  * @see #OTTER_TASK_START
  */
-#define OTTER_TASK_END(task) otterTaskEnd(task, OTTER_SOURCE_LOCATION())
+#define OTTER_TASK_END(task)                                                   \
+  ((task) != OTTER_NULL_TASK ? otterTaskEnd(task, OTTER_SOURCE_LOCATION())     \
+                             : (void)0)
+
+/**
+ * @brief Record the start of \p n tasks, such as a chunk of the tasks of an
+ * `OTTER_INIT_TASK_BATCH()`, which the calling thread runs together.
+ *
+ * @param tasks: An array of \p n task handles.
+ * @param n: The number of tasks.
+ *
+ * @see otterTaskStartBatch
+ */
+#define OTTER_TASK_START_BATCH(tasks, n)                                       \
+  OTTER_IMPL_IF_TRACING(                                                       \
+      otterTaskStartBatch(tasks, n, OTTER_SOURCE_LOCATION()), (void)0)
+
+/**
+ * @brief Counterpart to `OTTER_TASK_START_BATCH()`, indicating the end of the
+ * code represented by the given tasks.
+ *
+ * @param tasks: An array of \p n task handles.
+ * @param n: The number of tasks.
+ *
+ * @see otterTaskEndBatch
+ */
+#define OTTER_TASK_END_BATCH(tasks, n)                                         \
+  otterTaskEndBatch(tasks, n, OTTER_SOURCE_LOCATION())
 
 /**
  * @brief Records a barrier where the given task must wait until all prior child
@@ -300,8 +384,10 @@
  *
  */
 #define OTTER_TASK_WAIT_FOR(task, mode)                                        \
-  otterSynchroniseTasks(task, otter_sync_##mode, otter_endpoint_discrete,      \
-                        OTTER_SOURCE_LOCATION())
+  OTTER_IMPL_IF_TRACING(                                                       \
+      otterSynchroniseTasks(task, otter_sync_##mode, otter_endpoint_discrete,  \
+                            OTTER_SOURCE_LOCATION()),                        \
+      (void)0)
 
 /**
  * @brief Record the start of a region where the task waits for children or
@@ -326,8 +412,10 @@
  *
  */
 #define OTTER_TASK_WAIT_START(task, mode)                                      \
-  otterSynchroniseTasks(task, otter_sync_##mode, otter_endpoint_enter,         \
-                        OTTER_SOURCE_LOCATION())
+  OTTER_IMPL_IF_TRACING(                                                       \
+      otterSynchroniseTasks(task, otter_sync_##mode, otter_endpoint_enter,     \
+                            OTTER_SOURCE_LOCATION()),                        \
+      (void)0)
 
 /**
  * @brief Record the end of a region where the task waits for children or
@@ -337,8 +425,10 @@
  *
  */
 #define OTTER_TASK_WAIT_END(task, mode)                                        \
-  otterSynchroniseTasks(task, otter_sync_##mode, otter_endpoint_leave,         \
-                        OTTER_SOURCE_LOCATION())
+  OTTER_IMPL_IF_TRACING(                                                       \
+      otterSynchroniseTasks(task, otter_sync_##mode, otter_endpoint_leave,     \
+                            OTTER_SOURCE_LOCATION()),                        \
+      (void)0)
 
 /**
  * @brief Start a new algorithmic phase.
@@ -366,7 +456,8 @@
  * @see `OTTER_PHASE_SWITCH()`
  *
  */
-#define OTTER_PHASE_BEGIN(name) otterPhaseBegin((name), OTTER_SOURCE_LOCATION())
+#define OTTER_PHASE_BEGIN(name)                                                \
+  otterPhaseBegin((name), OTTER_SOURCE_LOCATION())
 
 /**
  * @brief End the present algorithmic phase.
@@ -400,4 +491,30 @@
 #define OTTER_PHASE_SWITCH(name)                                               \
   otterPhaseSwitch((name), OTTER_SOURCE_LOCATION())
 
+/**
+ * @brief Assign the calling thread's innermost phase to a task handle, so that
+ * it can be adopted by other threads with `OTTER_PHASE_ADOPT()`.
+ *
+ * @param phase A task handle declared with `OTTER_DECLARE_HANDLE()`, which is
+ * set to #OTTER_NULL_TASK if the calling thread hasn't begun a phase.
+ *
+ * @see `OTTER_PHASE_ADOPT()`
+ *
+ */
+#define OTTER_PHASE_CURRENT(phase) phase = otterPhaseCurrent()
+
+/**
+ * @brief Adopt another thread's phase, given by `OTTER_PHASE_CURRENT()`.
+ *
+ * While the calling thread has no phase of its own, tasks it creates with
+ * #OTTER_NULL_TASK as their parent are children of the adopted phase. Adopt
+ * #OTTER_NULL_TASK to leave it. The phase must be adopted before it ends.
+ *
+ * @param phase The phase to adopt.
+ *
+ * @see `OTTER_PHASE_CURRENT()`
+ *
+ */
+#define OTTER_PHASE_ADOPT(phase) otterPhaseAdopt(phase)
+
 #endif
@@ -1,161 +1,520 @@
+/**
+ * @file otter-task-graph-wrapper.hpp
+ * @author Adam Tuft
+ * @brief Header-only C++17 wrapper for the Otter task-graph API. Tasks, phases
+ * and synchronisation regions are RAII types which record the same events as
+ * the corresponding `OTTER_*` macros, capturing the source location of the
+ * code which declares them.
+ *
+ *     otter::Trace trace;
+ *     otter::Phase phase("timestep");
+ *     otter::Task task("solve %d", n);
+ *     {
+ *       otter::Task child(task, "leaf");
+ *     }
+ *     task.wait_for(otter_sync_children);
+ *     otter::TaskBatch chunks(task, n_chunks, "chunk");
+ *     for (otter::Task chunk : chunks) {
+ *       // ...
+ *     }
+ *
+ * A task is created and started when it is constructed and ends when it is
+ * destroyed, or explicitly with `end()`. Labels are `printf`-like formats as in
+ * the C API. A label declared as a `constexpr otter::Label` is hashed at
+ * compile time.
+ *
+ * Like the `OTTER_*` macros, these types do nothing while tracing is stopped
+ * (see `otterTraceStop()`), except that tasks and phases still open are ended,
+ * and recorded as ending if their start was recorded.
+ *
+ * Each type is an alias for a template taking a bool which says whether to
+ * trace. If `OTTER_TASK_GRAPH_DISABLE_USER` is defined (as for
+ * otter-task-graph-user.h), the aliases name the non-tracing instantiations,
+ * whose members do nothing and compile away entirely.
+ * @version 0.1
+ * @date 2026-10-19
+ *
+ * @copyright Copyright (c) 2026
+ *
+ */
+
 #pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <memory>
+#include <utility>
+
+#if !defined(__has_builtin)
+#define OTTER_IMPL_HAS_BUILTIN(x) 0
+#else
+#define OTTER_IMPL_HAS_BUILTIN(x) __has_builtin(x)
+#endif
+
+/* GCC has had these builtins for longer than __has_builtin */
+#if !OTTER_IMPL_HAS_BUILTIN(__builtin_FUNCTION) && !defined(__GNUC__)
+#include <source_location>
+#define OTTER_IMPL_STD_SOURCE_LOCATION 1
+#endif
+
+#define OTTER_USE_PRIVATE_HEADER
 #include "otter-task-graph.h"
+#undef OTTER_USE_PRIVATE_HEADER
+
+namespace otter {
+
+#if defined(OTTER_TASK_GRAPH_DISABLE_USER)
+inline constexpr bool tracing_enabled = false;
+#else
+inline constexpr bool tracing_enabled = true;
+#endif
 
 /**
- * @brief Provides classes which wrap the otter-task-graph API.
- *
+ * @brief The file, function and line of a call site. Used as a defaulted
+ * argument, `source_location::current()` is evaluated where the call is made.
+ * The compiler builtins give the unqualified function name, as `__func__` does
+ * for the C macros.
  */
-namespace otter {
+struct source_location {
+  const char *file = "";
+  const char *func = "";
+  int line = 0;
+
+#if defined(OTTER_IMPL_STD_SOURCE_LOCATION)
+  static constexpr source_location
+  current(std::source_location where = std::source_location::current()) {
+    return {where.file_name(), where.function_name(),
+            static_cast<int>(where.line())};
+  }
+#else
+  static constexpr source_location
+  current(const char *file = __builtin_FILE(),
+          const char *func = __builtin_FUNCTION(),
+          int line = __builtin_LINE()) {
+    return {file, func, line};
+  }
+#endif
+};
 
 /**
- * @brief Represents an Otter task context. The default constructor records
- * an `otterTaskBegin` event for a task with no parent i.e. a root task.
- * Calling `task.make_child()` constructs a child of `task` and records
- * this in the trace.
- *
- * Copying a task is disabled as it doesn't make sense to copy a task - each
- * task context represents a unique instance of some logical task.
- *
- * Move-assignment is disabled as it doesn't make sense to overwrite one
- * task's context with the moved context of another task.
- *
+ * @brief A task label's format. When declared `constexpr`, its FNV-1a hash is
+ * computed at compile time. A task given a label with no conversions and no
+ * format arguments is labelled through `otterTaskInitialiseHashed()`, which
+ * uses the hash to find the label's string reference instead of formatting
+ * the label and looking up its text.
  */
-class Task {
+class Label {
+public:
+  constexpr Label(const char *text)
+      : m_text{text}, m_hash{hash(text)}, m_plain{plain(text)} {}
+
+  constexpr const char *c_str(void) const { return m_text; }
+  constexpr std::uint64_t hash(void) const { return m_hash; }
+
+  /* Whether the label is its own text when formatted */
+  constexpr bool is_plain(void) const { return m_plain; }
+
+  static constexpr std::uint64_t hash(const char *text) {
+    std::uint64_t h = UINT64_C(0xcbf29ce484222325);
+    for (; *text != '\0'; text++) {
+      h ^= static_cast<unsigned char>(*text);
+      h *= UINT64_C(0x100000001b3);
+    }
+    return h;
+  }
 
+private:
+  static constexpr bool plain(const char *text) {
+    for (; *text != '\0'; text++) {
+      if (*text == '%')
+        return false;
+    }
+    return true;
+  }
+
+  const char *m_text;
+  std::uint64_t m_hash;
+  bool m_plain;
+};
+
+/**
+ * @brief A label together with the call site which used it. Converting a string
+ * or Label to this type captures the caller's location, which lets the
+ * constructors below take a variadic pack of format arguments.
+ */
+struct LabelAt {
+  constexpr LabelAt(const char *format,
+                    source_location where = source_location::current())
+      : format{format}, where{where} {}
+  constexpr LabelAt(const Label &label,
+                    source_location where = source_location::current())
+      : format{label.c_str()}, where{where}, hashed{label.is_plain()},
+        hash{label.hash()} {}
+
+  const char *format;
+  source_location where;
+  bool hashed = false; // whether hash identifies the text of format
+  std::uint64_t hash = 0;
+};
+
+/**
+ * @brief Initialises Otter on construction and finalises it on destruction.
+ * Exactly one should exist, outliving all other Otter objects.
+ */
+template <bool Tracing> class BasicTrace {
 public:
-  /**
-   * @brief Construct a root Task object i.e. a task with no parent,
-   * recording `otterTaskBegin` in the trace.
-   *
-   */
-  Task(void);
-  Task(int flavour);
+  explicit BasicTrace(source_location where = source_location::current())
+      : m_where{where} {
+    if constexpr (Tracing)
+      otterTraceInitialise(where.file, where.func, where.line);
+  }
 
-  /**
-   * @brief Construct a child task from its parent, recording
-   * `otterTaskBegin` in the trace.
-   *
-   * @return Task: the new child task.
-   */
-  Task make_child(void);
+  ~BasicTrace(void) {
+    if constexpr (Tracing)
+      otterTraceFinalise(m_where.file, m_where.func, m_where.line);
+  }
 
-  /**
-   * @brief As `make_child`, but associates a flavour with the task.
-   *
-   * @return Task: the new child task.
-   */
-  Task make_child(int flavour);
+  BasicTrace(const BasicTrace &) = delete;
+  BasicTrace &operator=(const BasicTrace &) = delete;
 
-  /**
-   * @brief Move-construct a new task by adopting the context from another
-   * task.
-   *
-   * @param other: the task whose context is moved into the new task.
-   */
-  Task(Task &&other);
+private:
+  source_location m_where;
+};
+
+/**
+ * @brief A task, created and started on construction and ended on destruction.
+ * A task constructed without a parent is a child of the current phase, or of
+ * the root task if there is none. Tasks may be moved but not copied.
+ */
+template <bool Tracing> class BasicTaskBatch;
+
+template <bool Tracing> class BasicTask {
+public:
+  template <typename... Args>
+  explicit BasicTask(LabelAt label, Args... args)
+      : BasicTask(static_cast<otter_task_context *>(nullptr), label,
+                  args...) {}
 
-  // Doesn't make sense to copy or move-assign a task:
-  Task(const Task &other) = delete;            // copy-constructor
-  Task &operator=(const Task &other) = delete; // copy-assignment
-  Task &operator=(Task &&other) = delete;      // move-assignment
+  template <typename... Args>
+  BasicTask(BasicTask &parent, LabelAt label, Args... args)
+      : BasicTask(parent.m_task, label, args...) {}
+
+  BasicTask(BasicTask &&other) noexcept
+      : m_task{std::exchange(other.m_task, nullptr)}, m_where{other.m_where} {}
+
+  BasicTask(const BasicTask &) = delete;
+  BasicTask &operator=(const BasicTask &) = delete;
+  BasicTask &operator=(BasicTask &&) = delete;
+
+  ~BasicTask(void) { end(m_where); }
 
   /**
-   * @brief Record a synchronisation constraint on the descendants of a
-   * task.
-   *
-   * @param mode: whether the synchronisation constraint applies to child
-   * tasks only or all descendant tasks.
+   * @brief End the task now rather than when it is destroyed. No effect if the
+   * task has already ended.
    */
-  void synchronise_tasks(otter_task_sync_t mode);
+  void end(source_location where = source_location::current()) {
+    if constexpr (Tracing) {
+      if (m_task != nullptr)
+        otterTaskEnd(m_task, where.file, where.func, where.line);
+    }
+    m_task = nullptr;
+  }
 
   /**
-   * @brief Explicitly end the task, recording `otterTaskEnd` in the
-   * trace. No effect if the task was already ended.
-   *
+   * @brief Record a barrier where the task waits for its children or
+   * descendants, as `OTTER_TASK_WAIT_FOR`.
    */
-  void end_task(void);
+  void wait_for(otter_task_sync_t mode = otter_sync_children,
+                source_location where = source_location::current()) {
+    if constexpr (Tracing) {
+      if (m_task != nullptr && OTTER_TRACING())
+        otterSynchroniseTasks(m_task, mode, otter_endpoint_discrete,
+                              where.file, where.func, where.line);
+    }
+  }
 
   /**
-   * @brief Destroy the Task object, calling `task.end_task()` if the task
-   * wasn't already ended.
-   *
+   * @brief The underlying task handle, e.g. to pass to the C API.
    */
-  ~Task(void);
+  otter_task_context *handle(void) const { return m_task; }
 
 private:
-  /**
-   * @brief The underlying Otter task context handle.
-   *
-   */
-  otter_task_context *m_task_context = nullptr;
+  friend class BasicTaskBatch<Tracing>;
 
-  /**
-   * @brief Construct a new Task object from its parent's context,
-   * recording `otterTaskBegin` in the trace.
-   *
-   * @param parent
-   */
-  Task(otter_task_context *parent, int flavour = 0);
+  /* Take ownership of an initialised task, which has already been started */
+  BasicTask(otter_task_context *task, source_location where)
+      : m_task{task}, m_where{where} {}
+
+  template <typename... Args>
+  BasicTask(otter_task_context *parent, const LabelAt &label, Args... args)
+      : m_where{label.where} {
+    if constexpr (Tracing) {
+      if (!OTTER_TRACING())
+        return;
+      const source_location &at = label.where;
+      if constexpr (sizeof...(Args) == 0) {
+        if (label.hashed) {
+          m_task = otterTaskInitialiseHashed(parent, -1, true, at.file, at.func,
+                                             at.line, label.format, label.hash);
+          m_task = otterTaskStart(m_task, at.file, at.func, at.line);
+          return;
+        }
+      }
+      m_task = otterTaskInitialise(parent, -1, otter_no_add_to_pool, true,
+                                   at.file, at.func, at.line, label.format,
+                                   args...);
+      m_task = otterTaskStart(m_task, at.file, at.func, at.line);
+    }
+  }
+
+  otter_task_context *m_task = nullptr;
+  source_location m_where;
 };
 
 /**
- * @brief A singleton class representing the global context for Otter. Must
- * be declared before any other Otter functions or classes are used. Stores
- * a handle to a root task which may be used as the ancestor of all tasks
- * in the trace.
+ * @brief A batch of sibling tasks with the same label, created together on
+ * construction as by `otterTaskInitialiseBatch()`. Iterating over the batch
+ * starts each task in turn and yields it as a `Task`, which ends when it goes
+ * out of scope, so a range-for loop records one task per iteration:
+ *
+ *     otter::TaskBatch chunks(parent, n, "chunk");
+ *     for (otter::Task chunk : chunks) {
+ *       // ...
+ *     }
  *
+ * `start(k)` starts task k alone. Tasks which haven't been started when the
+ * batch is destroyed are started and ended together, so every task created is
+ * recorded as ending. A batch may be moved but not copied.
  */
-class Otter {
+template <bool Tracing> class BasicTaskBatch {
 public:
-  /**
-   * @brief Return the handle to the static global Otter context.
-   * Initialises the trace with `otterTraceInitialise` on first use. Must
-   * be declared before any other Otter classes or functions can be used.
-   *
-   * @return Otter&
-   */
-  static Otter &get_otter(void);
+  template <typename... Args>
+  BasicTaskBatch(std::size_t n, LabelAt label, Args... args)
+      : BasicTaskBatch(static_cast<otter_task_context *>(nullptr), n, label,
+                       args...) {}
+
+  template <typename... Args>
+  BasicTaskBatch(BasicTask<Tracing> &parent, std::size_t n, LabelAt label,
+                 Args... args)
+      : BasicTaskBatch(parent.m_task, n, label, args...) {}
+
+  BasicTaskBatch(BasicTaskBatch &&other) noexcept
+      : m_tasks{std::move(other.m_tasks)},
+        m_size{std::exchange(other.m_size, 0)}, m_where{other.m_where} {}
+
+  BasicTaskBatch(const BasicTaskBatch &) = delete;
+  BasicTaskBatch &operator=(const BasicTaskBatch &) = delete;
+  BasicTaskBatch &operator=(BasicTaskBatch &&) = delete;
+
+  ~BasicTaskBatch(void) {
+    if constexpr (Tracing) {
+      if (m_tasks == nullptr)
+        return;
+      /* Gather the tasks never started, which stay in ID order */
+      std::size_t rest = 0;
+      for (std::size_t k = 0; k < m_size; k++) {
+        if (m_tasks[k] != nullptr)
+          m_tasks[rest++] = m_tasks[k];
+      }
+      if (rest == 0)
+        return;
+      const source_location &at = m_where;
+      if (OTTER_TRACING())
+        otterTaskStartBatch(m_tasks.get(), rest, at.file, at.func, at.line);
+      otterTaskEndBatch(m_tasks.get(), rest, at.file, at.func, at.line);
+    }
+  }
+
+  std::size_t size(void) const { return m_size; }
 
   /**
-   * @brief Delete the root task and finalise the Otter trace with
-   * `otterTraceFinalise`.
-   *
+   * @brief Start task k of the batch, which ends when the returned task is
+   * destroyed. A task may be started only once; starting it again gives a
+   * task which does nothing.
    */
-  void close(void);
+  BasicTask<Tracing> start(std::size_t k,
+                           source_location where = source_location::current()) {
+    otter_task_context *task = nullptr;
+    if constexpr (Tracing) {
+      if (m_tasks != nullptr && k < m_size && OTTER_TRACING()) {
+        task = std::exchange(m_tasks[k], nullptr);
+        if (task != nullptr)
+          task = otterTaskStart(task, where.file, where.func, where.line);
+      }
+    }
+    return BasicTask<Tracing>(task, where);
+  }
 
   /**
-   * @brief Delete the root task and finalise the Otter trace with
-   * `otterTraceFinalise`.
-   *
+   * @brief Yields the tasks of a batch in order, starting each as it is
+   * dereferenced. Events are recorded at the batch's source location.
    */
-  ~Otter(void);
+  class iterator {
+  public:
+    using iterator_category = std::input_iterator_tag;
+    using value_type = BasicTask<Tracing>;
+    using difference_type = std::ptrdiff_t;
+    using pointer = void;
+    using reference = BasicTask<Tracing>;
 
-  Otter(const Otter &) = delete;
-  Otter(Otter &&) = delete;
-  Otter &operator=(const Otter &) = delete;
-  Otter &operator=(Otter &&) = delete;
+    iterator(BasicTaskBatch *batch, std::size_t k) : m_batch{batch}, m_k{k} {}
 
-  /**
-   * @brief Get the root task context.
-   *
-   * @return Task&
-   */
-  Task &get_root_task(void);
+    BasicTask<Tracing> operator*(void) const {
+      return m_batch->start(m_k, m_batch->m_where);
+    }
+    iterator &operator++(void) {
+      m_k++;
+      return *this;
+    }
+    bool operator==(const iterator &other) const { return m_k == other.m_k; }
+    bool operator!=(const iterator &other) const { return m_k != other.m_k; }
+
+  private:
+    BasicTaskBatch *m_batch;
+    std::size_t m_k;
+  };
+
+  iterator begin(void) { return iterator(this, 0); }
+  iterator end(void) { return iterator(this, m_size); }
 
 private:
-  /**
-   * @brief Initialise the trace and create a root task. Private to prevent
-   * initialisation other than in the static `get` method.
-   *
-   */
-  Otter(void);
+  template <typename... Args>
+  BasicTaskBatch(otter_task_context *parent, std::size_t n,
+                 const LabelAt &label, Args... args)
+      : m_size{n}, m_where{label.where} {
+    if constexpr (Tracing) {
+      if (n == 0 || !OTTER_TRACING())
+        return;
+      const source_location &at = label.where;
+      m_tasks = std::make_unique<otter_task_context *[]>(n);
+      otterTaskInitialiseBatch(parent, n, -1, m_tasks.get(), at.file, at.func,
+                               at.line, label.format, args...);
+    }
+  }
+
+  std::unique_ptr<otter_task_context *[]> m_tasks;
+  std::size_t m_size;
+  source_location m_where;
+};
+
+/**
+ * @brief A global phase, begun on construction and ended on destruction.
+ * `switch_to()` ends the phase and immediately begins the next, as
+ * `OTTER_PHASE_SWITCH`. Other threads join the phase with a `PhaseMember`.
+ */
+template <bool Tracing> class BasicPhase {
+public:
+  explicit BasicPhase(const char *name,
+                      source_location where = source_location::current())
+      : m_where{where} {
+    if constexpr (Tracing) {
+      otterPhaseBegin(name, where.file, where.func, where.line);
+      m_phase = otterPhaseCurrent();
+    }
+  }
+
+  BasicPhase(const BasicPhase &) = delete;
+  BasicPhase &operator=(const BasicPhase &) = delete;
+
+  ~BasicPhase(void) {
+    if constexpr (Tracing)
+      otterPhaseEnd(m_where.file, m_where.func, m_where.line);
+  }
 
   /**
-   * @brief The handle to the trace's root task.
-   *
+   * @brief Record a barrier where the phase waits for the tasks created in it,
+   * as `OTTER_TASK_WAIT_FOR(OTTER_NULL_TASK, mode)`.
    */
-  Task *m_root_task;
-  bool m_finalised;
+  void wait_for(otter_task_sync_t mode = otter_sync_children,
+                source_location where = source_location::current()) {
+    if constexpr (Tracing) {
+      if (OTTER_TRACING())
+        otterSynchroniseTasks(nullptr, mode, otter_endpoint_discrete,
+                              where.file, where.func, where.line);
+    }
+  }
+
+  void switch_to(const char *name,
+                 source_location where = source_location::current()) {
+    if constexpr (Tracing) {
+      otterPhaseSwitch(name, where.file, where.func, where.line);
+      m_phase = otterPhaseCurrent();
+    }
+    m_where = where;
+  }
+
+  /// The phase's handle, as given by `OTTER_PHASE_CURRENT`
+  otter_task_context *handle(void) const { return m_phase; }
+
+private:
+  otter_task_context *m_phase = nullptr;
+  source_location m_where;
+};
+
+/**
+ * @brief Adopts another thread's phase on construction and leaves it on
+ * destruction, as `OTTER_PHASE_ADOPT`, so that tasks which the calling thread
+ * creates without a parent belong to that phase. Construct it on a worker
+ * thread while the phase is open, for example at the start of a parallel
+ * region begun inside it.
+ */
+template <bool Tracing> class BasicPhaseMember {
+public:
+  explicit BasicPhaseMember(const BasicPhase<Tracing> &phase) {
+    if constexpr (Tracing)
+      otterPhaseAdopt(phase.handle());
+  }
+
+  BasicPhaseMember(const BasicPhaseMember &) = delete;
+  BasicPhaseMember &operator=(const BasicPhaseMember &) = delete;
+
+  ~BasicPhaseMember(void) {
+    if constexpr (Tracing)
+      otterPhaseAdopt(nullptr);
+  }
 };
 
+/**
+ * @brief A region where a task waits for its children or descendants, entered
+ * on construction and left on destruction, as `OTTER_TASK_WAIT_START` and
+ * `OTTER_TASK_WAIT_END`.
+ */
+template <bool Tracing> class BasicSyncScope {
+public:
+  BasicSyncScope(BasicTask<Tracing> &task,
+                 otter_task_sync_t mode = otter_sync_children,
+                 source_location where = source_location::current())
+      : m_task{task.handle()}, m_mode{mode}, m_where{where} {
+    if constexpr (Tracing) {
+      if (m_task != nullptr && OTTER_TRACING())
+        otterSynchroniseTasks(m_task, m_mode, otter_endpoint_enter,
+                              where.file, where.func, where.line);
+    }
+  }
+
+  BasicSyncScope(const BasicSyncScope &) = delete;
+  BasicSyncScope &operator=(const BasicSyncScope &) = delete;
+
+  ~BasicSyncScope(void) {
+    if constexpr (Tracing) {
+      if (m_task != nullptr && OTTER_TRACING())
+        otterSynchroniseTasks(m_task, m_mode, otter_endpoint_leave,
+                              m_where.file, m_where.func, m_where.line);
+    }
+  }
+
+private:
+  otter_task_context *m_task;
+  otter_task_sync_t m_mode;
+  source_location m_where;
+};
+
+using Trace = BasicTrace<tracing_enabled>;
+using Task = BasicTask<tracing_enabled>;
+using TaskBatch = BasicTaskBatch<tracing_enabled>;
+using Phase = BasicPhase<tracing_enabled>;
+using PhaseMember = BasicPhaseMember<tracing_enabled>;
+using SyncScope = BasicSyncScope<tracing_enabled>;
+
 } // namespace otter
@@ -13,6 +13,8 @@
 #define OTTER_TASK_GRAPH_H
 
 #include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
 
 #if !defined(OTTER_USE_PRIVATE_HEADER)
 #warning                                                                       \
@@ -116,6 +118,14 @@ void otterTraceStart(void);
  *
  * To re-activate the tracing, you have to call `otterTraceStart()`.
  *
+ * While tracing is stopped the `OTTER_*` macros do nothing, except those which
+ * end a task or a phase, and the functions of this API record no events: a
+ * task is still initialised, but its creation, start and synchronisations are
+ * not recorded, and a phase begun while tracing is stopped is not recorded.
+ * `otterTaskEnd()`, `otterTaskEndBatch()` and `otterPhaseEnd()` record the end
+ * of a task or phase whose start was recorded even if tracing has stopped
+ * since, and release one whose start was not without recording it.
+ *
  * @warning toggling tracing on/off at different levels of the call tree may
  * result in an ill-formed trace. Otter does NOT check that you have started/
  * stopped tracing at a sensible point.
@@ -125,6 +135,46 @@ void otterTraceStart(void);
  */
 void otterTraceStop(void);
 
+/**
+ * @brief Non-zero while Otter is tracing: from `otterTraceInitialise()` until
+ * `otterTraceStop()` or `otterTraceFinalise()`, and again after
+ * `otterTraceStart()`. If `OTTER_TRACE_STOPPED` is set, tracing begins stopped
+ * and this is zero until `otterTraceStart()` is called.
+ *
+ * The `OTTER_*` macros of otter-task-graph-user.h test this flag inline with
+ * `OTTER_TRACING()` and skip the call into Otter, without evaluating its
+ * arguments, while it is zero. This makes instrumentation left in a program
+ * almost free while tracing is stopped.
+ *
+ * @see `OTTER_TRACING()`
+ */
+extern int otter_tracing_enabled;
+
+/**
+ * @brief Evaluates to true while Otter is tracing. Hinted as unlikely, so that
+ * code which skips instrumentation is laid out as the fall-through path.
+ */
+#if defined(__GNUC__)
+#define OTTER_TRACING()                                                        \
+  __builtin_expect(                                                            \
+      __atomic_load_n(&otter_tracing_enabled, __ATOMIC_RELAXED) != 0, 0)
+#else
+#define OTTER_TRACING() (otter_tracing_enabled != 0)
+#endif
+
+/**
+ * @brief Write the events held by the flight recorder to the trace.
+ *
+ * With `OTTER_SINK=flight`, Otter keeps only each thread's most recent events
+ * in memory and writes nothing to the trace until a dump is requested by this
+ * function, by `SIGUSR1` or by beginning the phase named in
+ * `OTTER_FLIGHT_DUMP_PHASE`. Each thread writes its events the next time it
+ * records an event, or when it ends.
+ *
+ * Does nothing if the flight recorder isn't in use.
+ */
+void otterTraceDump(void);
+
 /******
  * Defining Tasks
  ******/
@@ -157,6 +207,66 @@ otter_task_context *otterTaskInitialise(otter_task_context *parent_task,
                                         const char *file, const char *func,
                                         int line, const char *format, ...);
 
+/**
+ * @brief Initialise a task as by `otterTaskInitialise()`, labelled by the text
+ * of `label` rather than a format, without adding it to the task pool.
+ *
+ * `label_hash` identifies the label, so that a label seen before by the calling
+ * thread is given its string reference without being looked up. It must be the
+ * same for every use of the same text and differ for different texts, such as
+ * the FNV-1a hash computed at compile time by the C++ wrapper's `otter::Label`.
+ *
+ * @param parent_task: The handle of the parent of the new task.
+ * @param flavour: The user-defined flavour of the new task.
+ * @param record_task_create_event: Whether to record the task's creation.
+ * @param file: The file where the task was initialised.
+ * @param func: The function where the task was initialised.
+ * @param line: The line where the task was initialised.
+ * @param label: The task's label, which isn't treated as a format.
+ * @param label_hash: A hash of the text of `label`.
+ *
+ * @see `otterTaskInitialise()`
+ */
+otter_task_context *otterTaskInitialiseHashed(otter_task_context *parent_task,
+                                              int flavour,
+                                              bool record_task_create_event,
+                                              const char *file,
+                                              const char *func, int line,
+                                              const char *label,
+                                              uint64_t label_hash);
+
+/**
+ * @brief Initialise `n` sibling tasks with the given flavour and label as
+ * children of parent, storing their handles in `tasks[0]` to `tasks[n-1]`, and
+ * record their creation. Intended for loops which fan out many tasks at once,
+ * such as the chunks of a taskloop.
+ *
+ * The tasks are given consecutive IDs, reserved at once, and share one label,
+ * which is formatted once. Their creation is recorded as a single
+ * `task_create_batch` event whose `unique_id` is the ID of `tasks[0]` and
+ * whose `task_batch_size` is `n`, which otter-graph expands into `n` tasks.
+ * With `OTTER_COARSEN_TASKS` or `OTTER_PHASE_TEMPLATES` set, each task's
+ * creation is recorded as by `otterTaskCreate()` instead.
+ *
+ * The tasks are then started and ended like any other, either one at a time or
+ * together with `otterTaskStartBatch()` and `otterTaskEndBatch()`.
+ *
+ * @param parent_task: The handle of the parent of the new tasks.
+ * @param n: The number of tasks, at least 1.
+ * @param flavour: The user-defined flavour of the new tasks.
+ * @param tasks: Where to store the `n` new task handles.
+ * @param file: The file where the tasks were initialised.
+ * @param func: The function where the tasks were initialised.
+ * @param line: The line where the tasks were initialised.
+ * @param format: the format of the label, using subsequent arguments.
+ *
+ * @see `otterTaskInitialise()`
+ */
+void otterTaskInitialiseBatch(otter_task_context *parent_task, size_t n,
+                              int flavour, otter_task_context **tasks,
+                              const char *file, const char *func, int line,
+                              const char *format, ...);
+
 /******
  * Annotating Task Create, Start & End
  ******/
@@ -170,6 +280,9 @@ otter_task_context *otterTaskInitialise(otter_task_context *parent_task,
  * - This event requires an initialised task handle, so it must follow a call to
  *   `otterTaskInitialise()`.
  * - Must precede the task's `otterTaskStart()` event.
+ * - With `OTTER_COARSEN_TASKS` set, a task with the same label and flavour as
+ *   a sibling created since their parent last synchronised is folded into
+ *   that sibling and records no events of its own.
  *
  * @param task The handle to the created task.
  * @param parent_task The parent of the created task.
@@ -216,7 +329,9 @@ otter_task_context *otterTaskStart(otter_task_context *task, const char *file,
 
 /**
  * @brief Counterpart to `otterTaskStart()`, indicating the end of the code
- * representing the given task.
+ * representing the given task, and release its handle. The end is recorded if
+ * the start was, even if tracing has stopped since. A task started while
+ * tracing was stopped is released without being recorded.
  *
  * @param task The completed task.
  * @param file: The file where the task was ended.
@@ -228,6 +343,45 @@ otter_task_context *otterTaskStart(otter_task_context *task, const char *file,
 void otterTaskEnd(otter_task_context *task, const char *file, const char *func,
                   int line);
 
+/**
+ * @brief Record the start of `n` tasks which the calling thread runs together
+ * as one region of code, such as a chunk of a taskloop's tasks.
+ *
+ * If the tasks have consecutive IDs, as a slice of the tasks of one
+ * `otterTaskInitialiseBatch()` call in order does, their start is recorded as
+ * a single `task_enter_batch` event. Otherwise, or with `OTTER_COARSEN_TASKS`
+ * or `OTTER_PHASE_TEMPLATES` set, each task is started as by
+ * `otterTaskStart()`.
+ *
+ * @param tasks: The tasks to start.
+ * @param n: The number of tasks.
+ * @param file: The file where the tasks were started.
+ * @param func: The function where the tasks were started.
+ * @param line: The line where the tasks were started.
+ *
+ * @see `otterTaskEndBatch()`
+ */
+void otterTaskStartBatch(otter_task_context **tasks, size_t n, const char *file,
+                         const char *func, int line);
+
+/**
+ * @brief Counterpart to `otterTaskStartBatch()`, indicating the end of the
+ * code representing the given tasks. Records a single `task_leave_batch` event
+ * under the same conditions as `otterTaskStartBatch()`, and releases the task
+ * handles. As for `otterTaskEnd()`, the end of each task is recorded if its
+ * start was.
+ *
+ * @param tasks: The completed tasks.
+ * @param n: The number of tasks.
+ * @param file: The file where the tasks were ended.
+ * @param func: The function where the tasks were ended.
+ * @param line: The line where the tasks were ended.
+ *
+ * @see `otterTaskStartBatch()`
+ */
+void otterTaskEndBatch(otter_task_context **tasks, size_t n, const char *file,
+                       const char *func, int line);
+
 /******
  * Registering & Retrieving Tasks
  ******/
@@ -329,6 +483,27 @@ void otterSynchroniseTasks(otter_task_context *task, otter_task_sync_t mode,
  *
  * Creates a meta-region to nest all other regions encountered within it.
  *
+ * Phases belong to the thread which begins them and may be nested: a phase
+ * begun inside another phase on the same thread is its child, and ends before
+ * it. A task created without a parent is a child of the calling thread's
+ * innermost phase. A thread with no phase of its own uses the phase it adopted
+ * with `otterPhaseAdopt()`, or the root task if it hasn't adopted one. Threads
+ * may therefore run independent sequences of phases at once, each shared with
+ * its own worker threads.
+ *
+ * With `OTTER_SINK=compact` and `OTTER_SEGMENT_PHASES=N`, every Nth outermost
+ * phase also begins a new segment of the trace.
+ *
+ * With `OTTER_PHASE_TEMPLATES` set, the tasks created within the phase are
+ * recorded in the phase's task graph rather than as trace events. Each distinct
+ * graph is written once, and each phase as a reference to its graph plus the
+ * times of its tasks. Tasks created within a phase should end before it does.
+ * Only one phase is templated at a time: a phase nested within it is recorded
+ * as one of its tasks, and a phase begun concurrently is recorded as usual.
+ *
+ * A phase begun while tracing is stopped is not recorded, nor are the phases
+ * nested within it, but each must still be ended.
+ *
  *
  * @param name A unique identifier for this phase.
  * @param file: The file where the phase started.
@@ -337,6 +512,7 @@ void otterSynchroniseTasks(otter_task_context *task, otter_task_sync_t mode,
  *
  * @see `otterPhaseEnd()`
  * @see `otterPhaseSwitch()`
+ * @see `otterPhaseAdopt()`
  *
  */
 void otterPhaseBegin(const char *name, const char *file, const char *func,
@@ -345,8 +521,11 @@ void otterPhaseBegin(const char *name, const char *file, const char *func,
 /**
  * @brief End the present algorithmic phase.
  *
- * Indicates the end of the present algorithmic phase and return to the
- * default global phase.
+ * Indicates the end of the calling thread's innermost phase and return to the
+ * enclosing phase, or to the default global phase. The enclosing phase (or the
+ * root task) records a synchronisation with its children, so that phases are
+ * ordered one after another. The phase's end is recorded even if tracing has
+ * stopped since it began.
  *
  * @param file: The file where the phase ended.
  * @param func: The function where the phase ended.
@@ -381,6 +560,36 @@ void otterPhaseEnd(const char *file, const char *func, int line);
 void otterPhaseSwitch(const char *name, const char *file, const char *func,
                       int line);
 
+/**
+ * @brief Get the calling thread's innermost phase, so that the threads working
+ * on it can adopt it with `otterPhaseAdopt()`.
+ *
+ * @returns The phase, or `NULL` if the calling thread hasn't begun a phase.
+ * The handle is valid until the phase ends, or while a thread has adopted it.
+ *
+ * @see `otterPhaseAdopt()`
+ */
+otter_task_context *otterPhaseCurrent(void);
+
+/**
+ * @brief Adopt another thread's phase as the calling thread's own.
+ *
+ * While the calling thread has no phase of its own, tasks it creates without a
+ * parent are children of the adopted phase rather than of the root task. This
+ * is how the worker threads of a pipeline join the phases begun by the thread
+ * which drives it, independently of other pipelines running at the same time.
+ *
+ * The calling thread keeps the phase's handle valid until it adopts another
+ * phase, adopts `NULL` to leave the phase, or exits. A phase must be adopted
+ * before it ends, for example by the workers of a parallel region begun
+ * inside it.
+ *
+ * @param phase A phase given by `otterPhaseCurrent()`, or `NULL`.
+ *
+ * @see `otterPhaseCurrent()`
+ */
+void otterPhaseAdopt(otter_task_context *phase);
+
 #ifdef __cplusplus
 }
 #endif
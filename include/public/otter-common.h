@@ -32,6 +32,23 @@ typedef struct otter_opt_t {
   char *tracepath;
   char *archive_name;
   bool append_hostname;
+  bool record_mutex_events;
+  char *perf_events;
+  char *buffer_budget;
+  char *event_chunk_size;
+  char *def_chunk_size;
+  char *huge_pages;
+  char *sink;
+  char *stream_path;
+  char *flight_size;
+  char *flight_seconds;
+  char *flight_dump_phase;
+  char *segment_phases;
+  char *compact_shared;
+  char *loop_sample;
+  char *defer_labels;
+  bool coarsen_tasks;
+  bool phase_templates;
   otter_event_model_t event_model;
 } otter_opt_t;
 
@@ -7,9 +7,29 @@
 #define ENV_VAR_TRACE_OUTPUT "OTTER_TRACE_NAME"
 #define ENV_VAR_TRACE_PATH "OTTER_TRACE_PATH"
 #define ENV_VAR_REPORT_CBK "OTTER_REPORT_CALLBACKS"
+#define ENV_VAR_MUTEX_EVENTS "OTTER_MUTEX_EVENTS"
+#define ENV_VAR_PERF_EVENTS "OTTER_PERF_EVENTS"
+#define ENV_VAR_BUFFER_BUDGET "OTTER_BUFFER_BUDGET"
+#define ENV_VAR_EVENT_CHUNK_SIZE "OTTER_EVENT_CHUNK_SIZE"
+#define ENV_VAR_DEF_CHUNK_SIZE "OTTER_DEF_CHUNK_SIZE"
+#define ENV_VAR_HUGE_PAGES "OTTER_HUGE_PAGES"
+#define ENV_VAR_SINK "OTTER_SINK"
+#define ENV_VAR_STREAM_PATH "OTTER_STREAM_PATH"
+#define ENV_VAR_FLIGHT_SIZE "OTTER_FLIGHT_SIZE"
+#define ENV_VAR_FLIGHT_SECONDS "OTTER_FLIGHT_SECONDS"
+#define ENV_VAR_FLIGHT_DUMP_PHASE "OTTER_FLIGHT_DUMP_PHASE"
+#define ENV_VAR_SEGMENT_PHASES "OTTER_SEGMENT_PHASES"
+#define ENV_VAR_COMPACT_SHARED "OTTER_COMPACT_SHARED"
+#define ENV_VAR_LOOP_SAMPLE "OTTER_LOOP_SAMPLE"
+#define ENV_VAR_DEFER_LABELS "OTTER_DEFER_LABELS"
+#define ENV_VAR_COARSEN_TASKS "OTTER_COARSEN_TASKS"
+#define ENV_VAR_PHASE_TEMPLATES "OTTER_PHASE_TEMPLATES"
+#define ENV_VAR_TRACE_STOPPED "OTTER_TRACE_STOPPED"
+#define ENV_VAR_MAX_LOCATIONS "OTTER_MAX_LOCATIONS"
 
 /* Default values */
 #define DEFAULT_OTF2_TRACE_OUTPUT "otter_trace"
 #define DEFAULT_OTF2_TRACE_PATH "trace"
+#define DEFAULT_STREAM_PATH "otter-stream.sock"
 
 #endif // OTTER_ENV_H
@@ -0,0 +1,109 @@
+/**
+ * @file graph-format.h
+ * @author Adam Tuft
+ * @brief On-disk format of the task graph written by otter-graph. The file is
+ * an otter_graph_header_t followed by four sections at the offsets given in
+ * the header, each aligned to 8 bytes:
+ *
+ *   - nodes: an otter_graph_node_t for every task ID in [0, n_nodes). IDs which
+ *     no event referred to have flags == 0.
+ *   - offsets: n_nodes + 1 uint64_t. The edges leaving node i are
+ *     edges[offsets[i]] up to (but excluding) edges[offsets[i + 1]].
+ *   - edges: n_edges otter_graph_edge_t, grouped by source node (compressed
+ *     sparse row).
+ *   - strings: n_strings task labels, each an otter_graph_string_t followed by
+ *     the label's bytes. A node's label is the index of its string here.
+ *
+ * Every edge points from a task to a task which had to wait for it:
+ *
+ *   - child: from a parent to a task it created, at the time of creation
+ *   - sync: from a child to the parent which synchronised on it, at the time
+ *     the parent began to wait
+ *   - dependence: from the source to the sink of a task dependence, at the
+ *     time the dependence was recorded
+ *
+ * A task which stands for a group of coarsened siblings has the group's size
+ * and the total and longest times of its tasks from start to end, including
+ * its own. The other tasks of the group have no node.
+ *
+ * Times are OTF2 timestamps in units of 1 / timer_resolution seconds. Fields
+ * are in the writing host's byte order.
+ * @version 0.1
+ * @date 2026-10-19
+ *
+ * @copyright Copyright (c) 2026
+ *
+ */
+
+#if !defined(OTTER_GRAPH_FORMAT_H)
+#define OTTER_GRAPH_FORMAT_H
+
+#include <stdint.h>
+
+#define OTTER_GRAPH_MAGIC 0x5047544fu /* "OTGP" */
+#define OTTER_GRAPH_VERSION 2
+#define OTTER_GRAPH_NO_TASK UINT64_MAX
+#define OTTER_GRAPH_NO_TIME UINT64_MAX
+#define OTTER_GRAPH_NO_LABEL UINT32_MAX
+
+typedef struct {
+  uint32_t magic;
+  uint16_t version;
+  uint16_t unused;
+  uint64_t timer_resolution;
+  uint64_t n_nodes;   /* task ID slots, i.e. 1 + the largest task ID */
+  uint64_t n_tasks;   /* slots holding a task */
+  uint64_t n_edges;
+  uint64_t n_strings;
+  uint64_t nodes_offset;
+  uint64_t offsets_offset;
+  uint64_t edges_offset;
+  uint64_t strings_offset;
+  uint64_t length; /* of the whole file */
+} otter_graph_header_t;
+
+typedef enum {
+  otter_graph_node_created = 1 << 0, /* task-create event seen */
+  otter_graph_node_started = 1 << 1, /* start_time is set */
+  otter_graph_node_ended = 1 << 2,   /* end_time is set */
+  otter_graph_node_coarsened = 1 << 3 /* group_* are set */
+} otter_graph_node_flags_t;
+
+typedef struct {
+  uint64_t parent; /* or OTTER_GRAPH_NO_TASK */
+  uint64_t create_time;
+  uint64_t start_time; /* first time the task ran */
+  uint64_t end_time;   /* time the task completed */
+  uint32_t label;      /* or OTTER_GRAPH_NO_LABEL */
+  uint32_t flags;      /* otter_graph_node_flags_t */
+  uint32_t location;   /* index of the location which started the task */
+  uint32_t unused;
+  uint64_t group_tasks;      /* tasks this one stands for, itself included */
+  uint64_t group_total_time; /* total time of those tasks */
+  uint64_t group_max_time;   /* longest time of one of those tasks */
+} otter_graph_node_t;
+
+typedef enum {
+  otter_graph_edge_child,
+  otter_graph_edge_sync,
+  otter_graph_edge_dependence
+} otter_graph_edge_kind_t;
+
+/* The top 2 bits of target hold the edge's otter_graph_edge_kind_t */
+typedef struct {
+  uint64_t target;
+  uint64_t time;
+} otter_graph_edge_t;
+
+#define OTTER_GRAPH_EDGE_KIND_SHIFT 62
+#define OTTER_GRAPH_EDGE_TARGET(edge)                                          \
+  ((edge).target & ((UINT64_C(1) << OTTER_GRAPH_EDGE_KIND_SHIFT) - 1))
+#define OTTER_GRAPH_EDGE_KIND(edge)                                            \
+  ((otter_graph_edge_kind_t)((edge).target >> OTTER_GRAPH_EDGE_KIND_SHIFT))
+
+/* Followed by `length` bytes of the label, without a terminating null */
+typedef struct {
+  uint32_t length;
+} otter_graph_string_t;
+
+#endif // OTTER_GRAPH_FORMAT_H
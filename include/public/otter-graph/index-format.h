@@ -0,0 +1,88 @@
+/**
+ * @file index-format.h
+ * @author Adam Tuft
+ * @brief On-disk format of the random-access index written by otter-graph -i.
+ * The file is an otter_index_header_t followed by six sections at the offsets
+ * given in the header, each aligned to 8 bytes:
+ *
+ *   - locations: n_locations uint64_t OTF2 location refs. Entries name a
+ *     location by its index here.
+ *   - offsets: n_nodes + 1 uint64_t. The events of task i are
+ *     entries[offsets[i]] up to (but excluding) entries[offsets[i + 1]].
+ *   - entries: n_entries otter_index_entry_t, grouped by task ID and sorted by
+ *     time within each task.
+ *   - labels: n_labels otter_index_label_t, sorted by name so that a label can
+ *     be found by binary search.
+ *   - ranges: n_ranges otter_index_range_t. Each label's ranges are
+ *     contiguous and in ascending order of task ID.
+ *   - strings: the labels' names, without terminating nulls.
+ *
+ * An entry's position is the event's position within its location as returned
+ * by OTF2_EvtReader_GetPos, so a reader can go straight to the event with
+ * OTF2_EvtReader_Seek rather than reading the location from the start. Times
+ * are OTF2 timestamps in units of 1 / timer_resolution seconds. Fields are in
+ * the writing host's byte order.
+ * @version 0.1
+ * @date 2026-10-19
+ *
+ * @copyright Copyright (c) 2026
+ *
+ */
+
+#if !defined(OTTER_INDEX_FORMAT_H)
+#define OTTER_INDEX_FORMAT_H
+
+#include <stdint.h>
+
+#define OTTER_INDEX_MAGIC 0x5849544fu /* "OTIX" */
+#define OTTER_INDEX_VERSION 1
+
+typedef struct {
+  uint32_t magic;
+  uint16_t version;
+  uint16_t unused;
+  uint64_t timer_resolution;
+  uint64_t n_locations;
+  uint64_t n_nodes; /* task ID slots, i.e. 1 + the largest task ID */
+  uint64_t n_entries;
+  uint64_t n_labels;
+  uint64_t n_ranges;
+  uint64_t locations_offset;
+  uint64_t offsets_offset;
+  uint64_t entries_offset;
+  uint64_t labels_offset;
+  uint64_t ranges_offset;
+  uint64_t strings_offset;
+  uint64_t length; /* of the whole file */
+} otter_index_header_t;
+
+typedef enum {
+  otter_index_create, /* the task was created */
+  otter_index_start,  /* the task began or resumed running */
+  otter_index_end,    /* the task completed */
+  otter_index_sync    /* the task began to wait for its children */
+} otter_index_kind_t;
+
+typedef struct {
+  uint64_t time;
+  uint64_t position; /* for OTF2_EvtReader_Seek */
+  uint32_t location; /* index into the locations section */
+  uint8_t kind;      /* otter_index_kind_t */
+  uint8_t unused[3];
+} otter_index_entry_t;
+
+typedef struct {
+  uint64_t name_offset; /* from the start of the strings section */
+  uint32_t name_length;
+  uint32_t ref;         /* the label's OTF2 string ref */
+  uint64_t first_range; /* index into the ranges section */
+  uint64_t n_ranges;
+} otter_index_label_t;
+
+/* The tasks first, first + 1, ..., last all had the label */
+typedef struct {
+  uint64_t first;
+  uint64_t last;
+} otter_index_range_t;
+
+#endif // OTTER_INDEX_FORMAT_H
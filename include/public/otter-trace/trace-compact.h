@@ -0,0 +1,217 @@
+/**
+ * @file trace-compact.h
+ * @author Adam Tuft
+ * @brief On-disk format written by the compact sink and read by
+ * otter-compact2otf2. A compact trace is a directory holding a schema file and
+ * one append-only event file per location. Each file starts with an
+ * otter_compact_header_t. Fields are in the writing host's byte order.
+ *
+ * The schema file holds an otter_compact_schema_t followed by the attribute
+ * definitions (otter_compact_attribute_t and the attribute's name) and the
+ * string table (otter_compact_string_t and the string's bytes). Regions, lock
+ * IDs and locations are referred to by the refs defined in the OTF2 archive
+ * written alongside the compact trace.
+ *
+ * An event file holds a sequence of variable-length events. Each event is:
+ *
+ *   - 1 byte: the otter_compact_record_t
+ *   - 4 bytes: time since the previous event in this file, or
+ *     OTTER_COMPACT_TIME_ESCAPE followed by 8 bytes of absolute time
+ *   - the record's arguments as varints: the thread ID (thread begin/end), the
+ *     region ref (enter/leave) or the lock ID & order (acquire/release lock)
+ *   - a varint count of attributes, then for each attribute a varint key
+ *     ((ref << 1) | repeat) and, unless repeat is set, its value. Repeat means
+ *     the value is the one this attribute last had in this file. Integer and
+ *     string ref values are encoded as the zig-zag varint of the difference
+ *     from that last value (0 initially), float and double values as their
+ *     4 or 8 bytes. The attribute's type is given by the schema.
+ *
+ * Varints are LEB128: 7 bits per byte, least-significant group first, with the
+ * high bit set on all but the last byte.
+ *
+ * With OTTER_COMPACT_SHARED=N, the locations of a process write to N shared
+ * stream files, named by OTTER_COMPACT_SHARED_FILE_FMT, instead of a file each.
+ * A shared file's header gives the stream's index as its location and its total
+ * events as its count. It holds a sequence of blocks, each an
+ * otter_compact_block_t followed by `length` bytes of one location's events,
+ * encoded as they would be in the location's own event file: times and
+ * attribute values carry over from the location's previous block, and no event
+ * spans two blocks. A location always writes to the same stream, so its blocks
+ * are in order within the file. A location with no event file and no blocks
+ * recorded no events.
+ *
+ * A segmented trace (OTTER_SEGMENT_PHASES) holds one such directory per
+ * segment, named by OTTER_COMPACT_SEGMENT_DIR_FMT, and a manifest. Each
+ * segment's files start afresh, with no time or attribute value carried over
+ * from an earlier segment, and its schema is written as soon as every thread
+ * has left it. The manifest holds an otter_compact_header_t whose count is the
+ * number of complete segments, followed by an otter_compact_segment_t and the
+ * phase's name for each. It is replaced (not updated in place) as each segment
+ * completes. Task IDs are unique across segments, so a task referred to in one
+ * segment but created in another is found from the segments' task ranges.
+ * The ranges of adjacent segments can overlap, as a thread may create tasks
+ * before it moves into a new segment.
+ *
+ * So that a segment can be converted before the trace is finalised, each
+ * segment also has a definitions file, written with its schema. The file
+ * holds the header, whose count is the number of definitions, followed by an
+ * otter_compact_definition_t and its strings for each: the clock, the
+ * OTTER::EVENT_MODEL property, the system tree node and location group, the
+ * attributes, the locations which wrote to the segment, and the regions
+ * defined by the time it completed. A region is defined when it ends, so a
+ * region still active when its segment completes has no definition. Names are
+ * given as strings rather than string refs.
+ * @version 0.1
+ * @date 2026-10-19
+ *
+ * @copyright Copyright (c) 2026
+ *
+ */
+
+#if !defined(OTTER_TRACE_COMPACT_H)
+#define OTTER_TRACE_COMPACT_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define OTTER_COMPACT_MAGIC 0x5043544fu /* "OTCP" */
+#define OTTER_COMPACT_VERSION 2
+#define OTTER_COMPACT_DIR "compact"
+#define OTTER_COMPACT_SCHEMA_FILE "schema.otc"
+#define OTTER_COMPACT_EVENT_FILE_FMT "%lu.otc" /* location ref */
+#define OTTER_COMPACT_SEGMENT_DIR_FMT "segment.%lu" /* segment index */
+#define OTTER_COMPACT_MANIFEST_FILE "manifest.otc"
+#define OTTER_COMPACT_SHARED_FILE_FMT "shared.%lu.otc" /* stream index */
+#define OTTER_COMPACT_DEFINITIONS_FILE "definitions.otc"
+#define OTTER_COMPACT_TIME_ESCAPE 0xffffffffu
+
+typedef enum {
+  otter_compact_file_schema = 1,
+  otter_compact_file_events,
+  otter_compact_file_manifest,
+  otter_compact_file_shared,
+  otter_compact_file_definitions
+} otter_compact_file_kind_t;
+
+typedef struct {
+  uint32_t magic;
+  uint16_t version;
+  uint16_t kind;     /* otter_compact_file_kind_t */
+  uint64_t location; /* OTF2 location ref of an event file, or stream index */
+  uint64_t count;    /* events in an event or shared file */
+  uint64_t length;   /* bytes following this header */
+} otter_compact_header_t;
+
+typedef enum {
+  otter_compact_record_thread_begin,
+  otter_compact_record_thread_end,
+  otter_compact_record_enter,
+  otter_compact_record_leave,
+  otter_compact_record_task_create,
+  otter_compact_record_task_switch,
+  otter_compact_record_acquire_lock,
+  otter_compact_record_release_lock,
+  otter_compact_n_records
+} otter_compact_record_t;
+
+typedef struct {
+  uint32_t n_attributes;
+  uint32_t n_strings;
+} otter_compact_schema_t;
+
+/* Followed by `name_length` bytes of the name, without a terminating null */
+typedef struct {
+  uint32_t ref;
+  uint8_t type; /* OTF2_Type */
+  uint8_t unused;
+  uint16_t name_length;
+} otter_compact_attribute_t;
+
+/* Followed by `length` bytes of the string, without a terminating null */
+typedef struct {
+  uint32_t ref;
+  uint32_t length;
+} otter_compact_string_t;
+
+/* A block of a shared stream, followed by `length` bytes of events */
+typedef struct {
+  uint64_t location; /* OTF2 location ref */
+  uint32_t events;
+  uint32_t length;
+} otter_compact_block_t;
+
+/* Followed by `name_length` bytes of the name of the phase which began the
+   segment, without a terminating null. Segment 0 holds the events before the
+   first phase and has no name. */
+typedef struct {
+  uint64_t index;      /* of the segment's directory */
+  uint64_t start_time; /* when the segment began */
+  uint64_t events;
+  uint64_t first_task; /* smallest unique_id of a task created in the segment */
+  uint64_t last_task;  /* largest, or first_task > last_task if none */
+  uint32_t files;      /* event and shared files written in the segment */
+  uint32_t name_length;
+} otter_compact_segment_t;
+
+typedef enum {
+  otter_compact_definition_clock, /* arg: ticks per second, start, length */
+  otter_compact_definition_property,         /* name, text: value */
+  otter_compact_definition_system_tree_node, /* arg: parent; text: class */
+  otter_compact_definition_location_group,   /* arg: type, system tree node */
+  otter_compact_definition_location,         /* arg: type, location group */
+  otter_compact_definition_region,           /* arg: role, paradigm */
+  otter_compact_definition_attribute,        /* arg: type; text: description */
+  otter_compact_n_definitions
+} otter_compact_definition_kind_t;
+
+/* Followed by `name_length` bytes of the name and `text_length` bytes of the
+   text, without terminating nulls */
+typedef struct {
+  uint32_t kind; /* otter_compact_definition_kind_t */
+  uint16_t name_length;
+  uint16_t text_length;
+  uint64_t ref;
+  uint64_t arg[3];
+} otter_compact_definition_t;
+
+/* Varint & zig-zag coding shared by the writer and readers */
+
+static inline unsigned char *otter_compact_put_varint(unsigned char *p,
+                                                      uint64_t value) {
+  while (value >= 0x80) {
+    *p++ = (unsigned char)(value | 0x80);
+    value >>= 7;
+  }
+  *p++ = (unsigned char)value;
+  return p;
+}
+
+/* Returns NULL if the varint runs past end */
+static inline const unsigned char *
+otter_compact_get_varint(const unsigned char *p, const unsigned char *end,
+                         uint64_t *value) {
+  uint64_t result = 0;
+  for (unsigned shift = 0; p < end && shift < 64; shift += 7) {
+    unsigned char byte = *p++;
+    result |= (uint64_t)(byte & 0x7f) << shift;
+    if ((byte & 0x80) == 0) {
+      *value = result;
+      return p;
+    }
+  }
+  return NULL;
+}
+
+static inline uint64_t otter_compact_zigzag(uint64_t delta) {
+  return (delta << 1) ^ (uint64_t)((int64_t)delta >> 63);
+}
+
+static inline uint64_t otter_compact_unzigzag(uint64_t value) {
+  return (value >> 1) ^ (uint64_t)(-(int64_t)(value & 1));
+}
+
+/* Most bytes an encoded event can take, given its number of attributes */
+#define OTTER_COMPACT_EVENT_MAX(n_attributes)                                  \
+  (1 + 4 + 8 + 2 * 10 + 10 + (size_t)(n_attributes) * (10 + 10))
+
+#endif // OTTER_TRACE_COMPACT_H
@@ -0,0 +1,24 @@
+/**
+ * @file trace-flight.h
+ * @author Adam Tuft
+ * @brief Request that the flight recorder (OTTER_SINK=flight) writes the events
+ * it holds to the trace. Each thread writes its own events the next time it
+ * records an event or when it ends. These functions do nothing if the flight
+ * recorder isn't in use.
+ * @version 0.1
+ * @date 2026-10-19
+ *
+ * @copyright Copyright (c) 2026
+ *
+ */
+
+#if !defined(OTTER_TRACE_FLIGHT_H)
+#define OTTER_TRACE_FLIGHT_H
+
+/* Request a dump. Async-signal-safe. */
+void trace_flight_dump(void);
+
+/* Request a dump if this is the phase named by OTTER_FLIGHT_DUMP_PHASE */
+void trace_flight_phase_begin(const char *name);
+
+#endif // OTTER_TRACE_FLIGHT_H
@@ -0,0 +1,61 @@
+/**
+ * @file trace-label.h
+ * @author Adam Tuft
+ * @brief Defers formatting task labels until they are needed
+ * (OTTER_DEFER_LABELS). Used by the otter-task-graph event source.
+ *
+ * Instead of formatting a label when a task is created, its format pointer and
+ * a packed copy of its arguments are captured and the label is given a string
+ * ref at once, so events can refer to it. Labels are cached by format pointer
+ * and argument bytes, so a label seen before gets the same ref without being
+ * formatted again. New labels are formatted and defined in batches, by a
+ * background thread or when the trace is finalised.
+ *
+ * The arguments are checked against the conversions in the format. A label
+ * with a conversion which can't be captured (e.g. %n, positional arguments,
+ * long double or wide characters), or whose arguments don't fit the packed
+ * buffer, is formatted immediately as before.
+ *
+ * Formats are read again when the label is formatted, so they must outlive the
+ * trace (as string literals do), and a format pointer must not be reused for a
+ * different format. Labels with the same text but different formats may get
+ * different refs.
+ * @version 0.1
+ * @date 2026-10-19
+ *
+ * @copyright Copyright (c) 2026
+ *
+ */
+
+#if !defined(OTTER_TRACE_LABEL_H)
+#define OTTER_TRACE_LABEL_H
+
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "public/otter-common.h"
+
+void trace_label_initialise(otter_opt_t *opt);
+
+/* Stop the background thread, if any, and format every deferred label */
+void trace_label_finalise(void);
+
+/* Whether labels are deferred */
+bool trace_label_deferred(void);
+
+/* The ref of the label given by a format and its arguments, which is formatted
+   later. Returns OTTER_STRING_UNDEFINED if the label must be formatted now. The
+   arguments are consumed, so pass a copy if the caller may need them */
+otter_string_ref_t trace_label_defer(const char *format, va_list args);
+
+/* Format and define every label deferred so far */
+void trace_label_flush(void);
+
+/* Capture a label's arguments and format them into out as a deferred label
+   would be, without deferring it. Returns false if the label can't be
+   captured. Used to check the formatter against vsnprintf */
+bool trace_label_format(char *out, size_t size, const char *format,
+                        va_list args);
+
+#endif // OTTER_TRACE_LABEL_H
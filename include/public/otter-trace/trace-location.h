@@ -15,7 +15,7 @@
 #include "public/otter-common.h"
 #include "public/otter-trace/trace-region-def.h"
 #include "public/otter-trace/trace-types.h"
-#include "public/types/queue.h"
+#include "public/types/chunk-queue.h"
 #include "public/types/stack.h"
 #include <otf2/OTF2_DefWriter.h>
 #include <otf2/OTF2_Definitions.h>
@@ -30,6 +30,7 @@ trace_new_location_definition(uint64_t id, otter_thread_t thread_type,
                               OTF2_LocationType loc_type,
                               OTF2_LocationGroupRef loc_grp);
 void trace_destroy_location(trace_location_def_t *loc);
+void trace_location_release_thread(trace_location_def_t *loc);
 void trace_write_location_definition(trace_location_def_t *loc);
 bool trace_location_get_region_def(trace_location_def_t *loc,
                                    trace_region_def_t **rgn);
@@ -37,12 +38,28 @@ bool trace_location_store_region_def(trace_location_def_t *loc,
                                      trace_region_def_t *rgn);
 size_t trace_location_get_num_region_def(trace_location_def_t *loc);
 unique_id_t trace_location_get_id(trace_location_def_t *loc);
+OTF2_LocationRef trace_location_get_ref(trace_location_def_t *loc);
+OTF2_LocationType trace_location_get_type(trace_location_def_t *loc);
+OTF2_LocationGroupRef trace_location_get_group(trace_location_def_t *loc);
+void trace_location_get_name(trace_location_def_t *loc, char *name,
+                             size_t size);
+int trace_location_get_numa_node(trace_location_def_t *loc);
 otter_thread_t trace_location_get_thread_type(trace_location_def_t *loc);
 void trace_location_get_otf2(trace_location_def_t *loc,
                              OTF2_AttributeList **attributes,
                              OTF2_EvtWriter **evt_writer,
                              OTF2_DefWriter **def_writer);
+otter_dependence_t *
+trace_location_get_dependence_buffer(trace_location_def_t *loc, size_t n);
+struct trace_mutex_table_t *
+trace_location_get_mutex_table(trace_location_def_t *loc);
+struct trace_perf_group_t *
+trace_location_get_perf_group(trace_location_def_t *loc);
+const struct trace_sink_t *trace_location_get_sink(trace_location_def_t *loc);
+void *trace_location_get_sink_data(trace_location_def_t *loc);
 void trace_location_inc_event_count(trace_location_def_t *loc);
+void trace_location_set_event_count(trace_location_def_t *loc,
+                                    uint64_t events);
 void trace_location_enter_region_def_scope(trace_location_def_t *loc);
 void trace_location_leave_region_def_scope(trace_location_def_t *loc,
                                            trace_region_def_t *rgn);
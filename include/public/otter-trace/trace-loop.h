@@ -0,0 +1,41 @@
+/**
+ * @file trace-loop.h
+ * @author Adam Tuft
+ * @brief Records the iterations of a loop as statistics kept in the loop's
+ * workshare region rather than as events: the number of iterations, their
+ * total, shortest and longest time and a histogram of their times. The
+ * statistics are added as attributes of the loop's workshare-end event. Every
+ * Nth iteration may also be recorded as an event (OTTER_LOOP_SAMPLE). Used by
+ * the otter-serial event source.
+ * @version 0.1
+ * @date 2026-10-19
+ *
+ * @copyright Copyright (c) 2026
+ *
+ */
+
+#if !defined(OTTER_TRACE_LOOP_H)
+#define OTTER_TRACE_LOOP_H
+
+#include <otf2/OTF2_AttributeList.h>
+
+#include "public/otter-common.h"
+#include "public/otter-trace/trace-location.h"
+#include "public/otter-trace/trace-region-attr.h"
+#include "public/otter-trace/trace-region-def.h"
+
+/* Configure the sampling of loop iterations */
+void trace_loop_initialise(otter_opt_t *opt);
+
+/* Add a loop's iteration statistics to the attributes of an event */
+void trace_loop_add_attributes(const trace_loop_stats_t *stats,
+                               OTF2_AttributeList *attributes);
+
+/* Begin and end an iteration of the loop whose workshare region is given. An
+   iteration must end before the next begins */
+void trace_event_loop_iteration_begin(trace_location_def_t *self,
+                                      trace_region_def_t *loop);
+void trace_event_loop_iteration_end(trace_location_def_t *self,
+                                    trace_region_def_t *loop);
+
+#endif // OTTER_TRACE_LOOP_H
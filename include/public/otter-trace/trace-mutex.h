@@ -0,0 +1,49 @@
+/**
+ * @file trace-mutex.h
+ * @author Adam Tuft
+ * @brief Records the time threads spend waiting for and holding mutexes i.e.
+ * locks, critical and ordered regions and atomics. Times are aggregated per
+ * thread and per wait ID rather than recorded as events, unless full event
+ * recording is requested. The per-thread aggregates are merged when a thread's
+ * location is destroyed and reported when the trace is finalised.
+ * @version 0.1
+ * @date 2026-10-19
+ *
+ * @copyright Copyright (c) 2026
+ *
+ */
+
+#if !defined(OTTER_TRACE_MUTEX_H)
+#define OTTER_TRACE_MUTEX_H
+
+#include "public/otter-common.h"
+#include "public/otter-trace/trace-location.h"
+#include "public/otter-trace/trace-types.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+/* A table of wait and hold times for each mutex encountered by a thread */
+typedef struct trace_mutex_table_t trace_mutex_table_t;
+
+trace_mutex_table_t *trace_mutex_table_new(void);
+
+/* Merge a thread's table into the process-wide table and free it */
+void trace_mutex_table_finalise(trace_mutex_table_t *table);
+
+/* Configure mutex tracing & write the report of mutex contention */
+void trace_mutex_initialise(otter_opt_t *opt);
+void trace_mutex_finalise(void);
+
+void trace_event_lock_init(trace_location_def_t *self, otter_mutex_kind_t kind,
+                           uint64_t wait_id, const void *codeptr_ra);
+void trace_event_mutex_acquire(trace_location_def_t *self,
+                               otter_mutex_kind_t kind, uint64_t wait_id,
+                               const void *codeptr_ra);
+void trace_event_mutex_acquired(trace_location_def_t *self,
+                                otter_mutex_kind_t kind, uint64_t wait_id,
+                                const void *codeptr_ra);
+void trace_event_mutex_released(trace_location_def_t *self,
+                                otter_mutex_kind_t kind, uint64_t wait_id,
+                                const void *codeptr_ra);
+
+#endif // OTTER_TRACE_MUTEX_H
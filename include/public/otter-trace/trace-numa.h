@@ -0,0 +1,32 @@
+/**
+ * @file trace-numa.h
+ * @author Adam Tuft
+ * @brief The NUMA nodes of the machine, used to keep each thread's tracing
+ * buffers on the node of the thread which writes them. The nodes are read from
+ * sysfs and memory is placed with the mbind system call, so libnuma isn't
+ * needed. On a machine with one node (or none reported) every function here
+ * does nothing.
+ * @version 0.1
+ * @date 2026-10-19
+ *
+ * @copyright Copyright (c) 2026
+ *
+ */
+
+#if !defined(OTTER_TRACE_NUMA_H)
+#define OTTER_TRACE_NUMA_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/* The number of possible NUMA nodes, at least 1 */
+int trace_numa_nodes(void);
+
+/* The node of the CPU the calling thread is running on, 0 if unknown */
+int trace_numa_current_node(void);
+
+/* Prefer the given node for the pages of a mapping which haven't been touched
+   yet. Returns false if the memory couldn't be bound, or there's one node. */
+bool trace_numa_bind(void *addr, size_t length, int node);
+
+#endif // OTTER_TRACE_NUMA_H
@@ -32,6 +32,13 @@ void trace_event_task_switch(trace_location_def_t *self,
                              trace_region_def_t *prior_task,
                              otter_task_status_t prior_status,
                              trace_region_def_t *next_task);
+void trace_event_task_dependences(trace_location_def_t *self,
+                                  trace_region_def_t *task,
+                                  const otter_dependence_t *dependences,
+                                  int ndependences);
+void trace_event_task_dependence(trace_location_def_t *self,
+                                 trace_region_def_t *source_task,
+                                 trace_region_def_t *sink_task);
 // void trace_write_region_definition(trace_region_def_t *rgn);
 
 #endif // OTTER_TRACE_OMPT_H
@@ -0,0 +1,38 @@
+/**
+ * @file trace-perf.h
+ * @author Adam Tuft
+ * @brief Per-thread performance counters read with perf_event_open. The
+ * counters named in OTTER_PERF_EVENTS are opened as one group per thread and
+ * read with a single read(). The change in each counter since the thread's
+ * previous read is attached to task events as an attribute.
+ * @version 0.1
+ * @date 2026-10-19
+ *
+ * @copyright Copyright (c) 2026
+ *
+ */
+
+#if !defined(OTTER_TRACE_PERF_H)
+#define OTTER_TRACE_PERF_H
+
+#include "public/otter-common.h"
+#include "public/otter-trace/trace-location.h"
+#include <otf2/otf2.h>
+#include <stdbool.h>
+
+/* A group of counters opened for the calling thread */
+typedef struct trace_perf_group_t trace_perf_group_t;
+
+/* Parse the requested counters & check which can be opened */
+void trace_perf_initialise(otter_opt_t *opt);
+
+/* Returns NULL if no counters were requested or none could be opened */
+trace_perf_group_t *trace_perf_group_open(void);
+void trace_perf_group_close(trace_perf_group_t *group);
+
+/* Read the location's counters and add the deltas since the previous read to
+   the attribute list. Does nothing if counters are disabled. */
+void trace_perf_add_counters(trace_location_def_t *self,
+                             OTF2_AttributeList *attributes);
+
+#endif // OTTER_TRACE_PERF_H
@@ -13,7 +13,7 @@
 
 #include "public/otter-common.h"
 #include "public/otter-trace/trace-types.h"
-#include "public/types/queue.h"
+#include "public/types/chunk-queue.h"
 #include "public/types/stack.h"
 #include <pthread.h>
 #include <stdbool.h>
@@ -28,13 +28,30 @@ typedef struct {
   unsigned int ref_count;
   unsigned int enter_count;
   pthread_mutex_t lock_rgn;
-  otter_queue_t *rgn_defs;
+  otter_chunk_queue_t *rgn_defs;
 } trace_parallel_region_attr_t;
 
+/* The number of bins of a loop's histogram of iteration times */
+#define OTTER_LOOP_HISTOGRAM_BINS 8
+
+/* Statistics of the iterations of a loop. Times are in ns from each
+   iteration's start to its end. Bin i of the histogram counts iterations
+   shorter than 100ns * 10^i which don't fit an earlier bin, and the last bin
+   counts the rest */
+typedef struct {
+  uint64_t iterations;
+  uint64_t total_time;
+  uint64_t min_time;
+  uint64_t max_time;
+  uint64_t histogram[OTTER_LOOP_HISTOGRAM_BINS];
+  uint64_t start_time; /* start of the current iteration, 0 between them */
+} trace_loop_stats_t;
+
 /* Attributes of a workshare region */
 typedef struct {
   otter_work_t type;
   uint64_t count;
+  trace_loop_stats_t *loop; /* NULL until an iteration is recorded */
 } trace_wshare_region_attr_t;
 
 /* Attributes of a master region */
@@ -73,6 +90,15 @@ typedef struct {
   otter_string_ref_t name;
 } trace_phase_region_attr_t;
 
+/* Attributes of a group of coarsened sibling tasks. Times are in ns from each
+   task's start to its end */
+typedef struct {
+  uint64_t tasks;
+  uint64_t total_time;
+  uint64_t min_time;
+  uint64_t max_time;
+} trace_coarse_group_attr_t;
+
 typedef union {
   trace_parallel_region_attr_t parallel;
   trace_wshare_region_attr_t wshare;
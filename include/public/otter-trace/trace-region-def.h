@@ -10,7 +10,7 @@
 #include "public/otter-trace/trace-region-types.h"
 #include "public/otter-trace/trace-state.h"
 #include "public/otter-trace/trace-types.h"
-#include "public/types/queue.h"
+#include "public/types/chunk-queue.h"
 #include "public/types/stack.h"
 
 typedef struct trace_region_def_t trace_region_def_t;
@@ -75,7 +75,11 @@ OTF2_RegionRef trace_region_get_ref(trace_region_def_t *region);
 unique_id_t trace_region_get_encountering_task_id(trace_region_def_t *region);
 trace_region_type_t trace_region_get_type(trace_region_def_t *region);
 trace_region_attr_t trace_region_get_attributes(trace_region_def_t *region);
-otter_queue_t *trace_region_get_rgn_def_queue(trace_region_def_t *region);
+/* The iteration statistics of a workshare region, allocated when first
+   requested. NULL for other regions */
+trace_loop_stats_t *trace_region_get_loop_stats(trace_region_def_t *region);
+otter_chunk_queue_t *
+trace_region_get_rgn_def_queue(trace_region_def_t *region);
 otter_stack_t *trace_region_get_task_rgn_stack(trace_region_def_t *region);
 unsigned int trace_region_get_shared_ref_count(trace_region_def_t *region);
 
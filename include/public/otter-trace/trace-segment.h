@@ -0,0 +1,21 @@
+/**
+ * @file trace-segment.h
+ * @author Adam Tuft
+ * @brief Split a compact trace (OTTER_SINK=compact) into segments at phase
+ * boundaries. With OTTER_SEGMENT_PHASES=N, every Nth phase begins a new
+ * segment, which each thread moves into the next time it records an event.
+ * This function does nothing if the trace isn't segmented.
+ * @version 0.1
+ * @date 2026-10-19
+ *
+ * @copyright Copyright (c) 2026
+ *
+ */
+
+#if !defined(OTTER_TRACE_SEGMENT_H)
+#define OTTER_TRACE_SEGMENT_H
+
+/* Begin a new segment if this phase is one of every OTTER_SEGMENT_PHASES */
+void trace_segment_phase_begin(const char *name);
+
+#endif // OTTER_TRACE_SEGMENT_H
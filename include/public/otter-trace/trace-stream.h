@@ -0,0 +1,72 @@
+/**
+ * @file trace-stream.h
+ * @author Adam Tuft
+ * @brief Wire format of the frames written by the stream sink and read by
+ * otter-stream. Each frame is a header followed by `count` records of the kind
+ * given in the header. Frames never exceed OTTER_STREAM_FRAME_MAX bytes so that
+ * a frame written to a pipe is written whole or not at all. Fields are in the
+ * producer's byte order, as producer and consumer share a host.
+ * @version 0.1
+ * @date 2026-10-19
+ *
+ * @copyright Copyright (c) 2026
+ *
+ */
+
+#if !defined(OTTER_TRACE_STREAM_H)
+#define OTTER_TRACE_STREAM_H
+
+#include <stdint.h>
+
+#define OTTER_STREAM_MAGIC 0x4d53544fu /* "OTSM" */
+#define OTTER_STREAM_VERSION 2
+#define OTTER_STREAM_FRAME_MAX 4096 /* PIPE_BUF on Linux */
+
+typedef enum {
+  otter_stream_frame_events = 1, /* otter_stream_event_t records */
+  otter_stream_frame_strings,    /* otter_stream_string_t records */
+  otter_stream_frame_end         /* no records: the producer has finalised */
+} otter_stream_frame_kind_t;
+
+typedef struct {
+  uint32_t magic;
+  uint16_t version;
+  uint16_t kind;
+  uint32_t length;  /* bytes, including this header */
+  uint32_t count;   /* records in this frame */
+  uint64_t dropped; /* events the producer has dropped so far */
+} otter_stream_frame_header_t;
+
+/* The OTF2 record which carried an event */
+typedef enum {
+  otter_stream_record_thread_begin,
+  otter_stream_record_thread_end,
+  otter_stream_record_enter,
+  otter_stream_record_leave,
+  otter_stream_record_task_create,
+  otter_stream_record_task_switch,
+  otter_stream_record_acquire_lock,
+  otter_stream_record_release_lock
+} otter_stream_record_t;
+
+/* Strings are referred to by the OTF2 string ref defined for them in the
+   archive. A ref of 0 means the event had no such attribute. */
+typedef struct {
+  uint64_t time;
+  uint64_t unique_id;            /* unique_id attribute, if any */
+  uint64_t encountering_task_id; /* encountering_task_id attribute, if any */
+  uint32_t location;             /* ID of the thread which recorded the event */
+  uint32_t event_type;           /* string ref of the event_type attribute */
+  uint32_t task_label;           /* string ref of the task_label attribute */
+  uint32_t tasks; /* tasks with consecutive IDs a batch event stands for, or 1 */
+  uint8_t record; /* otter_stream_record_t */
+  uint8_t unused[7];
+} otter_stream_event_t;
+
+/* Followed by `length` bytes of the string, without a terminating null */
+typedef struct {
+  uint32_t ref;
+  uint32_t length;
+} otter_stream_string_t;
+
+#endif // OTTER_TRACE_STREAM_H
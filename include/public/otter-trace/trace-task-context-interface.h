@@ -17,6 +17,8 @@
 
 #include "api/otter-task-graph/otter-task-graph.h" // for otter_task_context typedef and otter_endpoint_t
 #include "public/otter-common.h"
+#include "public/otter-trace/trace-location.h"
+#include "public/otter-trace/trace-template.h"
 
 /**
  * @brief Allocate an uninitialised otter_task_context.
@@ -36,6 +38,21 @@ otter_task_context *otterTaskContext_alloc(void);
 void otterTaskContext_init(otter_task_context *task, otter_task_context *parent,
                            int flavour, otter_src_ref_t init_location);
 
+/**
+ * @brief Initialise n allocated tasks as children of parent, giving them
+ * consecutive IDs reserved at once.
+ *
+ * @param tasks The tasks to initialise. None may be NULL.
+ * @param n The number of tasks, at least 1.
+ * @param parent The parent of the tasks, or NULL if they have no parent.
+ * @param flavour The flavour of the new tasks.
+ * @return unique_id_t The ID of `tasks[0]`. `tasks[k]` has this ID plus k.
+ */
+unique_id_t otterTaskContext_init_batch(otter_task_context **tasks, size_t n,
+                                        otter_task_context *parent,
+                                        int flavour,
+                                        otter_src_ref_t init_location);
+
 /**
  * @brief Delete a task context.
  *
@@ -43,6 +60,62 @@ void otterTaskContext_init(otter_task_context *task, otter_task_context *parent,
  */
 void otterTaskContext_delete(otter_task_context *task);
 
+/**
+ * @brief Take a reference to a task context which is shared between threads,
+ * so that it isn't deleted until it is released. A context starts with one
+ * reference, held by whoever created it.
+ *
+ * @param task The context to keep.
+ */
+void otterTaskContext_acquire(otter_task_context *task);
+
+/**
+ * @brief Release a reference to a task context.
+ *
+ * @param task The context to release.
+ * @return true if that was the last reference, in which case the caller must
+ * delete the context.
+ */
+bool otterTaskContext_release(otter_task_context *task);
+
+// Coarsening
+
+/**
+ * @brief Add a task to the group of its siblings with the same label and
+ * flavour which have been created since their parent last synchronised,
+ * starting a new group if there is none. The first task in a group is its
+ * representative and is recorded as usual; the others are folded into it and
+ * record no events of their own.
+ *
+ * @param task The task to coarsen, whose label must already be set.
+ * @param parent The parent of `task`.
+ * @return true if `task` was folded into another task.
+ */
+bool otterTaskContext_coarsen(otter_task_context *task,
+                              otter_task_context *parent);
+
+/**
+ * @brief Note the time a coarsened task started.
+ */
+void otterTaskContext_coarse_start(otter_task_context *task);
+
+/**
+ * @brief Add a coarsened task's duration to its group. If the task is the last
+ * member of a closed group to end, the group's summary is recorded at
+ * `location` and the group is freed. Nothing is recorded if `location` is
+ * NULL.
+ */
+void otterTaskContext_coarse_end(otter_task_context *task,
+                                 trace_location_def_t *location);
+
+/**
+ * @brief Close the groups of a task's children so that later children start
+ * new groups, as when the task synchronises or ends. The summaries of groups
+ * whose members have all ended are recorded at `location`, unless it is NULL.
+ */
+void otterTaskContext_close_coarse_groups(otter_task_context *task,
+                                          trace_location_def_t *location);
+
 // Getters
 
 /**
@@ -63,6 +136,31 @@ otterTaskContext_get_task_context_id(const otter_task_context *task);
 unique_id_t
 otterTaskContext_get_parent_task_context_id(const otter_task_context *task);
 
+/**
+ * @brief Get the ID a task is recorded with: its own, or that of the
+ * representative it was folded into.
+ *
+ * @param task The task to inspect.
+ * @return unique_id_t
+ */
+unique_id_t otterTaskContext_get_graph_id(const otter_task_context *task);
+
+/**
+ * @brief Whether a task was folded into another task by coarsening.
+ */
+bool otterTaskContext_is_folded(const otter_task_context *task);
+
+/**
+ * @brief Whether the start of a task was recorded, in which case its end must
+ * be recorded too.
+ */
+bool otterTaskContext_is_started(const otter_task_context *task);
+
+/**
+ * @brief Note that the start of a task was recorded.
+ */
+void otterTaskContext_set_started(otter_task_context *task);
+
 /**
  * @brief Get the flavour of a task
  *
@@ -90,3 +188,16 @@ otterTaskContext_get_task_label_ref(const otter_task_context *task);
  */
 void otterTaskContext_set_task_label_ref(otter_task_context *task,
                                          otter_string_ref_t label);
+
+/**
+ * @brief Get where a task is in the graph of the phase it was recorded in, if
+ * phase templates are enabled.
+ */
+trace_template_ref_t
+otterTaskContext_get_template_ref(const otter_task_context *task);
+
+/**
+ * @brief Set where a task is in the graph of the phase it was recorded in.
+ */
+void otterTaskContext_set_template_ref(otter_task_context *task,
+                                       trace_template_ref_t ref);
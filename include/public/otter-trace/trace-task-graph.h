@@ -35,6 +35,29 @@ void trace_graph_event_task_end(trace_location_def_t *location,
                                 unique_id_t encountering_task_id,
                                 otter_src_ref_t end_ref);
 
+/* Record the creation, start or end of n tasks with consecutive IDs from
+   first_task_id as one batch event */
+void trace_graph_event_task_create_batch(trace_location_def_t *location,
+                                         unique_id_t encountering_task_id,
+                                         unique_id_t first_task_id, uint64_t n,
+                                         otter_string_ref_t task_label,
+                                         otter_src_ref_t create_ref);
+
+void trace_graph_event_task_begin_batch(trace_location_def_t *location,
+                                        unique_id_t first_task_id, uint64_t n,
+                                        otter_src_ref_t start_ref);
+
+void trace_graph_event_task_end_batch(trace_location_def_t *location,
+                                      unique_id_t first_task_id, uint64_t n,
+                                      otter_src_ref_t end_ref);
+
+/* Record that a group of sibling tasks was coarsened into one representative
+   task, whose own events stand for the whole group */
+void trace_graph_event_task_coarsened(trace_location_def_t *location,
+                                      unique_id_t encountering_task_id,
+                                      unique_id_t representative_task_id,
+                                      trace_coarse_group_attr_t group_attr);
+
 void trace_graph_synchronise_tasks(trace_location_def_t *location,
                                    unique_id_t encountering_task_id,
                                    trace_sync_region_attr_t sync_attr,
@@ -0,0 +1,145 @@
+/**
+ * @file trace-template.h
+ * @author Adam Tuft
+ * @brief Records the task graph of each phase as a template shared by every
+ * phase with the same structure, plus the times of that phase's tasks
+ * (OTTER_PHASE_TEMPLATES). Used by the otter-task-graph event source.
+ *
+ * While a phase is open, the phase task and its descendants are recorded here
+ * instead of as trace events: the phase task's own create, start and end
+ * events are still written to the trace. Each thread logs the events it records
+ * to a log of its own, and the thread which ends the phase builds the phase's
+ * graph from every thread's log. At the end of the phase its graph is
+ * reduced to a canonical form which ignores timing and the order in which
+ * threads recorded their tasks. A graph not seen before is written once as a
+ * template, and every phase is written as a reference to its template followed
+ * by the times of its tasks and synchronisations.
+ *
+ * The file OTTER_TEMPLATE_FILE in the archive directory holds an
+ * otter_template_header_t followed by a sequence of records, each an
+ * otter_template_record_t followed by `length` bytes:
+ *
+ *   - a template: an otter_template_t, then n_tasks otter_template_task_t and
+ *     n_syncs otter_template_sync_t. Task 0 is the phase task and tasks are in
+ *     depth-first order, so a task's parent always comes before it. Syncs are
+ *     grouped by task, in the order each task recorded them.
+ *   - a phase: an otter_template_phase_t, then for each task of its template:
+ *       - the zig-zag varint difference between its unique_id and that of the
+ *         task before it (for task 0, phase_task_id)
+ *       - the varint ref of the location which started it plus 1, or 0 if it
+ *         never started
+ *       - the varint create and start times
+ *       - the varint duration plus 1, or 0 if it didn't end within the phase
+ *     and then for each sync the varint time. Times are relative to the
+ *     phase's start_time. A phase's template is always written before it.
+ *
+ * Together with its template, a phase holds all that its tasks' create, start,
+ * end and sync events would have: otter-graph expands it back into them.
+ *
+ * Labels are string refs defined in the trace. Times are in ns and fields are
+ * in the writing host's byte order. Varints are coded as in trace-compact.h.
+ * @version 0.1
+ * @date 2026-10-19
+ *
+ * @copyright Copyright (c) 2026
+ *
+ */
+
+#if !defined(OTTER_TRACE_TEMPLATE_H)
+#define OTTER_TRACE_TEMPLATE_H
+
+#include "public/config.h"
+
+#include "api/otter-task-graph/otter-task-graph.h" // for otter_endpoint_t
+#include "public/otter-common.h"
+#include "public/otter-trace/trace-location.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+#define OTTER_TEMPLATE_MAGIC 0x4850544fu /* "OTPH" */
+#define OTTER_TEMPLATE_VERSION 2
+#define OTTER_TEMPLATE_FILE "phases.otp"
+#define OTTER_TEMPLATE_NO_TASK UINT64_MAX
+
+typedef struct {
+  uint32_t magic;
+  uint16_t version;
+  uint16_t unused;
+  uint64_t templates;
+  uint64_t phases;
+} otter_template_header_t;
+
+typedef enum {
+  otter_template_record_template = 1,
+  otter_template_record_phase
+} otter_template_record_kind_t;
+
+typedef struct {
+  uint32_t kind; /* otter_template_record_kind_t */
+  uint32_t unused;
+  uint64_t length; /* bytes following this header */
+} otter_template_record_t;
+
+typedef struct {
+  uint64_t id; /* templates are numbered from 0 in the order written */
+  uint64_t hash;
+  uint64_t n_tasks;
+  uint64_t n_syncs;
+} otter_template_t;
+
+typedef struct {
+  uint64_t parent; /* index of the parent task, OTTER_TEMPLATE_NO_TASK for 0 */
+  uint32_t label;  /* string ref */
+  int32_t flavour;
+  uint32_t epoch; /* syncs the parent had begun when the task was created */
+  uint32_t unused;
+} otter_template_task_t;
+
+typedef struct {
+  uint64_t task;
+  uint8_t endpoint; /* otter_endpoint_t */
+  uint8_t descendants;
+  uint8_t unused[6];
+} otter_template_sync_t;
+
+typedef struct {
+  uint64_t template_id;
+  uint64_t phase_task_id; /* unique_id of the phase task in the trace */
+  uint64_t start_time;
+} otter_template_phase_t;
+
+/* Refers to a task recorded in a phase's graph by the log entry which created
+   it. Phases and logs are numbered from 1, so a ref with phase 0 refers to no
+   task and one with log 0 to the phase task */
+typedef struct {
+  uint64_t phase;
+  uint32_t log;
+  uint32_t entry;
+} trace_template_ref_t;
+
+void trace_template_initialise(otter_opt_t *opt);
+void trace_template_finalise(void);
+
+/* Open the graph of a new phase whose phase task has begun. Returns the ref of
+   the phase task, or a ref to no task if templates are disabled or another
+   phase is open */
+trace_template_ref_t trace_template_phase_begin(unique_id_t phase_task_id);
+
+/* Close the phase whose phase task has the given ref and write its graph. Does
+   nothing unless the ref is one returned by trace_template_phase_begin() */
+void trace_template_phase_end(trace_template_ref_t phase);
+
+/* Each of these returns true if the event was recorded in the open phase's
+   graph, or false if it must be recorded as a trace event instead: the task is
+   not in the open phase, or it is the phase task, whose create, start and end
+   events are always written to the trace */
+bool trace_template_task_create(trace_template_ref_t parent,
+                                otter_string_ref_t label, int flavour,
+                                unique_id_t id, trace_template_ref_t *task);
+bool trace_template_task_start(trace_template_ref_t task,
+                               trace_location_def_t *location);
+bool trace_template_task_end(trace_template_ref_t task);
+bool trace_template_sync(trace_template_ref_t task, otter_endpoint_t endpoint,
+                         bool descendants);
+
+#endif // OTTER_TRACE_TEMPLATE_H
@@ -25,6 +25,8 @@
 #if !defined(OTTER_TRACE_TYPES_H)
 #define OTTER_TRACE_TYPES_H
 
+#include <stdint.h>
+
 typedef enum {
   otter_thread_initial = 1,
   otter_thread_worker = 2,
@@ -99,4 +101,31 @@ typedef enum {
   otter_parallel_team = 0x80000000
 } otter_parallel_flag_t;
 
+typedef enum {
+  otter_dependence_type_in = 1,
+  otter_dependence_type_out = 2,
+  otter_dependence_type_inout = 3,
+  otter_dependence_type_mutexinoutset = 4,
+  otter_dependence_type_source = 5,
+  otter_dependence_type_sink = 6,
+  otter_dependence_type_inoutset = 7
+} otter_dependence_type_t;
+
+typedef enum {
+  otter_mutex_lock = 1,
+  otter_mutex_test_lock = 2,
+  otter_mutex_nest_lock = 3,
+  otter_mutex_test_nest_lock = 4,
+  otter_mutex_critical = 5,
+  otter_mutex_atomic = 6,
+  otter_mutex_ordered = 7
+} otter_mutex_kind_t;
+
+/* A dependence of a task on a variable (or, for doacross dependences, on an
+   iteration vector) */
+typedef struct {
+  uint64_t variable;
+  otter_dependence_type_t type;
+} otter_dependence_t;
+
 #endif // OTTER_TRACE_TYPES_H
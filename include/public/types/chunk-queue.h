@@ -0,0 +1,43 @@
+#if !defined(OTTER_CHUNK_QUEUE_H)
+#define OTTER_CHUNK_QUEUE_H
+
+// Public
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "public/debug.h"
+#include "public/types/datatypes-common.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* A FIFO queue which stores its items in contiguous, fixed-size chunks.
+
+   Unlike otter_queue_t, pushing an item only allocates when the tail chunk is
+   full, and chunks emptied by popping are kept for re-use by the same queue
+   rather than freed. Appending one chunk queue to another splices the chunks
+   of the source onto the destination in O(1) without copying any items. */
+typedef struct otter_chunk_queue_t otter_chunk_queue_t;
+
+/* the number of items per chunk used when chunk_queue_create is given 0 */
+#define OTTER_CHUNK_QUEUE_DEFAULT_CHUNK_ITEMS 64
+
+otter_chunk_queue_t *chunk_queue_create(size_t chunk_items);
+bool chunk_queue_push(otter_chunk_queue_t *q, data_item_t item);
+bool chunk_queue_pop(otter_chunk_queue_t *q, data_item_t *dest);
+bool chunk_queue_peek(otter_chunk_queue_t *q, data_item_t *dest);
+size_t chunk_queue_length(otter_chunk_queue_t *q);
+bool chunk_queue_is_empty(otter_chunk_queue_t *q);
+void chunk_queue_destroy(otter_chunk_queue_t *q, bool items,
+                         data_destructor_t destructor);
+
+/* splice the items in r onto the end of q, leaving r empty but still usable */
+bool chunk_queue_append(otter_chunk_queue_t *q, otter_chunk_queue_t *r);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // OTTER_CHUNK_QUEUE_H
@@ -14,6 +14,15 @@ void string_registry_apply(string_registry *, string_registry_callback *,
                            void *);
 void string_registry_delete(string_registry *);
 uint32_t string_registry_insert(string_registry *, const char *);
+/* As string_registry_insert, setting *is_new if the string was labelled by
+   this call */
+uint32_t string_registry_insert_new(string_registry *, const char *,
+                                    int *is_new);
+/* Label a string with a label chosen by the caller. If the string already has
+   a different label it keeps it, and string_registry_apply visits the string
+   once with each label */
+void string_registry_insert_label(string_registry *, const char *,
+                                  uint32_t label);
 
 #if defined(__cplusplus)
 }
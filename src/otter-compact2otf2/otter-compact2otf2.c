@@ -0,0 +1,1086 @@
+/**
+ * @file otter-compact2otf2.c
+ * @author Adam Tuft
+ * @brief Converts a trace written by Otter's compact sink to OTF2.
+ *
+ *   otter-compact2otf2 [-s segment] [-o path] trace-dir
+ *
+ * trace-dir is the directory holding the archive Otter wrote, i.e.
+ * <OTTER_TRACE_PATH>/<archive name>. The compact sink writes the archive's
+ * definitions but not its events, which are in trace-dir/compact. The
+ * definitions are copied and the events decoded into a new archive with the
+ * same name under the output path, which defaults to trace-dir/otf2.
+ *
+ * A segmented trace (OTTER_SEGMENT_PHASES) is converted a segment at a time
+ * with -s, so that segments can be converted in parallel. The output path then
+ * defaults to trace-dir/otf2.<segment>. The definitions are taken from the
+ * segment's own definitions file rather than the archive, so a segment can be
+ * converted as soon as it is complete. They define the locations which wrote
+ * to the segment and the regions which had ended by the time it completed. A
+ * region still active then is given a placeholder definition.
+ *
+ * A trace written with OTTER_COMPACT_SHARED holds shared stream files instead
+ * of a file per location. Their blocks are sorted by location and each
+ * location's blocks decoded in turn.
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <libgen.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <otf2/otf2.h>
+
+#include "public/otter-trace/trace-compact.h"
+
+/* Global definitions are kept in the order they were read and written once
+   the events are converted, so that each location's event count is known */
+typedef enum {
+  def_clock_properties,
+  def_string,
+  def_system_tree_node,
+  def_location_group,
+  def_location,
+  def_region,
+  def_attribute,
+  def_source_code_location
+} def_kind_t;
+
+typedef struct {
+  def_kind_t kind;
+  uint64_t ref;
+  uint64_t arg[10];
+  char *string;
+} def_t;
+
+static struct {
+  def_t *items;
+  size_t count;
+  size_t capacity;
+} defs = {NULL, 0, 0};
+
+typedef struct {
+  OTF2_StringRef ref;
+  char *string;
+} schema_string_t;
+
+/* Attribute types by ref and the string table, from the schema */
+static struct {
+  OTF2_Type *types;
+  uint32_t count;
+  schema_string_t *strings;
+  uint32_t n_strings;
+} schema = {NULL, 0, NULL, 0};
+
+/* With a segment's own definitions, the string refs given to their names and
+   the regions the events enter, so that any not yet defined can be */
+static struct {
+  bool from_segment;
+  OTF2_StringRef next_string;
+  OTF2_StringRef empty;
+  uint8_t *regions_seen;
+  size_t regions_capacity;
+} segment_defs = {false, 0, OTF2_UNDEFINED_STRING, NULL, 0};
+
+/* A block of a shared stream. `order` is the block's position among all the
+   blocks read, which keeps a location's blocks in the order written. */
+typedef struct {
+  uint64_t location;
+  uint64_t order;
+  const unsigned char *events;
+  uint32_t n_events;
+  uint32_t length;
+} shared_block_t;
+
+typedef struct {
+  const unsigned char *data;
+  size_t size;
+} shared_file_t;
+
+/* The blocks of every shared stream, sorted by location */
+static struct {
+  shared_block_t *blocks;
+  size_t count;
+  size_t capacity;
+  shared_file_t *files;
+  size_t n_files;
+} shared = {NULL, 0, 0, NULL, 0};
+
+/* The state carried from one event to the next of a location */
+typedef struct {
+  uint64_t *last_value;
+  OTF2_TimeStamp time;
+} decoder_t;
+
+static def_t *add_def(def_kind_t kind, uint64_t ref) {
+  if (defs.count == defs.capacity) {
+    size_t capacity = defs.capacity ? 2 * defs.capacity : 256;
+    def_t *items = realloc(defs.items, capacity * sizeof(*items));
+    if (items == NULL) {
+      fprintf(stderr, "otter-compact2otf2: out of memory\n");
+      exit(EXIT_FAILURE);
+    }
+    defs.items = items;
+    defs.capacity = capacity;
+  }
+  def_t *def = &defs.items[defs.count++];
+  *def = (def_t){.kind = kind, .ref = ref};
+  return def;
+}
+
+static OTF2_CallbackCode read_clock_properties(void *data, uint64_t resolution,
+                                               uint64_t offset,
+                                               uint64_t length) {
+  def_t *def = add_def(def_clock_properties, 0);
+  def->arg[0] = resolution;
+  def->arg[1] = offset;
+  def->arg[2] = length;
+  return OTF2_CALLBACK_SUCCESS;
+}
+
+static OTF2_CallbackCode read_string(void *data, OTF2_StringRef self,
+                                     const char *string) {
+  add_def(def_string, self)->string = strdup(string);
+  return OTF2_CALLBACK_SUCCESS;
+}
+
+static OTF2_CallbackCode read_system_tree_node(void *data,
+                                               OTF2_SystemTreeNodeRef self,
+                                               OTF2_StringRef name,
+                                               OTF2_StringRef class_name,
+                                               OTF2_SystemTreeNodeRef parent) {
+  def_t *def = add_def(def_system_tree_node, self);
+  def->arg[0] = name;
+  def->arg[1] = class_name;
+  def->arg[2] = parent;
+  return OTF2_CALLBACK_SUCCESS;
+}
+
+static OTF2_CallbackCode read_location_group(void *data,
+                                             OTF2_LocationGroupRef self,
+                                             OTF2_StringRef name,
+                                             OTF2_LocationGroupType type,
+                                             OTF2_SystemTreeNodeRef parent) {
+  def_t *def = add_def(def_location_group, self);
+  def->arg[0] = name;
+  def->arg[1] = type;
+  def->arg[2] = parent;
+  return OTF2_CALLBACK_SUCCESS;
+}
+
+static OTF2_CallbackCode read_location(void *data, OTF2_LocationRef self,
+                                       OTF2_StringRef name,
+                                       OTF2_LocationType type, uint64_t events,
+                                       OTF2_LocationGroupRef group) {
+  def_t *def = add_def(def_location, self);
+  def->arg[0] = name;
+  def->arg[1] = type;
+  def->arg[2] = 0; /* events, counted when converted */
+  def->arg[3] = group;
+  return OTF2_CALLBACK_SUCCESS;
+}
+
+static OTF2_CallbackCode
+read_region(void *data, OTF2_RegionRef self, OTF2_StringRef name,
+            OTF2_StringRef canonical_name, OTF2_StringRef description,
+            OTF2_RegionRole role, OTF2_Paradigm paradigm, OTF2_RegionFlag flags,
+            OTF2_StringRef source_file, uint32_t begin_line,
+            uint32_t end_line) {
+  def_t *def = add_def(def_region, self);
+  def->arg[0] = name;
+  def->arg[1] = canonical_name;
+  def->arg[2] = description;
+  def->arg[3] = role;
+  def->arg[4] = paradigm;
+  def->arg[5] = flags;
+  def->arg[6] = source_file;
+  def->arg[7] = begin_line;
+  def->arg[8] = end_line;
+  return OTF2_CALLBACK_SUCCESS;
+}
+
+static OTF2_CallbackCode read_attribute(void *data, OTF2_AttributeRef self,
+                                        OTF2_StringRef name,
+                                        OTF2_StringRef description,
+                                        OTF2_Type type) {
+  def_t *def = add_def(def_attribute, self);
+  def->arg[0] = name;
+  def->arg[1] = description;
+  def->arg[2] = type;
+  return OTF2_CALLBACK_SUCCESS;
+}
+
+static OTF2_CallbackCode
+read_source_code_location(void *data, OTF2_SourceCodeLocationRef self,
+                          OTF2_StringRef file, uint32_t line) {
+  def_t *def = add_def(def_source_code_location, self);
+  def->arg[0] = file;
+  def->arg[1] = line;
+  return OTF2_CALLBACK_SUCCESS;
+}
+
+static bool read_definitions(const char *anchor, OTF2_Archive *archive) {
+  OTF2_Reader *reader = OTF2_Reader_Open(anchor);
+  if (reader == NULL) {
+    fprintf(stderr, "otter-compact2otf2: can't open %s\n", anchor);
+    return false;
+  }
+  OTF2_Reader_SetSerialCollectiveCallbacks(reader);
+
+  OTF2_GlobalDefReaderCallbacks *callbacks =
+      OTF2_GlobalDefReaderCallbacks_New();
+  OTF2_GlobalDefReaderCallbacks_SetClockPropertiesCallback(
+      callbacks, read_clock_properties);
+  OTF2_GlobalDefReaderCallbacks_SetStringCallback(callbacks, read_string);
+  OTF2_GlobalDefReaderCallbacks_SetSystemTreeNodeCallback(
+      callbacks, read_system_tree_node);
+  OTF2_GlobalDefReaderCallbacks_SetLocationGroupCallback(callbacks,
+                                                         read_location_group);
+  OTF2_GlobalDefReaderCallbacks_SetLocationCallback(callbacks, read_location);
+  OTF2_GlobalDefReaderCallbacks_SetRegionCallback(callbacks, read_region);
+  OTF2_GlobalDefReaderCallbacks_SetAttributeCallback(callbacks,
+                                                     read_attribute);
+  OTF2_GlobalDefReaderCallbacks_SetSourceCodeLocationCallback(
+      callbacks, read_source_code_location);
+
+  OTF2_GlobalDefReader *def_reader = OTF2_Reader_GetGlobalDefReader(reader);
+  OTF2_Reader_RegisterGlobalDefCallbacks(reader, def_reader, callbacks, NULL);
+  uint64_t read = 0;
+  OTF2_ErrorCode err =
+      OTF2_Reader_ReadAllGlobalDefinitions(reader, def_reader, &read);
+  OTF2_Reader_CloseGlobalDefReader(reader, def_reader);
+  OTF2_GlobalDefReaderCallbacks_Delete(callbacks);
+
+  /* Properties such as OTTER::EVENT_MODEL */
+  uint32_t n_properties = 0;
+  char **names = NULL;
+  if (err == OTF2_SUCCESS &&
+      OTF2_Reader_GetPropertyNames(reader, &n_properties, &names) ==
+          OTF2_SUCCESS) {
+    for (uint32_t k = 0; k < n_properties; k++) {
+      char *value = NULL;
+      if (OTF2_Reader_GetProperty(reader, names[k], &value) == OTF2_SUCCESS) {
+        OTF2_Archive_SetProperty(archive, names[k], value, true);
+        free(value);
+      }
+    }
+    free(names);
+  }
+  OTF2_Reader_Close(reader);
+
+  if (err != OTF2_SUCCESS) {
+    fprintf(stderr, "otter-compact2otf2: can't read definitions from %s\n",
+            anchor);
+    return false;
+  }
+  return true;
+}
+
+/* Map a compact file and check its header */
+static const unsigned char *map_file(const char *path, uint16_t kind,
+                                     size_t *size) {
+  int fd = open(path, O_RDONLY);
+  if (fd == -1) {
+    fprintf(stderr, "otter-compact2otf2: can't open %s: %s\n", path,
+            strerror(errno));
+    return NULL;
+  }
+  struct stat info;
+  const unsigned char *data = MAP_FAILED;
+  if (fstat(fd, &info) == 0 && info.st_size >= sizeof(otter_compact_header_t))
+    data = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (data == MAP_FAILED) {
+    fprintf(stderr, "otter-compact2otf2: can't map %s\n", path);
+    return NULL;
+  }
+  const otter_compact_header_t *header = (const otter_compact_header_t *)data;
+  if (header->magic != OTTER_COMPACT_MAGIC ||
+      header->version != OTTER_COMPACT_VERSION || header->kind != kind ||
+      header->length > info.st_size - sizeof(*header)) {
+    fprintf(stderr, "otter-compact2otf2: %s is not a compact %s file\n", path,
+            kind == otter_compact_file_schema        ? "schema"
+            : kind == otter_compact_file_shared      ? "shared"
+            : kind == otter_compact_file_definitions ? "definitions"
+                                                     : "event");
+    munmap((void *)data, info.st_size);
+    return NULL;
+  }
+  *size = info.st_size;
+  return data;
+}
+
+static bool read_schema(const char *dir) {
+  char path[PATH_MAX];
+  snprintf(path, sizeof(path), "%s/%s", dir, OTTER_COMPACT_SCHEMA_FILE);
+  size_t size = 0;
+  const unsigned char *data = map_file(path, otter_compact_file_schema, &size);
+  if (data == NULL)
+    return false;
+
+  const unsigned char *p = data + sizeof(otter_compact_header_t);
+  const unsigned char *end =
+      p + ((const otter_compact_header_t *)data)->length;
+  otter_compact_schema_t counts;
+  bool ok = end - p >= sizeof(counts);
+  if (ok) {
+    memcpy(&counts, p, sizeof(counts));
+    p += sizeof(counts);
+  }
+  for (uint32_t k = 0; ok && k < counts.n_attributes; k++) {
+    otter_compact_attribute_t entry;
+    if (end - p < sizeof(entry)) {
+      ok = false;
+      break;
+    }
+    memcpy(&entry, p, sizeof(entry));
+    p += sizeof(entry) + entry.name_length;
+    if (entry.ref >= schema.count) {
+      OTF2_Type *types =
+          realloc(schema.types, (entry.ref + 1) * sizeof(*types));
+      if (types == NULL) {
+        ok = false;
+        break;
+      }
+      memset(types + schema.count, OTF2_TYPE_NONE,
+             (entry.ref + 1 - schema.count) * sizeof(*types));
+      schema.types = types;
+      schema.count = entry.ref + 1;
+    }
+    schema.types[entry.ref] = entry.type;
+  }
+  /* The archive already defines every string, but a segment's definitions
+     need the strings its events refer to */
+  if (ok) {
+    schema.strings = calloc(counts.n_strings, sizeof(*schema.strings));
+    ok = counts.n_strings == 0 || schema.strings != NULL;
+  }
+  for (uint32_t k = 0; ok && k < counts.n_strings; k++) {
+    otter_compact_string_t entry;
+    if (end - p < sizeof(entry)) {
+      ok = false;
+      break;
+    }
+    memcpy(&entry, p, sizeof(entry));
+    p += sizeof(entry);
+    if (end - p < entry.length) {
+      ok = false;
+      break;
+    }
+    schema.strings[k].ref = entry.ref;
+    schema.strings[k].string = strndup((const char *)p, entry.length);
+    schema.n_strings++;
+    p += entry.length;
+  }
+  munmap((void *)data, size);
+  if (!ok || p > end)
+    fprintf(stderr, "otter-compact2otf2: %s is truncated\n", path);
+  return ok && p <= end;
+}
+
+/* Define a string for a segment definition's name */
+static OTF2_StringRef add_segment_string(const char *string, size_t length) {
+  OTF2_StringRef ref = segment_defs.next_string++;
+  add_def(def_string, ref)->string = strndup(string, length);
+  return ref;
+}
+
+/* Read the definitions written with a segment in place of the archive's */
+static bool read_segment_definitions(const char *dir, OTF2_Archive *archive) {
+  char path[PATH_MAX];
+  snprintf(path, sizeof(path), "%s/%s", dir, OTTER_COMPACT_DEFINITIONS_FILE);
+  size_t size = 0;
+  const unsigned char *data =
+      map_file(path, otter_compact_file_definitions, &size);
+  if (data == NULL)
+    return false;
+  const otter_compact_header_t *header = (const otter_compact_header_t *)data;
+  const unsigned char *p = data + sizeof(*header);
+  const unsigned char *end = p + header->length;
+
+  /* The clock comes first, then the strings the events refer to. Names are
+     given refs after the largest of those. */
+  OTF2_StringRef next = 0;
+  for (uint32_t k = 0; k < schema.n_strings; k++) {
+    if (schema.strings[k].ref >= next)
+      next = schema.strings[k].ref + 1;
+  }
+  segment_defs.next_string = next;
+  segment_defs.from_segment = true;
+
+  uint64_t count = 0;
+  bool ok = true;
+  for (; ok && count < header->count; count++) {
+    otter_compact_definition_t entry;
+    if (end - p < sizeof(entry)) {
+      ok = false;
+      break;
+    }
+    memcpy(&entry, p, sizeof(entry));
+    p += sizeof(entry);
+    if (end - p < (size_t)entry.name_length + entry.text_length ||
+        entry.kind >= otter_compact_n_definitions) {
+      ok = false;
+      break;
+    }
+    const char *name = (const char *)p;
+    const char *text = name + entry.name_length;
+    p += entry.name_length + entry.text_length;
+
+    uint64_t *arg = entry.arg;
+    def_t *def = NULL;
+    switch (entry.kind) {
+    case otter_compact_definition_clock:
+      def = add_def(def_clock_properties, 0);
+      memcpy(def->arg, arg, 3 * sizeof(*arg));
+      for (uint32_t k = 0; k < schema.n_strings; k++) {
+        add_def(def_string, schema.strings[k].ref)->string =
+            strdup(schema.strings[k].string);
+      }
+      segment_defs.empty = add_segment_string("", 0);
+      break;
+    case otter_compact_definition_property: {
+      char *key = strndup(name, entry.name_length);
+      char *value = strndup(text, entry.text_length);
+      if (key != NULL && value != NULL)
+        OTF2_Archive_SetProperty(archive, key, value, true);
+      free(key);
+      free(value);
+      break;
+    }
+    case otter_compact_definition_system_tree_node: {
+      OTF2_StringRef name_ref = add_segment_string(name, entry.name_length);
+      OTF2_StringRef class_ref = add_segment_string(text, entry.text_length);
+      def = add_def(def_system_tree_node, entry.ref);
+      def->arg[0] = name_ref;
+      def->arg[1] = class_ref;
+      def->arg[2] = arg[0];
+      break;
+    }
+    case otter_compact_definition_location_group: {
+      OTF2_StringRef name_ref = add_segment_string(name, entry.name_length);
+      def = add_def(def_location_group, entry.ref);
+      def->arg[0] = name_ref;
+      def->arg[1] = arg[0];
+      def->arg[2] = arg[1];
+      break;
+    }
+    case otter_compact_definition_location: {
+      OTF2_StringRef name_ref = add_segment_string(name, entry.name_length);
+      def = add_def(def_location, entry.ref);
+      def->arg[0] = name_ref;
+      def->arg[1] = arg[0];
+      def->arg[2] = 0; /* events, counted when converted */
+      def->arg[3] = arg[1];
+      break;
+    }
+    case otter_compact_definition_region: {
+      OTF2_StringRef name_ref = add_segment_string(name, entry.name_length);
+      def = add_def(def_region, entry.ref);
+      def->arg[0] = name_ref;
+      def->arg[1] = segment_defs.empty;
+      def->arg[2] = segment_defs.empty;
+      def->arg[3] = arg[0];
+      def->arg[4] = arg[1];
+      def->arg[5] = OTF2_REGION_FLAG_NONE;
+      def->arg[6] = segment_defs.empty;
+      def->arg[7] = 0;
+      def->arg[8] = 0;
+      break;
+    }
+    case otter_compact_definition_attribute: {
+      OTF2_StringRef name_ref = add_segment_string(name, entry.name_length);
+      OTF2_StringRef description_ref =
+          add_segment_string(text, entry.text_length);
+      def = add_def(def_attribute, entry.ref);
+      def->arg[0] = name_ref;
+      def->arg[1] = description_ref;
+      def->arg[2] = arg[0];
+      break;
+    }
+    }
+  }
+  munmap((void *)data, size);
+  if (!ok || p != end || segment_defs.empty == OTF2_UNDEFINED_STRING) {
+    fprintf(stderr, "otter-compact2otf2: %s is truncated\n", path);
+    return false;
+  }
+  return true;
+}
+
+/* Note a region the events refer to */
+static void see_region(uint64_t ref) {
+  if (!segment_defs.from_segment || ref == OTF2_UNDEFINED_REGION)
+    return;
+  if (ref >= segment_defs.regions_capacity) {
+    size_t capacity =
+        segment_defs.regions_capacity ? segment_defs.regions_capacity : 256;
+    while (capacity <= ref)
+      capacity *= 2;
+    uint8_t *seen = realloc(segment_defs.regions_seen, capacity);
+    if (seen == NULL)
+      return;
+    memset(seen + segment_defs.regions_capacity, 0,
+           capacity - segment_defs.regions_capacity);
+    segment_defs.regions_seen = seen;
+    segment_defs.regions_capacity = capacity;
+  }
+  segment_defs.regions_seen[ref] = 1;
+}
+
+/* Define the regions the events entered which hadn't ended when the segment
+   completed, and so have no definition of their own */
+static void define_unseen_regions(void) {
+  for (size_t k = 0; k < defs.count; k++) {
+    if (defs.items[k].kind == def_region &&
+        defs.items[k].ref < segment_defs.regions_capacity)
+      segment_defs.regions_seen[defs.items[k].ref] = 0;
+  }
+  uint64_t placeholders = 0;
+  for (size_t ref = 0; ref < segment_defs.regions_capacity; ref++) {
+    if (!segment_defs.regions_seen[ref])
+      continue;
+    char name[64];
+    int length = snprintf(name, sizeof(name), "Region %lu", (unsigned long)ref);
+    OTF2_StringRef name_ref = add_segment_string(name, length);
+    def_t *def = add_def(def_region, ref);
+    def->arg[0] = name_ref;
+    def->arg[1] = def->arg[2] = def->arg[6] = segment_defs.empty;
+    def->arg[3] = OTF2_REGION_ROLE_UNKNOWN;
+    def->arg[4] = OTF2_PARADIGM_UNKNOWN;
+    def->arg[5] = OTF2_REGION_FLAG_NONE;
+    placeholders++;
+  }
+  if (placeholders > 0)
+    fprintf(stderr,
+            "otter-compact2otf2: %lu regions were still active when the "
+            "segment completed and are named by their ref\n",
+            (unsigned long)placeholders);
+}
+
+static OTF2_AttributeValue attribute_value(OTF2_Type type, uint64_t bits) {
+  OTF2_AttributeValue value;
+  memset(&value, 0, sizeof(value));
+  switch (type) {
+  case OTF2_TYPE_UINT8:
+    value.uint8 = bits;
+    break;
+  case OTF2_TYPE_UINT16:
+    value.uint16 = bits;
+    break;
+  case OTF2_TYPE_UINT32:
+    value.uint32 = bits;
+    break;
+  case OTF2_TYPE_INT8:
+    value.int8 = (int64_t)bits;
+    break;
+  case OTF2_TYPE_INT16:
+    value.int16 = (int64_t)bits;
+    break;
+  case OTF2_TYPE_INT32:
+    value.int32 = (int64_t)bits;
+    break;
+  case OTF2_TYPE_STRING:
+    value.stringRef = bits;
+    break;
+  case OTF2_TYPE_FLOAT:
+    memcpy(&value.float32, &bits, sizeof(value.float32));
+    break;
+  default:
+    value.uint64 = bits;
+    break;
+  }
+  return value;
+}
+
+/* Decode a run of one location's events, continuing from the decoder's state.
+   Returns the number of events written or -1 if the events are corrupt. */
+static int64_t convert_events(const unsigned char *p, const unsigned char *end,
+                              OTF2_EvtWriter *writer,
+                              OTF2_AttributeList *attributes,
+                              decoder_t *decoder) {
+  uint64_t *last_value = decoder->last_value;
+  OTF2_TimeStamp time = decoder->time;
+  int64_t events = 0;
+  bool ok = true;
+
+  while (ok && p < end) {
+    unsigned char record = *p++;
+    uint32_t delta;
+    if (record >= otter_compact_n_records || end - p < sizeof(delta)) {
+      ok = false;
+      break;
+    }
+    memcpy(&delta, p, sizeof(delta));
+    p += sizeof(delta);
+    if (delta == OTTER_COMPACT_TIME_ESCAPE) {
+      if (end - p < sizeof(time)) {
+        ok = false;
+        break;
+      }
+      memcpy(&time, p, sizeof(time));
+      p += sizeof(time);
+    } else {
+      time += delta;
+    }
+
+    uint64_t arg[2] = {0, 0};
+    int n_args = 0;
+    if (record == otter_compact_record_acquire_lock ||
+        record == otter_compact_record_release_lock) {
+      n_args = 2;
+    } else if (record != otter_compact_record_task_create &&
+               record != otter_compact_record_task_switch) {
+      n_args = 1;
+    }
+    for (int k = 0; ok && k < n_args; k++) {
+      ok = (p = otter_compact_get_varint(p, end, &arg[k])) != NULL;
+    }
+
+    uint64_t n_attributes = 0;
+    ok = ok && (p = otter_compact_get_varint(p, end, &n_attributes)) != NULL;
+    for (uint64_t k = 0; ok && k < n_attributes; k++) {
+      uint64_t key;
+      ok = (p = otter_compact_get_varint(p, end, &key)) != NULL &&
+           (key >> 1) < schema.count;
+      if (!ok)
+        break;
+      OTF2_AttributeRef ref = key >> 1;
+      OTF2_Type type = schema.types[ref];
+      if ((key & 1) == 0) {
+        if (type == OTF2_TYPE_FLOAT || type == OTF2_TYPE_DOUBLE) {
+          size_t size = type == OTF2_TYPE_FLOAT ? 4 : 8;
+          if (end - p < size) {
+            ok = false;
+            break;
+          }
+          last_value[ref] = 0;
+          memcpy(&last_value[ref], p, size);
+          p += size;
+        } else {
+          uint64_t value;
+          ok = (p = otter_compact_get_varint(p, end, &value)) != NULL;
+          last_value[ref] += otter_compact_unzigzag(value);
+        }
+      }
+      OTF2_AttributeList_AddAttribute(attributes, ref, type,
+                                      attribute_value(type, last_value[ref]));
+    }
+    if (!ok)
+      break;
+
+    switch (record) {
+    case otter_compact_record_thread_begin:
+      OTF2_EvtWriter_ThreadBegin(writer, attributes, time, OTF2_UNDEFINED_COMM,
+                                 arg[0]);
+      break;
+    case otter_compact_record_thread_end:
+      OTF2_EvtWriter_ThreadEnd(writer, attributes, time, OTF2_UNDEFINED_COMM,
+                               arg[0]);
+      break;
+    case otter_compact_record_enter:
+      see_region(arg[0]);
+      OTF2_EvtWriter_Enter(writer, attributes, time, arg[0]);
+      break;
+    case otter_compact_record_leave:
+      see_region(arg[0]);
+      OTF2_EvtWriter_Leave(writer, attributes, time, arg[0]);
+      break;
+    case otter_compact_record_task_create:
+      OTF2_EvtWriter_ThreadTaskCreate(writer, attributes, time,
+                                      OTF2_UNDEFINED_COMM,
+                                      OTF2_UNDEFINED_UINT32, 0);
+      break;
+    case otter_compact_record_task_switch:
+      OTF2_EvtWriter_ThreadTaskSwitch(writer, attributes, time,
+                                      OTF2_UNDEFINED_COMM,
+                                      OTF2_UNDEFINED_UINT32, 0);
+      break;
+    case otter_compact_record_acquire_lock:
+      OTF2_EvtWriter_ThreadAcquireLock(writer, attributes, time,
+                                       OTF2_PARADIGM_OPENMP, arg[0], arg[1]);
+      break;
+    case otter_compact_record_release_lock:
+      OTF2_EvtWriter_ThreadReleaseLock(writer, attributes, time,
+                                       OTF2_PARADIGM_OPENMP, arg[0], arg[1]);
+      break;
+    }
+    events++;
+  }
+  OTF2_AttributeList_RemoveAllAttributes(attributes);
+  decoder->time = time;
+  return ok ? events : -1;
+}
+
+static int compare_blocks(const void *a, const void *b) {
+  const shared_block_t *x = a;
+  const shared_block_t *y = b;
+  if (x->location != y->location)
+    return x->location < y->location ? -1 : 1;
+  return x->order < y->order ? -1 : x->order > y->order;
+}
+
+/* Read the blocks of a shared stream file */
+static bool read_shared_file(const char *path) {
+  size_t size = 0;
+  const unsigned char *data = map_file(path, otter_compact_file_shared, &size);
+  if (data == NULL)
+    return false;
+  shared_file_t *files =
+      realloc(shared.files, (shared.n_files + 1) * sizeof(*files));
+  if (files == NULL) {
+    munmap((void *)data, size);
+    return false;
+  }
+  shared.files = files;
+  shared.files[shared.n_files++] = (shared_file_t){data, size};
+
+  const otter_compact_header_t *header = (const otter_compact_header_t *)data;
+  const unsigned char *p = data + sizeof(*header);
+  const unsigned char *end = p + header->length;
+  uint64_t events = 0;
+  while (p < end) {
+    otter_compact_block_t block;
+    if (end - p < sizeof(block))
+      break;
+    memcpy(&block, p, sizeof(block));
+    p += sizeof(block);
+    if (block.length > end - p)
+      break;
+    if (shared.count == shared.capacity) {
+      size_t capacity = shared.capacity ? 2 * shared.capacity : 1024;
+      shared_block_t *blocks =
+          realloc(shared.blocks, capacity * sizeof(*blocks));
+      if (blocks == NULL)
+        break;
+      shared.blocks = blocks;
+      shared.capacity = capacity;
+    }
+    shared.blocks[shared.count] = (shared_block_t){.location = block.location,
+                                                   .order = shared.count,
+                                                   .events = p,
+                                                   .n_events = block.events,
+                                                   .length = block.length};
+    shared.count++;
+    events += block.events;
+    p += block.length;
+  }
+  if (p != end) {
+    fprintf(stderr, "otter-compact2otf2: %s is corrupt\n", path);
+    return false;
+  }
+  if (events != header->count) {
+    fprintf(stderr, "otter-compact2otf2: %s: expected %lu events, found %lu\n",
+            path, (unsigned long)header->count, (unsigned long)events);
+  }
+  return true;
+}
+
+/* Read every shared stream file in the directory, numbered from 0 */
+static bool read_shared(const char *dir) {
+  bool ok = true;
+  for (unsigned long k = 0;; k++) {
+    char name[64];
+    char path[PATH_MAX];
+    snprintf(name, sizeof(name), OTTER_COMPACT_SHARED_FILE_FMT, k);
+    snprintf(path, sizeof(path), "%s/%s", dir, name);
+    if (access(path, F_OK) != 0 && errno == ENOENT)
+      break;
+    ok = read_shared_file(path) && ok;
+  }
+  qsort(shared.blocks, shared.count, sizeof(*shared.blocks), compare_blocks);
+  return ok;
+}
+
+static void free_shared(void) {
+  for (size_t k = 0; k < shared.n_files; k++) {
+    munmap((void *)shared.files[k].data, shared.files[k].size);
+  }
+  free(shared.files);
+  free(shared.blocks);
+}
+
+/* Decode a location's blocks from the shared streams, returning the number of
+   events written or -1 if a block is corrupt */
+static int64_t convert_shared(uint64_t location, OTF2_EvtWriter *writer,
+                              OTF2_AttributeList *attributes,
+                              decoder_t *decoder, uint64_t *bytes) {
+  size_t lo = 0;
+  size_t hi = shared.count;
+  while (lo < hi) {
+    size_t mid = lo + (hi - lo) / 2;
+    if (shared.blocks[mid].location < location)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  int64_t events = 0;
+  for (size_t k = lo; k < shared.count && shared.blocks[k].location == location;
+       k++) {
+    const shared_block_t *block = &shared.blocks[k];
+    int64_t n = convert_events(block->events, block->events + block->length,
+                               writer, attributes, decoder);
+    if (n < 0) {
+      fprintf(stderr,
+              "otter-compact2otf2: block %lu of location %lu is corrupt\n",
+              (unsigned long)(k - lo), (unsigned long)location);
+      return -1;
+    }
+    if ((uint64_t)n != block->n_events) {
+      fprintf(stderr,
+              "otter-compact2otf2: block %lu of location %lu: expected %lu "
+              "events, read %ld\n",
+              (unsigned long)(k - lo), (unsigned long)location,
+              (unsigned long)block->n_events, (long)n);
+    }
+    events += n;
+    *bytes += sizeof(otter_compact_block_t) + block->length;
+  }
+  return events;
+}
+
+static bool convert_location(const char *dir, bool segment, def_t *location,
+                             OTF2_Archive *archive,
+                             OTF2_AttributeList *attributes, uint64_t *bytes) {
+  char path[PATH_MAX];
+  char name[64];
+  snprintf(name, sizeof(name), OTTER_COMPACT_EVENT_FILE_FMT,
+           (unsigned long)location->ref);
+  snprintf(path, sizeof(path), "%s/%s", dir, name);
+
+  OTF2_EvtWriter *writer = OTF2_Archive_GetEvtWriter(archive, location->ref);
+  decoder_t decoder = {calloc(schema.count, sizeof(uint64_t)), 0};
+  if (decoder.last_value == NULL) {
+    OTF2_Archive_CloseEvtWriter(archive, writer);
+    return false;
+  }
+  if ((segment || shared.n_files > 0) && access(path, F_OK) != 0 &&
+      errno == ENOENT) {
+    int64_t events =
+        convert_shared(location->ref, writer, attributes, &decoder, bytes);
+    OTF2_Archive_CloseEvtWriter(archive, writer);
+    free(decoder.last_value);
+    location->arg[2] = events > 0 ? events : 0;
+    return events >= 0;
+  }
+  size_t size = 0;
+  const unsigned char *data = map_file(path, otter_compact_file_events, &size);
+  int64_t events = -1;
+  if (data != NULL) {
+    const otter_compact_header_t *header =
+        (const otter_compact_header_t *)data;
+    const unsigned char *start = data + sizeof(*header);
+    events = convert_events(start, start + header->length, writer, attributes,
+                            &decoder);
+    if (events >= 0 && (uint64_t)events != header->count) {
+      fprintf(stderr, "otter-compact2otf2: %s: expected %lu events, read %ld\n",
+              path, (unsigned long)header->count, (long)events);
+    }
+    *bytes += size;
+    munmap((void *)data, size);
+  }
+  if (data != NULL && events < 0)
+    fprintf(stderr, "otter-compact2otf2: %s is corrupt\n", path);
+  OTF2_Archive_CloseEvtWriter(archive, writer);
+  free(decoder.last_value);
+  location->arg[2] = events > 0 ? events : 0;
+  return events >= 0;
+}
+
+static void write_definitions(OTF2_Archive *archive) {
+  OTF2_GlobalDefWriter *writer = OTF2_Archive_GetGlobalDefWriter(archive);
+  for (size_t k = 0; k < defs.count; k++) {
+    def_t *def = &defs.items[k];
+    uint64_t *arg = def->arg;
+    switch (def->kind) {
+    case def_clock_properties:
+      OTF2_GlobalDefWriter_WriteClockProperties(writer, arg[0], arg[1],
+                                                arg[2]);
+      break;
+    case def_string:
+      OTF2_GlobalDefWriter_WriteString(writer, def->ref, def->string);
+      break;
+    case def_system_tree_node:
+      OTF2_GlobalDefWriter_WriteSystemTreeNode(writer, def->ref, arg[0],
+                                               arg[1], arg[2]);
+      break;
+    case def_location_group:
+      OTF2_GlobalDefWriter_WriteLocationGroup(writer, def->ref, arg[0], arg[1],
+                                              arg[2]);
+      break;
+    case def_location:
+      OTF2_GlobalDefWriter_WriteLocation(writer, def->ref, arg[0], arg[1],
+                                         arg[2], arg[3]);
+      break;
+    case def_region:
+      OTF2_GlobalDefWriter_WriteRegion(writer, def->ref, arg[0], arg[1],
+                                       arg[2], arg[3], arg[4], arg[5], arg[6],
+                                       arg[7], arg[8]);
+      break;
+    case def_attribute:
+      OTF2_GlobalDefWriter_WriteAttribute(writer, def->ref, arg[0], arg[1],
+                                          arg[2]);
+      break;
+    case def_source_code_location:
+      OTF2_GlobalDefWriter_WriteSourceCodeLocation(writer, def->ref, arg[0],
+                                                   arg[1]);
+      break;
+    }
+  }
+}
+
+static void usage(const char *name) {
+  fprintf(stderr, "usage: %s [-s segment] [-o path] trace-dir\n", name);
+  fprintf(stderr, "  -s segment  convert one segment of a segmented trace\n");
+  fprintf(stderr, "  -o path     where to write the OTF2 archive "
+                  "(default trace-dir/otf2, or trace-dir/otf2.<segment>)\n");
+  fprintf(stderr, "  trace-dir   the archive directory written by Otter\n");
+}
+
+int main(int argc, char *argv[]) {
+  const char *output = NULL;
+  const char *segment = NULL;
+  int opt;
+  while ((opt = getopt(argc, argv, "s:o:h")) != -1) {
+    switch (opt) {
+    case 's':
+      segment = optarg;
+      break;
+    case 'o':
+      output = optarg;
+      break;
+    default:
+      usage(argv[0]);
+      return opt == 'h' ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+  }
+  if (optind != argc - 1) {
+    usage(argv[0]);
+    return EXIT_FAILURE;
+  }
+
+  /* The archive is named after its directory */
+  char trace_dir[PATH_MAX];
+  snprintf(trace_dir, sizeof(trace_dir), "%s", argv[optind]);
+  size_t len = strlen(trace_dir);
+  while (len > 1 && trace_dir[len - 1] == '/')
+    trace_dir[--len] = '\0';
+  char copy[PATH_MAX];
+  snprintf(copy, sizeof(copy), "%s", trace_dir);
+  char archive_name[NAME_MAX + 1];
+  snprintf(archive_name, sizeof(archive_name), "%s", basename(copy));
+
+  char anchor[PATH_MAX];
+  char compact_dir[PATH_MAX];
+  char output_path[PATH_MAX];
+  snprintf(anchor, sizeof(anchor), "%s/%s.otf2", trace_dir, archive_name);
+  snprintf(compact_dir, sizeof(compact_dir), "%s/%s", trace_dir,
+           OTTER_COMPACT_DIR);
+  snprintf(output_path, sizeof(output_path), "%s",
+           output != NULL ? output : trace_dir);
+  if (output == NULL)
+    strncat(output_path, "/otf2", sizeof(output_path) - len - 1);
+  if (segment != NULL) {
+    char *end = NULL;
+    unsigned long index = strtoul(segment, &end, 10);
+    if (end == segment || *end != '\0') {
+      fprintf(stderr, "otter-compact2otf2: invalid segment %s\n", segment);
+      return EXIT_FAILURE;
+    }
+    char name[64];
+    snprintf(name, sizeof(name), "/" OTTER_COMPACT_SEGMENT_DIR_FMT, index);
+    strncat(compact_dir, name, sizeof(compact_dir) - strlen(compact_dir) - 1);
+    if (output == NULL)
+      snprintf(output_path, sizeof(output_path), "%s/otf2.%lu", trace_dir,
+               index);
+  }
+
+  if (!read_schema(compact_dir) || !read_shared(compact_dir))
+    return EXIT_FAILURE;
+
+  OTF2_Archive *archive = OTF2_Archive_Open(
+      output_path, archive_name, OTF2_FILEMODE_WRITE,
+      OTF2_CHUNK_SIZE_EVENTS_DEFAULT, OTF2_CHUNK_SIZE_DEFINITIONS_DEFAULT,
+      OTF2_SUBSTRATE_POSIX, OTF2_COMPRESSION_NONE);
+  if (archive == NULL) {
+    fprintf(stderr, "otter-compact2otf2: can't create archive in %s\n",
+            output_path);
+    return EXIT_FAILURE;
+  }
+  OTF2_Archive_SetSerialCollectiveCallbacks(archive);
+
+  /* A segment written before segments had definitions of their own needs the
+     archive's */
+  char segment_defs_path[PATH_MAX];
+  snprintf(segment_defs_path, sizeof(segment_defs_path), "%s/%s", compact_dir,
+           OTTER_COMPACT_DEFINITIONS_FILE);
+  bool defined = segment != NULL && access(segment_defs_path, F_OK) == 0
+                     ? read_segment_definitions(compact_dir, archive)
+                     : read_definitions(anchor, archive);
+  if (!defined) {
+    OTF2_Archive_Close(archive);
+    return EXIT_FAILURE;
+  }
+
+  OTF2_Archive_OpenEvtFiles(archive);
+  OTF2_AttributeList *attributes = OTF2_AttributeList_New();
+  uint64_t locations = 0;
+  uint64_t events = 0;
+  uint64_t bytes = 0;
+  bool ok = true;
+  for (size_t k = 0; k < defs.count; k++) {
+    if (defs.items[k].kind != def_location)
+      continue;
+    ok = convert_location(compact_dir, segment != NULL, &defs.items[k],
+                          archive, attributes, &bytes) &&
+         ok;
+    locations++;
+    events += defs.items[k].arg[2];
+  }
+  OTF2_AttributeList_Delete(attributes);
+  OTF2_Archive_CloseEvtFiles(archive);
+  if (segment_defs.from_segment)
+    define_unseen_regions();
+
+  /* Each location has an (empty) local definition file, as Otter writes */
+  OTF2_Archive_OpenDefFiles(archive);
+  for (size_t k = 0; k < defs.count; k++) {
+    if (defs.items[k].kind != def_location)
+      continue;
+    OTF2_DefWriter *def_writer =
+        OTF2_Archive_GetDefWriter(archive, defs.items[k].ref);
+    OTF2_Archive_CloseDefWriter(archive, def_writer);
+  }
+  OTF2_Archive_CloseDefFiles(archive);
+
+  write_definitions(archive);
+  OTF2_Archive_Close(archive);
+
+  printf("%-30s %lu\n", "Locations:", (unsigned long)locations);
+  printf("%-30s %lu\n", "Events:", (unsigned long)events);
+  printf("%-30s %lu\n", "Compact bytes:", (unsigned long)bytes);
+  printf("%-30s %s/%s.otf2\n", "Written to:", output_path, archive_name);
+
+  for (size_t k = 0; k < defs.count; k++) {
+    free(defs.items[k].string);
+  }
+  free(defs.items);
+  free(schema.types);
+  for (uint32_t k = 0; k < schema.n_strings; k++) {
+    free(schema.strings[k].string);
+  }
+  free(schema.strings);
+  free(segment_defs.regions_seen);
+  free_shared();
+  return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,693 @@
+/**
+ * @file analyse.cpp
+ * @author Adam Tuft
+ * @brief Critical-path and parallelism analysis of a task graph written by
+ * otter-graph.
+ *
+ *   otter-graph-analyse [-j threads] [-b bins] [-n labels] [-p profile.csv]
+ *                       graph.otg
+ *
+ * A task's work is the time its location spent running it and not a task
+ * nested inside it, less the time it spent waiting at a synchronisation point
+ * for children running elsewhere. Each task is split into segments at the
+ * points where it synchronised on its children, which makes the graph
+ * acyclic: a child follows the segment of its parent which created it, and
+ * the segment after a sync follows the children synchronised on.
+ *
+ * A task which stands for a group of coarsened siblings adds the time of the
+ * others to the total work. As the siblings could run alongside it, the group
+ * lengthens the task's last segment only by as much as the longest of them
+ * outlasted the task itself.
+ *
+ * The longest path through the segments is the span (critical path). Total
+ * work over span is the average parallelism. Segments are swept in
+ * topological order by a pool of threads, a level at a time. The parallelism
+ * profile gives, over time, both the parallelism measured in the trace and
+ * that available if every segment ran as soon as its predecessors finished,
+ * with times relative to the start of each.
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <thread>
+#include <unistd.h>
+#include <unordered_map>
+
+#include "graph-file.hpp"
+
+static const uint64_t no_segment = UINT64_MAX;
+
+static bool earlier(const otter_graph_edge_t &a, const otter_graph_edge_t &b) {
+  return a.time < b.time;
+}
+
+struct interval {
+  uint64_t start;
+  uint64_t end;
+};
+
+/* Work done in a sorted list of intervals before time t, for t which never
+   decreases between calls */
+struct work_clock {
+  const std::vector<interval> &work;
+  size_t next = 0;
+  uint64_t done = 0;
+
+  uint64_t at(uint64_t t) {
+    while (next < work.size() && work[next].end <= t) {
+      done += work[next].end - work[next].start;
+      next++;
+    }
+    if (next < work.size() && work[next].start < t)
+      return done + (t - work[next].start);
+    return done;
+  }
+};
+
+struct profile {
+  uint64_t origin = 0;
+  uint64_t length = 1;
+  std::vector<double> bins;
+
+  profile(uint64_t origin, uint64_t length, size_t n)
+      : origin(origin), length(std::max<uint64_t>(length, 1)), bins(n, 0.0) {}
+
+  void add(uint64_t start, uint64_t end, double weight = 1.0) {
+    if (end <= start || bins.empty())
+      return;
+    double width = (double)length / bins.size();
+    double a = (double)(start - origin) / width;
+    double b = (double)(end - origin) / width;
+    for (size_t k = (size_t)a; k < bins.size() && k < b; k++) {
+      bins[k] +=
+          weight * (std::min<double>(b, k + 1) - std::max<double>(a, k));
+    }
+  }
+
+  void merge(const profile &other) {
+    for (size_t k = 0; k < bins.size(); k++) {
+      bins[k] += other.bins[k];
+    }
+  }
+};
+
+struct analysis {
+  const graph_view &graph;
+  uint64_t n_nodes;
+  unsigned threads;
+
+  /* Edges by target, sorted by time. Their target field holds the source */
+  std::vector<uint64_t> in_offsets;
+  std::vector<otter_graph_edge_t> in_edges;
+
+  /* Segments of node i are seg_first[i] up to seg_first[i + 1] */
+  std::vector<uint64_t> seg_first;
+  std::vector<uint64_t> seg_time;
+  std::vector<uint64_t> seg_work;
+  std::vector<uint64_t> seg_dist;
+  std::vector<uint64_t> seg_pred;
+  std::vector<uint8_t> seg_pred_created; /* pred is the parent's creation */
+  std::unique_ptr<std::atomic<uint32_t>[]> seg_pending;
+
+  /* Parent's work in its segment before creating this node */
+  std::vector<uint64_t> create_work;
+
+  /* Work of the siblings coarsened into this node, and how much longer than
+     the node the longest of them took */
+  std::vector<uint64_t> group_work;
+  std::vector<uint64_t> group_span;
+  uint64_t folded_tasks = 0;
+
+  uint64_t trace_start = UINT64_MAX;
+  uint64_t trace_end = 0;
+
+  analysis(const graph_view &graph, unsigned threads)
+      : graph(graph), n_nodes(graph.header->n_nodes), threads(threads) {}
+
+  template <typename F> void parallel_for(uint64_t n, F f) {
+    std::atomic<uint64_t> next{0};
+    const uint64_t grain =
+        std::clamp<uint64_t>(n / (threads * 16), 1, 4096);
+    auto worker = [&](unsigned id) {
+      for (uint64_t k = next.fetch_add(grain); k < n;
+           k = next.fetch_add(grain)) {
+        for (uint64_t j = k; j < std::min(n, k + grain); j++) {
+          f(id, j);
+        }
+      }
+    };
+    std::vector<std::thread> pool;
+    for (unsigned k = 1; k < threads; k++) {
+      pool.emplace_back(worker, k);
+    }
+    worker(0);
+    for (auto &thread : pool) {
+      thread.join();
+    }
+  }
+
+  bool ran(const otter_graph_node_t &node) const {
+    return (node.flags & otter_graph_node_started) &&
+           (node.flags & otter_graph_node_ended) &&
+           node.end_time >= node.start_time;
+  }
+
+  uint64_t segment_of(uint64_t task, uint64_t time) const {
+    auto first = seg_time.begin() + seg_first[task];
+    auto last = seg_time.begin() + seg_first[task + 1];
+    auto seg = std::upper_bound(first + 1, last, time);
+    return (seg - seg_time.begin()) - 1;
+  }
+
+  uint64_t task_of(uint64_t segment) const {
+    auto next =
+        std::upper_bound(seg_first.begin(), seg_first.end(), segment);
+    return (next - seg_first.begin()) - 1;
+  }
+
+  /* A task's last segment also stands for the siblings coarsened into it */
+  uint64_t seg_length(uint64_t task, uint64_t seg) const {
+    return seg_work[seg] +
+           (seg == seg_first[task + 1] - 1 ? group_span[task] : 0);
+  }
+
+  uint64_t dist_end(uint64_t task) const {
+    uint64_t last = seg_first[task + 1] - 1;
+    return seg_dist[last] + seg_length(task, last);
+  }
+
+  void build_in_edges() {
+    in_offsets.assign(n_nodes + 1, 0);
+    for (uint64_t e = 0; e < graph.header->n_edges; e++) {
+      in_offsets[OTTER_GRAPH_EDGE_TARGET(graph.edges[e]) + 1]++;
+    }
+    for (uint64_t k = 0; k < n_nodes; k++) {
+      in_offsets[k + 1] += in_offsets[k];
+    }
+    in_edges.resize(graph.header->n_edges);
+    std::vector<uint64_t> fill(in_offsets.begin(), in_offsets.end() - 1);
+    for (uint64_t k = 0; k < n_nodes; k++) {
+      for (uint64_t e = graph.offsets[k]; e < graph.offsets[k + 1]; e++) {
+        const otter_graph_edge_t &edge = graph.edges[e];
+        uint64_t kind = (uint64_t)OTTER_GRAPH_EDGE_KIND(edge);
+        in_edges[fill[OTTER_GRAPH_EDGE_TARGET(edge)]++] = otter_graph_edge_t{
+            k | kind << OTTER_GRAPH_EDGE_KIND_SHIFT, edge.time};
+      }
+    }
+    parallel_for(n_nodes, [&](unsigned, uint64_t k) {
+      std::sort(in_edges.begin() + in_offsets[k],
+                in_edges.begin() + in_offsets[k + 1],
+                earlier);
+    });
+  }
+
+  /* A node has a segment for its start and one after each distinct time at
+     which it synchronised on its children */
+  void build_segments() {
+    seg_first.assign(n_nodes + 1, 0);
+    parallel_for(n_nodes, [&](unsigned, uint64_t k) {
+      uint64_t count = 1;
+      uint64_t last = OTTER_GRAPH_NO_TIME;
+      for (uint64_t e = in_offsets[k]; e < in_offsets[k + 1]; e++) {
+        if (OTTER_GRAPH_EDGE_KIND(in_edges[e]) == otter_graph_edge_sync &&
+            in_edges[e].time != last) {
+          last = in_edges[e].time;
+          count++;
+        }
+      }
+      seg_first[k + 1] = count;
+    });
+    for (uint64_t k = 0; k < n_nodes; k++) {
+      seg_first[k + 1] += seg_first[k];
+    }
+    uint64_t n_segments = seg_first[n_nodes];
+    seg_time.assign(n_segments, 0);
+    seg_work.assign(n_segments, 0);
+    seg_dist.assign(n_segments, 0);
+    seg_pred.assign(n_segments, no_segment);
+    seg_pred_created.assign(n_segments, 0);
+    seg_pending.reset(new std::atomic<uint32_t>[n_segments]);
+    create_work.assign(n_nodes, 0);
+    /* A node's first segment waits for its parent and the sources of its
+       dependences, each later segment for the one before it and the children
+       synchronised on */
+    parallel_for(n_nodes, [&](unsigned, uint64_t k) {
+      const otter_graph_node_t &node = graph.nodes[k];
+      uint64_t first = seg_first[k];
+      uint64_t seg = first;
+      uint32_t first_preds = 0;
+      seg_time[first] = ran(node) ? node.start_time : 0;
+      for (uint64_t e = in_offsets[k]; e < in_offsets[k + 1]; e++) {
+        const otter_graph_edge_t &edge = in_edges[e];
+        if (OTTER_GRAPH_EDGE_KIND(edge) != otter_graph_edge_sync) {
+          first_preds++;
+          continue;
+        }
+        if (seg == first || edge.time != seg_time[seg]) {
+          seg_time[++seg] = edge.time;
+          seg_pending[seg].store(1, std::memory_order_relaxed);
+        }
+        seg_pending[seg].fetch_add(1, std::memory_order_relaxed);
+      }
+      seg_pending[first].store(first_preds, std::memory_order_relaxed);
+    });
+  }
+
+  void measure_groups() {
+    group_work.assign(n_nodes, 0);
+    group_span.assign(n_nodes, 0);
+    for (uint64_t k = 0; k < n_nodes; k++) {
+      const otter_graph_node_t &node = graph.nodes[k];
+      if (!(node.flags & otter_graph_node_coarsened) || !ran(node))
+        continue;
+      uint64_t own = node.end_time - node.start_time;
+      if (node.group_total_time > own)
+        group_work[k] = node.group_total_time - own;
+      if (node.group_max_time > own)
+        group_span[k] = node.group_max_time - own;
+      if (node.group_tasks > 1)
+        folded_tasks += node.group_tasks - 1;
+    }
+  }
+
+  /* Split each task's time on its location into work and the time taken by
+     tasks nested inside it, one location per thread */
+  void measure_work(profile &measured) {
+    std::vector<std::vector<uint64_t>> by_location;
+    for (uint64_t k = 0; k < n_nodes; k++) {
+      const otter_graph_node_t &node = graph.nodes[k];
+      if (!ran(node))
+        continue;
+      if (node.location >= by_location.size())
+        by_location.resize(node.location + 1);
+      by_location[node.location].push_back(k);
+      trace_start = std::min(trace_start, node.start_time);
+      trace_end = std::max(trace_end, node.end_time);
+    }
+    measured = profile(trace_start, trace_end - trace_start,
+                       measured.bins.size());
+    std::vector<profile> partial(threads, measured);
+    parallel_for(by_location.size(), [&](unsigned id, uint64_t k) {
+      sweep_location(by_location[k], partial[id]);
+    });
+    for (auto &p : partial) {
+      measured.merge(p);
+    }
+  }
+
+  struct frame {
+    uint64_t task;
+    std::vector<interval> nested;
+  };
+
+  void sweep_location(std::vector<uint64_t> &tasks, profile &measured) {
+    const otter_graph_node_t *nodes = graph.nodes;
+    std::sort(tasks.begin(), tasks.end(), [&](uint64_t a, uint64_t b) {
+      if (nodes[a].start_time != nodes[b].start_time)
+        return nodes[a].start_time < nodes[b].start_time;
+      return nodes[a].end_time > nodes[b].end_time;
+    });
+    std::vector<frame> stack;
+    std::vector<interval> gaps;
+    std::vector<interval> work;
+    for (uint64_t task : tasks) {
+      const otter_graph_node_t &node = nodes[task];
+      while (!stack.empty() &&
+             nodes[stack.back().task].end_time <= node.start_time) {
+        finish_task(stack.back(), gaps, work, measured);
+        stack.pop_back();
+      }
+      if (!stack.empty()) {
+        uint64_t outer_end = nodes[stack.back().task].end_time;
+        stack.back().nested.push_back(
+            interval{node.start_time, std::min(node.end_time, outer_end)});
+      }
+      stack.push_back(frame{task, {}});
+    }
+    while (!stack.empty()) {
+      finish_task(stack.back(), gaps, work, measured);
+      stack.pop_back();
+    }
+  }
+
+  void finish_task(const frame &f, std::vector<interval> &gaps,
+                   std::vector<interval> &work, profile &measured) {
+    const otter_graph_node_t &node = graph.nodes[f.task];
+    uint64_t start = node.start_time;
+    uint64_t end = node.end_time;
+    auto clamp = [&](uint64_t t) { return std::min(std::max(t, start), end); };
+
+    gaps.clear();
+    uint64_t t = start;
+    for (const interval &nested : f.nested) {
+      if (nested.start > t)
+        gaps.push_back(interval{t, nested.start});
+      t = std::max(t, nested.end);
+    }
+    if (end > t)
+      gaps.push_back(interval{t, end});
+
+    /* Not work: waiting at a sync until the last child synchronised on ended,
+       unless other tasks ran nested in the meantime */
+    uint64_t first = seg_first[f.task];
+    uint64_t last = seg_first[f.task + 1];
+    std::vector<interval> waits;
+    uint64_t e = in_offsets[f.task];
+    for (uint64_t seg = first + 1; seg < last; seg++) {
+      uint64_t resume = seg_time[seg];
+      for (; e < in_offsets[f.task + 1] && in_edges[e].time <= seg_time[seg];
+           e++) {
+        const otter_graph_node_t &child =
+            graph.nodes[OTTER_GRAPH_EDGE_TARGET(in_edges[e])];
+        if (OTTER_GRAPH_EDGE_KIND(in_edges[e]) == otter_graph_edge_sync &&
+            in_edges[e].time == seg_time[seg] && ran(child))
+          resume = std::max(resume, child.end_time);
+      }
+      uint64_t limit = seg + 1 < last ? seg_time[seg + 1] : end;
+      waits.push_back(
+          interval{clamp(seg_time[seg]), clamp(std::min(resume, limit))});
+    }
+    work.clear();
+    size_t w = 0;
+    for (const interval &gap : gaps) {
+      uint64_t from = gap.start;
+      while (w < waits.size() && waits[w].end <= from)
+        w++;
+      for (size_t j = w; j < waits.size() && waits[j].start < gap.end; j++) {
+        if (waits[j].start > from)
+          work.push_back(interval{from, waits[j].start});
+        from = std::max(from, waits[j].end);
+      }
+      if (from < gap.end)
+        work.push_back(interval{from, gap.end});
+    }
+    for (const interval &span : work) {
+      measured.add(span.start, span.end);
+    }
+
+    /* Work in each segment, and before each child was created */
+    std::vector<uint64_t> seg_start_work(last - first);
+    work_clock segments{work};
+    for (uint64_t seg = first; seg < last; seg++) {
+      seg_start_work[seg - first] = segments.at(clamp(seg_time[seg]));
+    }
+    for (uint64_t seg = first; seg < last; seg++) {
+      uint64_t next =
+          seg + 1 < last ? seg_start_work[seg + 1 - first] : segments.at(end);
+      seg_work[seg] = next - seg_start_work[seg - first];
+    }
+    work_clock creates{work};
+    for (uint64_t k = graph.offsets[f.task]; k < graph.offsets[f.task + 1];
+         k++) {
+      const otter_graph_edge_t &edge = graph.edges[k];
+      if (OTTER_GRAPH_EDGE_KIND(edge) != otter_graph_edge_child)
+        continue;
+      uint64_t seg = segment_of(f.task, edge.time);
+      uint64_t before = creates.at(clamp(edge.time));
+      create_work[OTTER_GRAPH_EDGE_TARGET(edge)] =
+          before > seg_start_work[seg - first]
+              ? before - seg_start_work[seg - first]
+              : 0;
+    }
+  }
+
+  /* Each segment's distance from the start of the graph is the longest of
+     its predecessors' */
+  void settle(uint64_t task, uint64_t seg) {
+    uint64_t first = seg_first[task];
+    uint64_t dist = 0;
+    uint64_t pred = no_segment;
+    bool created = false;
+    auto offer = [&](uint64_t d, uint64_t p, bool c) {
+      if (pred == no_segment || d > dist) {
+        dist = d;
+        pred = p;
+        created = c;
+      }
+    };
+    if (seg > first) {
+      offer(seg_dist[seg - 1] + seg_work[seg - 1], seg - 1, false);
+      auto [lo, hi] = std::equal_range(
+          in_edges.begin() + in_offsets[task],
+          in_edges.begin() + in_offsets[task + 1],
+          otter_graph_edge_t{0, seg_time[seg]}, earlier);
+      for (auto edge = lo; edge != hi; edge++) {
+        if (OTTER_GRAPH_EDGE_KIND(*edge) == otter_graph_edge_sync) {
+          uint64_t source = OTTER_GRAPH_EDGE_TARGET(*edge);
+          offer(dist_end(source), seg_first[source + 1] - 1, false);
+        }
+      }
+    } else {
+      for (uint64_t e = in_offsets[task]; e < in_offsets[task + 1]; e++) {
+        const otter_graph_edge_t &edge = in_edges[e];
+        uint64_t source = OTTER_GRAPH_EDGE_TARGET(edge);
+        if (OTTER_GRAPH_EDGE_KIND(edge) == otter_graph_edge_child) {
+          uint64_t from = segment_of(source, edge.time);
+          offer(seg_dist[from] + create_work[task], from, true);
+        } else if (OTTER_GRAPH_EDGE_KIND(edge) ==
+                   otter_graph_edge_dependence) {
+          offer(dist_end(source), seg_first[source + 1] - 1, false);
+        }
+      }
+    }
+    seg_dist[seg] = dist;
+    seg_pred[seg] = pred;
+    seg_pred_created[seg] = created;
+  }
+
+  /* Release the segments which follow seg, collecting those now ready */
+  void release(uint64_t task, uint64_t seg, std::vector<uint64_t> &ready) {
+    auto done = [&](uint64_t next) {
+      if (seg_pending[next].fetch_sub(1, std::memory_order_acq_rel) == 1)
+        ready.push_back(next);
+    };
+    uint64_t first = seg_first[task];
+    uint64_t last = seg_first[task + 1] - 1;
+    if (seg < last)
+      done(seg + 1);
+
+    /* Out-edges are in time order, so the children created in this segment
+       are a contiguous run of them */
+    const otter_graph_edge_t *begin = graph.edges + graph.offsets[task];
+    const otter_graph_edge_t *end = graph.edges + graph.offsets[task + 1];
+    const otter_graph_edge_t *lo =
+        seg == first ? begin
+                     : std::lower_bound(begin, end,
+                                        otter_graph_edge_t{0, seg_time[seg]},
+                                        earlier);
+    const otter_graph_edge_t *hi =
+        seg == last ? end
+                    : std::lower_bound(begin, end,
+                                       otter_graph_edge_t{0, seg_time[seg + 1]},
+                                       earlier);
+    for (const otter_graph_edge_t *edge = lo; edge != hi; edge++) {
+      if (OTTER_GRAPH_EDGE_KIND(*edge) == otter_graph_edge_child)
+        done(seg_first[OTTER_GRAPH_EDGE_TARGET(*edge)]);
+    }
+    if (seg != last)
+      return;
+    for (const otter_graph_edge_t *edge = begin; edge != end; edge++) {
+      uint64_t target = OTTER_GRAPH_EDGE_TARGET(*edge);
+      if (OTTER_GRAPH_EDGE_KIND(*edge) == otter_graph_edge_dependence)
+        done(seg_first[target]);
+      else if (OTTER_GRAPH_EDGE_KIND(*edge) == otter_graph_edge_sync)
+        done(segment_of(target, edge->time));
+    }
+  }
+
+  uint64_t sweep() {
+    std::vector<uint64_t> level;
+    for (uint64_t seg = 0; seg < seg_first[n_nodes]; seg++) {
+      if (seg_pending[seg].load(std::memory_order_relaxed) == 0)
+        level.push_back(seg);
+    }
+    uint64_t settled = 0;
+    std::vector<std::vector<uint64_t>> next(threads);
+    while (!level.empty()) {
+      parallel_for(level.size(), [&](unsigned id, uint64_t k) {
+        uint64_t seg = level[k];
+        uint64_t task = task_of(seg);
+        settle(task, seg);
+        release(task, seg, next[id]);
+      });
+      settled += level.size();
+      level.clear();
+      for (auto &ready : next) {
+        level.insert(level.end(), ready.begin(), ready.end());
+        ready.clear();
+      }
+    }
+    return settled;
+  }
+};
+
+struct label_share {
+  uint64_t time = 0;
+  uint64_t segments = 0;
+};
+
+static void usage(const char *name) {
+  fprintf(stderr,
+          "usage: %s [-j threads] [-b bins] [-n labels] [-p profile.csv] "
+          "graph.otg\n",
+          name);
+}
+
+int main(int argc, char *argv[]) {
+  unsigned threads = std::thread::hardware_concurrency();
+  size_t n_bins = 100;
+  size_t n_labels = 20;
+  const char *profile_path = nullptr;
+  int opt;
+  while ((opt = getopt(argc, argv, "j:b:n:p:h")) != -1) {
+    switch (opt) {
+    case 'j':
+      threads = strtoul(optarg, nullptr, 10);
+      break;
+    case 'b':
+      n_bins = strtoul(optarg, nullptr, 10);
+      break;
+    case 'n':
+      n_labels = strtoul(optarg, nullptr, 10);
+      break;
+    case 'p':
+      profile_path = optarg;
+      break;
+    default:
+      usage(argv[0]);
+      return opt == 'h' ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+  }
+  if (optind != argc - 1) {
+    usage(argv[0]);
+    return EXIT_FAILURE;
+  }
+  if (threads == 0)
+    threads = 1;
+
+  graph_view graph;
+  if (!map_graph(argv[optind], graph))
+    return EXIT_FAILURE;
+
+  analysis a(graph, threads);
+  profile measured(0, 1, n_bins);
+  a.build_in_edges();
+  a.build_segments();
+  a.measure_work(measured);
+  a.measure_groups();
+  uint64_t settled = a.sweep();
+  uint64_t n_segments = a.seg_first[a.n_nodes];
+
+  uint64_t work = 0;
+  uint64_t span = 0;
+  uint64_t end_seg = no_segment;
+  for (uint64_t k = 0; k < a.n_nodes; k++) {
+    work += a.group_work[k];
+    for (uint64_t seg = a.seg_first[k]; seg < a.seg_first[k + 1]; seg++) {
+      work += a.seg_work[seg];
+      if (end_seg == no_segment ||
+          a.seg_dist[seg] + a.seg_length(k, seg) > span) {
+        span = a.seg_dist[seg] + a.seg_length(k, seg);
+        end_seg = seg;
+      }
+    }
+  }
+
+  /* Walk the critical path back from its last segment, charging each
+     segment's part of it to its task's label */
+  std::unordered_map<uint32_t, label_share> shares;
+  uint64_t path_segments = 0;
+  for (uint64_t seg = end_seg,
+                part = end_seg != no_segment
+                           ? a.seg_length(a.task_of(end_seg), end_seg)
+                           : 0;
+       seg != no_segment;) {
+    uint64_t seg_task = a.task_of(seg);
+    label_share &share = shares[graph.nodes[seg_task].label];
+    share.time += part;
+    share.segments++;
+    path_segments++;
+    uint64_t pred = a.seg_pred[seg];
+    if (pred != no_segment)
+      part = a.seg_pred_created[seg] ? a.create_work[seg_task]
+                                     : a.seg_length(a.task_of(pred), pred);
+    seg = pred;
+  }
+
+  double resolution = (double)graph.header->timer_resolution;
+  printf("%-30s %lu\n", "Tasks:", (unsigned long)graph.header->n_tasks);
+  if (a.folded_tasks > 0)
+    printf("%-30s %lu\n", "Folded tasks:", (unsigned long)a.folded_tasks);
+  printf("%-30s %lu\n", "Segments:", (unsigned long)n_segments);
+  printf("%-30s %u\n", "Threads:", threads);
+  printf("%-30s %.6f s\n", "Total work:", work / resolution);
+  printf("%-30s %.6f s\n", "Span:", span / resolution);
+  printf("%-30s %.2f\n", "Average parallelism:",
+         span > 0 ? (double)work / span : 0.0);
+  printf("%-30s %.6f s\n", "Measured duration:",
+         a.trace_end > a.trace_start
+             ? (a.trace_end - a.trace_start) / resolution
+             : 0.0);
+  printf("%-30s %lu\n", "Critical path segments:",
+         (unsigned long)path_segments);
+  if (settled != n_segments)
+    printf("%-30s %lu (cyclic dependences?)\n", "Segments not reached:",
+           (unsigned long)(n_segments - settled));
+
+  std::vector<std::pair<uint32_t, label_share>> by_share(shares.begin(),
+                                                          shares.end());
+  std::sort(by_share.begin(), by_share.end(), [](auto &a, auto &b) {
+    return a.second.time > b.second.time;
+  });
+  printf("\nCritical path by label:\n");
+  printf("  %-40s %14s %8s %10s\n", "label", "time (s)", "span", "segments");
+  for (size_t k = 0; k < by_share.size() && k < n_labels; k++) {
+    auto &[label, share] = by_share[k];
+    std::string name = label < graph.labels.size() ? graph.labels[label]
+                                                   : std::string("(none)");
+    printf("  %-40.40s %14.6f %7.2f%% %10lu\n", name.c_str(),
+           share.time / resolution, span > 0 ? 100.0 * share.time / span : 0.0,
+           (unsigned long)share.segments);
+  }
+
+  if (profile_path != nullptr) {
+    profile available(0, span, n_bins);
+    for (uint64_t k = 0; k < a.n_nodes; k++) {
+      uint64_t first = a.seg_first[k];
+      uint64_t last = a.seg_first[k + 1];
+      for (uint64_t seg = first; seg < last; seg++) {
+        available.add(a.seg_dist[seg], a.seg_dist[seg] + a.seg_work[seg]);
+      }
+      /* The coarsened siblings are spread over the longest of them */
+      uint64_t longest = graph.nodes[k].group_max_time;
+      if (a.group_work[k] > 0 && longest > 0)
+        available.add(a.seg_dist[first], a.seg_dist[first] + longest,
+                      (double)a.group_work[k] / longest);
+    }
+    FILE *out = fopen(profile_path, "w");
+    if (out == nullptr) {
+      fprintf(stderr, "otter-graph-analyse: can't create %s\n", profile_path);
+      unmap_graph(graph);
+      return EXIT_FAILURE;
+    }
+    fprintf(out, "series,start,end,parallelism\n");
+    for (const profile *p : {&measured, &available}) {
+      double width = (double)p->length / p->bins.size();
+      for (size_t k = 0; k < p->bins.size(); k++) {
+        fprintf(out, "%s,%.9f,%.9f,%.4f\n",
+                p == &measured ? "measured" : "available",
+                k * width / resolution, (k + 1) * width / resolution,
+                p->bins[k]);
+      }
+    }
+    fclose(out);
+    printf("\n%-30s %s\n", "Profile written to:", profile_path);
+  }
+
+  unmap_graph(graph);
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,330 @@
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <queue>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "otter-graph.hpp"
+
+bool map_records(const std::string &path, uint32_t location,
+                 record_cursor &cursor) {
+  cursor = record_cursor{nullptr, nullptr, nullptr, 0, location};
+  int fd = open(path.c_str(), O_RDONLY);
+  struct stat st;
+  if (fd < 0 || fstat(fd, &st) != 0) {
+    fprintf(stderr, "otter-graph: can't open %s: %s\n", path.c_str(),
+            strerror(errno));
+    if (fd >= 0)
+      close(fd);
+    return false;
+  }
+  cursor.length = st.st_size;
+  if (cursor.length > 0) {
+    cursor.map = mmap(nullptr, cursor.length, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (cursor.map == MAP_FAILED) {
+      fprintf(stderr, "otter-graph: can't map %s\n", path.c_str());
+      close(fd);
+      return false;
+    }
+    madvise(cursor.map, cursor.length, MADV_SEQUENTIAL);
+    cursor.next = static_cast<const task_record *>(cursor.map);
+    cursor.end = cursor.next + cursor.length / sizeof(task_record);
+  }
+  close(fd);
+  return true;
+}
+
+/* Edges are spooled to a file in the order they are found and then placed in
+   CSR order once every node's out-degree is known */
+struct spooled_edge {
+  uint64_t source;
+  uint64_t target; /* with the kind in the top bits */
+  uint64_t time;
+};
+
+struct graph_builder {
+  otter_graph_node_t *nodes;
+  uint64_t *offsets; /* out-degrees until the edges are placed */
+  uint64_t n_nodes;
+  FILE *spool;
+  build_summary *summary;
+  /* Children each task has created since it last synchronised. This is the
+     only state which grows with the graph: 8 bytes per outstanding child */
+  std::unordered_map<uint64_t, std::vector<uint64_t>> pending;
+  std::unordered_map<OTF2_StringRef, uint32_t> labels;
+  std::vector<OTF2_StringRef> label_refs;
+
+  otter_graph_node_t *node(uint64_t task) {
+    return task < n_nodes ? &nodes[task] : nullptr;
+  }
+
+  void edge(uint64_t source, uint64_t target, otter_graph_edge_kind_t kind,
+            uint64_t time) {
+    if (source >= n_nodes || target >= n_nodes)
+      return;
+    spooled_edge e{source,
+                   target | (uint64_t)kind << OTTER_GRAPH_EDGE_KIND_SHIFT,
+                   time};
+    fwrite(&e, sizeof(e), 1, spool);
+    offsets[source]++;
+    summary->edges[kind]++;
+  }
+
+  uint32_t label(OTF2_StringRef ref) {
+    if (ref == OTF2_UNDEFINED_STRING)
+      return OTTER_GRAPH_NO_LABEL;
+    auto [entry, is_new] = labels.try_emplace(ref, label_refs.size());
+    if (is_new)
+      label_refs.push_back(ref);
+    return entry->second;
+  }
+
+  void sync(uint64_t task, uint64_t time, bool descendants) {
+    auto children = pending.find(task);
+    if (children == pending.end())
+      return;
+    /* A taskgroup also waits for its descendants, which are left pending as
+       their own parents may still synchronise on them */
+    std::vector<uint64_t> stack(children->second);
+    while (!stack.empty()) {
+      uint64_t child = stack.back();
+      stack.pop_back();
+      edge(child, task, otter_graph_edge_sync, time);
+      if (!descendants)
+        continue;
+      auto grandchildren = pending.find(child);
+      if (grandchildren != pending.end())
+        stack.insert(stack.end(), grandchildren->second.begin(),
+                     grandchildren->second.end());
+    }
+    pending.erase(task);
+  }
+
+  void apply(const task_record &record, uint32_t location) {
+    otter_graph_node_t *n = node(record.a);
+    if (n == nullptr)
+      return;
+    switch (record.kind) {
+    case record_kind::create:
+      n->flags |= otter_graph_node_created;
+      n->create_time = record.time;
+      n->label = label(record.label);
+      n->parent = record.b;
+      if (record.b != OTTER_GRAPH_NO_TASK && node(record.b) != nullptr) {
+        edge(record.b, record.a, otter_graph_edge_child, record.time);
+        pending[record.b].push_back(record.a);
+      }
+      break;
+    case record_kind::start:
+      if ((n->flags & otter_graph_node_started) == 0) {
+        n->flags |= otter_graph_node_started;
+        n->start_time = record.time;
+        n->location = location;
+      }
+      break;
+    case record_kind::end:
+      n->flags |= otter_graph_node_ended;
+      n->end_time = record.time;
+      break;
+    case record_kind::sync:
+      sync(record.a, record.time, record.flag != 0);
+      break;
+    case record_kind::dependence:
+      if (node(record.b) != nullptr)
+        edge(record.a, record.b, otter_graph_edge_dependence, record.time);
+      break;
+    case record_kind::coarsened:
+      n->flags |= otter_graph_node_coarsened;
+      if (record.flag == coarse_tasks)
+        n->group_tasks = record.b;
+      else if (record.flag == coarse_total_time)
+        n->group_total_time = record.b;
+      else if (record.flag == coarse_max_time)
+        n->group_max_time = record.b;
+      break;
+    }
+  }
+};
+
+/* Merge the locations' records, and those expanded from phase templates, into
+   one time-ordered stream */
+static bool merge_records(const trace_defs &defs, const std::string &tmp_dir,
+                          graph_builder &builder) {
+  std::vector<record_cursor> cursors(defs.locations.size());
+  bool ok = true;
+  for (size_t k = 0; k < defs.locations.size(); k++) {
+    ok = map_records(record_path(tmp_dir, k), k, cursors[k]) && ok;
+    std::string templated = template_record_path(tmp_dir, k);
+    if (access(templated.c_str(), F_OK) == 0) {
+      ok = map_records(templated, k, cursors.emplace_back()) && ok;
+    }
+  }
+  auto later = [](const record_cursor *a, const record_cursor *b) {
+    if (a->next->time != b->next->time)
+      return a->next->time > b->next->time;
+    return a->location > b->location;
+  };
+  std::priority_queue<record_cursor *, std::vector<record_cursor *>,
+                      decltype(later)>
+      queue(later);
+  for (auto &cursor : cursors) {
+    if (cursor.next != cursor.end)
+      queue.push(&cursor);
+  }
+  while (ok && !queue.empty()) {
+    record_cursor *cursor = queue.top();
+    queue.pop();
+    builder.apply(*cursor->next, cursor->location);
+    if (++cursor->next != cursor->end)
+      queue.push(cursor);
+  }
+  for (auto &cursor : cursors) {
+    if (cursor.map != nullptr)
+      munmap(cursor.map, cursor.length);
+  }
+  return ok;
+}
+
+/* Place the spooled edges in CSR order, leaving offsets[i] as the index of
+   node i's first edge */
+static void place_edges(FILE *spool, uint64_t *offsets, uint64_t n_nodes,
+                        otter_graph_edge_t *edges) {
+  uint64_t total = 0;
+  for (uint64_t k = 0; k < n_nodes; k++) {
+    uint64_t degree = offsets[k];
+    offsets[k] = total;
+    total += degree;
+  }
+  offsets[n_nodes] = total;
+  rewind(spool);
+  spooled_edge e;
+  while (fread(&e, sizeof(e), 1, spool) == 1) {
+    edges[offsets[e.source]++] = otter_graph_edge_t{e.target, e.time};
+  }
+  /* Each offsets[i] now holds the end of node i's edges */
+  for (uint64_t k = n_nodes; k > 0; k--) {
+    offsets[k] = offsets[k - 1];
+  }
+  offsets[0] = 0;
+}
+
+bool build_graph(const trace_defs &defs, const std::string &tmp_dir,
+                 const read_summary &read, const std::string &path,
+                 build_summary &summary) {
+  otter_graph_header_t header{};
+  header.magic = OTTER_GRAPH_MAGIC;
+  header.version = OTTER_GRAPH_VERSION;
+  header.timer_resolution = defs.timer_resolution;
+  header.n_nodes = read.any_task ? read.max_task + 1 : 0;
+  if (header.n_nodes > max_nodes) {
+    fprintf(stderr, "otter-graph: task IDs up to %lu are too sparse to index\n",
+            (unsigned long)read.max_task);
+    return false;
+  }
+  header.nodes_offset = align8(sizeof(header));
+  header.offsets_offset =
+      header.nodes_offset + header.n_nodes * sizeof(otter_graph_node_t);
+  header.edges_offset =
+      header.offsets_offset + (header.n_nodes + 1) * sizeof(uint64_t);
+
+  int fd = open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0) {
+    fprintf(stderr, "otter-graph: can't create %s: %s\n", path.c_str(),
+            strerror(errno));
+    return false;
+  }
+  std::string spool_path = tmp_dir + "/edges.tmp";
+  FILE *spool = fopen(spool_path.c_str(), "w+b");
+  if (spool == nullptr || ftruncate(fd, header.edges_offset) != 0) {
+    fprintf(stderr, "otter-graph: can't write %s\n", path.c_str());
+    if (spool != nullptr)
+      fclose(spool);
+    close(fd);
+    return false;
+  }
+
+  /* Nodes and degrees are updated in whatever order tasks appear, so they
+     live in the output file rather than the heap */
+  void *map = mmap(nullptr, header.edges_offset, PROT_READ | PROT_WRITE,
+                   MAP_SHARED, fd, 0);
+  if (map == MAP_FAILED) {
+    fprintf(stderr, "otter-graph: can't map %s\n", path.c_str());
+    fclose(spool);
+    close(fd);
+    return false;
+  }
+  char *base = static_cast<char *>(map);
+  graph_builder builder{};
+  builder.nodes =
+      reinterpret_cast<otter_graph_node_t *>(base + header.nodes_offset);
+  builder.offsets = reinterpret_cast<uint64_t *>(base + header.offsets_offset);
+  builder.n_nodes = header.n_nodes;
+  builder.spool = spool;
+  builder.summary = &summary;
+  for (uint64_t k = 0; k < header.n_nodes; k++) {
+    builder.nodes[k] = otter_graph_node_t{
+        OTTER_GRAPH_NO_TASK, OTTER_GRAPH_NO_TIME, OTTER_GRAPH_NO_TIME,
+        OTTER_GRAPH_NO_TIME, OTTER_GRAPH_NO_LABEL, 0, 0, 0, 0, 0, 0};
+  }
+
+  bool ok = merge_records(defs, tmp_dir, builder);
+  builder.pending.clear();
+  for (uint64_t k = 0; k < header.n_nodes; k++) {
+    if (builder.nodes[k].flags != 0)
+      summary.tasks++;
+  }
+  munmap(map, header.edges_offset);
+
+  header.n_tasks = summary.tasks;
+  header.n_edges = summary.edges[otter_graph_edge_child] +
+                   summary.edges[otter_graph_edge_sync] +
+                   summary.edges[otter_graph_edge_dependence];
+  header.strings_offset = align8(header.edges_offset +
+                                 header.n_edges * sizeof(otter_graph_edge_t));
+  header.n_strings = builder.label_refs.size();
+  if (ok && ftruncate(fd, header.strings_offset) == 0) {
+    map = mmap(nullptr, header.strings_offset, PROT_READ | PROT_WRITE,
+               MAP_SHARED, fd, 0);
+    ok = map != MAP_FAILED;
+  } else {
+    ok = false;
+  }
+  if (ok) {
+    base = static_cast<char *>(map);
+    fflush(spool);
+    place_edges(
+        spool, reinterpret_cast<uint64_t *>(base + header.offsets_offset),
+        header.n_nodes,
+        reinterpret_cast<otter_graph_edge_t *>(base + header.edges_offset));
+    munmap(map, header.strings_offset);
+  }
+  fclose(spool);
+  remove(spool_path.c_str());
+
+  /* Labels follow the edges, then the header is written last so that a
+     partial file is never mistaken for a graph */
+  uint64_t offset = header.strings_offset;
+  for (OTF2_StringRef ref : builder.label_refs) {
+    auto string = defs.strings.find(ref);
+    const std::string &label =
+        string != defs.strings.end() ? string->second : std::string();
+    otter_graph_string_t entry{static_cast<uint32_t>(label.size())};
+    ok = ok &&
+         pwrite(fd, &entry, sizeof(entry), offset) == (ssize_t)sizeof(entry) &&
+         pwrite(fd, label.data(), label.size(), offset + sizeof(entry)) ==
+             (ssize_t)label.size();
+    offset += sizeof(entry) + label.size();
+  }
+  header.length = offset;
+  ok = ok && pwrite(fd, &header, sizeof(header), 0) == (ssize_t)sizeof(header);
+  if (close(fd) != 0)
+    ok = false;
+  if (!ok)
+    fprintf(stderr, "otter-graph: can't write %s\n", path.c_str());
+  summary.labels = header.n_strings;
+  summary.bytes = header.length;
+  return ok;
+}
@@ -0,0 +1,142 @@
+#include <cstdio>
+
+#include "otter-graph.hpp"
+
+static const char *edge_kind_name[] = {"child", "sync", "dependence"};
+
+static void put_escaped(FILE *out, const std::string &text, bool xml) {
+  for (char c : text) {
+    if (xml && c == '<')
+      fputs("&lt;", out);
+    else if (xml && c == '>')
+      fputs("&gt;", out);
+    else if (xml && c == '&')
+      fputs("&amp;", out);
+    else if (xml && c == '"')
+      fputs("&quot;", out);
+    else if (!xml && (c == '"' || c == '\\'))
+      fprintf(out, "\\%c", c);
+    else if ((unsigned char)c < 0x20)
+      fputc(' ', out);
+    else
+      fputc(c, out);
+  }
+}
+
+static bool finish(FILE *out, const std::string &path) {
+  bool ok = !ferror(out);
+  if (fclose(out) != 0 || !ok) {
+    fprintf(stderr, "otter-graph: can't write %s\n", path.c_str());
+    return false;
+  }
+  return true;
+}
+
+bool export_graphml(const graph_view &graph, const std::string &path) {
+  FILE *out = fopen(path.c_str(), "w");
+  if (out == nullptr) {
+    fprintf(stderr, "otter-graph: can't create %s\n", path.c_str());
+    return false;
+  }
+  fputs("<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+        "<graphml xmlns=\"http://graphml.graphdrawing.org/xmlns\">\n"
+        "  <key id=\"label\" for=\"node\" attr.name=\"label\""
+        " attr.type=\"string\"/>\n"
+        "  <key id=\"create_time\" for=\"node\" attr.name=\"create_time\""
+        " attr.type=\"long\"/>\n"
+        "  <key id=\"start_time\" for=\"node\" attr.name=\"start_time\""
+        " attr.type=\"long\"/>\n"
+        "  <key id=\"end_time\" for=\"node\" attr.name=\"end_time\""
+        " attr.type=\"long\"/>\n"
+        "  <key id=\"location\" for=\"node\" attr.name=\"location\""
+        " attr.type=\"int\"/>\n"
+        "  <key id=\"group_tasks\" for=\"node\" attr.name=\"group_tasks\""
+        " attr.type=\"long\"/>\n"
+        "  <key id=\"group_total_time\" for=\"node\""
+        " attr.name=\"group_total_time\" attr.type=\"long\"/>\n"
+        "  <key id=\"group_max_time\" for=\"node\""
+        " attr.name=\"group_max_time\" attr.type=\"long\"/>\n"
+        "  <key id=\"kind\" for=\"edge\" attr.name=\"kind\""
+        " attr.type=\"string\"/>\n"
+        "  <key id=\"time\" for=\"edge\" attr.name=\"time\""
+        " attr.type=\"long\"/>\n"
+        "  <graph id=\"tasks\" edgedefault=\"directed\">\n",
+        out);
+  for (uint64_t k = 0; k < graph.header->n_nodes; k++) {
+    const otter_graph_node_t &node = graph.nodes[k];
+    if (node.flags == 0)
+      continue;
+    fprintf(out, "    <node id=\"%lu\">", (unsigned long)k);
+    if (const std::string *label = graph.label(node)) {
+      fputs("<data key=\"label\">", out);
+      put_escaped(out, *label, true);
+      fputs("</data>", out);
+    }
+    if (node.flags & otter_graph_node_created)
+      fprintf(out, "<data key=\"create_time\">%lu</data>",
+              (unsigned long)node.create_time);
+    if (node.flags & otter_graph_node_started)
+      fprintf(out,
+              "<data key=\"start_time\">%lu</data>"
+              "<data key=\"location\">%u</data>",
+              (unsigned long)node.start_time, node.location);
+    if (node.flags & otter_graph_node_ended)
+      fprintf(out, "<data key=\"end_time\">%lu</data>",
+              (unsigned long)node.end_time);
+    if (node.flags & otter_graph_node_coarsened)
+      fprintf(out,
+              "<data key=\"group_tasks\">%lu</data>"
+              "<data key=\"group_total_time\">%lu</data>"
+              "<data key=\"group_max_time\">%lu</data>",
+              (unsigned long)node.group_tasks,
+              (unsigned long)node.group_total_time,
+              (unsigned long)node.group_max_time);
+    fputs("</node>\n", out);
+  }
+  for (uint64_t k = 0; k < graph.header->n_nodes; k++) {
+    for (uint64_t e = graph.offsets[k]; e < graph.offsets[k + 1]; e++) {
+      const otter_graph_edge_t &edge = graph.edges[e];
+      fprintf(out,
+              "    <edge source=\"%lu\" target=\"%lu\">"
+              "<data key=\"kind\">%s</data>"
+              "<data key=\"time\">%lu</data></edge>\n",
+              (unsigned long)k, (unsigned long)OTTER_GRAPH_EDGE_TARGET(edge),
+              edge_kind_name[OTTER_GRAPH_EDGE_KIND(edge)],
+              (unsigned long)edge.time);
+    }
+  }
+  fputs("  </graph>\n</graphml>\n", out);
+  return finish(out, path);
+}
+
+bool export_dot(const graph_view &graph, const std::string &path) {
+  FILE *out = fopen(path.c_str(), "w");
+  if (out == nullptr) {
+    fprintf(stderr, "otter-graph: can't create %s\n", path.c_str());
+    return false;
+  }
+  fputs("digraph tasks {\n", out);
+  for (uint64_t k = 0; k < graph.header->n_nodes; k++) {
+    const otter_graph_node_t &node = graph.nodes[k];
+    if (node.flags == 0)
+      continue;
+    fprintf(out, "  %lu [label=\"", (unsigned long)k);
+    if (const std::string *label = graph.label(node))
+      put_escaped(out, *label, false);
+    else
+      fprintf(out, "%lu", (unsigned long)k);
+    fputs("\"];\n", out);
+  }
+  static const char *edge_style[] = {"solid", "dashed", "bold"};
+  for (uint64_t k = 0; k < graph.header->n_nodes; k++) {
+    for (uint64_t e = graph.offsets[k]; e < graph.offsets[k + 1]; e++) {
+      const otter_graph_edge_t &edge = graph.edges[e];
+      otter_graph_edge_kind_t kind = OTTER_GRAPH_EDGE_KIND(edge);
+      fprintf(out, "  %lu -> %lu [kind=%s, style=%s];\n", (unsigned long)k,
+              (unsigned long)OTTER_GRAPH_EDGE_TARGET(edge),
+              edge_kind_name[kind], edge_style[kind]);
+    }
+  }
+  fputs("}\n", out);
+  return finish(out, path);
+}
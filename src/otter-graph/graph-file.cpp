@@ -0,0 +1,87 @@
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "graph-file.hpp"
+
+static bool section_fits(const graph_view &graph, uint64_t offset,
+                         uint64_t count, size_t size) {
+  return offset <= graph.length && count <= (graph.length - offset) / size;
+}
+
+bool map_graph(const std::string &path, graph_view &graph) {
+  graph = graph_view{};
+  int fd = open(path.c_str(), O_RDONLY);
+  struct stat st;
+  if (fd < 0 || fstat(fd, &st) != 0) {
+    fprintf(stderr, "otter-graph: can't open %s: %s\n", path.c_str(),
+            strerror(errno));
+    if (fd >= 0)
+      close(fd);
+    return false;
+  }
+  graph.length = st.st_size;
+  if (graph.length < sizeof(otter_graph_header_t)) {
+    fprintf(stderr, "otter-graph: %s is not a task graph\n", path.c_str());
+    close(fd);
+    return false;
+  }
+  graph.map = mmap(nullptr, graph.length, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (graph.map == MAP_FAILED) {
+    fprintf(stderr, "otter-graph: can't map %s\n", path.c_str());
+    graph.map = nullptr;
+    return false;
+  }
+
+  const char *base = static_cast<const char *>(graph.map);
+  graph.header = reinterpret_cast<const otter_graph_header_t *>(base);
+  const otter_graph_header_t &h = *graph.header;
+  if (h.magic != OTTER_GRAPH_MAGIC || h.version != OTTER_GRAPH_VERSION ||
+      h.length != graph.length ||
+      !section_fits(graph, h.nodes_offset, h.n_nodes,
+                    sizeof(otter_graph_node_t)) ||
+      !section_fits(graph, h.offsets_offset, h.n_nodes + 1,
+                    sizeof(uint64_t)) ||
+      !section_fits(graph, h.edges_offset, h.n_edges,
+                    sizeof(otter_graph_edge_t))) {
+    fprintf(stderr, "otter-graph: %s is not a task graph\n", path.c_str());
+    unmap_graph(graph);
+    return false;
+  }
+  graph.nodes =
+      reinterpret_cast<const otter_graph_node_t *>(base + h.nodes_offset);
+  graph.offsets = reinterpret_cast<const uint64_t *>(base + h.offsets_offset);
+  graph.edges =
+      reinterpret_cast<const otter_graph_edge_t *>(base + h.edges_offset);
+
+  uint64_t offset = h.strings_offset;
+  graph.labels.reserve(h.n_strings);
+  for (uint64_t k = 0; k < h.n_strings; k++) {
+    otter_graph_string_t entry;
+    if (!section_fits(graph, offset, 1, sizeof(entry)))
+      break;
+    memcpy(&entry, base + offset, sizeof(entry));
+    offset += sizeof(entry);
+    if (!section_fits(graph, offset, entry.length, 1))
+      break;
+    graph.labels.emplace_back(base + offset, entry.length);
+    offset += entry.length;
+  }
+  if (graph.labels.size() != h.n_strings) {
+    fprintf(stderr, "otter-graph: %s is truncated\n", path.c_str());
+    unmap_graph(graph);
+    return false;
+  }
+  return true;
+}
+
+void unmap_graph(graph_view &graph) {
+  if (graph.map != nullptr)
+    munmap(graph.map, graph.length);
+  graph = graph_view{};
+}
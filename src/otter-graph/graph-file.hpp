@@ -0,0 +1,29 @@
+#if !defined(OTTER_GRAPH_FILE_HPP)
+#define OTTER_GRAPH_FILE_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "public/otter-graph/graph-format.h"
+
+/* A graph file mapped read-only */
+struct graph_view {
+  const otter_graph_header_t *header = nullptr;
+  const otter_graph_node_t *nodes = nullptr;
+  const uint64_t *offsets = nullptr;
+  const otter_graph_edge_t *edges = nullptr;
+  std::vector<std::string> labels;
+  void *map = nullptr;
+  size_t length = 0;
+
+  const std::string *label(const otter_graph_node_t &node) const {
+    return node.label < labels.size() ? &labels[node.label] : nullptr;
+  }
+};
+
+bool map_graph(const std::string &path, graph_view &graph);
+void unmap_graph(graph_view &graph);
+
+#endif // OTTER_GRAPH_FILE_HPP
@@ -0,0 +1,254 @@
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "otter-graph.hpp"
+#include "public/otter-graph/index-format.h"
+
+static bool index_kind(record_kind kind, otter_index_kind_t *index) {
+  switch (kind) {
+  case record_kind::create:
+    *index = otter_index_create;
+    return true;
+  case record_kind::start:
+    *index = otter_index_start;
+    return true;
+  case record_kind::end:
+    *index = otter_index_end;
+    return true;
+  case record_kind::sync:
+    *index = otter_index_sync;
+    return true;
+  case record_kind::dependence:
+  case record_kind::coarsened:
+    break;
+  }
+  return false;
+}
+
+/* Call f(record, location) for every record of every location, in no
+   particular order across locations */
+template <typename F>
+static bool each_record(const trace_defs &defs, const std::string &tmp_dir,
+                        F f) {
+  for (size_t k = 0; k < defs.locations.size(); k++) {
+    record_cursor cursor;
+    if (!map_records(record_path(tmp_dir, k), k, cursor))
+      return false;
+    for (; cursor.next != cursor.end; cursor.next++) {
+      f(*cursor.next, cursor.location);
+    }
+    if (cursor.map != nullptr)
+      munmap(cursor.map, cursor.length);
+  }
+  return true;
+}
+
+/* The label each task was created with, by task ID. Like the node array it is
+   kept in a file rather than the heap */
+static uint32_t *map_task_labels(const std::string &path, uint64_t n_nodes,
+                                 size_t *length) {
+  *length = std::max<size_t>(n_nodes * sizeof(uint32_t), 1);
+  int fd = open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0)
+    return nullptr;
+  void *map = MAP_FAILED;
+  if (ftruncate(fd, *length) == 0)
+    map = mmap(nullptr, *length, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED)
+    return nullptr;
+  uint32_t *labels = static_cast<uint32_t *>(map);
+  std::fill(labels, labels + n_nodes, OTF2_UNDEFINED_STRING);
+  return labels;
+}
+
+/* Runs of consecutive task IDs with the same label, by label ref */
+static std::unordered_map<uint32_t, std::vector<otter_index_range_t>>
+find_ranges(const uint32_t *task_labels, uint64_t n_nodes) {
+  std::unordered_map<uint32_t, std::vector<otter_index_range_t>> ranges;
+  for (uint64_t task = 0; task < n_nodes; task++) {
+    if (task_labels[task] == OTF2_UNDEFINED_STRING)
+      continue;
+    auto &runs = ranges[task_labels[task]];
+    if (!runs.empty() && runs.back().last + 1 == task)
+      runs.back().last = task;
+    else
+      runs.push_back(otter_index_range_t{task, task});
+  }
+  return ranges;
+}
+
+bool build_index(const trace_defs &defs, const std::string &tmp_dir,
+                 const read_summary &read, const std::string &path,
+                 index_summary &summary) {
+  otter_index_header_t header{};
+  header.magic = OTTER_INDEX_MAGIC;
+  header.version = OTTER_INDEX_VERSION;
+  header.timer_resolution = defs.timer_resolution;
+  header.n_locations = defs.locations.size();
+  header.n_nodes = read.any_task ? read.max_task + 1 : 0;
+  if (header.n_nodes > max_nodes) {
+    fprintf(stderr, "otter-graph: task IDs up to %lu are too sparse to index\n",
+            (unsigned long)read.max_task);
+    return false;
+  }
+  header.locations_offset = align8(sizeof(header));
+  header.offsets_offset =
+      header.locations_offset + header.n_locations * sizeof(uint64_t);
+  header.entries_offset =
+      header.offsets_offset + (header.n_nodes + 1) * sizeof(uint64_t);
+
+  int fd = open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0) {
+    fprintf(stderr, "otter-graph: can't create %s: %s\n", path.c_str(),
+            strerror(errno));
+    return false;
+  }
+  std::string labels_path = tmp_dir + "/labels.tmp";
+  size_t labels_length = 0;
+  uint32_t *task_labels =
+      map_task_labels(labels_path, header.n_nodes, &labels_length);
+  void *map = MAP_FAILED;
+  if (task_labels != nullptr && ftruncate(fd, header.entries_offset) == 0)
+    map = mmap(nullptr, header.entries_offset, PROT_READ | PROT_WRITE,
+               MAP_SHARED, fd, 0);
+  if (map == MAP_FAILED) {
+    fprintf(stderr, "otter-graph: can't write %s\n", path.c_str());
+    if (task_labels != nullptr)
+      munmap(task_labels, labels_length);
+    remove(labels_path.c_str());
+    close(fd);
+    return false;
+  }
+
+  /* Count each task's events so that they can be placed without sorting the
+     whole index */
+  char *base = static_cast<char *>(map);
+  uint64_t *locations =
+      reinterpret_cast<uint64_t *>(base + header.locations_offset);
+  std::copy(defs.locations.begin(), defs.locations.end(), locations);
+  uint64_t *offsets = reinterpret_cast<uint64_t *>(base + header.offsets_offset);
+  const uint64_t n_nodes = header.n_nodes;
+  bool ok = each_record(
+      defs, tmp_dir, [&](const task_record &record, uint32_t location) {
+        otter_index_kind_t kind;
+        if (record.a >= n_nodes || !index_kind(record.kind, &kind))
+          return;
+        offsets[record.a]++;
+        if (kind == otter_index_create)
+          task_labels[record.a] = record.label;
+      });
+  uint64_t total = 0;
+  for (uint64_t k = 0; k < n_nodes; k++) {
+    uint64_t count = offsets[k];
+    offsets[k] = total;
+    total += count;
+  }
+  offsets[n_nodes] = total;
+  munmap(map, header.entries_offset);
+
+  header.n_entries = total;
+  header.labels_offset = align8(header.entries_offset +
+                                header.n_entries * sizeof(otter_index_entry_t));
+  map = MAP_FAILED;
+  if (ok && ftruncate(fd, header.labels_offset) == 0)
+    map = mmap(nullptr, header.labels_offset, PROT_READ | PROT_WRITE,
+               MAP_SHARED, fd, 0);
+  ok = ok && map != MAP_FAILED;
+  if (ok) {
+    base = static_cast<char *>(map);
+    offsets = reinterpret_cast<uint64_t *>(base + header.offsets_offset);
+    otter_index_entry_t *entries =
+        reinterpret_cast<otter_index_entry_t *>(base + header.entries_offset);
+    ok = each_record(
+        defs, tmp_dir, [&](const task_record &record, uint32_t location) {
+          otter_index_kind_t kind;
+          if (record.a >= n_nodes || !index_kind(record.kind, &kind))
+            return;
+          entries[offsets[record.a]++] = otter_index_entry_t{
+              record.time, record.position, location, (uint8_t)kind, {0}};
+        });
+    /* Each offsets[i] now holds the end of task i's entries */
+    for (uint64_t k = n_nodes; k > 0; k--) {
+      offsets[k] = offsets[k - 1];
+    }
+    offsets[0] = 0;
+    auto earlier = [](const otter_index_entry_t &a,
+                      const otter_index_entry_t &b) {
+      if (a.time != b.time)
+        return a.time < b.time;
+      if (a.location != b.location)
+        return a.location < b.location;
+      return a.position < b.position;
+    };
+    for (uint64_t k = 0; k < n_nodes; k++) {
+      std::sort(entries + offsets[k], entries + offsets[k + 1], earlier);
+    }
+    munmap(map, header.labels_offset);
+  }
+
+  auto ranges = find_ranges(task_labels, n_nodes);
+  munmap(task_labels, labels_length);
+  remove(labels_path.c_str());
+
+  /* Labels are looked up by name, so they are sorted by name */
+  std::vector<std::pair<const std::string *, uint32_t>> names;
+  static const std::string unnamed;
+  for (auto &[ref, runs] : ranges) {
+    auto string = defs.strings.find(ref);
+    names.emplace_back(string != defs.strings.end() ? &string->second
+                                                    : &unnamed,
+                       ref);
+  }
+  std::sort(names.begin(), names.end(), [](const auto &a, const auto &b) {
+    return *a.first != *b.first ? *a.first < *b.first : a.second < b.second;
+  });
+
+  header.n_labels = names.size();
+  header.ranges_offset =
+      header.labels_offset + header.n_labels * sizeof(otter_index_label_t);
+  uint64_t label_offset = header.labels_offset;
+  uint64_t range_offset = header.ranges_offset;
+  uint64_t name_offset = 0;
+  for (auto &[name, ref] : names) {
+    const auto &runs = ranges[ref];
+    otter_index_label_t label{name_offset, (uint32_t)name->size(), ref,
+                              header.n_ranges, runs.size()};
+    ok = ok &&
+         pwrite(fd, &label, sizeof(label), label_offset) ==
+             (ssize_t)sizeof(label) &&
+         pwrite(fd, runs.data(), runs.size() * sizeof(runs[0]),
+                range_offset) == (ssize_t)(runs.size() * sizeof(runs[0]));
+    label_offset += sizeof(label);
+    range_offset += runs.size() * sizeof(runs[0]);
+    header.n_ranges += runs.size();
+    name_offset += name->size();
+  }
+  header.strings_offset = range_offset;
+  uint64_t offset = header.strings_offset;
+  for (auto &[name, ref] : names) {
+    ok = ok && pwrite(fd, name->data(), name->size(), offset) ==
+                   (ssize_t)name->size();
+    offset += name->size();
+  }
+
+  /* The header is written last so that a partial file is never mistaken for an
+     index */
+  header.length = offset;
+  ok = ok && ftruncate(fd, header.length) == 0 &&
+       pwrite(fd, &header, sizeof(header), 0) == (ssize_t)sizeof(header);
+  if (close(fd) != 0)
+    ok = false;
+  if (!ok)
+    fprintf(stderr, "otter-graph: can't write %s\n", path.c_str());
+  summary.entries = header.n_entries;
+  summary.labels = header.n_labels;
+  summary.ranges = header.n_ranges;
+  summary.bytes = header.length;
+  return ok;
+}
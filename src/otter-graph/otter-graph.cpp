@@ -0,0 +1,185 @@
+/**
+ * @file otter-graph.cpp
+ * @author Adam Tuft
+ * @brief Builds the task graph of an Otter trace.
+ *
+ *   otter-graph [-j threads] [-f graphml,dot] [-i] [-o prefix] trace-dir
+ *
+ * trace-dir is the directory holding the archive Otter wrote, i.e.
+ * <OTTER_TRACE_PATH>/<archive name>. Tasks, parent/child edges, sync edges and
+ * dependence edges are reconstructed from the archive's event attributes and
+ * written to <prefix>.otg in the format given in graph-format.h, and to
+ * <prefix>.graphml and <prefix>.dot if asked for. The prefix defaults to
+ * trace-dir/<archive name>. With -i, a random-access index of each task's
+ * events and of the tasks with each label is also written to <prefix>.oti in
+ * the format given in index-format.h, for otter-index to query.
+ *
+ * The graph is built in three passes so that memory use does not depend on the
+ * size of the trace:
+ *
+ *   1. Locations are read in parallel, each reduced to a file of task records.
+ *      Phases recorded as templates (OTTER_PHASE_TEMPLATES) are expanded into
+ *      the records their tasks' events would have given
+ *   2. The record files are merged in time order into the node array and a
+ *      spool of edges, both on disk
+ *   3. The edges are placed in CSR order by their source task
+ */
+
+#include <cerrno>
+#include <climits>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <libgen.h>
+#include <sys/stat.h>
+#include <thread>
+#include <unistd.h>
+
+#include "otter-graph.hpp"
+#include "public/otter-trace/trace-template.h"
+
+static void usage(const char *name) {
+  fprintf(stderr, "usage: %s [-j threads] [-f graphml,dot] [-i] [-o prefix] "
+                  "trace-dir\n",
+          name);
+}
+
+int main(int argc, char *argv[]) {
+  const char *prefix_arg = nullptr;
+  unsigned threads = std::thread::hardware_concurrency();
+  bool graphml = false;
+  bool dot = false;
+  bool index = false;
+  int opt;
+  while ((opt = getopt(argc, argv, "j:f:io:h")) != -1) {
+    switch (opt) {
+    case 'j':
+      threads = strtoul(optarg, nullptr, 10);
+      break;
+    case 'f':
+      for (char *format = strtok(optarg, ","); format != nullptr;
+           format = strtok(nullptr, ",")) {
+        if (strcmp(format, "graphml") == 0) {
+          graphml = true;
+        } else if (strcmp(format, "dot") == 0) {
+          dot = true;
+        } else {
+          fprintf(stderr, "otter-graph: unknown format %s\n", format);
+          return EXIT_FAILURE;
+        }
+      }
+      break;
+    case 'i':
+      index = true;
+      break;
+    case 'o':
+      prefix_arg = optarg;
+      break;
+    default:
+      usage(argv[0]);
+      return opt == 'h' ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+  }
+  if (optind != argc - 1) {
+    usage(argv[0]);
+    return EXIT_FAILURE;
+  }
+
+  /* The archive is named after its directory */
+  std::string trace_dir = argv[optind];
+  while (trace_dir.size() > 1 && trace_dir.back() == '/')
+    trace_dir.pop_back();
+  char copy[PATH_MAX];
+  snprintf(copy, sizeof(copy), "%s", trace_dir.c_str());
+  std::string archive_name = basename(copy);
+  std::string anchor = trace_dir + "/" + archive_name + ".otf2";
+  std::string prefix =
+      prefix_arg != nullptr ? prefix_arg : trace_dir + "/" + archive_name;
+
+  OTF2_Reader *reader = OTF2_Reader_Open(anchor.c_str());
+  if (reader == nullptr) {
+    fprintf(stderr, "otter-graph: can't open %s\n", anchor.c_str());
+    return EXIT_FAILURE;
+  }
+  OTF2_Reader_SetSerialCollectiveCallbacks(reader);
+  trace_defs defs;
+  if (!read_definitions(reader, defs)) {
+    fprintf(stderr, "otter-graph: can't read definitions from %s\n",
+            anchor.c_str());
+    OTF2_Reader_Close(reader);
+    return EXIT_FAILURE;
+  }
+  if (threads == 0)
+    threads = 1;
+  if (threads > defs.locations.size())
+    threads = defs.locations.size();
+
+  std::string tmp_dir = prefix + ".tmp";
+  if (mkdir(tmp_dir.c_str(), 0755) != 0 && errno != EEXIST) {
+    fprintf(stderr, "otter-graph: can't create %s: %s\n", tmp_dir.c_str(),
+            strerror(errno));
+    OTF2_Reader_Close(reader);
+    return EXIT_FAILURE;
+  }
+
+  read_summary read;
+  bool ok = read_locations(reader, defs, tmp_dir, threads, read);
+  OTF2_Reader_Close(reader);
+  ok = ok && read_templates(trace_dir + "/" + OTTER_TEMPLATE_FILE, defs,
+                            tmp_dir, read);
+
+  build_summary built;
+  std::string graph_path = prefix + ".otg";
+  ok = ok && build_graph(defs, tmp_dir, read, graph_path, built);
+  index_summary indexed;
+  std::string index_path = prefix + ".oti";
+  if (index)
+    ok = ok && build_index(defs, tmp_dir, read, index_path, indexed);
+  for (size_t k = 0; k < defs.locations.size(); k++) {
+    remove(record_path(tmp_dir, k).c_str());
+    remove(template_record_path(tmp_dir, k).c_str());
+  }
+  rmdir(tmp_dir.c_str());
+  if (!ok)
+    return EXIT_FAILURE;
+
+  printf("%-30s %lu\n", "Locations:", (unsigned long)defs.locations.size());
+  printf("%-30s %u\n", "Reader threads:", threads);
+  printf("%-30s %lu\n", "Events:", (unsigned long)read.events);
+  if (read.templated_phases > 0)
+    printf("%-30s %lu (%lu tasks)\n", "Templated phases expanded:",
+           (unsigned long)read.templated_phases,
+           (unsigned long)read.templated_tasks);
+  printf("%-30s %lu\n", "Tasks:", (unsigned long)built.tasks);
+  printf("%-30s %lu\n", "Child edges:",
+         (unsigned long)built.edges[otter_graph_edge_child]);
+  printf("%-30s %lu\n", "Sync edges:",
+         (unsigned long)built.edges[otter_graph_edge_sync]);
+  printf("%-30s %lu\n", "Dependence edges:",
+         (unsigned long)built.edges[otter_graph_edge_dependence]);
+  printf("%-30s %lu\n", "Labels:", (unsigned long)built.labels);
+  printf("%-30s %s (%lu bytes)\n", "Written to:", graph_path.c_str(),
+         (unsigned long)built.bytes);
+  if (index) {
+    printf("%-30s %lu\n", "Index entries:", (unsigned long)indexed.entries);
+    printf("%-30s %lu\n", "Label ranges:", (unsigned long)indexed.ranges);
+    printf("%-30s %s (%lu bytes)\n", "Written to:", index_path.c_str(),
+           (unsigned long)indexed.bytes);
+  }
+
+  if (graphml || dot) {
+    graph_view graph;
+    if (!map_graph(graph_path, graph))
+      return EXIT_FAILURE;
+    if (graphml) {
+      ok = export_graphml(graph, prefix + ".graphml") && ok;
+      printf("%-30s %s.graphml\n", "Written to:", prefix.c_str());
+    }
+    if (dot) {
+      ok = export_dot(graph, prefix + ".dot") && ok;
+      printf("%-30s %s.dot\n", "Written to:", prefix.c_str());
+    }
+    unmap_graph(graph);
+  }
+  return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,146 @@
+#if !defined(OTTER_GRAPH_HPP)
+#define OTTER_GRAPH_HPP
+
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include <otf2/otf2.h>
+
+#include "graph-file.hpp"
+
+/* What an event means for the graph, decided from its event_type attribute */
+enum class graph_event {
+  none,
+  task_create,
+  task_enter,
+  task_leave,
+  task_switch,
+  sync_begin,
+  dependence_pair,
+  task_coarsened
+};
+
+/* Each location's events are reduced to these records, in time order */
+enum class record_kind : uint8_t {
+  create,     /* a = task, b = parent, label */
+  start,      /* a = task */
+  end,        /* a = task */
+  sync,       /* a = task, flag = includes descendants */
+  dependence, /* a = source task, b = sink task */
+  coarsened,  /* a = task, b = the group attribute given by flag */
+};
+
+/* The flag of a coarsened record */
+enum coarse_field : uint8_t {
+  coarse_tasks,
+  coarse_total_time,
+  coarse_max_time
+};
+
+struct task_record {
+  uint64_t time;
+  uint64_t position; /* of the event in its location, for OTF2 seeking */
+  uint64_t a;
+  uint64_t b;
+  uint32_t label;
+  record_kind kind;
+  uint8_t flag;
+  uint16_t unused;
+};
+
+/* The global definitions otter-graph needs */
+struct trace_defs {
+  uint64_t timer_resolution = 1;
+  std::vector<OTF2_LocationRef> locations;
+  std::unordered_map<OTF2_StringRef, std::string> strings;
+  std::unordered_map<OTF2_StringRef, graph_event> event_types;
+  std::unordered_set<OTF2_StringRef> complete; /* prior_task_status refs */
+  struct {
+    OTF2_AttributeRef unique_id = OTF2_UNDEFINED_ATTRIBUTE;
+    OTF2_AttributeRef encountering_task_id = OTF2_UNDEFINED_ATTRIBUTE;
+    OTF2_AttributeRef parent_task_id = OTF2_UNDEFINED_ATTRIBUTE;
+    OTF2_AttributeRef prior_task_id = OTF2_UNDEFINED_ATTRIBUTE;
+    OTF2_AttributeRef next_task_id = OTF2_UNDEFINED_ATTRIBUTE;
+    OTF2_AttributeRef prior_task_status = OTF2_UNDEFINED_ATTRIBUTE;
+    OTF2_AttributeRef sync_descendant_tasks = OTF2_UNDEFINED_ATTRIBUTE;
+    OTF2_AttributeRef dependence_source_task_id = OTF2_UNDEFINED_ATTRIBUTE;
+    OTF2_AttributeRef dependence_sink_task_id = OTF2_UNDEFINED_ATTRIBUTE;
+    OTF2_AttributeRef task_label = OTF2_UNDEFINED_ATTRIBUTE;
+    OTF2_AttributeRef task_type = OTF2_UNDEFINED_ATTRIBUTE;
+    OTF2_AttributeRef task_batch_size = OTF2_UNDEFINED_ATTRIBUTE;
+    OTF2_AttributeRef coarsened_tasks = OTF2_UNDEFINED_ATTRIBUTE;
+    OTF2_AttributeRef coarsened_total_time = OTF2_UNDEFINED_ATTRIBUTE;
+    OTF2_AttributeRef coarsened_max_time = OTF2_UNDEFINED_ATTRIBUTE;
+    OTF2_AttributeRef event_type = OTF2_UNDEFINED_ATTRIBUTE;
+  } attr;
+};
+
+struct read_summary {
+  uint64_t events = 0;
+  uint64_t records = 0;
+  uint64_t max_task = 0;
+  bool any_task = false;
+  uint64_t templated_phases = 0;
+  uint64_t templated_tasks = 0;
+};
+
+struct build_summary {
+  uint64_t tasks = 0;
+  uint64_t edges[3] = {0, 0, 0}; /* by otter_graph_edge_kind_t */
+  uint64_t labels = 0;
+  uint64_t bytes = 0;
+};
+
+struct index_summary {
+  uint64_t entries = 0;
+  uint64_t labels = 0;
+  uint64_t ranges = 0;
+  uint64_t bytes = 0;
+};
+
+/* reader.cpp */
+bool read_definitions(OTF2_Reader *reader, trace_defs &defs);
+std::string record_path(const std::string &tmp_dir, size_t location_index);
+bool read_locations(OTF2_Reader *reader, const trace_defs &defs,
+                    const std::string &tmp_dir, unsigned threads,
+                    read_summary &summary);
+std::string template_record_path(const std::string &tmp_dir,
+                                 size_t location_index);
+bool read_templates(const std::string &path, const trace_defs &defs,
+                    const std::string &tmp_dir, read_summary &summary);
+
+/* Task IDs index the node array directly, so refuse IDs which would make it
+   absurdly sparse rather than try to map petabytes */
+const uint64_t max_nodes = UINT64_C(1) << 36;
+
+inline uint64_t align8(uint64_t offset) { return (offset + 7) & ~UINT64_C(7); }
+
+/* A location's records, mapped read-only */
+struct record_cursor {
+  const task_record *next;
+  const task_record *end;
+  void *map;
+  size_t length;
+  uint32_t location;
+};
+
+/* builder.cpp */
+bool map_records(const std::string &path, uint32_t location,
+                 record_cursor &cursor);
+bool build_graph(const trace_defs &defs, const std::string &tmp_dir,
+                 const read_summary &read, const std::string &path,
+                 build_summary &summary);
+
+/* indexer.cpp */
+bool build_index(const trace_defs &defs, const std::string &tmp_dir,
+                 const read_summary &read, const std::string &path,
+                 index_summary &summary);
+
+/* export.cpp */
+bool export_graphml(const graph_view &graph, const std::string &path);
+bool export_dot(const graph_view &graph, const std::string &path);
+
+#endif // OTTER_GRAPH_HPP
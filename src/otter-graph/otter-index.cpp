@@ -0,0 +1,230 @@
+/**
+ * @file otter-index.cpp
+ * @author Adam Tuft
+ * @brief Queries the random-access index written by otter-graph -i.
+ *
+ *   otter-index [-t task-id]... [-l label]... index.oti
+ *
+ * -t lists the create, start, end and sync events of a task with the location,
+ * position and time of each, which is enough to seek straight to the events in
+ * the archive with OTF2_EvtReader_Seek. -l lists the ranges of task IDs with a
+ * label. A task is found by indexing the offsets and a label by binary search,
+ * so queries take the same time however large the trace. With no query, the
+ * size of the index is reported.
+ */
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <string>
+#include <string_view>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+
+#include "public/otter-graph/index-format.h"
+
+static const char *kind_name[] = {"create", "start", "end", "sync"};
+
+/* An index file mapped read-only */
+struct index_view {
+  const otter_index_header_t *header = nullptr;
+  const uint64_t *locations = nullptr;
+  const uint64_t *offsets = nullptr;
+  const otter_index_entry_t *entries = nullptr;
+  const otter_index_label_t *labels = nullptr;
+  const otter_index_range_t *ranges = nullptr;
+  const char *strings = nullptr;
+  void *map = nullptr;
+  size_t length = 0;
+
+  std::string_view name(const otter_index_label_t &label) const {
+    return std::string_view(strings + label.name_offset, label.name_length);
+  }
+};
+
+static bool section_fits(const index_view &index, uint64_t offset,
+                         uint64_t count, size_t size) {
+  return offset <= index.length && count <= (index.length - offset) / size;
+}
+
+static void unmap_index(index_view &index) {
+  if (index.map != nullptr)
+    munmap(index.map, index.length);
+  index = index_view{};
+}
+
+static bool map_index(const char *path, index_view &index) {
+  index = index_view{};
+  int fd = open(path, O_RDONLY);
+  struct stat st;
+  if (fd < 0 || fstat(fd, &st) != 0) {
+    fprintf(stderr, "otter-index: can't open %s: %s\n", path, strerror(errno));
+    if (fd >= 0)
+      close(fd);
+    return false;
+  }
+  index.length = st.st_size;
+  if (index.length < sizeof(otter_index_header_t)) {
+    fprintf(stderr, "otter-index: %s is not an index\n", path);
+    close(fd);
+    return false;
+  }
+  index.map = mmap(nullptr, index.length, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (index.map == MAP_FAILED) {
+    fprintf(stderr, "otter-index: can't map %s\n", path);
+    index.map = nullptr;
+    return false;
+  }
+
+  const char *base = static_cast<const char *>(index.map);
+  index.header = reinterpret_cast<const otter_index_header_t *>(base);
+  const otter_index_header_t &h = *index.header;
+  if (h.magic != OTTER_INDEX_MAGIC || h.version != OTTER_INDEX_VERSION ||
+      h.length != index.length ||
+      !section_fits(index, h.locations_offset, h.n_locations,
+                    sizeof(uint64_t)) ||
+      !section_fits(index, h.offsets_offset, h.n_nodes + 1,
+                    sizeof(uint64_t)) ||
+      !section_fits(index, h.entries_offset, h.n_entries,
+                    sizeof(otter_index_entry_t)) ||
+      !section_fits(index, h.labels_offset, h.n_labels,
+                    sizeof(otter_index_label_t)) ||
+      !section_fits(index, h.ranges_offset, h.n_ranges,
+                    sizeof(otter_index_range_t)) ||
+      h.strings_offset > index.length) {
+    fprintf(stderr, "otter-index: %s is not an index\n", path);
+    unmap_index(index);
+    return false;
+  }
+  index.locations =
+      reinterpret_cast<const uint64_t *>(base + h.locations_offset);
+  index.offsets = reinterpret_cast<const uint64_t *>(base + h.offsets_offset);
+  index.entries =
+      reinterpret_cast<const otter_index_entry_t *>(base + h.entries_offset);
+  index.labels =
+      reinterpret_cast<const otter_index_label_t *>(base + h.labels_offset);
+  index.ranges =
+      reinterpret_cast<const otter_index_range_t *>(base + h.ranges_offset);
+  index.strings = base + h.strings_offset;
+  return true;
+}
+
+static bool query_task(const index_view &index, uint64_t task) {
+  const otter_index_header_t &h = *index.header;
+  if (task >= h.n_nodes || index.offsets[task] == index.offsets[task + 1]) {
+    fprintf(stderr, "otter-index: no events for task %lu\n",
+            (unsigned long)task);
+    return false;
+  }
+  if (index.offsets[task + 1] > h.n_entries ||
+      index.offsets[task] > index.offsets[task + 1]) {
+    fprintf(stderr, "otter-index: offsets of task %lu are corrupt\n",
+            (unsigned long)task);
+    return false;
+  }
+  printf("Task %lu:\n", (unsigned long)task);
+  printf("  %-8s %20s %20s %20s\n", "Event", "Location", "Position", "Time");
+  for (uint64_t e = index.offsets[task]; e < index.offsets[task + 1]; e++) {
+    const otter_index_entry_t &entry = index.entries[e];
+    unsigned long location = entry.location < h.n_locations
+                                 ? index.locations[entry.location]
+                                 : entry.location;
+    printf("  %-8s %20lu %20lu %20lu\n",
+           entry.kind <= otter_index_sync ? kind_name[entry.kind] : "?",
+           location, (unsigned long)entry.position,
+           (unsigned long)entry.time);
+  }
+  return true;
+}
+
+static bool query_label(const index_view &index, const char *name) {
+  const otter_index_header_t &h = *index.header;
+  const otter_index_label_t *end = index.labels + h.n_labels;
+  const otter_index_label_t *label = std::lower_bound(
+      index.labels, end, std::string_view(name),
+      [&](const otter_index_label_t &label, std::string_view name) {
+        return index.name(label) < name;
+      });
+  if (label == end || index.name(*label) != name) {
+    fprintf(stderr, "otter-index: no tasks labelled \"%s\"\n", name);
+    return false;
+  }
+  /* Labels which differ only in their OTF2 string ref are adjacent */
+  printf("Label \"%s\":\n", name);
+  for (; label != end && index.name(*label) == name; label++) {
+    if (label->first_range > h.n_ranges ||
+        label->n_ranges > h.n_ranges - label->first_range) {
+      fprintf(stderr, "otter-index: ranges of \"%s\" are corrupt\n", name);
+      return false;
+    }
+    uint64_t tasks = 0;
+    for (uint64_t r = 0; r < label->n_ranges; r++) {
+      const otter_index_range_t &range =
+          index.ranges[label->first_range + r];
+      tasks += range.last - range.first + 1;
+      if (range.first == range.last)
+        printf("  %lu\n", (unsigned long)range.first);
+      else
+        printf("  %lu-%lu\n", (unsigned long)range.first,
+               (unsigned long)range.last);
+    }
+    printf("  %-28s %lu in %lu ranges\n", "Tasks:", (unsigned long)tasks,
+           (unsigned long)label->n_ranges);
+  }
+  return true;
+}
+
+static void usage(const char *name) {
+  fprintf(stderr, "usage: %s [-t task-id]... [-l label]... index.oti\n", name);
+}
+
+int main(int argc, char *argv[]) {
+  std::vector<uint64_t> tasks;
+  std::vector<const char *> labels;
+  int opt;
+  while ((opt = getopt(argc, argv, "t:l:h")) != -1) {
+    switch (opt) {
+    case 't':
+      tasks.push_back(strtoull(optarg, nullptr, 10));
+      break;
+    case 'l':
+      labels.push_back(optarg);
+      break;
+    default:
+      usage(argv[0]);
+      return opt == 'h' ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+  }
+  if (optind != argc - 1) {
+    usage(argv[0]);
+    return EXIT_FAILURE;
+  }
+
+  index_view index;
+  if (!map_index(argv[optind], index))
+    return EXIT_FAILURE;
+
+  bool ok = true;
+  if (tasks.empty() && labels.empty()) {
+    const otter_index_header_t &h = *index.header;
+    printf("%-30s %lu\n", "Locations:", (unsigned long)h.n_locations);
+    printf("%-30s %lu\n", "Task IDs:", (unsigned long)h.n_nodes);
+    printf("%-30s %lu\n", "Index entries:", (unsigned long)h.n_entries);
+    printf("%-30s %lu\n", "Labels:", (unsigned long)h.n_labels);
+    printf("%-30s %lu\n", "Label ranges:", (unsigned long)h.n_ranges);
+  }
+  for (uint64_t task : tasks) {
+    ok = query_task(index, task) && ok;
+  }
+  for (const char *label : labels) {
+    ok = query_label(index, label) && ok;
+  }
+  unmap_index(index);
+  return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
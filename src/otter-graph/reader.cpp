@@ -0,0 +1,570 @@
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <thread>
+
+#include <otf2/OTF2_Pthread_Locks.h>
+
+#include "otter-graph.hpp"
+#include "public/otter-trace/trace-compact.h"
+#include "public/otter-trace/trace-template.h"
+
+/* Global definitions */
+
+struct def_state {
+  trace_defs *defs;
+  std::unordered_map<OTF2_AttributeRef, OTF2_StringRef> attribute_names;
+};
+
+static OTF2_CallbackCode read_clock_properties(void *data, uint64_t resolution,
+                                               uint64_t offset,
+                                               uint64_t length) {
+  static_cast<def_state *>(data)->defs->timer_resolution = resolution;
+  return OTF2_CALLBACK_SUCCESS;
+}
+
+static OTF2_CallbackCode read_string(void *data, OTF2_StringRef self,
+                                     const char *string) {
+  static_cast<def_state *>(data)->defs->strings[self] = string;
+  return OTF2_CALLBACK_SUCCESS;
+}
+
+static OTF2_CallbackCode read_location(void *data, OTF2_LocationRef self,
+                                       OTF2_StringRef name,
+                                       OTF2_LocationType type,
+                                       uint64_t events,
+                                       OTF2_LocationGroupRef group) {
+  static_cast<def_state *>(data)->defs->locations.push_back(self);
+  return OTF2_CALLBACK_SUCCESS;
+}
+
+static OTF2_CallbackCode read_attribute(void *data, OTF2_AttributeRef self,
+                                        OTF2_StringRef name,
+                                        OTF2_StringRef description,
+                                        OTF2_Type type) {
+  static_cast<def_state *>(data)->attribute_names[self] = name;
+  return OTF2_CALLBACK_SUCCESS;
+}
+
+/* Attributes and labels are found by name, as their refs depend on the
+   version of Otter which wrote the trace */
+static void resolve_definitions(def_state &state) {
+  trace_defs &defs = *state.defs;
+  const std::unordered_map<std::string, OTF2_AttributeRef *> attributes = {
+      {"unique_id", &defs.attr.unique_id},
+      {"encountering_task_id", &defs.attr.encountering_task_id},
+      {"parent_task_id", &defs.attr.parent_task_id},
+      {"prior_task_id", &defs.attr.prior_task_id},
+      {"next_task_id", &defs.attr.next_task_id},
+      {"prior_task_status", &defs.attr.prior_task_status},
+      {"sync_descendant_tasks", &defs.attr.sync_descendant_tasks},
+      {"dependence_source_task_id", &defs.attr.dependence_source_task_id},
+      {"dependence_sink_task_id", &defs.attr.dependence_sink_task_id},
+      {"task_label", &defs.attr.task_label},
+      {"task_type", &defs.attr.task_type},
+      {"task_batch_size", &defs.attr.task_batch_size},
+      {"coarsened_tasks", &defs.attr.coarsened_tasks},
+      {"coarsened_total_time", &defs.attr.coarsened_total_time},
+      {"coarsened_max_time", &defs.attr.coarsened_max_time},
+      {"event_type", &defs.attr.event_type},
+  };
+  for (auto &[ref, name] : state.attribute_names) {
+    auto string = defs.strings.find(name);
+    if (string == defs.strings.end())
+      continue;
+    auto attribute = attributes.find(string->second);
+    if (attribute != attributes.end())
+      *attribute->second = ref;
+  }
+
+  const std::unordered_map<std::string, graph_event> events = {
+      {"task_create", graph_event::task_create},
+      {"task_enter", graph_event::task_enter},
+      {"task_leave", graph_event::task_leave},
+      {"task_create_batch", graph_event::task_create},
+      {"task_enter_batch", graph_event::task_enter},
+      {"task_leave_batch", graph_event::task_leave},
+      {"task_switch", graph_event::task_switch},
+      {"sync_begin", graph_event::sync_begin},
+      {"task_dependence_pair", graph_event::dependence_pair},
+      {"task_coarsened", graph_event::task_coarsened},
+  };
+  for (auto &[ref, string] : defs.strings) {
+    auto event = events.find(string);
+    if (event != events.end())
+      defs.event_types[ref] = event->second;
+    if (string == "complete")
+      defs.complete.insert(ref);
+  }
+}
+
+bool read_definitions(OTF2_Reader *reader, trace_defs &defs) {
+  def_state state{&defs, {}};
+  OTF2_GlobalDefReader *def_reader = OTF2_Reader_GetGlobalDefReader(reader);
+  if (def_reader == nullptr)
+    return false;
+  OTF2_GlobalDefReaderCallbacks *callbacks =
+      OTF2_GlobalDefReaderCallbacks_New();
+  OTF2_GlobalDefReaderCallbacks_SetClockPropertiesCallback(
+      callbacks, read_clock_properties);
+  OTF2_GlobalDefReaderCallbacks_SetStringCallback(callbacks, read_string);
+  OTF2_GlobalDefReaderCallbacks_SetLocationCallback(callbacks, read_location);
+  OTF2_GlobalDefReaderCallbacks_SetAttributeCallback(callbacks,
+                                                     read_attribute);
+  OTF2_Reader_RegisterGlobalDefCallbacks(reader, def_reader, callbacks,
+                                         &state);
+  uint64_t count = 0;
+  OTF2_ErrorCode err =
+      OTF2_Reader_ReadAllGlobalDefinitions(reader, def_reader, &count);
+  OTF2_GlobalDefReaderCallbacks_Delete(callbacks);
+  OTF2_Reader_CloseGlobalDefReader(reader, def_reader);
+  if (err != OTF2_SUCCESS)
+    return false;
+  resolve_definitions(state);
+  if (defs.attr.event_type == OTF2_UNDEFINED_ATTRIBUTE ||
+      defs.attr.unique_id == OTF2_UNDEFINED_ATTRIBUTE) {
+    fprintf(stderr, "otter-graph: archive has no Otter event attributes\n");
+    return false;
+  }
+  return true;
+}
+
+/* Events */
+
+struct location_state {
+  const trace_defs *defs;
+  OTF2_EvtReader *evt_reader;
+  FILE *records;
+  uint64_t count = 0;
+  uint64_t max_task = 0;
+  bool any_task = false;
+};
+
+static void put_record(location_state *state, record_kind kind, uint64_t time,
+                       uint64_t a, uint64_t b = OTTER_GRAPH_NO_TASK,
+                       uint32_t label = OTF2_UNDEFINED_STRING,
+                       uint8_t flag = 0) {
+  uint64_t position = 0;
+  OTF2_EvtReader_GetPos(state->evt_reader, &position);
+  task_record record{time, position, a, b, label, kind, flag, 0};
+  fwrite(&record, sizeof(record), 1, state->records);
+  state->count++;
+  /* A coarsened record's b is a value rather than a task */
+  if (kind == record_kind::coarsened)
+    b = OTTER_GRAPH_NO_TASK;
+  for (uint64_t task : {a, b}) {
+    if (task == OTTER_GRAPH_NO_TASK)
+      continue;
+    if (!state->any_task || task > state->max_task)
+      state->max_task = task;
+    state->any_task = true;
+  }
+}
+
+static bool get_task(const OTF2_AttributeList *attributes,
+                     OTF2_AttributeRef ref, uint64_t *task) {
+  return ref != OTF2_UNDEFINED_ATTRIBUTE &&
+         OTF2_AttributeList_GetUint64(attributes, ref, task) == OTF2_SUCCESS;
+}
+
+static bool get_string(const OTF2_AttributeList *attributes,
+                       OTF2_AttributeRef ref, OTF2_StringRef *string) {
+  return ref != OTF2_UNDEFINED_ATTRIBUTE &&
+         OTF2_AttributeList_GetStringRef(attributes, ref, string) ==
+             OTF2_SUCCESS;
+}
+
+static void read_event(location_state *state, OTF2_TimeStamp time,
+                       const OTF2_AttributeList *attributes) {
+  const auto &attr = state->defs->attr;
+  OTF2_StringRef event_type;
+  if (!get_string(attributes, attr.event_type, &event_type))
+    return;
+  auto event = state->defs->event_types.find(event_type);
+  if (event == state->defs->event_types.end())
+    return;
+
+  uint64_t task = 0;
+  uint64_t other = 0;
+  OTF2_StringRef string = OTF2_UNDEFINED_STRING;
+  /* A batch event stands for this many tasks with consecutive IDs from the
+     task it names, and is expanded into a record for each */
+  uint64_t batch = 1;
+  get_task(attributes, attr.task_batch_size, &batch);
+  switch (event->second) {
+  case graph_event::task_create:
+    if (!get_task(attributes, attr.unique_id, &task))
+      return;
+    /* OMPT events name the parent, task-graph events the encountering task */
+    if (!get_task(attributes, attr.parent_task_id, &other) &&
+        !get_task(attributes, attr.encountering_task_id, &other))
+      other = OTTER_GRAPH_NO_TASK;
+    if (!get_string(attributes, attr.task_label, &string))
+      get_string(attributes, attr.task_type, &string);
+    for (uint64_t k = 0; k < batch; k++) {
+      put_record(state, record_kind::create, time, task + k, other, string);
+    }
+    break;
+  case graph_event::task_enter:
+    if (!get_task(attributes, attr.encountering_task_id, &task))
+      return;
+    for (uint64_t k = 0; k < batch; k++) {
+      put_record(state, record_kind::start, time, task + k);
+    }
+    break;
+  case graph_event::task_leave:
+    if (!get_task(attributes, attr.encountering_task_id, &task))
+      return;
+    for (uint64_t k = 0; k < batch; k++) {
+      put_record(state, record_kind::end, time, task + k);
+    }
+    break;
+  case graph_event::task_switch:
+    if (get_task(attributes, attr.prior_task_id, &task) &&
+        get_string(attributes, attr.prior_task_status, &string) &&
+        state->defs->complete.count(string) != 0)
+      put_record(state, record_kind::end, time, task);
+    if (get_task(attributes, attr.next_task_id, &task))
+      put_record(state, record_kind::start, time, task);
+    break;
+  case graph_event::sync_begin: {
+    uint8_t descendants = 0;
+    if (attr.sync_descendant_tasks != OTF2_UNDEFINED_ATTRIBUTE)
+      OTF2_AttributeList_GetUint8(attributes, attr.sync_descendant_tasks,
+                                  &descendants);
+    if (get_task(attributes, attr.encountering_task_id, &task))
+      put_record(state, record_kind::sync, time, task, OTTER_GRAPH_NO_TASK,
+                 OTF2_UNDEFINED_STRING, descendants);
+    break;
+  }
+  case graph_event::dependence_pair:
+    if (get_task(attributes, attr.dependence_source_task_id, &task) &&
+        get_task(attributes, attr.dependence_sink_task_id, &other))
+      put_record(state, record_kind::dependence, time, task, other);
+    break;
+  case graph_event::task_coarsened: {
+    /* Group times are in ns rather than timestamp units */
+    double ticks_per_ns = state->defs->timer_resolution / 1e9;
+    uint64_t value = 0;
+    if (!get_task(attributes, attr.unique_id, &task) ||
+        !get_task(attributes, attr.coarsened_tasks, &value))
+      return;
+    put_record(state, record_kind::coarsened, time, task, value,
+               OTF2_UNDEFINED_STRING, coarse_tasks);
+    if (get_task(attributes, attr.coarsened_total_time, &value))
+      put_record(state, record_kind::coarsened, time, task,
+                 (uint64_t)(value * ticks_per_ns), OTF2_UNDEFINED_STRING,
+                 coarse_total_time);
+    if (get_task(attributes, attr.coarsened_max_time, &value))
+      put_record(state, record_kind::coarsened, time, task,
+                 (uint64_t)(value * ticks_per_ns), OTF2_UNDEFINED_STRING,
+                 coarse_max_time);
+    break;
+  }
+  case graph_event::none:
+    break;
+  }
+}
+
+static OTF2_CallbackCode read_region_event(OTF2_LocationRef location,
+                                           OTF2_TimeStamp time, void *data,
+                                           OTF2_AttributeList *attributes,
+                                           OTF2_RegionRef region) {
+  read_event(static_cast<location_state *>(data), time, attributes);
+  return OTF2_CALLBACK_SUCCESS;
+}
+
+static OTF2_CallbackCode read_task_event(OTF2_LocationRef location,
+                                         OTF2_TimeStamp time, void *data,
+                                         OTF2_AttributeList *attributes,
+                                         OTF2_CommRef team, uint32_t thread,
+                                         uint32_t generation) {
+  read_event(static_cast<location_state *>(data), time, attributes);
+  return OTF2_CALLBACK_SUCCESS;
+}
+
+std::string record_path(const std::string &tmp_dir, size_t location_index) {
+  return tmp_dir + "/" + std::to_string(location_index) + ".rec";
+}
+
+bool read_locations(OTF2_Reader *reader, const trace_defs &defs,
+                    const std::string &tmp_dir, unsigned threads,
+                    read_summary &summary) {
+  /* Readers are opened serially, as the OTF2 documentation does, and then
+     read concurrently under the reader's locking callbacks */
+  OTF2_Pthread_Reader_SetLockingCallbacks(reader, nullptr);
+  for (OTF2_LocationRef location : defs.locations) {
+    OTF2_Reader_SelectLocation(reader, location);
+  }
+  bool def_files = OTF2_Reader_OpenDefFiles(reader) == OTF2_SUCCESS;
+  OTF2_Reader_OpenEvtFiles(reader);
+  std::vector<OTF2_EvtReader *> evt_readers;
+  for (OTF2_LocationRef location : defs.locations) {
+    if (def_files) {
+      OTF2_DefReader *def_reader = OTF2_Reader_GetDefReader(reader, location);
+      if (def_reader != nullptr) {
+        uint64_t count = 0;
+        OTF2_Reader_ReadAllLocalDefinitions(reader, def_reader, &count);
+        OTF2_Reader_CloseDefReader(reader, def_reader);
+      }
+    }
+    evt_readers.push_back(OTF2_Reader_GetEvtReader(reader, location));
+  }
+  if (def_files)
+    OTF2_Reader_CloseDefFiles(reader);
+
+  OTF2_EvtReaderCallbacks *callbacks = OTF2_EvtReaderCallbacks_New();
+  OTF2_EvtReaderCallbacks_SetEnterCallback(callbacks, read_region_event);
+  OTF2_EvtReaderCallbacks_SetLeaveCallback(callbacks, read_region_event);
+  OTF2_EvtReaderCallbacks_SetThreadTaskCreateCallback(callbacks,
+                                                      read_task_event);
+  OTF2_EvtReaderCallbacks_SetThreadTaskSwitchCallback(callbacks,
+                                                      read_task_event);
+
+  std::vector<location_state> states(defs.locations.size(),
+                                     location_state{&defs, nullptr, nullptr});
+  std::vector<uint64_t> events(defs.locations.size(), 0);
+  std::atomic<size_t> next{0};
+  std::atomic<bool> ok{true};
+  auto worker = [&]() {
+    std::vector<char> buffer(1 << 20);
+    for (size_t k = next++; k < defs.locations.size(); k = next++) {
+      std::string path = record_path(tmp_dir, k);
+      states[k].records = fopen(path.c_str(), "wb");
+      if (states[k].records == nullptr || evt_readers[k] == nullptr) {
+        fprintf(stderr, "otter-graph: can't read location %lu into %s\n",
+                (unsigned long)defs.locations[k], path.c_str());
+        ok = false;
+        continue;
+      }
+      setvbuf(states[k].records, buffer.data(), _IOFBF, buffer.size());
+      states[k].evt_reader = evt_readers[k];
+      OTF2_Reader_RegisterEvtCallbacks(reader, evt_readers[k], callbacks,
+                                       &states[k]);
+      if (OTF2_Reader_ReadAllLocalEvents(reader, evt_readers[k],
+                                         &events[k]) != OTF2_SUCCESS) {
+        fprintf(stderr, "otter-graph: can't read events of location %lu\n",
+                (unsigned long)defs.locations[k]);
+        ok = false;
+      }
+      if (fclose(states[k].records) != 0)
+        ok = false;
+    }
+  };
+  std::vector<std::thread> pool;
+  for (unsigned k = 0; k < threads; k++) {
+    pool.emplace_back(worker);
+  }
+  for (auto &thread : pool) {
+    thread.join();
+  }
+
+  OTF2_EvtReaderCallbacks_Delete(callbacks);
+  for (OTF2_EvtReader *evt_reader : evt_readers) {
+    if (evt_reader != nullptr)
+      OTF2_Reader_CloseEvtReader(reader, evt_reader);
+  }
+  OTF2_Reader_CloseEvtFiles(reader);
+
+  for (size_t k = 0; k < states.size(); k++) {
+    summary.events += events[k];
+    summary.records += states[k].count;
+    if (states[k].any_task &&
+        (!summary.any_task || states[k].max_task > summary.max_task))
+      summary.max_task = states[k].max_task;
+    summary.any_task = summary.any_task || states[k].any_task;
+  }
+  return ok;
+}
+
+/* Phase templates */
+
+std::string template_record_path(const std::string &tmp_dir,
+                                 size_t location_index) {
+  return tmp_dir + "/" + std::to_string(location_index) + ".tpl.rec";
+}
+
+struct stored_template {
+  std::vector<otter_template_task_t> tasks;
+  std::vector<otter_template_sync_t> syncs;
+};
+
+struct template_state {
+  const trace_defs *defs;
+  const std::string *tmp_dir;
+  std::unordered_map<OTF2_LocationRef, size_t> location_index;
+  std::vector<stored_template> templates;
+  std::vector<std::vector<task_record>> by_location;
+  std::vector<FILE *> files;
+  read_summary *summary;
+};
+
+static void put_template_record(template_state &state, size_t location,
+                                record_kind kind, uint64_t time, uint64_t a,
+                                uint64_t b = OTTER_GRAPH_NO_TASK,
+                                uint32_t label = OTF2_UNDEFINED_STRING,
+                                uint8_t flag = 0) {
+  state.by_location[location].push_back(
+      task_record{time, 0, a, b, label, kind, flag, 0});
+  read_summary &summary = *state.summary;
+  summary.records++;
+  for (uint64_t task : {a, b}) {
+    if (task == OTTER_GRAPH_NO_TASK)
+      continue;
+    if (!summary.any_task || task > summary.max_task)
+      summary.max_task = task;
+    summary.any_task = true;
+  }
+}
+
+static bool read_template(template_state &state, const unsigned char *p,
+                          const unsigned char *end) {
+  otter_template_t def;
+  if (end - p < (ptrdiff_t)sizeof(def))
+    return false;
+  memcpy(&def, p, sizeof(def));
+  p += sizeof(def);
+  if (def.id != state.templates.size() || def.n_tasks == 0 ||
+      (uint64_t)(end - p) !=
+          def.n_tasks * sizeof(otter_template_task_t) +
+              def.n_syncs * sizeof(otter_template_sync_t))
+    return false;
+  stored_template &stored = state.templates.emplace_back();
+  stored.tasks.resize(def.n_tasks);
+  stored.syncs.resize(def.n_syncs);
+  memcpy(stored.tasks.data(), p, def.n_tasks * sizeof(otter_template_task_t));
+  p += def.n_tasks * sizeof(otter_template_task_t);
+  memcpy(stored.syncs.data(), p, def.n_syncs * sizeof(otter_template_sync_t));
+  return true;
+}
+
+/* Expand a phase into the records its tasks' events would have given. A task's
+   events go with the location which started it, and its create with its
+   parent's. The phase task's own events are in the archive */
+static bool expand_phase(template_state &state, const unsigned char *p,
+                         const unsigned char *end) {
+  otter_template_phase_t phase;
+  if (end - p < (ptrdiff_t)sizeof(phase))
+    return false;
+  memcpy(&phase, p, sizeof(phase));
+  p += sizeof(phase);
+  if (phase.template_id >= state.templates.size())
+    return false;
+  const stored_template &stored = state.templates[phase.template_id];
+  const size_t n = stored.tasks.size();
+  std::vector<uint64_t> ids(n);
+  std::vector<size_t> locations(n, 0);
+  uint64_t id = phase.phase_task_id;
+  for (size_t i = 0; i < n; i++) {
+    uint64_t delta, location, create, start, duration;
+    if ((p = otter_compact_get_varint(p, end, &delta)) == nullptr ||
+        (p = otter_compact_get_varint(p, end, &location)) == nullptr ||
+        (p = otter_compact_get_varint(p, end, &create)) == nullptr ||
+        (p = otter_compact_get_varint(p, end, &start)) == nullptr ||
+        (p = otter_compact_get_varint(p, end, &duration)) == nullptr)
+      return false;
+    id += otter_compact_unzigzag(delta);
+    ids[i] = id;
+    const otter_template_task_t &task = stored.tasks[i];
+    if (i > 0 && task.parent >= i)
+      return false;
+    size_t parent_location = i > 0 ? locations[task.parent] : 0;
+    auto index = state.location_index.find(location - 1);
+    locations[i] = location != 0 && index != state.location_index.end()
+                       ? index->second
+                       : parent_location;
+    if (i == 0)
+      continue;
+    put_template_record(state, parent_location, record_kind::create,
+                        phase.start_time + create, id, ids[task.parent],
+                        task.label);
+    if (location == 0)
+      continue;
+    put_template_record(state, locations[i], record_kind::start,
+                        phase.start_time + start, id);
+    if (duration != 0)
+      put_template_record(state, locations[i], record_kind::end,
+                          phase.start_time + start + duration - 1, id);
+  }
+  /* Only the start of a sync is a record, as with events */
+  for (const otter_template_sync_t &sync : stored.syncs) {
+    uint64_t time;
+    if ((p = otter_compact_get_varint(p, end, &time)) == nullptr ||
+        sync.task >= n)
+      return false;
+    if (sync.endpoint != otter_endpoint_leave)
+      put_template_record(state, locations[sync.task], record_kind::sync,
+                          phase.start_time + time, ids[sync.task],
+                          OTTER_GRAPH_NO_TASK, OTF2_UNDEFINED_STRING,
+                          sync.descendants);
+  }
+  state.summary->templated_phases++;
+  state.summary->templated_tasks += n - 1;
+
+  /* Phases are written in the order they ended and never overlap, so each
+     location's file stays in time order */
+  for (size_t k = 0; k < state.by_location.size(); k++) {
+    std::vector<task_record> &records = state.by_location[k];
+    if (records.empty())
+      continue;
+    std::stable_sort(records.begin(), records.end(),
+                     [](const task_record &a, const task_record &b) {
+                       return a.time < b.time;
+                     });
+    if (state.files[k] == nullptr) {
+      std::string path = template_record_path(*state.tmp_dir, k);
+      state.files[k] = fopen(path.c_str(), "wb");
+      if (state.files[k] == nullptr) {
+        fprintf(stderr, "otter-graph: can't create %s\n", path.c_str());
+        return false;
+      }
+    }
+    fwrite(records.data(), sizeof(task_record), records.size(),
+           state.files[k]);
+    records.clear();
+  }
+  return true;
+}
+
+bool read_templates(const std::string &path, const trace_defs &defs,
+                    const std::string &tmp_dir, read_summary &summary) {
+  FILE *file = fopen(path.c_str(), "rb");
+  if (file == nullptr)
+    return errno == ENOENT;
+  template_state state{&defs, &tmp_dir};
+  for (size_t k = 0; k < defs.locations.size(); k++) {
+    state.location_index[defs.locations[k]] = k;
+  }
+  state.by_location.resize(defs.locations.size());
+  state.files.resize(defs.locations.size(), nullptr);
+  state.summary = &summary;
+
+  otter_template_header_t header;
+  bool ok = !defs.locations.empty() &&
+            fread(&header, sizeof(header), 1, file) == 1 &&
+            header.magic == OTTER_TEMPLATE_MAGIC &&
+            header.version == OTTER_TEMPLATE_VERSION;
+  otter_template_record_t record;
+  std::vector<unsigned char> body;
+  while (ok && fread(&record, sizeof(record), 1, file) == 1) {
+    body.resize(record.length);
+    ok = fread(body.data(), 1, body.size(), file) == body.size();
+    const unsigned char *begin = body.data();
+    const unsigned char *end = begin + body.size();
+    if (ok && record.kind == otter_template_record_template)
+      ok = read_template(state, begin, end);
+    else if (ok && record.kind == otter_template_record_phase)
+      ok = expand_phase(state, begin, end);
+  }
+  if (!ok)
+    fprintf(stderr, "otter-graph: can't read phase templates from %s\n",
+            path.c_str());
+  fclose(file);
+  for (FILE *records : state.files) {
+    if (records != nullptr && fclose(records) != 0)
+      ok = false;
+  }
+  return ok;
+}
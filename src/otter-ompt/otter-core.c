@@ -10,6 +10,7 @@
 #include "public/debug.h"
 #include "public/otter-common.h"
 #include "public/otter-environment-variables.h"
+#include "public/otter-trace/trace-mutex.h"
 #include "public/otter-trace/trace-ompt.h"
 #include "public/otter-trace/trace-parallel-data.h"
 #include "public/otter-trace/trace-task-data.h"
@@ -39,6 +40,12 @@ otter_opt_t *tool_setup(tool_callbacks_t *callbacks,
   include_callback(callbacks, ompt_callback_implicit_task);
   include_callback(callbacks, ompt_callback_work);
   include_callback(callbacks, ompt_callback_sync_region);
+  include_callback(callbacks, ompt_callback_dependences);
+  include_callback(callbacks, ompt_callback_task_dependence);
+  include_callback(callbacks, ompt_callback_lock_init);
+  include_callback(callbacks, ompt_callback_mutex_acquire);
+  include_callback(callbacks, ompt_callback_mutex_acquired);
+  include_callback(callbacks, ompt_callback_mutex_released);
 #if defined(USE_OMPT_MASKED)
   include_callback(callbacks, ompt_callback_masked);
 #else
@@ -57,12 +64,40 @@ otter_opt_t *tool_setup(tool_callbacks_t *callbacks,
                             .tracename = NULL,
                             .tracepath = NULL,
                             .archive_name = NULL,
-                            .append_hostname = false};
+                            .append_hostname = false,
+                            .record_mutex_events = false,
+                            .perf_events = NULL,
+                            .buffer_budget = NULL,
+                            .event_chunk_size = NULL,
+                            .def_chunk_size = NULL,
+                            .huge_pages = NULL,
+                            .sink = NULL,
+                            .stream_path = NULL,
+                            .flight_size = NULL,
+                            .flight_seconds = NULL,
+                            .flight_dump_phase = NULL,
+                            .segment_phases = NULL,
+                            .compact_shared = NULL,
+                            .loop_sample = NULL,
+                            .defer_labels = NULL};
 
   opt.hostname = host;
   opt.tracename = getenv(ENV_VAR_TRACE_OUTPUT);
   opt.tracepath = getenv(ENV_VAR_TRACE_PATH);
   opt.append_hostname = getenv(ENV_VAR_APPEND_HOST) == NULL ? false : true;
+  opt.record_mutex_events = getenv(ENV_VAR_MUTEX_EVENTS) == NULL ? false : true;
+  opt.perf_events = getenv(ENV_VAR_PERF_EVENTS);
+  opt.buffer_budget = getenv(ENV_VAR_BUFFER_BUDGET);
+  opt.event_chunk_size = getenv(ENV_VAR_EVENT_CHUNK_SIZE);
+  opt.def_chunk_size = getenv(ENV_VAR_DEF_CHUNK_SIZE);
+  opt.huge_pages = getenv(ENV_VAR_HUGE_PAGES);
+  opt.sink = getenv(ENV_VAR_SINK);
+  opt.stream_path = getenv(ENV_VAR_STREAM_PATH);
+  opt.flight_size = getenv(ENV_VAR_FLIGHT_SIZE);
+  opt.flight_seconds = getenv(ENV_VAR_FLIGHT_SECONDS);
+  opt.flight_dump_phase = getenv(ENV_VAR_FLIGHT_DUMP_PHASE);
+  opt.segment_phases = getenv(ENV_VAR_SEGMENT_PHASES);
+  opt.compact_shared = getenv(ENV_VAR_COMPACT_SHARED);
   opt.event_model = otter_event_model_omp;
 
   /* Apply defaults if variables not provided */
@@ -76,6 +111,31 @@ otter_opt_t *tool_setup(tool_callbacks_t *callbacks,
   LOG_INFO("%-30s %s", ENV_VAR_TRACE_PATH, opt.tracepath);
   LOG_INFO("%-30s %s", ENV_VAR_TRACE_OUTPUT, opt.tracename);
   LOG_INFO("%-30s %s", ENV_VAR_APPEND_HOST, opt.append_hostname ? "Yes" : "No");
+  LOG_INFO("%-30s %s", ENV_VAR_MUTEX_EVENTS,
+           opt.record_mutex_events ? "Yes" : "No");
+  LOG_INFO("%-30s %s", ENV_VAR_PERF_EVENTS,
+           opt.perf_events ? opt.perf_events : "(none)");
+  LOG_INFO("%-30s %s", ENV_VAR_BUFFER_BUDGET,
+           opt.buffer_budget ? opt.buffer_budget : "(unlimited)");
+  LOG_INFO("%-30s %s", ENV_VAR_EVENT_CHUNK_SIZE,
+           opt.event_chunk_size ? opt.event_chunk_size : "(default)");
+  LOG_INFO("%-30s %s", ENV_VAR_DEF_CHUNK_SIZE,
+           opt.def_chunk_size ? opt.def_chunk_size : "(default)");
+  LOG_INFO("%-30s %s", ENV_VAR_HUGE_PAGES,
+           opt.huge_pages ? opt.huge_pages : "off");
+  LOG_INFO("%-30s %s", ENV_VAR_SINK, opt.sink ? opt.sink : "otf2");
+  LOG_INFO("%-30s %s", ENV_VAR_STREAM_PATH,
+           opt.stream_path ? opt.stream_path : DEFAULT_STREAM_PATH);
+  LOG_INFO("%-30s %s", ENV_VAR_FLIGHT_SIZE,
+           opt.flight_size ? opt.flight_size : "(default)");
+  LOG_INFO("%-30s %s", ENV_VAR_FLIGHT_SECONDS,
+           opt.flight_seconds ? opt.flight_seconds : "(unlimited)");
+  LOG_INFO("%-30s %s", ENV_VAR_FLIGHT_DUMP_PHASE,
+           opt.flight_dump_phase ? opt.flight_dump_phase : "(none)");
+  LOG_INFO("%-30s %s", ENV_VAR_SEGMENT_PHASES,
+           opt.segment_phases ? opt.segment_phases : "(none)");
+  LOG_INFO("%-30s %s", ENV_VAR_COMPACT_SHARED,
+           opt.compact_shared ? opt.compact_shared : "(none)");
 
   trace_initialise(&opt);
 
@@ -298,6 +358,69 @@ on_ompt_callback_task_create(ompt_data_t *encountering_task,
   return;
 }
 
+/* Dispatched after task-create for a task with dependences, on the thread
+   which created the task. For doacross (source/sink) dependences the variable
+   holds the iteration vector rather than an address. */
+static void on_ompt_callback_dependences(ompt_data_t *task,
+                                         const ompt_dependence_t *deps,
+                                         int ndeps) {
+  thread_data_t *thread_data = (thread_data_t *)get_thread_data()->ptr;
+  task_data_t *task_data = (task_data_t *)task->ptr;
+
+  if (task_data == NULL) {
+    LOG_ERROR("dependences: null pointer");
+    return;
+  }
+
+  LOG_DEBUG("[t=%lu] (event) dependences (task=%lu, ndeps=%d)",
+            thread_data->id, trace_task_get_id(task_data), ndeps);
+
+  if (ndeps <= 0) {
+    return;
+  }
+
+  /* Convert to the tracer's representation in the thread's re-usable buffer
+     so no allocation is needed per task */
+  otter_dependence_t *dependences =
+      trace_location_get_dependence_buffer(thread_data->location, ndeps);
+  if (dependences == NULL) {
+    return;
+  }
+
+  for (int n = 0; n < ndeps; n++) {
+    dependences[n] = (otter_dependence_t){
+        .variable = deps[n].variable.value,
+        .type = (otter_dependence_type_t)deps[n].dependence_type};
+  }
+
+  trace_event_task_dependences(thread_data->location,
+                               trace_task_get_region_def(task_data),
+                               dependences, ndeps);
+  return;
+}
+
+/* Dispatched when the runtime resolves a dependence between two tasks */
+static void on_ompt_callback_task_dependence(ompt_data_t *src_task,
+                                             ompt_data_t *sink_task) {
+  thread_data_t *thread_data = (thread_data_t *)get_thread_data()->ptr;
+  task_data_t *src_task_data = (task_data_t *)src_task->ptr;
+  task_data_t *sink_task_data = (task_data_t *)sink_task->ptr;
+
+  if (src_task_data == NULL || sink_task_data == NULL) {
+    LOG_ERROR("task dependence: null pointer");
+    return;
+  }
+
+  LOG_DEBUG("[t=%lu] (event) task-dependence %lu -> %lu", thread_data->id,
+            trace_task_get_id(src_task_data),
+            trace_task_get_id(sink_task_data));
+
+  trace_event_task_dependence(thread_data->location,
+                              trace_task_get_region_def(src_task_data),
+                              trace_task_get_region_def(sink_task_data));
+  return;
+}
+
 static void on_ompt_callback_task_schedule(ompt_data_t *prior_task,
                                            ompt_task_status_t prior_task_status,
                                            ompt_data_t *next_task) {
@@ -606,3 +729,44 @@ static void on_ompt_callback_sync_region(ompt_sync_region_t kind,
   }
   return;
 }
+
+/* The mutex callbacks are dispatched for locks, critical & ordered regions and
+   atomics. Only the time spent waiting for and holding each mutex is recorded,
+   aggregated per thread and per wait ID, unless OTTER_MUTEX_EVENTS is set. */
+static void on_ompt_callback_lock_init(ompt_mutex_t kind, unsigned int hint,
+                                       unsigned int impl,
+                                       ompt_wait_id_t wait_id,
+                                       const void *codeptr_ra) {
+  thread_data_t *thread_data = (thread_data_t *)get_thread_data()->ptr;
+  trace_event_lock_init(thread_data->location, (otter_mutex_kind_t)kind,
+                        wait_id, codeptr_ra);
+  return;
+}
+
+static void on_ompt_callback_mutex_acquire(ompt_mutex_t kind, unsigned int hint,
+                                           unsigned int impl,
+                                           ompt_wait_id_t wait_id,
+                                           const void *codeptr_ra) {
+  thread_data_t *thread_data = (thread_data_t *)get_thread_data()->ptr;
+  trace_event_mutex_acquire(thread_data->location, (otter_mutex_kind_t)kind,
+                            wait_id, codeptr_ra);
+  return;
+}
+
+static void on_ompt_callback_mutex_acquired(ompt_mutex_t kind,
+                                            ompt_wait_id_t wait_id,
+                                            const void *codeptr_ra) {
+  thread_data_t *thread_data = (thread_data_t *)get_thread_data()->ptr;
+  trace_event_mutex_acquired(thread_data->location, (otter_mutex_kind_t)kind,
+                             wait_id, codeptr_ra);
+  return;
+}
+
+static void on_ompt_callback_mutex_released(ompt_mutex_t kind,
+                                            ompt_wait_id_t wait_id,
+                                            const void *codeptr_ra) {
+  thread_data_t *thread_data = (thread_data_t *)get_thread_data()->ptr;
+  trace_event_mutex_released(thread_data->location, (otter_mutex_kind_t)kind,
+                             wait_id, codeptr_ra);
+  return;
+}
@@ -36,6 +36,12 @@
 #define implements_callback_work
 #define implements_callback_sync_region
 #define implements_callback_master
+#define implements_callback_dependences
+#define implements_callback_task_dependence
+#define implements_callback_lock_init
+#define implements_callback_mutex_acquire
+#define implements_callback_mutex_acquired
+#define implements_callback_mutex_released
 #include "ompt-callback-prototypes.h"
 
 #endif // OTTER_H
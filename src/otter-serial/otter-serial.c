@@ -9,6 +9,9 @@
 #include "api/otter-serial/otter-serial.h"
 #include "public/debug.h"
 #include "public/otter-environment-variables.h"
+#include "public/otter-trace/trace-flight.h"
+#include "public/otter-trace/trace-loop.h"
+#include "public/otter-trace/trace-segment.h"
 #include "public/otter-trace/trace-ompt.h"
 
 #include "public/otter-trace/trace-parallel-data.h"
@@ -23,6 +26,7 @@ static trace_location_def_t *location = NULL;
 static unique_id_t thread_id = 0;
 static otter_stack_t *task_stack = NULL;
 static otter_stack_t *parallel_stack = NULL;
+static otter_stack_t *loop_stack = NULL; // innermost loop on top
 static bool tracingActive = false;
 
 /* detect environment variables */
@@ -49,6 +53,18 @@ void otterTraceInitialise(const char *file, const char *func, const int line) {
   opt.tracename = getenv(ENV_VAR_TRACE_OUTPUT);
   opt.tracepath = getenv(ENV_VAR_TRACE_PATH);
   opt.append_hostname = getenv(ENV_VAR_APPEND_HOST) == NULL ? false : true;
+  opt.buffer_budget = getenv(ENV_VAR_BUFFER_BUDGET);
+  opt.event_chunk_size = getenv(ENV_VAR_EVENT_CHUNK_SIZE);
+  opt.def_chunk_size = getenv(ENV_VAR_DEF_CHUNK_SIZE);
+  opt.huge_pages = getenv(ENV_VAR_HUGE_PAGES);
+  opt.sink = getenv(ENV_VAR_SINK);
+  opt.stream_path = getenv(ENV_VAR_STREAM_PATH);
+  opt.flight_size = getenv(ENV_VAR_FLIGHT_SIZE);
+  opt.flight_seconds = getenv(ENV_VAR_FLIGHT_SECONDS);
+  opt.flight_dump_phase = getenv(ENV_VAR_FLIGHT_DUMP_PHASE);
+  opt.segment_phases = getenv(ENV_VAR_SEGMENT_PHASES);
+  opt.compact_shared = getenv(ENV_VAR_COMPACT_SHARED);
+  opt.loop_sample = getenv(ENV_VAR_LOOP_SAMPLE);
   opt.event_model = otter_event_model_serial;
 
   /* Apply defaults if variables not provided */
@@ -67,6 +83,7 @@ void otterTraceInitialise(const char *file, const char *func, const int line) {
 
   task_stack = stack_create();
   parallel_stack = stack_create();
+  loop_stack = stack_create();
 
   tracingActive = true;
 
@@ -149,6 +166,7 @@ void otterTraceFinalise(void) {
 
   stack_destroy(task_stack, false, NULL);
   stack_destroy(parallel_stack, false, NULL);
+  stack_destroy(loop_stack, false, NULL);
 
   char trace_folder[PATH_MAX] = {0};
 
@@ -290,6 +308,7 @@ void otterLoopBegin() {
       otter_work_loop, 1, trace_task_get_id(encountering_task));
 
   trace_location_store_region_def(location, loop);
+  stack_push(loop_stack, (data_item_t){.ptr = loop});
   trace_event_enter(location, loop);
 
   return;
@@ -300,6 +319,8 @@ void otterLoopEnd(void) {
     LOG_DEBUG("[INACTIVE]");
     return;
   }
+  trace_region_def_t *loop = NULL;
+  stack_pop(loop_stack, (data_item_t *)&loop);
   trace_event_leave(location);
   return;
 }
@@ -310,7 +331,12 @@ void otterLoopIterationBegin() {
     return;
   }
 
-  // LOG_EVENT_CALL(file, func, line, __func__);
+  trace_region_def_t *loop = NULL;
+  if (!stack_peek(loop_stack, (data_item_t *)&loop)) {
+    LOG_WARN("loop iteration outside a loop (ignored)");
+    return;
+  }
+  trace_event_loop_iteration_begin(location, loop);
   return;
 }
 
@@ -320,6 +346,12 @@ void otterLoopIterationEnd(void) {
     return;
   }
 
+  trace_region_def_t *loop = NULL;
+  if (!stack_peek(loop_stack, (data_item_t *)&loop)) {
+    LOG_WARN("loop iteration outside a loop (ignored)");
+    return;
+  }
+  trace_event_loop_iteration_end(location, loop);
   return;
 }
 
@@ -387,7 +419,11 @@ void otterTraceStop(void) {
   return;
 }
 
+void otterTraceDump(void) { trace_flight_dump(); }
+
 void otterPhaseBegin(const char *name) {
+  trace_flight_phase_begin(name);
+  trace_segment_phase_begin(name);
   if (!tracingActive) {
     LOG_DEBUG("[INACTIVE]");
     return;
@@ -0,0 +1,492 @@
+/**
+ * @file otter-stream.c
+ * @author Adam Tuft
+ * @brief Reference consumer for the frames written by Otter's stream sink.
+ * Listens on a Unix-domain datagram socket or reads a named pipe and prints the
+ * per-label rate at which tasks are created and completed, the event rate and
+ * the number of events the producer dropped.
+ *
+ *   otter-stream [-f] [-k] [-i seconds] [path]
+ *
+ * The path defaults to OTTER_STREAM_PATH, or otter-stream.sock. With -f a
+ * named pipe is created instead of a socket. With -k the consumer keeps
+ * listening after the producer finalises.
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "public/otter-environment-variables.h"
+#include "public/otter-trace/trace-stream.h"
+
+/* A counter for the current interval and the whole run */
+typedef struct {
+  uint64_t interval;
+  uint64_t total;
+} count_t;
+
+typedef struct {
+  count_t created;
+  count_t completed;
+} label_stats_t;
+
+/* Strings and per-label stats are indexed by string ref */
+static struct {
+  char **strings;
+  label_stats_t *labels;
+  count_t *event_types;
+  size_t capacity;
+} refs = {NULL, NULL, NULL, 0};
+
+/* Label of each task created but not yet completed, keyed by task ID */
+typedef struct {
+  uint64_t task;
+  uint32_t label;
+  bool used;
+} task_entry_t;
+
+static struct {
+  task_entry_t *entries;
+  size_t capacity;
+  size_t count;
+} tasks = {NULL, 0, 0};
+
+static count_t events = {0, 0};
+static uint64_t dropped = 0;
+static uint64_t dropped_reported = 0;
+static uint32_t task_leave_ref = 0;
+static uint32_t task_leave_batch_ref = 0;
+static volatile sig_atomic_t stop = 0;
+
+static void handle_signal(int signum) { stop = 1; }
+
+static uint64_t now_ns(void) {
+  struct timespec time;
+  clock_gettime(CLOCK_MONOTONIC, &time);
+  return time.tv_sec * (uint64_t)1000000000 + time.tv_nsec;
+}
+
+static bool refs_reserve(uint32_t ref) {
+  if (ref < refs.capacity)
+    return true;
+  size_t capacity = refs.capacity == 0 ? 1024 : refs.capacity;
+  while (capacity <= ref)
+    capacity *= 2;
+  char **strings = realloc(refs.strings, capacity * sizeof(*strings));
+  label_stats_t *labels = realloc(refs.labels, capacity * sizeof(*labels));
+  count_t *event_types =
+      realloc(refs.event_types, capacity * sizeof(*event_types));
+  if (strings != NULL)
+    refs.strings = strings;
+  if (labels != NULL)
+    refs.labels = labels;
+  if (event_types != NULL)
+    refs.event_types = event_types;
+  if (strings == NULL || labels == NULL || event_types == NULL)
+    return false;
+  size_t added = capacity - refs.capacity;
+  memset(&refs.strings[refs.capacity], 0, added * sizeof(*strings));
+  memset(&refs.labels[refs.capacity], 0, added * sizeof(*labels));
+  memset(&refs.event_types[refs.capacity], 0, added * sizeof(*event_types));
+  refs.capacity = capacity;
+  return true;
+}
+
+static const char *ref_string(uint32_t ref) {
+  if (ref < refs.capacity && refs.strings[ref] != NULL)
+    return refs.strings[ref];
+  return NULL;
+}
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+/*   TASK TABLE (open addressing, linear probing)                            */
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+static size_t task_slot(uint64_t task) {
+  return (task * 0x9e3779b97f4a7c15ull) & (tasks.capacity - 1);
+}
+
+static void task_insert(uint64_t task, uint32_t label);
+
+static bool tasks_grow(void) {
+  task_entry_t *old = tasks.entries;
+  size_t old_capacity = tasks.capacity;
+  size_t capacity = old_capacity == 0 ? 4096 : 2 * old_capacity;
+  task_entry_t *entries = calloc(capacity, sizeof(*entries));
+  if (entries == NULL)
+    return false;
+  tasks.entries = entries;
+  tasks.capacity = capacity;
+  tasks.count = 0;
+  for (size_t k = 0; k < old_capacity; k++) {
+    if (old[k].used)
+      task_insert(old[k].task, old[k].label);
+  }
+  free(old);
+  return true;
+}
+
+static void task_insert(uint64_t task, uint32_t label) {
+  if (2 * (tasks.count + 1) > tasks.capacity && !tasks_grow())
+    return;
+  size_t slot = task_slot(task);
+  while (tasks.entries[slot].used && tasks.entries[slot].task != task)
+    slot = (slot + 1) & (tasks.capacity - 1);
+  if (!tasks.entries[slot].used)
+    tasks.count++;
+  tasks.entries[slot] = (task_entry_t){task, label, true};
+}
+
+/* Remove a task, returning its label or 0 if it wasn't found */
+static uint32_t task_remove(uint64_t task) {
+  if (tasks.capacity == 0)
+    return 0;
+  size_t mask = tasks.capacity - 1;
+  size_t slot = task_slot(task);
+  while (tasks.entries[slot].used && tasks.entries[slot].task != task)
+    slot = (slot + 1) & mask;
+  if (!tasks.entries[slot].used)
+    return 0;
+  uint32_t label = tasks.entries[slot].label;
+  tasks.count--;
+  /* shift back any later entries which would no longer be found */
+  size_t next = (slot + 1) & mask;
+  while (tasks.entries[next].used) {
+    size_t home = task_slot(tasks.entries[next].task);
+    if (((next - home) & mask) >= ((next - slot) & mask)) {
+      tasks.entries[slot] = tasks.entries[next];
+      slot = next;
+    }
+    next = (next + 1) & mask;
+  }
+  tasks.entries[slot] = (task_entry_t){0, 0, false};
+  return label;
+}
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+/*   FRAMES                                                                  */
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+static void count_many(count_t *counter, uint64_t n) {
+  counter->interval += n;
+  counter->total += n;
+}
+
+static void count(count_t *counter) { count_many(counter, 1); }
+
+static void read_strings(const char *body, size_t length, uint32_t n) {
+  size_t offset = 0;
+  for (uint32_t k = 0; k < n; k++) {
+    otter_stream_string_t record;
+    if (offset + sizeof(record) > length)
+      return;
+    memcpy(&record, &body[offset], sizeof(record));
+    offset += sizeof(record);
+    if (offset + record.length > length || !refs_reserve(record.ref))
+      return;
+    free(refs.strings[record.ref]);
+    refs.strings[record.ref] = strndup(&body[offset], record.length);
+    if (strcmp(refs.strings[record.ref], "task_leave") == 0)
+      task_leave_ref = record.ref;
+    if (strcmp(refs.strings[record.ref], "task_leave_batch") == 0)
+      task_leave_batch_ref = record.ref;
+    offset += record.length;
+  }
+}
+
+static void read_events(const char *body, size_t length, uint32_t n) {
+  if (n > length / sizeof(otter_stream_event_t))
+    n = length / sizeof(otter_stream_event_t);
+  for (uint32_t k = 0; k < n; k++) {
+    otter_stream_event_t event;
+    memcpy(&event, &body[k * sizeof(event)], sizeof(event));
+    count(&events);
+    if (refs_reserve(event.event_type))
+      count(&refs.event_types[event.event_type]);
+    /* A batch event stands for tasks with consecutive IDs from the one named */
+    uint32_t tasks = event.tasks == 0 ? 1 : event.tasks;
+    if (event.record == otter_stream_record_task_create) {
+      for (uint32_t t = 0; t < tasks; t++) {
+        task_insert(event.unique_id + t, event.task_label);
+      }
+      if (refs_reserve(event.task_label))
+        count_many(&refs.labels[event.task_label].created, tasks);
+    } else if ((task_leave_ref != 0 && event.event_type == task_leave_ref) ||
+               (task_leave_batch_ref != 0 &&
+                event.event_type == task_leave_batch_ref)) {
+      for (uint32_t t = 0; t < tasks; t++) {
+        uint32_t label = task_remove(event.encountering_task_id + t);
+        if (refs_reserve(label))
+          count(&refs.labels[label].completed);
+      }
+    }
+  }
+}
+
+/* Returns false at the producer's end frame */
+static bool read_frame(const char *frame, size_t length) {
+  otter_stream_frame_header_t header;
+  if (length < sizeof(header))
+    return true;
+  memcpy(&header, frame, sizeof(header));
+  if (header.magic != OTTER_STREAM_MAGIC ||
+      header.version != OTTER_STREAM_VERSION || header.length > length) {
+    fprintf(stderr, "otter-stream: ignored invalid frame\n");
+    return true;
+  }
+  if (header.dropped > dropped)
+    dropped = header.dropped;
+  const char *body = &frame[sizeof(header)];
+  size_t body_length = header.length - sizeof(header);
+  switch (header.kind) {
+  case otter_stream_frame_strings:
+    read_strings(body, body_length, header.count);
+    break;
+  case otter_stream_frame_events:
+    read_events(body, body_length, header.count);
+    break;
+  case otter_stream_frame_end:
+    return false;
+  }
+  return true;
+}
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+/*   REPORT                                                                  */
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+static void report(double elapsed, double interval) {
+  printf("\n[%8.1fs] %-21s %12.0f  %-9s %lu (+%lu)\n", elapsed, "events/s:",
+         events.interval / interval, "dropped:", dropped,
+         dropped - dropped_reported);
+  dropped_reported = dropped;
+  events.interval = 0;
+
+  bool header = false;
+  for (size_t ref = 0; ref < refs.capacity; ref++) {
+    label_stats_t *stats = &refs.labels[ref];
+    if (stats->created.total == 0 && stats->completed.total == 0)
+      continue;
+    if (!header)
+      printf("  %-30s %12s %12s %12s %12s\n", "task label", "created/s",
+             "completed/s", "created", "completed");
+    header = true;
+    const char *label = ref_string((uint32_t)ref);
+    printf("  %-30s %12.0f %12.0f %12lu %12lu\n",
+           ref == 0 ? "(none)" : (label ? label : "(unknown)"),
+           stats->created.interval / interval,
+           stats->completed.interval / interval, stats->created.total,
+           stats->completed.total);
+    stats->created.interval = stats->completed.interval = 0;
+  }
+
+  header = false;
+  for (size_t ref = 1; ref < refs.capacity; ref++) {
+    count_t *event_type = &refs.event_types[ref];
+    if (event_type->interval == 0)
+      continue;
+    if (!header)
+      printf("  %-30s %12s\n", "event type", "events/s");
+    header = true;
+    const char *name = ref_string((uint32_t)ref);
+    printf("  %-30s %12.0f\n", name ? name : "(unknown)",
+           event_type->interval / interval);
+    event_type->interval = 0;
+  }
+  fflush(stdout);
+}
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+/*   MAIN                                                                    */
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+static int open_socket(const char *path) {
+  struct sockaddr_un addr = {.sun_family = AF_UNIX};
+  if (strlen(path) >= sizeof(addr.sun_path)) {
+    fprintf(stderr, "otter-stream: path too long: %s\n", path);
+    return -1;
+  }
+  strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+  int fd = socket(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+  if (fd == -1 || bind(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+    fprintf(stderr, "otter-stream: can't bind %s: %s\n", path,
+            strerror(errno));
+    if (fd != -1)
+      close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+/* Open the pipe for reading and hold it open for writing so that it doesn't
+   report end-of-file while no producer has it open */
+static int open_fifo(const char *path, int *keep_open) {
+  int fd = open(path, O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+  if (fd == -1) {
+    fprintf(stderr, "otter-stream: can't open %s: %s\n", path,
+            strerror(errno));
+    return -1;
+  }
+  *keep_open = open(path, O_WRONLY | O_NONBLOCK | O_CLOEXEC);
+  return fd;
+}
+
+static void usage(const char *name) {
+  fprintf(stderr, "usage: %s [-f] [-k] [-i seconds] [path]\n", name);
+  fprintf(stderr, "  -f          create a named pipe instead of a socket\n");
+  fprintf(stderr, "  -k          keep listening after the producer ends\n");
+  fprintf(stderr, "  -i seconds  reporting interval (default 1)\n");
+  fprintf(stderr, "  path        default $%s or %s\n", ENV_VAR_STREAM_PATH,
+          DEFAULT_STREAM_PATH);
+}
+
+int main(int argc, char *argv[]) {
+  bool make_fifo = false;
+  bool keep_listening = false;
+  double interval = 1.0;
+  int opt;
+  while ((opt = getopt(argc, argv, "fki:h")) != -1) {
+    switch (opt) {
+    case 'f':
+      make_fifo = true;
+      break;
+    case 'k':
+      keep_listening = true;
+      break;
+    case 'i':
+      interval = atof(optarg);
+      if (interval <= 0) {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+      }
+      break;
+    default:
+      usage(argv[0]);
+      return opt == 'h' ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+  }
+
+  const char *path = getenv(ENV_VAR_STREAM_PATH);
+  if (optind < argc)
+    path = argv[optind];
+  if (path == NULL || path[0] == '\0')
+    path = DEFAULT_STREAM_PATH;
+
+  /* Replace a stale socket or pipe, but nothing else */
+  struct stat info;
+  bool existing_fifo = false;
+  if (stat(path, &info) == 0) {
+    if (S_ISFIFO(info.st_mode) && make_fifo) {
+      existing_fifo = true;
+    } else if (S_ISSOCK(info.st_mode) || S_ISFIFO(info.st_mode)) {
+      unlink(path);
+    } else {
+      fprintf(stderr, "otter-stream: %s exists and is not a socket or pipe\n",
+              path);
+      return EXIT_FAILURE;
+    }
+  }
+  if (make_fifo && !existing_fifo && mkfifo(path, 0600) != 0) {
+    fprintf(stderr, "otter-stream: can't create %s: %s\n", path,
+            strerror(errno));
+    return EXIT_FAILURE;
+  }
+
+  int keep_open = -1;
+  int fd = make_fifo ? open_fifo(path, &keep_open) : open_socket(path);
+  if (fd == -1)
+    return EXIT_FAILURE;
+
+  struct sigaction action = {.sa_handler = handle_signal};
+  sigaction(SIGINT, &action, NULL);
+  sigaction(SIGTERM, &action, NULL);
+
+  printf("otter-stream: listening on %s (%s)\n", path,
+         make_fifo ? "named pipe" : "socket");
+  fflush(stdout);
+
+  /* A pipe delivers a byte stream, so frames are re-assembled in a buffer */
+  static char buffer[2 * OTTER_STREAM_FRAME_MAX];
+  size_t buffered = 0;
+  bool running = true;
+  uint64_t start = now_ns();
+  uint64_t last_report = start;
+  uint64_t interval_ns = (uint64_t)(interval * 1e9);
+
+  while (running && !stop) {
+    uint64_t now = now_ns();
+    if (now - last_report >= interval_ns) {
+      report((now - start) / 1e9, (now - last_report) / 1e9);
+      last_report = now;
+    }
+    int timeout_ms = (int)((last_report + interval_ns - now) / 1000000) + 1;
+    struct pollfd pfd = {.fd = fd, .events = POLLIN};
+    int ready = poll(&pfd, 1, timeout_ms);
+    if (ready <= 0)
+      continue;
+
+    if (!make_fifo) {
+      ssize_t length = recv(fd, buffer, sizeof(buffer), MSG_DONTWAIT);
+      if (length > 0 && !read_frame(buffer, (size_t)length))
+        running = keep_listening;
+      continue;
+    }
+
+    ssize_t length = read(fd, &buffer[buffered], sizeof(buffer) - buffered);
+    if (length <= 0)
+      continue;
+    buffered += (size_t)length;
+    size_t offset = 0;
+    while (buffered - offset >= sizeof(otter_stream_frame_header_t)) {
+      otter_stream_frame_header_t header;
+      memcpy(&header, &buffer[offset], sizeof(header));
+      if (header.magic != OTTER_STREAM_MAGIC ||
+          header.length < sizeof(header) ||
+          header.length > OTTER_STREAM_FRAME_MAX) {
+        fprintf(stderr, "otter-stream: lost frame alignment, resetting\n");
+        offset = buffered;
+        break;
+      }
+      if (buffered - offset < header.length)
+        break;
+      if (!read_frame(&buffer[offset], header.length))
+        running = keep_listening;
+      offset += header.length;
+    }
+    memmove(buffer, &buffer[offset], buffered - offset);
+    buffered -= offset;
+  }
+
+  uint64_t now = now_ns();
+  report((now - start) / 1e9, (now - last_report) / 1e9);
+  printf("\notter-stream: %s after %lu events (%lu dropped by producer)\n",
+         stop ? "interrupted" : "producer finished", events.total, dropped);
+
+  close(fd);
+  if (keep_open != -1)
+    close(keep_open);
+  unlink(path);
+
+  for (size_t ref = 0; ref < refs.capacity; ref++) {
+    free(refs.strings[ref]);
+  }
+  free(refs.strings);
+  free(refs.labels);
+  free(refs.event_types);
+  free(tasks.entries);
+  return EXIT_SUCCESS;
+}
@@ -28,16 +28,24 @@
 #include "public/debug.h"
 #include "public/otter-environment-variables.h"
 #include "public/otter-trace/source-location.h"
+#include "public/otter-trace/trace-flight.h"
+#include "public/otter-trace/trace-segment.h"
 #include "public/otter-trace/strings.h"
 #include "public/otter-trace/trace-initialise.h"
+#include "public/otter-trace/trace-label.h"
+#include "public/otter-trace/trace-numa.h"
 #include "public/otter-trace/trace-task-context-interface.h"
 #include "public/otter-trace/trace-task-graph.h"
 #include "public/otter-trace/trace-task-manager.h"
+#include "public/otter-trace/trace-template.h"
 #include "public/otter-trace/trace-thread-data.h"
 #include "public/otter-version.h"
 #include "public/types/queue.h"
+#include "public/types/stack.h"
 
 #define LABEL_BUFFER_MAX_CHARS 256
+#define LABEL_HASH_CACHE_SLOTS 256
+#define PHASE_STACK_MAX_DEPTH 64
 
 struct thread_data_queue {
   otter_queue_t *instance;
@@ -46,6 +54,19 @@ struct thread_data_queue {
 
 static trace_task_manager_callback debug_print_count;
 static trace_task_manager_callback debug_store_count_in_queue;
+static void task_create(otter_task_context *task, otter_task_context *parent,
+                        const char *file, const char *func, int line);
+static otter_task_context *task_start(otter_task_context *task,
+                                      const char *file, const char *func,
+                                      int line);
+static void task_end(otter_task_context *task, const char *file,
+                     const char *func, int line);
+static void synchronise_tasks(otter_task_context *task, otter_task_sync_t mode,
+                              otter_endpoint_t endpoint, const char *file,
+                              const char *func, int line);
+static void phase_end(const char *file, const char *func, int line);
+static void release_phase(otter_task_context *phase,
+                          trace_location_def_t *location);
 
 /* detect environment variables */
 static otter_opt_t opt = {.hostname = NULL,
@@ -54,9 +75,24 @@ static otter_opt_t opt = {.hostname = NULL,
                           .archive_name = NULL,
                           .append_hostname = false};
 
-// The implicit root task
+// Tested inline by the user macros, so they skip calls while tracing is stopped
+int otter_tracing_enabled = 0;
+
+// The implicit root task, written only while Otter is initialised
 static otter_task_context *root_task = NULL;
-static otter_task_context *phase_task = NULL;
+
+// The phases begun by this thread and not yet ended, innermost last. Phases
+// nested too deeply are counted but not recorded
+static thread_local struct {
+  otter_task_context *tasks[PHASE_STACK_MAX_DEPTH];
+  int depth;
+  int ignored;
+} phase_stack = {.depth = 0, .ignored = 0};
+
+// The phase which this thread's tasks belong to while it has no phase of its
+// own, adopted from the thread which began it. This thread holds a reference
+// to the phase until it adopts another
+static thread_local otter_task_context *adopted_phase = NULL;
 
 // TODO: move into trace_state_t
 static pthread_mutex_t task_manager_mutex = PTHREAD_MUTEX_INITIALIZER;
@@ -71,27 +107,141 @@ static thread_local thread_data_t *thread_data = NULL;
 static struct thread_data_queue thread_queue = {
     .instance = NULL, .lock = PTHREAD_MUTEX_INITIALIZER};
 
-static inline thread_data_t *get_thread_data(void) {
-  if (thread_data == NULL) {
-    thread_data = new_thread_data(otter_thread_worker);
-    LOG_DEBUG("allocate thread-local data for thread %" PRIu64,
-              thread_data->id);
-    // add to shared queue for later clean-up
+// Per-thread state (and so locations) released by threads which have exited,
+// for reuse by new threads. If max_live isn't 0, at most max_live are in use
+// at once and a new thread waits for one to be released. Released locations
+// are kept per NUMA node, and a new thread takes one created on its own node,
+// whose buffers are local to it, unless it would otherwise have to wait.
+static struct {
+  otter_stack_t **released; // by node
+  int nodes;
+  uint64_t available_count; // released locations on all nodes
+  uint64_t live;
+  uint64_t max_live;
+  uint64_t created;
+  uint64_t threads;
+  pthread_key_t key; // releases a thread's state when it exits
+  pthread_mutex_t lock;
+  pthread_cond_t available;
+} location_pool = {.released = NULL,
+                   .nodes = 0,
+                   .available_count = 0,
+                   .live = 0,
+                   .max_live = 0,
+                   .created = 0,
+                   .threads = 0,
+                   .lock = PTHREAD_MUTEX_INITIALIZER,
+                   .available = PTHREAD_COND_INITIALIZER};
+
+static void release_thread_data(void *data) {
+  thread_data_t *released = (thread_data_t *)data;
+  LOG_DEBUG("release thread-local data for thread %" PRIu64, released->id);
+  if (adopted_phase != NULL) {
+    release_phase(adopted_phase, released->location);
+    adopted_phase = NULL;
+  }
+  trace_location_release_thread(released->location);
+  thread_data = NULL;
+  int node = trace_location_get_numa_node(released->location);
+  pthread_mutex_lock(&location_pool.lock);
+  stack_push(location_pool.released[node], (data_item_t){.ptr = released});
+  location_pool.available_count++;
+  location_pool.live--;
+  pthread_cond_signal(&location_pool.available);
+  pthread_mutex_unlock(&location_pool.lock);
+}
 
+static thread_data_t *acquire_thread_data(void) {
+  thread_data_t *data = NULL;
+  data_item_t item;
+  int node = trace_numa_current_node();
+  pthread_mutex_lock(&location_pool.lock);
+  bool at_limit = location_pool.max_live > 0 &&
+                  location_pool.live >= location_pool.max_live;
+  while (location_pool.available_count == 0 && at_limit) {
+    pthread_cond_wait(&location_pool.available, &location_pool.lock);
+    at_limit = location_pool.max_live > 0 &&
+               location_pool.live >= location_pool.max_live;
+  }
+  bool reused = stack_pop(location_pool.released[node], &item);
+  for (int k = 0; !reused && at_limit && k < location_pool.nodes; k++) {
+    reused = stack_pop(location_pool.released[k], &item);
+  }
+  if (reused) {
+    data = (thread_data_t *)item.ptr;
+    location_pool.available_count--;
+  } else {
+    location_pool.created++;
+  }
+  location_pool.live++;
+  location_pool.threads++;
+  pthread_mutex_unlock(&location_pool.lock);
+
+  if (data == NULL) {
+    data = new_thread_data(otter_thread_worker);
+    LOG_DEBUG("allocate thread-local data for thread %" PRIu64, data->id);
+    // add to shared queue for later clean-up
     pthread_mutex_lock(&thread_queue.lock);
     if (thread_queue.instance == NULL) {
       thread_queue.instance = queue_create();
     }
-    queue_push(thread_queue.instance, (data_item_t){.ptr = thread_data});
+    queue_push(thread_queue.instance, (data_item_t){.ptr = data});
     pthread_mutex_unlock(&thread_queue.lock);
+  } else {
+    LOG_DEBUG("reuse thread-local data of thread %" PRIu64, data->id);
+  }
+  pthread_setspecific(location_pool.key, data);
+  return data;
+}
+
+static inline thread_data_t *get_thread_data(void) {
+  if (thread_data == NULL) {
+    thread_data = acquire_thread_data();
   }
   return thread_data;
 }
 
+// The parent of a task created without one: this thread's innermost phase,
+// otherwise the phase it adopted, otherwise the root task. Only the implicit
+// root task has no parent.
+static inline otter_task_context *get_default_parent(void) {
+  if (phase_stack.depth > 0) {
+    return phase_stack.tasks[phase_stack.depth - 1];
+  }
+  return adopted_phase != NULL ? adopted_phase : root_task;
+}
+
+// Release a reference to a phase, freeing it with the last one. Tasks created
+// by a thread which adopted the phase after it ended may have left coarse
+// groups open, which are closed first
+static void release_phase(otter_task_context *phase,
+                          trace_location_def_t *location) {
+  if (!otterTaskContext_release(phase)) {
+    return;
+  }
+  if (opt.coarsen_tasks) {
+    otterTaskContext_close_coarse_groups(phase, location);
+  }
+  otterTaskContext_delete(phase);
+}
+
+// Label a task. A label which isn't looked up by its text may be formatted
+// later if defer is set, which needs a format that outlives the trace
 static void otter_register_task_label_va_list(otter_task_context *task,
                                               bool add_to_task_manager,
-                                              const char *format,
+                                              bool defer, const char *format,
                                               va_list args) {
+  if (defer && !add_to_task_manager && trace_label_deferred()) {
+    va_list deferred_args;
+    va_copy(deferred_args, args);
+    otter_string_ref_t task_label_ref =
+        trace_label_defer(format, deferred_args);
+    va_end(deferred_args);
+    if (task_label_ref != OTTER_STRING_UNDEFINED) {
+      otterTaskContext_set_task_label_ref(task, task_label_ref);
+      return;
+    }
+  }
   char label_buffer[LABEL_BUFFER_MAX_CHARS] = {0};
   int chars_required =
       vsnprintf(&label_buffer[0], LABEL_BUFFER_MAX_CHARS, format, args);
@@ -109,6 +259,27 @@ static void otter_register_task_label_va_list(otter_task_context *task,
   otterTaskContext_set_task_label_ref(task, task_label_ref);
 }
 
+// The refs of labels given by their hash, cached per thread so that a label
+// seen before needs neither a lookup in the string registry nor its lock.
+// Labels are identified by their 64-bit hash alone
+static thread_local struct {
+  uint64_t hash;
+  otter_string_ref_t ref;
+} label_hash_cache[LABEL_HASH_CACHE_SLOTS];
+
+static otter_string_ref_t get_hashed_label_ref(const char *label,
+                                               uint64_t label_hash) {
+  size_t slot = (size_t)label_hash & (LABEL_HASH_CACHE_SLOTS - 1);
+  if (label_hash_cache[slot].hash == label_hash &&
+      label_hash_cache[slot].ref != OTTER_STRING_UNDEFINED) {
+    return label_hash_cache[slot].ref;
+  }
+  otter_string_ref_t ref = get_string_ref(label);
+  label_hash_cache[slot].hash = label_hash;
+  label_hash_cache[slot].ref = ref;
+  return ref;
+}
+
 void otterTraceInitialise(const char *file, const char *func, int line) {
   // Initialise archive
 
@@ -119,7 +290,24 @@ void otterTraceInitialise(const char *file, const char *func, int line) {
   opt.tracename = getenv(ENV_VAR_TRACE_OUTPUT);
   opt.tracepath = getenv(ENV_VAR_TRACE_PATH);
   opt.append_hostname = getenv(ENV_VAR_APPEND_HOST) == NULL ? false : true;
+  opt.perf_events = getenv(ENV_VAR_PERF_EVENTS);
+  opt.buffer_budget = getenv(ENV_VAR_BUFFER_BUDGET);
+  opt.event_chunk_size = getenv(ENV_VAR_EVENT_CHUNK_SIZE);
+  opt.def_chunk_size = getenv(ENV_VAR_DEF_CHUNK_SIZE);
+  opt.huge_pages = getenv(ENV_VAR_HUGE_PAGES);
+  opt.sink = getenv(ENV_VAR_SINK);
+  opt.stream_path = getenv(ENV_VAR_STREAM_PATH);
+  opt.flight_size = getenv(ENV_VAR_FLIGHT_SIZE);
+  opt.flight_seconds = getenv(ENV_VAR_FLIGHT_SECONDS);
+  opt.flight_dump_phase = getenv(ENV_VAR_FLIGHT_DUMP_PHASE);
+  opt.segment_phases = getenv(ENV_VAR_SEGMENT_PHASES);
+  opt.compact_shared = getenv(ENV_VAR_COMPACT_SHARED);
+  opt.defer_labels = getenv(ENV_VAR_DEFER_LABELS);
+  opt.coarsen_tasks = getenv(ENV_VAR_COARSEN_TASKS) == NULL ? false : true;
+  opt.phase_templates = getenv(ENV_VAR_PHASE_TEMPLATES) == NULL ? false : true;
   opt.event_model = otter_event_model_task_graph;
+  bool trace_stopped = getenv(ENV_VAR_TRACE_STOPPED) == NULL ? false : true;
+  const char *max_locations = getenv(ENV_VAR_MAX_LOCATIONS);
 
   /* Apply defaults if variables not provided */
   if (opt.tracename == NULL)
@@ -132,6 +320,55 @@ void otterTraceInitialise(const char *file, const char *func, int line) {
   LOG_INFO("%-30s %s", ENV_VAR_TRACE_PATH, opt.tracepath);
   LOG_INFO("%-30s %s", ENV_VAR_TRACE_OUTPUT, opt.tracename);
   LOG_INFO("%-30s %s", ENV_VAR_APPEND_HOST, opt.append_hostname ? "Yes" : "No");
+  LOG_INFO("%-30s %s", ENV_VAR_PERF_EVENTS,
+           opt.perf_events ? opt.perf_events : "(none)");
+  LOG_INFO("%-30s %s", ENV_VAR_BUFFER_BUDGET,
+           opt.buffer_budget ? opt.buffer_budget : "(unlimited)");
+  LOG_INFO("%-30s %s", ENV_VAR_EVENT_CHUNK_SIZE,
+           opt.event_chunk_size ? opt.event_chunk_size : "(default)");
+  LOG_INFO("%-30s %s", ENV_VAR_DEF_CHUNK_SIZE,
+           opt.def_chunk_size ? opt.def_chunk_size : "(default)");
+  LOG_INFO("%-30s %s", ENV_VAR_HUGE_PAGES,
+           opt.huge_pages ? opt.huge_pages : "off");
+  LOG_INFO("%-30s %s", ENV_VAR_SINK, opt.sink ? opt.sink : "otf2");
+  LOG_INFO("%-30s %s", ENV_VAR_STREAM_PATH,
+           opt.stream_path ? opt.stream_path : DEFAULT_STREAM_PATH);
+  LOG_INFO("%-30s %s", ENV_VAR_FLIGHT_SIZE,
+           opt.flight_size ? opt.flight_size : "(default)");
+  LOG_INFO("%-30s %s", ENV_VAR_FLIGHT_SECONDS,
+           opt.flight_seconds ? opt.flight_seconds : "(unlimited)");
+  LOG_INFO("%-30s %s", ENV_VAR_FLIGHT_DUMP_PHASE,
+           opt.flight_dump_phase ? opt.flight_dump_phase : "(none)");
+  LOG_INFO("%-30s %s", ENV_VAR_SEGMENT_PHASES,
+           opt.segment_phases ? opt.segment_phases : "(none)");
+  LOG_INFO("%-30s %s", ENV_VAR_COMPACT_SHARED,
+           opt.compact_shared ? opt.compact_shared : "(none)");
+  LOG_INFO("%-30s %s", ENV_VAR_DEFER_LABELS,
+           opt.defer_labels ? opt.defer_labels : "off");
+  LOG_INFO("%-30s %s", ENV_VAR_COARSEN_TASKS, opt.coarsen_tasks ? "Yes" : "No");
+  LOG_INFO("%-30s %s", ENV_VAR_PHASE_TEMPLATES,
+           opt.phase_templates ? "Yes" : "No");
+  LOG_INFO("%-30s %s", ENV_VAR_TRACE_STOPPED, trace_stopped ? "Yes" : "No");
+  LOG_INFO("%-30s %s", ENV_VAR_MAX_LOCATIONS,
+           max_locations ? max_locations : "(unlimited)");
+
+  if (max_locations != NULL) {
+    char *end = NULL;
+    unsigned long long max = strtoull(max_locations, &end, 10);
+    if (end == max_locations || *end != '\0') {
+      LOG_WARN("ignoring %s=%s (not a number)", ENV_VAR_MAX_LOCATIONS,
+               max_locations);
+    } else {
+      location_pool.max_live = max;
+    }
+  }
+  location_pool.nodes = trace_numa_nodes();
+  location_pool.released =
+      calloc(location_pool.nodes, sizeof(*location_pool.released));
+  for (int node = 0; node < location_pool.nodes; node++) {
+    location_pool.released[node] = stack_create();
+  }
+  pthread_key_create(&location_pool.key, release_thread_data);
 
   trace_initialise(&opt);
   task_manager = trace_task_manager_alloc();
@@ -150,28 +387,35 @@ void otterTraceInitialise(const char *file, const char *func, int line) {
       file, func, line, "OTTER ROOT TASK (%s:%d)", func, line);
 
   // record task-create for root task so that it can still be registered during
-  // post-processing. Must record the parent task ID as OTF2_UNDEFINED_UINT64
-  otterTaskCreate(task, NULL, file, func, line);
-  otterTaskStart(task, file, func, line);
+  // post-processing. Must record the parent task ID as OTF2_UNDEFINED_UINT64.
+  // The root task is recorded even if tracing starts stopped
+  task_create(task, NULL, file, func, line);
+  task_start(task, file, func, line);
 
   // Only store the root task once we're done here so we don't accdentally write
   // an event where it is its own parent
   root_task = task;
 
+  if (!trace_stopped)
+    otterTraceStart();
+
   return;
 }
 
 void otterTraceFinalise(const char *file, const char *func, int line) {
   // Finalise arhchive
   LOG_DEBUG("=== finalising archive ===");
+  otterTraceStop();
 
-  if (phase_task != NULL) {
-    otterPhaseEnd(file, func, line);
+  while (phase_stack.depth + phase_stack.ignored > 0) {
+    phase_end(file, func, line);
   }
+  otterPhaseAdopt(NULL);
 
   // TODO: add implicit synchronisation for root_task here.
 
-  otterTaskEnd(root_task, file, func, line);
+  task_end(root_task, file, func, line);
+  otterTaskContext_delete(root_task);
 
 #if DEBUG_LEVEL >= 3
   otter_queue_t *queue = queue_create();
@@ -188,6 +432,20 @@ void otterTraceFinalise(const char *file, const char *func, int line) {
 
   trace_task_manager_free(task_manager);
 
+  // Threads which exit from now on keep their thread data, which is destroyed
+  // below
+  pthread_key_delete(location_pool.key);
+  for (int node = 0; node < location_pool.nodes; node++) {
+    stack_destroy(location_pool.released[node], false, NULL);
+  }
+  free(location_pool.released);
+  location_pool.released = NULL;
+  if (location_pool.threads > location_pool.created) {
+    fprintf(stderr, "%-30s %" PRIu64 " for %" PRIu64 " threads\n",
+            "Thread locations:", location_pool.created,
+            location_pool.threads);
+  }
+
   // destroy any accumulated thread data
   void *thread_data = NULL;
   while (queue_pop(thread_queue.instance, (data_item_t *)&thread_data)) {
@@ -206,39 +464,121 @@ void otterTraceFinalise(const char *file, const char *func, int line) {
   return;
 }
 
+// Initialise a task labelled by format and args, or if args is NULL by the
+// text of format with the given hash. defer_label says whether the label may
+// be formatted later
+static otter_task_context *
+task_initialise(otter_task_context *parent, int flavour,
+                otter_add_to_pool_t add_to_pool, bool record_task_create_event,
+                const char *file, const char *func, int line,
+                const char *format, uint64_t label_hash, va_list *args,
+                bool defer_label) {
+  LOG_DEBUG("%s:%d in %s", file, line, func);
+  otter_task_context *task = otterTaskContext_alloc();
+  otter_src_ref_t init_ref = get_source_location_ref(
+      (otter_src_location_t){.file = file, .func = func, .line = line});
+
+  // If no parent given, set the current phase (or root) task as the parent.
+  if (parent == NULL) {
+    parent = get_default_parent();
+  }
+
+  otterTaskContext_init(task, parent, flavour, init_ref);
+  if (args != NULL) {
+    otter_register_task_label_va_list(
+        task, add_to_pool == otter_add_to_pool ? true : false, defer_label,
+        format, *args);
+  } else {
+    otterTaskContext_set_task_label_ref(
+        task, get_hashed_label_ref(format, label_hash));
+  }
+
+  // A task initialised while tracing is stopped is still returned so that it
+  // can be ended, but its creation is not recorded
+  if (record_task_create_event && OTTER_TRACING())
+    task_create(task, parent, file, func, line);
+
+  return task;
+}
+
 otter_task_context *otterTaskInitialise(otter_task_context *parent, int flavour,
                                         otter_add_to_pool_t add_to_pool,
                                         bool record_task_create_event,
                                         const char *file, const char *func,
                                         int line, const char *format, ...) {
+  va_list args;
+  va_start(args, format);
+  otter_task_context *task =
+      task_initialise(parent, flavour, add_to_pool, record_task_create_event,
+                      file, func, line, format, 0, &args, true);
+  va_end(args);
+  return task;
+}
+
+otter_task_context *otterTaskInitialiseHashed(otter_task_context *parent,
+                                              int flavour,
+                                              bool record_task_create_event,
+                                              const char *file,
+                                              const char *func, int line,
+                                              const char *label,
+                                              uint64_t label_hash) {
+  return task_initialise(parent, flavour, otter_no_add_to_pool,
+                         record_task_create_event, file, func, line, label,
+                         label_hash, NULL, false);
+}
+
+void otterTaskInitialiseBatch(otter_task_context *parent, size_t n, int flavour,
+                              otter_task_context **tasks, const char *file,
+                              const char *func, int line, const char *format,
+                              ...) {
   LOG_DEBUG("%s:%d in %s", file, line, func);
-  otter_task_context *task = otterTaskContext_alloc();
+  if (tasks == NULL || n == 0) {
+    LOG_ERROR("IGNORED (tried to initialise an empty batch at %s:%d in %s)",
+              file, line, func);
+    return;
+  }
+  for (size_t k = 0; k < n; k++) {
+    tasks[k] = otterTaskContext_alloc();
+  }
   otter_src_ref_t init_ref = get_source_location_ref(
       (otter_src_location_t){.file = file, .func = func, .line = line});
 
   // If no parent given, set the current phase (or root) task as the parent.
-  // Only the implicit root task may have a NULL parent.
   if (parent == NULL) {
-    if (phase_task != NULL) {
-      parent = phase_task;
-    } else if (root_task != NULL) {
-      parent = root_task;
-    } else {
-      parent = NULL;
-    }
+    parent = get_default_parent();
   }
 
-  otterTaskContext_init(task, parent, flavour, init_ref);
+  unique_id_t first_id =
+      otterTaskContext_init_batch(tasks, n, parent, flavour, init_ref);
+
+  // The siblings share one label, formatted (or deferred) once
   va_list args;
   va_start(args, format);
-  otter_register_task_label_va_list(
-      task, add_to_pool == otter_add_to_pool ? true : false, format, args);
+  otter_register_task_label_va_list(tasks[0], false, true, format, args);
   va_end(args);
+  otter_string_ref_t label_ref = otterTaskContext_get_task_label_ref(tasks[0]);
+  for (size_t k = 1; k < n; k++) {
+    otterTaskContext_set_task_label_ref(tasks[k], label_ref);
+  }
 
-  if (record_task_create_event)
-    otterTaskCreate(task, parent, file, func, line);
+  // Templates and coarsening consider each task in turn
+  if (!OTTER_TRACING()) {
+    LOG_DEBUG("[%lu-%lu] not recording creation (tracing stopped)", first_id,
+              first_id + n - 1);
+  } else if (opt.phase_templates || opt.coarsen_tasks) {
+    for (size_t k = 0; k < n; k++) {
+      task_create(tasks[k], parent, file, func, line);
+    }
+  } else {
+    unique_id_t parent_id = otterTaskContext_get_graph_id(parent);
 
-  return task;
+    LOG_DEBUG("[%lu-%lu] create %zu tasks (children of %lu)", first_id,
+              first_id + n - 1, n, parent_id);
+
+    trace_graph_event_task_create_batch(get_thread_data()->location,
+                                        parent_id, first_id, n, label_ref,
+                                        init_ref);
+  }
 }
 
 void otterTaskCreate(otter_task_context *task, otter_task_context *parent,
@@ -248,23 +588,42 @@ void otterTaskCreate(otter_task_context *task, otter_task_context *parent,
               func);
     return;
   }
+  if (!OTTER_TRACING()) {
+    return;
+  }
 
   // If no parent given, set the current phase (or root) task as the parent.
-  // Only the implicit root task may have a NULL parent.
   if (parent == NULL) {
-    if (phase_task != NULL) {
-      parent = phase_task;
-    } else if (root_task != NULL) {
-      parent = root_task;
-    } else {
-      parent = NULL;
-    }
+    parent = get_default_parent();
   }
+  task_create(task, parent, file, func, line);
+}
 
+static void task_create(otter_task_context *task, otter_task_context *parent,
+                        const char *file, const char *func, int line) {
   otter_src_ref_t create_ref = get_source_location_ref(
       (otter_src_location_t){.file = file, .func = func, .line = line});
 
-  unique_id_t parent_id = otterTaskContext_get_task_context_id(parent);
+  // A task within a phase is recorded in the phase's graph, which makes
+  // coarsening it unnecessary
+  if (opt.phase_templates) {
+    trace_template_ref_t ref;
+    bool templated = trace_template_task_create(
+        otterTaskContext_get_template_ref(parent),
+        otterTaskContext_get_task_label_ref(task),
+        otterTaskContext_get_task_flavour(task),
+        otterTaskContext_get_task_context_id(task), &ref);
+    otterTaskContext_set_template_ref(task, ref);
+    if (templated)
+      return;
+  }
+
+  // A task folded into a sibling is recorded only through that sibling
+  if (opt.coarsen_tasks && otterTaskContext_coarsen(task, parent)) {
+    return;
+  }
+
+  unique_id_t parent_id = otterTaskContext_get_graph_id(parent);
   unique_id_t child_id = otterTaskContext_get_task_context_id(task);
   otter_string_ref_t label_ref = otterTaskContext_get_task_label_ref(task);
 
@@ -282,6 +641,27 @@ otter_task_context *otterTaskStart(otter_task_context *task, const char *file,
               func);
     return NULL;
   }
+  if (!OTTER_TRACING()) {
+    return task;
+  }
+  return task_start(task, file, func, line);
+}
+
+// Record the start of a task, which means its end is recorded too
+static otter_task_context *task_start(otter_task_context *task,
+                                      const char *file, const char *func,
+                                      int line) {
+  otterTaskContext_set_started(task);
+  if (opt.phase_templates &&
+      trace_template_task_start(otterTaskContext_get_template_ref(task),
+                                get_thread_data()->location)) {
+    return task;
+  }
+  if (opt.coarsen_tasks) {
+    otterTaskContext_coarse_start(task);
+    if (otterTaskContext_is_folded(task))
+      return task;
+  }
   // TODO: not great to pass this struct by value since I only need a few of the
   // fields here
   trace_task_region_attr_t task_attr;
@@ -301,21 +681,126 @@ otter_task_context *otterTaskStart(otter_task_context *task, const char *file,
   return task;
 }
 
+// Record the end of a task. The caller frees its context
+static void task_end(otter_task_context *task, const char *file,
+                     const char *func, int line) {
+  LOG_DEBUG("[%lu] end task", otterTaskContext_get_task_context_id(task));
+  if (opt.phase_templates &&
+      trace_template_task_end(otterTaskContext_get_template_ref(task))) {
+    return;
+  }
+  trace_location_def_t *location = get_thread_data()->location;
+  if (opt.coarsen_tasks) {
+    otterTaskContext_close_coarse_groups(task, location);
+  }
+  if (!otterTaskContext_is_folded(task)) {
+    otter_src_ref_t end_ref = get_source_location_ref(
+        (otter_src_location_t){.file = file, .func = func, .line = line});
+    trace_graph_event_task_end(location,
+                               otterTaskContext_get_task_context_id(task),
+                               end_ref);
+  }
+  if (opt.coarsen_tasks) {
+    otterTaskContext_coarse_end(task, location);
+  }
+}
+
+// End a task whose start wasn't recorded without recording it. Groups waiting
+// for the task are released so that they are freed too. The caller frees its
+// context
+static void discard_task(otter_task_context *task) {
+  LOG_DEBUG("[%lu] discard task", otterTaskContext_get_task_context_id(task));
+  if (opt.coarsen_tasks) {
+    otterTaskContext_close_coarse_groups(task, NULL);
+    otterTaskContext_coarse_end(task, NULL);
+  }
+}
+
+// A task's end is recorded if its start was, even if tracing has stopped since
 void otterTaskEnd(otter_task_context *task, const char *file, const char *func,
                   int line) {
-  LOG_DEBUG("[%lu] end task", otterTaskContext_get_task_context_id(task));
+  if (otterTaskContext_is_started(task)) {
+    task_end(task, file, func, line);
+  } else {
+    discard_task(task);
+  }
+  otterTaskContext_delete(task);
+}
+
+// Whether a batch event can stand for these tasks: their IDs must be
+// consecutive, and templates and coarsening must not need each task in turn
+static bool can_record_as_batch(otter_task_context **tasks, size_t n) {
+  if (opt.phase_templates || opt.coarsen_tasks || tasks[0] == NULL) {
+    return false;
+  }
+  unique_id_t first_id = otterTaskContext_get_task_context_id(tasks[0]);
+  for (size_t k = 1; k < n; k++) {
+    if (tasks[k] == NULL ||
+        otterTaskContext_get_task_context_id(tasks[k]) != first_id + k) {
+      return false;
+    }
+  }
+  return true;
+}
+
+void otterTaskStartBatch(otter_task_context **tasks, size_t n, const char *file,
+                         const char *func, int line) {
+  if (tasks == NULL || n == 0 || !OTTER_TRACING()) {
+    return;
+  }
+  if (!can_record_as_batch(tasks, n)) {
+    for (size_t k = 0; k < n; k++) {
+      otterTaskStart(tasks[k], file, func, line);
+    }
+    return;
+  }
+  for (size_t k = 0; k < n; k++) {
+    otterTaskContext_set_started(tasks[k]);
+  }
+  unique_id_t first_id = otterTaskContext_get_task_context_id(tasks[0]);
+  LOG_DEBUG("[%lu-%lu] begin %zu tasks", first_id, first_id + n - 1, n);
+  otter_src_ref_t start_ref = get_source_location_ref(
+      (otter_src_location_t){.file = file, .func = func, .line = line});
+  trace_graph_event_task_begin_batch(get_thread_data()->location, first_id, n,
+                                     start_ref);
+}
+
+void otterTaskEndBatch(otter_task_context **tasks, size_t n, const char *file,
+                       const char *func, int line) {
+  if (tasks == NULL || n == 0) {
+    return;
+  }
+  // A batch event stands only for tasks whose starts were all recorded
+  bool started = can_record_as_batch(tasks, n);
+  for (size_t k = 0; started && k < n; k++) {
+    started = otterTaskContext_is_started(tasks[k]);
+  }
+  if (!started) {
+    for (size_t k = 0; k < n; k++) {
+      if (tasks[k] == NULL) {
+        LOG_ERROR("IGNORED (tried to end null task at %s:%d in %s)", file,
+                  line, func);
+        continue;
+      }
+      otterTaskEnd(tasks[k], file, func, line);
+    }
+    return;
+  }
+  unique_id_t first_id = otterTaskContext_get_task_context_id(tasks[0]);
+  LOG_DEBUG("[%lu-%lu] end %zu tasks", first_id, first_id + n - 1, n);
   otter_src_ref_t end_ref = get_source_location_ref(
       (otter_src_location_t){.file = file, .func = func, .line = line});
-  trace_graph_event_task_end(get_thread_data()->location,
-                             otterTaskContext_get_task_context_id(task),
-                             end_ref);
-  otterTaskContext_delete(task);
+  trace_graph_event_task_end_batch(get_thread_data()->location, first_id, n,
+                                   end_ref);
+  for (size_t k = 0; k < n; k++) {
+    otterTaskContext_delete(tasks[k]);
+  }
 }
 
 void otterTaskPushLabel(otter_task_context *task, const char *format, ...) {
   va_list args;
   va_start(args, format);
-  otter_register_task_label_va_list(task, true, format, args);
+  otter_register_task_label_va_list(task, true, false, format, args);
   va_end(args);
   return;
 }
@@ -362,75 +847,142 @@ void otterSynchroniseTasks(otter_task_context *task, otter_task_sync_t mode,
                            otter_endpoint_t endpoint, const char *file,
                            const char *func, int line) {
   LOG_DEBUG("synchronise tasks: %d", mode);
+  if (!OTTER_TRACING()) {
+    return;
+  }
+
+  if (task == NULL) {
+    task = get_default_parent();
+  }
+  synchronise_tasks(task, mode, endpoint, file, func, line);
+}
 
+static void synchronise_tasks(otter_task_context *task, otter_task_sync_t mode,
+                              otter_endpoint_t endpoint, const char *file,
+                              const char *func, int line) {
   otter_src_ref_t src_ref = get_source_location_ref(
       (otter_src_location_t){.file = file, .func = func, .line = line});
 
-  if (task == NULL) {
-    if (phase_task != NULL) {
-      task = phase_task;
-    } else {
-      task = root_task;
-    }
+  if (opt.phase_templates &&
+      trace_template_sync(otterTaskContext_get_template_ref(task), endpoint,
+                          mode == otter_sync_descendants)) {
+    return;
+  }
+
+  // Children created after a synchronisation start new coarse groups
+  if (opt.coarsen_tasks && endpoint != otter_endpoint_leave) {
+    otterTaskContext_close_coarse_groups(task, get_thread_data()->location);
   }
 
   trace_sync_region_attr_t sync_attr;
   sync_attr.type = otter_sync_region_taskwait;
   sync_attr.sync_descendant_tasks =
       mode == otter_sync_descendants ? true : false;
-  sync_attr.encountering_task_id = otterTaskContext_get_task_context_id(task);
+  sync_attr.encountering_task_id = otterTaskContext_get_graph_id(task);
   trace_graph_synchronise_tasks(get_thread_data()->location,
-                                otterTaskContext_get_task_context_id(task),
-                                sync_attr, endpoint, src_ref);
+                                otterTaskContext_get_graph_id(task), sync_attr,
+                                endpoint, src_ref);
   return;
 }
 
-void otterTraceStart(void) { LOG_DEBUG("not currently implemented - ignored"); }
+void otterTraceStart(void) {
+  __atomic_store_n(&otter_tracing_enabled, 1, __ATOMIC_RELAXED);
+}
 
-void otterTraceStop(void) { LOG_DEBUG("not currently implemented - ignored"); }
+void otterTraceStop(void) {
+  __atomic_store_n(&otter_tracing_enabled, 0, __ATOMIC_RELAXED);
+}
+
+void otterTraceDump(void) { trace_flight_dump(); }
 
 void otterPhaseBegin(const char *name, const char *file, const char *func,
                      int line) {
+  // A phase begun while tracing is stopped, and the phases within it, are
+  // counted so that their ends are matched but are not recorded
+  if (!OTTER_TRACING()) {
+    phase_stack.ignored++;
+    return;
+  }
+  trace_flight_phase_begin(name);
 #if OTTER_USE_PHASES
   assert(name != NULL);
-  assert(phase_task == NULL);
   assert(root_task != NULL);
-  phase_task = otterTaskInitialise(
-      root_task, 0, otter_no_add_to_pool, true, file, func, line,
+  if (phase_stack.depth == PHASE_STACK_MAX_DEPTH || phase_stack.ignored > 0) {
+    if (phase_stack.ignored == 0) {
+      LOG_ERROR("phases nested more than %d deep - ignoring (name=%s)",
+                PHASE_STACK_MAX_DEPTH, name);
+    }
+    phase_stack.ignored++;
+    return;
+  }
+  // Only a thread's outermost phases divide the trace into segments
+  if (phase_stack.depth == 0) {
+    trace_segment_phase_begin(name);
+  }
+  otter_task_context *parent =
+      phase_stack.depth > 0 ? phase_stack.tasks[phase_stack.depth - 1]
+                            : root_task;
+  otter_task_context *phase = otterTaskInitialise(
+      parent, 0, otter_no_add_to_pool, true, file, func, line,
       "OTTER PHASE: \"%s\" (%s:%d)", name, func, line);
-  unique_id_t phase_id = otterTaskContext_get_task_context_id(phase_task);
+  unique_id_t phase_id = otterTaskContext_get_task_context_id(phase);
   LOG_DEBUG("<phase %lu> OTTER PHASE: \"%s\" (%s:%d)", phase_id, name,
-            source.func, source.line);
-  otterTaskStart(phase_task, file, func, line);
+            func, line);
+  task_start(phase, file, func, line);
+  if (opt.phase_templates) {
+    // A phase nested in a templated phase is recorded as one of its tasks
+    trace_template_ref_t ref = trace_template_phase_begin(phase_id);
+    if (ref.phase != 0)
+      otterTaskContext_set_template_ref(phase, ref);
+  }
+  phase_stack.tasks[phase_stack.depth++] = phase;
 #else
+  trace_segment_phase_begin(name);
   LOG_WARN("phases are disabled - ignoring (name=%s)", name);
 #endif
   return;
 }
 
-void otterPhaseEnd(const char *file, const char *func, int line) {
+// End the calling thread's innermost phase. Its start was recorded, so its end
+// is recorded even if tracing has stopped since
+static void phase_end(const char *file, const char *func, int line) {
 #if OTTER_USE_PHASES
-  assert(phase_task != NULL);
-  unique_id_t phase_id = otterTaskContext_get_task_context_id(phase_task);
-  LOG_DEBUG("<phase %lu> (%s:%d)", phase_id, source.func, source.line);
-  otterTaskEnd(phase_task, file, func, line);
-
-  // All phases are implicitly synchronised to indicate that they must happen
-  // sequentially
-  otterSynchroniseTasks(root_task, otter_sync_children, otter_endpoint_discrete,
-                        file, func, line);
-
-  phase_task = NULL;
+  if (phase_stack.ignored > 0) {
+    phase_stack.ignored--;
+    return;
+  }
+  if (phase_stack.depth == 0) {
+    LOG_ERROR("IGNORED (no phase to end at %s:%d in %s)", file, line, func);
+    return;
+  }
+  otter_task_context *phase = phase_stack.tasks[--phase_stack.depth];
+  otter_task_context *parent =
+      phase_stack.depth > 0 ? phase_stack.tasks[phase_stack.depth - 1]
+                            : root_task;
+  unique_id_t phase_id = otterTaskContext_get_task_context_id(phase);
+  LOG_DEBUG("<phase %lu> (%s:%d)", phase_id, func, line);
+  task_end(phase, file, func, line);
+  trace_template_phase_end(otterTaskContext_get_template_ref(phase));
+
+  // Phases are implicitly synchronised by the enclosing phase (or the root
+  // task) to indicate that they must happen sequentially
+  synchronise_tasks(parent, otter_sync_children, otter_endpoint_discrete, file,
+                    func, line);
+  release_phase(phase, get_thread_data()->location);
 #else
   LOG_WARN("phases are disabled - ignoring.");
 #endif
   return;
 }
 
+void otterPhaseEnd(const char *file, const char *func, int line) {
+  phase_end(file, func, line);
+}
+
 void otterPhaseSwitch(const char *name, const char *file, const char *func,
                       int line) {
 #if OTTER_USE_PHASES
-  if (phase_task != NULL) {
+  if (phase_stack.depth + phase_stack.ignored > 0) {
     otterPhaseEnd(file, func, line);
   }
   otterPhaseBegin(name, file, func, line);
@@ -440,6 +992,25 @@ void otterPhaseSwitch(const char *name, const char *file, const char *func,
   return;
 }
 
+otter_task_context *otterPhaseCurrent(void) {
+  return phase_stack.depth > 0 ? phase_stack.tasks[phase_stack.depth - 1]
+                               : NULL;
+}
+
+void otterPhaseAdopt(otter_task_context *phase) {
+  if (phase == adopted_phase) {
+    return;
+  }
+  otterTaskContext_acquire(phase);
+  if (adopted_phase != NULL) {
+    release_phase(adopted_phase, get_thread_data()->location);
+  } else if (phase != NULL) {
+    // The thread's data is released when it exits, and the phase with it
+    get_thread_data();
+  }
+  adopted_phase = phase;
+}
+
 static void debug_print_count(const char *str, int count, void *data) {
   LOG_DEBUG("%s %d", str, count);
   return;
@@ -463,15 +1034,31 @@ Fortran code which requires them, since Fortran doesn't support variadic
 functions.
 */
 
+static otter_task_context *
+task_initialise_eager(otter_task_context *parent, int flavour,
+                      otter_add_to_pool_t add_to_pool,
+                      bool record_task_create_event, const char *file,
+                      const char *func, int line, const char *format, ...) {
+  va_list args;
+  va_start(args, format);
+  otter_task_context *task =
+      task_initialise(parent, flavour, add_to_pool, record_task_create_event,
+                      file, func, line, format, 0, &args, false);
+  va_end(args);
+  return task;
+}
+
+// The label of a Fortran task is a temporary copy of its tag, so it is never
+// deferred
 otter_task_context *otterTaskInitialise_f(otter_task_context *parent,
                                           int flavour,
                                           otter_add_to_pool_t add_to_pool,
                                           bool record_task_create_event,
                                           const char *file, const char *func,
                                           int line, const char *format) {
-  return otterTaskInitialise(parent, flavour, add_to_pool,
-                             record_task_create_event, file, func, line,
-                             format);
+  return task_initialise_eager(parent, flavour, add_to_pool,
+                               record_task_create_event, file, func, line,
+                               format);
 }
 
 void otterTaskPushLabel_f(otter_task_context *task, const char *format) {
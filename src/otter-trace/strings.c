@@ -1,10 +1,15 @@
 #include "public/otter-trace/strings.h"
+#include "trace-sink.h"
 #include "trace-state.h"
 
 otter_string_ref_t get_string_ref(const char *string) {
   otter_string_ref_t string_ref = OTTER_STRING_UNDEFINED;
-  pthread_mutex_lock(&state.strings.lock);
-  string_ref = string_registry_insert(state.strings.instance, string);
-  pthread_mutex_unlock(&state.strings.lock);
+  int is_new = 0;
+  trace_lock(&state.strings.lock);
+  string_ref =
+      string_registry_insert_new(state.strings.instance, string, &is_new);
+  if (is_new && trace_sink_get()->define_string != NULL)
+    trace_sink_get()->define_string(string_ref, string);
+  trace_unlock(&state.strings.lock);
   return string_ref;
 }
@@ -20,8 +20,10 @@
 #include "public/otter-version.h"
 
 #include "trace-archive-impl.h"
+#include "trace-archive.h"
 #include "trace-attributes.h"
 #include "trace-check-error-code.h"
+#include "trace-memory.h"
 #include "trace-static-constants.h"
 #include "trace-timestamp.h"
 #include "trace-unique-refs.h"
@@ -42,6 +44,37 @@ static OTF2_TimeStamp post_flush(void *userData, OTF2_FileType fileType,
   return get_timestamp();
 }
 
+/**
+ * @brief Get the value of the OTTER::EVENT_MODEL property and the name of the
+ * location group for an event model.
+ */
+void trace_archive_event_model_names(otter_event_model_t event_model,
+                                     const char **event_model_name,
+                                     const char **location_group_name) {
+  switch (event_model) {
+  case otter_event_model_omp:
+    *event_model_name = "OMP";
+    *location_group_name = "OMP Process";
+    break;
+
+  case otter_event_model_serial:
+    // otter-serial uses the same event model as otter-ompt
+    *event_model_name = "OMP";
+    *location_group_name = "Serial Process";
+    break;
+
+  case otter_event_model_task_graph:
+    *event_model_name = "TASKGRAPH";
+    *location_group_name = "Task-graph Process";
+    break;
+
+  default:
+    *event_model_name = "UNKNOWN";
+    *location_group_name = "Unknown Process";
+    break;
+  }
+}
+
 bool trace_initialise_archive(const char *archive_path,
                               const char *archive_name,
                               otter_event_model_t event_model,
@@ -53,11 +86,14 @@ bool trace_initialise_archive(const char *archive_path,
   OTF2_Archive *_archive =
       OTF2_Archive_Open(archive_path, /* archive path */
                         archive_name, /* archive name */
-                        OTF2_FILEMODE_WRITE, OTF2_CHUNK_SIZE_EVENTS_DEFAULT,
-                        OTF2_CHUNK_SIZE_DEFINITIONS_DEFAULT,
-                        OTF2_SUBSTRATE_POSIX, OTF2_COMPRESSION_NONE);
+                        OTF2_FILEMODE_WRITE, trace_memory_event_chunk_size(),
+                        trace_memory_def_chunk_size(), OTF2_SUBSTRATE_POSIX,
+                        OTF2_COMPRESSION_NONE);
   *archive = _archive;
 
+  /* allocate buffer chunks from Otter's arena */
+  trace_memory_set_callbacks(_archive);
+
   /* set flush callbacks */
   static OTF2_FlushCallbacks on_flush = {.otf2_pre_flush = pre_flush,
                                          .otf2_post_flush = post_flush};
@@ -82,28 +118,8 @@ bool trace_initialise_archive(const char *archive_path,
   /* detect the chosen event model and set the trace property for this */
   const char *event_model_name = NULL;
   const char *location_group_name = NULL;
-  switch (event_model) {
-  case otter_event_model_omp:
-    event_model_name = "OMP";
-    location_group_name = "OMP Process";
-    break;
-
-  case otter_event_model_serial:
-    // otter-serial uses the same event model as otter-ompt
-    event_model_name = "OMP";
-    location_group_name = "Serial Process";
-    break;
-
-  case otter_event_model_task_graph:
-    event_model_name = "TASKGRAPH";
-    location_group_name = "Task-graph Process";
-    break;
-
-  default:
-    event_model_name = "UNKNOWN";
-    location_group_name = "Unknown Process";
-    break;
-  }
+  trace_archive_event_model_names(event_model, &event_model_name,
+                                  &location_group_name);
 
   ret = OTF2_Archive_SetProperty(_archive, "OTTER::EVENT_MODEL",
                                  event_model_name, true);
@@ -23,5 +23,8 @@ bool trace_initialise_archive(const char *archive_path,
                               OTF2_Archive **archive,
                               OTF2_GlobalDefWriter **global_def_writer);
 bool trace_finalise_archive(OTF2_Archive *archive);
+void trace_archive_event_model_names(otter_event_model_t event_model,
+                                     const char **event_model_name,
+                                     const char **location_group_name);
 
 #endif // OTTER_TRACE_ARCHIVE_H
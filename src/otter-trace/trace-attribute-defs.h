@@ -59,6 +59,39 @@ INCLUDE_ATTRIBUTE(OTF2_TYPE_STRING, workshare_type, "type of workshare region")
 INCLUDE_ATTRIBUTE(OTF2_TYPE_UINT64, workshare_count,
                   "number of iterations associated with workshare region")
 
+/* Statistics of the iterations of a loop recorded by otter-serial, added to
+   the loop's workshare-end event. Times are in ns */
+INCLUDE_ATTRIBUTE(OTF2_TYPE_UINT64, loop_iterations,
+                  "number of iterations of a loop")
+INCLUDE_ATTRIBUTE(OTF2_TYPE_UINT64, loop_total_time,
+                  "total time in ns from start to end of a loop's iterations")
+INCLUDE_ATTRIBUTE(OTF2_TYPE_UINT64, loop_min_time,
+                  "shortest time in ns from start to end of a loop iteration")
+INCLUDE_ATTRIBUTE(OTF2_TYPE_UINT64, loop_max_time,
+                  "longest time in ns from start to end of a loop iteration")
+INCLUDE_ATTRIBUTE(OTF2_TYPE_UINT64, loop_iterations_under_100ns,
+                  "number of loop iterations shorter than 100ns")
+INCLUDE_ATTRIBUTE(OTF2_TYPE_UINT64, loop_iterations_under_1us,
+                  "number of loop iterations from 100ns to 1us")
+INCLUDE_ATTRIBUTE(OTF2_TYPE_UINT64, loop_iterations_under_10us,
+                  "number of loop iterations from 1us to 10us")
+INCLUDE_ATTRIBUTE(OTF2_TYPE_UINT64, loop_iterations_under_100us,
+                  "number of loop iterations from 10us to 100us")
+INCLUDE_ATTRIBUTE(OTF2_TYPE_UINT64, loop_iterations_under_1ms,
+                  "number of loop iterations from 100us to 1ms")
+INCLUDE_ATTRIBUTE(OTF2_TYPE_UINT64, loop_iterations_under_10ms,
+                  "number of loop iterations from 1ms to 10ms")
+INCLUDE_ATTRIBUTE(OTF2_TYPE_UINT64, loop_iterations_under_100ms,
+                  "number of loop iterations from 10ms to 100ms")
+INCLUDE_ATTRIBUTE(OTF2_TYPE_UINT64, loop_iterations_over_100ms,
+                  "number of loop iterations of 100ms or longer")
+
+/* A sampled loop iteration, recorded when requested with OTTER_LOOP_SAMPLE */
+INCLUDE_ATTRIBUTE(OTF2_TYPE_UINT64, loop_iteration,
+                  "index of a loop iteration, counted from 0")
+INCLUDE_ATTRIBUTE(OTF2_TYPE_UINT64, loop_iteration_time,
+                  "time in ns from start to end of a loop iteration")
+
 /* Attributes relating to sync regions (barrier, taskgroup, taskwait) */
 INCLUDE_ATTRIBUTE(OTF2_TYPE_STRING, sync_type, "type of synchronisation region")
 INCLUDE_ATTRIBUTE(OTF2_TYPE_UINT8, sync_descendant_tasks,
@@ -71,6 +104,72 @@ INCLUDE_ATTRIBUTE(OTF2_TYPE_UINT32, task_flags, "flags set for this task")
 INCLUDE_ATTRIBUTE(OTF2_TYPE_UINT8, task_has_dependences,
                   "whether this task has dependences")
 
+/* The number of tasks with consecutive IDs, from unique_id (task_create_batch)
+   or encountering_task_id (task_enter_batch and task_leave_batch), which a
+   batch event stands for */
+INCLUDE_ATTRIBUTE(OTF2_TYPE_UINT64, task_batch_size,
+                  "number of consecutive tasks a batch event records")
+
+/* Attributes of a task standing for sibling tasks folded into it, recorded
+   when requested with OTTER_COARSEN_TASKS */
+INCLUDE_ATTRIBUTE(OTF2_TYPE_UINT64, coarsened_tasks,
+                  "number of sibling tasks a task stands for, itself included")
+INCLUDE_ATTRIBUTE(OTF2_TYPE_UINT64, coarsened_total_time,
+                  "total time in ns from start to end of the coarsened tasks")
+INCLUDE_ATTRIBUTE(OTF2_TYPE_UINT64, coarsened_min_time,
+                  "shortest time in ns from start to end of a coarsened task")
+INCLUDE_ATTRIBUTE(OTF2_TYPE_UINT64, coarsened_max_time,
+                  "longest time in ns from start to end of a coarsened task")
+
+/* Attributes relating to task dependences */
+INCLUDE_ATTRIBUTE(OTF2_TYPE_UINT64, dependence_variable,
+                  "address of a dependence variable or doacross iteration")
+INCLUDE_ATTRIBUTE(OTF2_TYPE_STRING, dependence_type, "type of a dependence")
+INCLUDE_LABEL(dependence_type, in)
+INCLUDE_LABEL(dependence_type, out)
+INCLUDE_LABEL(dependence_type, inout)
+INCLUDE_LABEL(dependence_type, mutexinoutset)
+INCLUDE_LABEL(dependence_type, source)
+INCLUDE_LABEL(dependence_type, sink)
+INCLUDE_LABEL(dependence_type, inoutset)
+INCLUDE_ATTRIBUTE(OTF2_TYPE_UINT64, dependence_source_task_id,
+                  "unique ID of the task which must complete first")
+INCLUDE_ATTRIBUTE(OTF2_TYPE_UINT64, dependence_sink_task_id,
+                  "unique ID of the task which depends on the source task")
+
+/* Attributes relating to mutexes (locks, critical, ordered and atomic) */
+INCLUDE_ATTRIBUTE(OTF2_TYPE_UINT64, mutex_wait_id,
+                  "wait ID of a lock, critical, ordered or atomic mutex")
+INCLUDE_ATTRIBUTE(OTF2_TYPE_STRING, mutex_kind, "kind of mutex")
+INCLUDE_LABEL(mutex_kind, lock)
+INCLUDE_LABEL(mutex_kind, test_lock)
+INCLUDE_LABEL(mutex_kind, nest_lock)
+INCLUDE_LABEL(mutex_kind, test_nest_lock)
+INCLUDE_LABEL(mutex_kind, critical)
+INCLUDE_LABEL(mutex_kind, atomic)
+INCLUDE_LABEL(mutex_kind, ordered)
+INCLUDE_ATTRIBUTE(OTF2_TYPE_UINT64, mutex_wait_time,
+                  "time in ns a thread waited to acquire a mutex")
+INCLUDE_ATTRIBUTE(OTF2_TYPE_UINT64, mutex_hold_time,
+                  "time in ns a thread held a mutex")
+
+/* Performance counter deltas accrued by a thread since its previous task event,
+   recorded when requested with OTTER_PERF_EVENTS */
+INCLUDE_ATTRIBUTE(OTF2_TYPE_UINT64, perf_cycles, "CPU cycles")
+INCLUDE_ATTRIBUTE(OTF2_TYPE_UINT64, perf_instructions, "instructions retired")
+INCLUDE_ATTRIBUTE(OTF2_TYPE_UINT64, perf_cache_references,
+                  "last-level cache references")
+INCLUDE_ATTRIBUTE(OTF2_TYPE_UINT64, perf_cache_misses,
+                  "last-level cache misses")
+INCLUDE_ATTRIBUTE(OTF2_TYPE_UINT64, perf_branches, "branch instructions")
+INCLUDE_ATTRIBUTE(OTF2_TYPE_UINT64, perf_branch_misses,
+                  "mispredicted branch instructions")
+INCLUDE_ATTRIBUTE(OTF2_TYPE_UINT64, perf_task_clock,
+                  "time in ns the thread was running on a cpu")
+INCLUDE_ATTRIBUTE(OTF2_TYPE_UINT64, perf_context_switches, "context switches")
+INCLUDE_ATTRIBUTE(OTF2_TYPE_UINT64, perf_cpu_migrations, "cpu migrations")
+INCLUDE_ATTRIBUTE(OTF2_TYPE_UINT64, perf_page_faults, "page faults")
+
 /* Attributes relating to phase regions */
 INCLUDE_ATTRIBUTE(OTF2_TYPE_STRING, phase_type,
                   "type of synchronisation region")
@@ -94,6 +193,15 @@ INCLUDE_LABEL(event_type, master_begin)
 INCLUDE_LABEL(event_type, master_end)
 INCLUDE_LABEL(event_type, phase_begin)
 INCLUDE_LABEL(event_type, phase_end)
+INCLUDE_LABEL(event_type, task_dependence)
+INCLUDE_LABEL(event_type, task_dependence_pair)
+INCLUDE_LABEL(event_type, mutex_acquired)
+INCLUDE_LABEL(event_type, mutex_released)
+INCLUDE_LABEL(event_type, task_coarsened)
+INCLUDE_LABEL(event_type, loop_iteration)
+INCLUDE_LABEL(event_type, task_create_batch)
+INCLUDE_LABEL(event_type, task_enter_batch)
+INCLUDE_LABEL(event_type, task_leave_batch)
 
 /* Result of call to sched_getcpu() */
 INCLUDE_ATTRIBUTE(OTF2_TYPE_INT32, cpu,
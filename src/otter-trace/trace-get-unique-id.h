@@ -1,6 +1,7 @@
 #include "public/otter-common.h"
+#include "trace-state.h"
 
 static unique_id_t get_unique_id(void) {
   static unique_id_t id = 0;
-  return __sync_fetch_and_add(&id, 1L);
+  return trace_next_u64(&id);
 }
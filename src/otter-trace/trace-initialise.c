@@ -1,7 +1,14 @@
 #define _GNU_SOURCE
 #include "public/otter-trace/trace-initialise.h"
+#include "public/otter-trace/trace-label.h"
+#include "public/otter-trace/trace-loop.h"
+#include "public/otter-trace/trace-mutex.h"
+#include "public/otter-trace/trace-perf.h"
+#include "public/otter-trace/trace-template.h"
 #include "trace-archive-impl.h"
 #include "trace-archive.h"
+#include "trace-memory.h"
+#include "trace-sink.h"
 #include "public/debug.h"
 #include <errno.h>
 #include <stdio.h>
@@ -29,6 +36,12 @@ static void write_str_ref_cbk(const char *s, OTF2_StringRef ref,
 static void trace_copy_proc_maps(otter_opt_t *opt);
 
 bool trace_initialise(otter_opt_t *opt) {
+  // The serial event model records every event from the thread which
+  // initialised it, so the trace needs no locks or atomic refs
+  state.single_threaded = opt->event_model == otter_event_model_serial;
+  if (state.single_threaded)
+    fprintf(stderr, "%-30s %s\n", "Trace locking:", "off (single thread)");
+
   // Determine the archive name from the options
   static char archive_name[default_name_buf_sz + 1] = {0};
   char *p = &archive_name[0];
@@ -62,6 +75,10 @@ bool trace_initialise(otter_opt_t *opt) {
   /* Store archive name in options struct */
   opt->archive_name = &archive_name[0];
 
+  trace_memory_initialise(opt);
+
+  trace_sink_initialise(opt);
+
   bool archive_initialised = trace_initialise_archive(
       &archive_path[0], opt->archive_name, opt->event_model,
       &state.archive.instance, &state.global_def_writer.instance);
@@ -70,6 +87,16 @@ bool trace_initialise(otter_opt_t *opt) {
 
   trace_copy_proc_maps(opt);
 
+  trace_mutex_initialise(opt);
+
+  trace_loop_initialise(opt);
+
+  trace_perf_initialise(opt);
+
+  trace_template_initialise(opt);
+
+  trace_label_initialise(opt);
+
   return archive_initialised;
 }
 
@@ -133,10 +160,15 @@ exit_error:
 
 bool trace_finalise(void) {
   LOG_DEBUG("=== Finalising trace ===");
+  trace_label_finalise();
+  trace_mutex_finalise();
+  trace_template_finalise();
+  trace_sink_finalise();
   string_registry_apply(state.strings.instance, write_str_ref_cbk,
                         state.global_def_writer.instance);
   string_registry_delete(state.strings.instance);
   bool result = trace_finalise_archive(state.archive.instance);
+  trace_memory_finalise();
   return result;
 }
 
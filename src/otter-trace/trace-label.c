@@ -0,0 +1,739 @@
+/**
+ * @file trace-label.c
+ * @author Adam Tuft
+ * @brief Captures task labels as a format and packed arguments, caches them by
+ * format pointer and argument bytes, and formats new labels in batches away
+ * from the threads which created them.
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "public/debug.h"
+#include "public/otter-environment-variables.h"
+#include "public/otter-trace/trace-label.h"
+#include "public/types/string_value_registry.hpp"
+
+#include "trace-sink.h"
+#include "trace-state.h"
+#include "trace-unique-refs.h"
+
+enum {
+  label_args_max = 256,      /* bytes of packed arguments */
+  label_chars_max = 256,     /* a formatted label, as in otter-task-graph */
+  label_spec_max = 64,       /* a conversion, with any '*' written out */
+  label_cache_max = 1 << 16, /* labels kept in the cache */
+  label_batch = 1024,        /* pending labels which wake the formatter */
+  label_wait_ms = 100        /* longest the formatter sleeps */
+};
+
+typedef enum {
+  label_defer_off,
+  label_defer_thread,  /* formatted by a background thread */
+  label_defer_finalise /* formatted when the trace is finalised */
+} label_defer_t;
+
+typedef enum {
+  label_arg_int,    /* int, or a char or short promoted to one */
+  label_arg_uint,   /* unsigned int */
+  label_arg_long,   /* any 64-bit signed integer */
+  label_arg_ulong,  /* any 64-bit unsigned integer */
+  label_arg_double, /* double, or a float promoted to one */
+  label_arg_ptr,    /* %p */
+  label_arg_str,    /* %s, copied into the packed arguments */
+  label_arg_unsupported
+} label_arg_kind_t;
+
+typedef enum {
+  label_len_none,
+  label_len_hh,
+  label_len_h,
+  label_len_l,
+  label_len_ll,
+  label_len_z,
+  label_len_j,
+  label_len_t,
+  label_len_L
+} label_length_t;
+
+/* One conversion in a format */
+typedef struct {
+  const char *begin;      /* the '%' */
+  const char *length;     /* the length modifier, if any */
+  const char *conversion; /* the conversion character */
+  const char *end;        /* one past the conversion character */
+  bool star_width;
+  bool star_precision;
+  label_length_t len;
+  label_arg_kind_t kind;
+} label_spec_t;
+
+/* Strings are packed as their length then their bytes. A NULL string has
+   this length */
+#define LABEL_NULL_STRING UINT16_MAX
+
+typedef struct label_t {
+  const char *format;
+  uint64_t hash;
+  otter_string_ref_t ref;
+  bool cached;     /* owned by the cache, otherwise freed once formatted */
+  uint16_t length; /* bytes of packed arguments */
+  unsigned char args[];
+} label_t;
+
+static struct {
+  label_defer_t mode;
+  pthread_mutex_t lock; /* guards the fields below */
+  /* an open-addressing hash table, capacity always a power of 2 */
+  label_t **cache;
+  size_t capacity;
+  size_t count;
+  /* labels waiting to be formatted */
+  label_t **pending;
+  size_t n_pending;
+  size_t max_pending;
+  /* the background formatter */
+  pthread_cond_t wake;
+  pthread_t thread;
+  bool running;
+  bool stop;
+  /* held while a batch is formatted, so a flush waits for one in progress */
+  pthread_mutex_t drain;
+  struct {
+    uint64_t deferred;
+    uint64_t hits;
+    uint64_t formatted;
+    uint64_t eager;
+  } totals;
+} labels = {.mode = label_defer_off,
+            .lock = PTHREAD_MUTEX_INITIALIZER,
+            .wake = PTHREAD_COND_INITIALIZER,
+            .drain = PTHREAD_MUTEX_INITIALIZER};
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+/*   PARSE FORMATS                                                           */
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+static inline bool is_digit(char c) { return c >= '0' && c <= '9'; }
+
+static label_arg_kind_t label_arg_kind(char conversion, label_length_t len) {
+  bool wide =
+      len != label_len_none && len != label_len_hh && len != label_len_h;
+  switch (conversion) {
+  case 'd':
+  case 'i':
+    if (len == label_len_L)
+      return label_arg_unsupported;
+    return wide ? label_arg_long : label_arg_int;
+  case 'u':
+  case 'o':
+  case 'x':
+  case 'X':
+    if (len == label_len_L)
+      return label_arg_unsupported;
+    return wide ? label_arg_ulong : label_arg_uint;
+  case 'c':
+    return len == label_len_none ? label_arg_int : label_arg_unsupported;
+  case 'e':
+  case 'E':
+  case 'f':
+  case 'F':
+  case 'g':
+  case 'G':
+  case 'a':
+  case 'A':
+    return len == label_len_none || len == label_len_l ? label_arg_double
+                                                        : label_arg_unsupported;
+  case 's':
+    return len == label_len_none ? label_arg_str : label_arg_unsupported;
+  case 'p':
+    return len == label_len_none ? label_arg_ptr : label_arg_unsupported;
+  default: /* %n, %m, wide characters and anything unknown */
+    return label_arg_unsupported;
+  }
+}
+
+/* Find the first conversion at or after p, skipping "%%". Returns false if
+   there are none */
+static bool label_next_spec(const char *p, label_spec_t *spec) {
+  for (;;) {
+    p = strchr(p, '%');
+    if (p == NULL)
+      return false;
+    if (p[1] != '%')
+      break;
+    p += 2;
+  }
+  *spec = (label_spec_t){.begin = p++, .kind = label_arg_unsupported};
+  while (*p != '\0' && strchr("-+ #0'", *p) != NULL)
+    p++;
+  if (*p == '*') {
+    spec->star_width = true;
+    p++;
+  } else {
+    while (is_digit(*p))
+      p++;
+    if (*p == '$') /* a positional argument */
+      return true;
+  }
+  if (*p == '.') {
+    p++;
+    if (*p == '*') {
+      spec->star_precision = true;
+      p++;
+    } else {
+      while (is_digit(*p))
+        p++;
+    }
+  }
+  spec->length = p;
+  switch (*p) {
+  case 'h':
+    spec->len = p[1] == 'h' ? label_len_hh : label_len_h;
+    break;
+  case 'l':
+    spec->len = p[1] == 'l' ? label_len_ll : label_len_l;
+    break;
+  case 'z':
+    spec->len = label_len_z;
+    break;
+  case 'j':
+    spec->len = label_len_j;
+    break;
+  case 't':
+    spec->len = label_len_t;
+    break;
+  case 'L':
+    spec->len = label_len_L;
+    break;
+  default:
+    spec->len = label_len_none;
+    break;
+  }
+  p += spec->len == label_len_none                              ? 0
+       : spec->len == label_len_hh || spec->len == label_len_ll ? 2
+                                                                : 1;
+  spec->conversion = p;
+  if (*p == '\0')
+    return true;
+  spec->end = p + 1;
+  /* leave room to write out a '*' width and precision */
+  if (spec->end - spec->begin <= label_spec_max / 2)
+    spec->kind = label_arg_kind(*p, spec->len);
+  return true;
+}
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+/*   CAPTURE ARGUMENTS                                                       */
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+static inline bool label_pack(unsigned char *args, size_t *length,
+                              const void *value, size_t size) {
+  if (*length + size > label_args_max)
+    return false;
+  memcpy(&args[*length], value, size);
+  *length += size;
+  return true;
+}
+
+static bool label_pack_string(unsigned char *args, size_t *length,
+                              const char *string) {
+  uint16_t n = LABEL_NULL_STRING;
+  if (string != NULL) {
+    size_t chars = strnlen(string, label_chars_max);
+    n = (uint16_t)chars;
+  }
+  if (!label_pack(args, length, &n, sizeof(n)))
+    return false;
+  return n == LABEL_NULL_STRING || label_pack(args, length, string, n);
+}
+
+/* Copy the arguments a format consumes. Returns false if any conversion can't
+   be captured or the arguments don't fit */
+static bool label_capture(const char *format, va_list args,
+                          unsigned char *packed, size_t *length) {
+  label_spec_t spec;
+  *length = 0;
+  for (const char *p = format; label_next_spec(p, &spec); p = spec.end) {
+    if (spec.kind == label_arg_unsupported)
+      return false;
+    if (spec.star_width) {
+      int width = va_arg(args, int);
+      if (!label_pack(packed, length, &width, sizeof(width)))
+        return false;
+    }
+    if (spec.star_precision) {
+      int precision = va_arg(args, int);
+      if (!label_pack(packed, length, &precision, sizeof(precision)))
+        return false;
+    }
+    bool packed_ok = false;
+    switch (spec.kind) {
+    case label_arg_int: {
+      int value = va_arg(args, int);
+      packed_ok = label_pack(packed, length, &value, sizeof(value));
+      break;
+    }
+    case label_arg_uint: {
+      unsigned int value = va_arg(args, unsigned int);
+      packed_ok = label_pack(packed, length, &value, sizeof(value));
+      break;
+    }
+    case label_arg_long:
+    case label_arg_ulong: {
+      uint64_t value = 0;
+      switch (spec.len) {
+      case label_len_l:
+        value = (uint64_t)va_arg(args, long);
+        break;
+      case label_len_z:
+        value = (uint64_t)va_arg(args, size_t);
+        break;
+      case label_len_j:
+        value = (uint64_t)va_arg(args, intmax_t);
+        break;
+      case label_len_t:
+        value = (uint64_t)va_arg(args, ptrdiff_t);
+        break;
+      default:
+        value = (uint64_t)va_arg(args, long long);
+        break;
+      }
+      packed_ok = label_pack(packed, length, &value, sizeof(value));
+      break;
+    }
+    case label_arg_double: {
+      double value = va_arg(args, double);
+      packed_ok = label_pack(packed, length, &value, sizeof(value));
+      break;
+    }
+    case label_arg_ptr: {
+      void *value = va_arg(args, void *);
+      packed_ok = label_pack(packed, length, &value, sizeof(value));
+      break;
+    }
+    case label_arg_str:
+      packed_ok = label_pack_string(packed, length, va_arg(args, char *));
+      break;
+    default:
+      break;
+    }
+    if (!packed_ok)
+      return false;
+  }
+  return true;
+}
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+/*   FORMAT LABELS                                                           */
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+typedef struct {
+  char *out;
+  size_t used;
+  size_t size;
+} label_buffer_t;
+
+static void label_append(label_buffer_t *buf, const char *text, size_t n) {
+  size_t room = buf->size - 1 - buf->used;
+  if (n > room)
+    n = room;
+  memcpy(&buf->out[buf->used], text, n);
+  buf->used += n;
+  buf->out[buf->used] = '\0';
+}
+
+/* Copy literal text, in which every '%' is doubled */
+static void label_append_literal(label_buffer_t *buf, const char *begin,
+                                 const char *end) {
+  while (begin < end) {
+    const char *percent = memchr(begin, '%', end - begin);
+    if (percent == NULL) {
+      label_append(buf, begin, end - begin);
+      return;
+    }
+    label_append(buf, begin, percent - begin + 1);
+    begin = percent + 2;
+  }
+}
+
+static inline const unsigned char *label_unpack(const unsigned char *args,
+                                                void *value, size_t size) {
+  memcpy(value, args, size);
+  return args + size;
+}
+
+/* Write a conversion with any '*' replaced by the captured value, and a 64-bit
+   integer's length modifier replaced by "ll" */
+static const unsigned char *label_write_spec(const label_spec_t *spec,
+                                             const unsigned char *args,
+                                             char *out) {
+  char *q = out;
+  const char *p = spec->begin;
+  int width = 0, precision = 0;
+  if (spec->star_width)
+    args = label_unpack(args, &width, sizeof(width));
+  if (spec->star_precision)
+    args = label_unpack(args, &precision, sizeof(precision));
+  while (p < spec->length) {
+    if (*p == '*' && spec->star_width && p[-1] != '.') {
+      q += sprintf(q, "%d", width);
+      p++;
+    } else if (*p == '.' && spec->star_precision) {
+      /* a negative precision is taken as if it were omitted */
+      if (precision >= 0)
+        q += sprintf(q, ".%d", precision);
+      p += 2;
+    } else {
+      *q++ = *p++;
+    }
+  }
+  if (spec->kind == label_arg_long || spec->kind == label_arg_ulong) {
+    *q++ = 'l';
+    *q++ = 'l';
+  } else {
+    memcpy(q, spec->length, spec->conversion - spec->length);
+    q += spec->conversion - spec->length;
+  }
+  *q++ = *spec->conversion;
+  *q = '\0';
+  return args;
+}
+
+static void label_format(const label_t *label, char *out, size_t size) {
+  label_buffer_t buf = {.out = out, .used = 0, .size = size};
+  const unsigned char *args = label->args;
+  char conversion[label_spec_max] = {0};
+  char piece[label_chars_max] = {0};
+  label_spec_t spec;
+  const char *p = label->format;
+  out[0] = '\0';
+  for (; label_next_spec(p, &spec); p = spec.end) {
+    label_append_literal(&buf, p, spec.begin);
+    args = label_write_spec(&spec, args, conversion);
+    int n = 0;
+    switch (spec.kind) {
+    case label_arg_int: {
+      int value;
+      args = label_unpack(args, &value, sizeof(value));
+      n = snprintf(piece, sizeof(piece), conversion, value);
+      break;
+    }
+    case label_arg_uint: {
+      unsigned int value;
+      args = label_unpack(args, &value, sizeof(value));
+      n = snprintf(piece, sizeof(piece), conversion, value);
+      break;
+    }
+    case label_arg_long: {
+      uint64_t value;
+      args = label_unpack(args, &value, sizeof(value));
+      n = snprintf(piece, sizeof(piece), conversion, (long long)value);
+      break;
+    }
+    case label_arg_ulong: {
+      uint64_t value;
+      args = label_unpack(args, &value, sizeof(value));
+      n = snprintf(piece, sizeof(piece), conversion,
+                   (unsigned long long)value);
+      break;
+    }
+    case label_arg_double: {
+      double value;
+      args = label_unpack(args, &value, sizeof(value));
+      n = snprintf(piece, sizeof(piece), conversion, value);
+      break;
+    }
+    case label_arg_ptr: {
+      void *value;
+      args = label_unpack(args, &value, sizeof(value));
+      n = snprintf(piece, sizeof(piece), conversion, value);
+      break;
+    }
+    case label_arg_str: {
+      uint16_t length;
+      char string[label_chars_max + 1] = {0};
+      args = label_unpack(args, &length, sizeof(length));
+      if (length == LABEL_NULL_STRING) {
+        n = snprintf(piece, sizeof(piece), conversion, "(null)");
+      } else {
+        args = label_unpack(args, string, length);
+        n = snprintf(piece, sizeof(piece), conversion, string);
+      }
+      break;
+    }
+    default: /* not captured, so never deferred */
+      break;
+    }
+    if (n > 0)
+      label_append(&buf, piece, (size_t)n < sizeof(piece) ? (size_t)n
+                                                          : sizeof(piece) - 1);
+  }
+  label_append_literal(&buf, p, p + strlen(p));
+}
+
+/* Format and define the pending labels. Called with no locks held */
+static void label_drain(void) {
+  pthread_mutex_lock(&labels.drain);
+  pthread_mutex_lock(&labels.lock);
+  label_t **batch = labels.pending;
+  size_t n = labels.n_pending;
+  labels.pending = NULL;
+  labels.n_pending = 0;
+  labels.max_pending = 0;
+  pthread_mutex_unlock(&labels.lock);
+
+  if (n > 0) {
+    char (*text)[label_chars_max] = malloc(n * sizeof(*text));
+    if (text == NULL) {
+      LOG_ERROR("failed to allocate %lu deferred labels", n);
+    } else {
+      for (size_t k = 0; k < n; k++)
+        label_format(batch[k], text[k], label_chars_max);
+      trace_lock(&state.strings.lock);
+      for (size_t k = 0; k < n; k++) {
+        string_registry_insert_label(state.strings.instance, text[k],
+                                     batch[k]->ref);
+        if (trace_sink_get()->define_string != NULL)
+          trace_sink_get()->define_string(batch[k]->ref, text[k]);
+      }
+      trace_unlock(&state.strings.lock);
+      free(text);
+    }
+    for (size_t k = 0; k < n; k++) {
+      if (!batch[k]->cached)
+        free(batch[k]);
+    }
+    labels.totals.formatted += n;
+  }
+  free(batch);
+  pthread_mutex_unlock(&labels.drain);
+}
+
+static void *label_formatter(void *unused) {
+  pthread_mutex_lock(&labels.lock);
+  while (!labels.stop) {
+    if (labels.n_pending < label_batch) {
+      struct timespec until;
+      clock_gettime(CLOCK_REALTIME, &until);
+      until.tv_nsec += label_wait_ms * 1000000L;
+      until.tv_sec += until.tv_nsec / 1000000000L;
+      until.tv_nsec %= 1000000000L;
+      pthread_cond_timedwait(&labels.wake, &labels.lock, &until);
+    }
+    if (labels.n_pending > 0) {
+      pthread_mutex_unlock(&labels.lock);
+      label_drain();
+      pthread_mutex_lock(&labels.lock);
+    }
+  }
+  pthread_mutex_unlock(&labels.lock);
+  return NULL;
+}
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+/*   CACHE                                                                   */
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+static uint64_t label_hash(const char *format, const unsigned char *args,
+                           size_t length) {
+  uint64_t hash = 0xcbf29ce484222325ULL;
+  uintptr_t key = (uintptr_t)format;
+  for (size_t k = 0; k < sizeof(key); k++) {
+    hash ^= (key >> (8 * k)) & 0xff;
+    hash *= 0x100000001b3ULL;
+  }
+  for (size_t k = 0; k < length; k++) {
+    hash ^= args[k];
+    hash *= 0x100000001b3ULL;
+  }
+  return hash;
+}
+
+static label_t **label_cache_slot(label_t **cache, size_t capacity,
+                                  uint64_t hash, const char *format,
+                                  const unsigned char *args, size_t length) {
+  size_t slot = (size_t)hash & (capacity - 1);
+  for (;;) {
+    label_t *entry = cache[slot];
+    if (entry == NULL ||
+        (entry->hash == hash && entry->format == format &&
+         entry->length == length && memcmp(entry->args, args, length) == 0))
+      return &cache[slot];
+    slot = (slot + 1) & (capacity - 1);
+  }
+}
+
+/* Grow the cache to keep it at most half full. Returns false if it can't */
+static bool label_cache_reserve(void) {
+  if (2 * (labels.count + 1) <= labels.capacity)
+    return true;
+  if (labels.count >= label_cache_max)
+    return false;
+  size_t capacity = labels.capacity ? 2 * labels.capacity : 1024;
+  label_t **cache = calloc(capacity, sizeof(*cache));
+  if (cache == NULL)
+    return false;
+  for (size_t k = 0; k < labels.capacity; k++) {
+    label_t *entry = labels.cache[k];
+    if (entry != NULL)
+      *label_cache_slot(cache, capacity, entry->hash, entry->format,
+                        entry->args, entry->length) = entry;
+  }
+  free(labels.cache);
+  labels.cache = cache;
+  labels.capacity = capacity;
+  return true;
+}
+
+static bool label_push_pending(label_t *label) {
+  if (labels.n_pending == labels.max_pending) {
+    size_t max = labels.max_pending ? 2 * labels.max_pending : label_batch;
+    label_t **pending = realloc(labels.pending, max * sizeof(*pending));
+    if (pending == NULL)
+      return false;
+    labels.pending = pending;
+    labels.max_pending = max;
+  }
+  labels.pending[labels.n_pending++] = label;
+  return true;
+}
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+/*   INTERFACE                                                               */
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+void trace_label_initialise(otter_opt_t *opt) {
+  labels.mode = label_defer_off;
+  if (opt->defer_labels == NULL || opt->defer_labels[0] == '\0')
+    return;
+  if (strcmp(opt->defer_labels, "thread") == 0) {
+    labels.mode = label_defer_thread;
+  } else if (strcmp(opt->defer_labels, "finalise") == 0) {
+    labels.mode = label_defer_finalise;
+  } else {
+    fprintf(stderr, "invalid value for %s (ignored): %s\n",
+            ENV_VAR_DEFER_LABELS, opt->defer_labels);
+    return;
+  }
+  labels.stop = false;
+  if (labels.mode == label_defer_thread) {
+    int err = pthread_create(&labels.thread, NULL, label_formatter, NULL);
+    if (err != 0) {
+      LOG_WARN("failed to start label formatter, formatting at finalise: %s",
+               strerror(err));
+      labels.mode = label_defer_finalise;
+    } else {
+      labels.running = true;
+    }
+  }
+  fprintf(stderr, "%-30s %s\n", "Deferred labels:",
+          labels.mode == label_defer_thread ? "background thread"
+                                            : "at finalise");
+}
+
+bool trace_label_deferred(void) { return labels.mode != label_defer_off; }
+
+otter_string_ref_t trace_label_defer(const char *format, va_list args) {
+  unsigned char packed[label_args_max];
+  size_t length = 0;
+  if (format == NULL || !label_capture(format, args, packed, &length)) {
+    pthread_mutex_lock(&labels.lock);
+    labels.totals.eager++;
+    pthread_mutex_unlock(&labels.lock);
+    return OTTER_STRING_UNDEFINED;
+  }
+  uint64_t hash = label_hash(format, packed, length);
+
+  pthread_mutex_lock(&labels.lock);
+  label_t **slot = NULL;
+  if (label_cache_reserve()) {
+    slot = label_cache_slot(labels.cache, labels.capacity, hash, format,
+                            packed, length);
+    if (*slot != NULL) {
+      labels.totals.hits++;
+      otter_string_ref_t ref = (*slot)->ref;
+      pthread_mutex_unlock(&labels.lock);
+      return ref;
+    }
+  }
+  label_t *label = malloc(sizeof(*label) + length);
+  if (label == NULL || !label_push_pending(label)) {
+    labels.totals.eager++;
+    pthread_mutex_unlock(&labels.lock);
+    free(label);
+    return OTTER_STRING_UNDEFINED;
+  }
+  *label = (label_t){.format = format,
+                     .hash = hash,
+                     .ref = get_unique_str_ref(),
+                     .cached = slot != NULL,
+                     .length = (uint16_t)length};
+  memcpy(label->args, packed, length);
+  if (slot != NULL) {
+    *slot = label;
+    labels.count++;
+  }
+  labels.totals.deferred++;
+  otter_string_ref_t ref = label->ref;
+  if (labels.running && labels.n_pending == label_batch)
+    pthread_cond_signal(&labels.wake);
+  pthread_mutex_unlock(&labels.lock);
+  return ref;
+}
+
+void trace_label_flush(void) {
+  if (labels.mode != label_defer_off)
+    label_drain();
+}
+
+bool trace_label_format(char *out, size_t size, const char *format,
+                        va_list args) {
+  unsigned char packed[label_args_max];
+  size_t length = 0;
+  if (format == NULL || size == 0 ||
+      !label_capture(format, args, packed, &length))
+    return false;
+  label_t *label = malloc(sizeof(*label) + length);
+  if (label == NULL)
+    return false;
+  *label = (label_t){.format = format, .length = (uint16_t)length};
+  memcpy(label->args, packed, length);
+  label_format(label, out, size);
+  free(label);
+  return true;
+}
+
+void trace_label_finalise(void) {
+  if (labels.mode == label_defer_off)
+    return;
+  if (labels.running) {
+    pthread_mutex_lock(&labels.lock);
+    labels.stop = true;
+    pthread_cond_signal(&labels.wake);
+    pthread_mutex_unlock(&labels.lock);
+    pthread_join(labels.thread, NULL);
+    labels.running = false;
+  }
+  label_drain();
+
+  fprintf(stderr, "\nDEFERRED LABELS:\n");
+  fprintf(stderr, "%-30s %lu\n", "Labels formatted:", labels.totals.formatted);
+  fprintf(stderr, "%-30s %lu\n", "Cache hits:", labels.totals.hits);
+  fprintf(stderr, "%-30s %lu\n", "Formatted immediately:",
+          labels.totals.eager);
+
+  for (size_t k = 0; k < labels.capacity; k++)
+    free(labels.cache[k]);
+  free(labels.cache);
+  labels.cache = NULL;
+  labels.capacity = labels.count = 0;
+  labels.mode = label_defer_off;
+}
@@ -10,16 +10,20 @@
 #define _GNU_SOURCE
 
 #include "public/otter-trace/trace-location.h"
+#include "public/otter-trace/trace-mutex.h"
+#include "public/otter-trace/trace-numa.h"
+#include "public/otter-trace/trace-perf.h"
 #include "trace-archive-impl.h"
 #include "trace-attribute-lookup.h"
 #include "trace-attributes.h"
 #include "trace-check-error-code.h"
+#include "trace-sink.h"
 #include "trace-state.h"
 #include "trace-static-constants.h"
 #include "trace-types-as-labels.h"
 #include "trace-unique-refs.h"
 #include "public/debug.h"
-#include "public/types/queue.h"
+#include "public/types/chunk-queue.h"
 #include "public/types/stack.h"
 #include <otf2/otf2.h>
 #include <pthread.h>
@@ -30,9 +34,17 @@ typedef struct trace_location_def_t {
   unique_id_t id;
   otter_thread_t thread_type;
   uint64_t events;
+  int numa_node; /* of the thread which created the location */
   otter_stack_t *rgn_stack;
-  otter_queue_t *rgn_defs;
+  otter_chunk_queue_t *rgn_defs;
   otter_stack_t *rgn_defs_stack;
+  otter_stack_t *rgn_defs_pool;
+  otter_dependence_t *dependences;
+  size_t dependences_capacity;
+  trace_mutex_table_t *mutexes;
+  trace_perf_group_t *perf;
+  const trace_sink_t *sink;
+  void *sink_data;
   OTF2_LocationRef ref;
   OTF2_LocationType type;
   OTF2_LocationGroupRef location_group;
@@ -50,12 +62,20 @@ trace_new_location_definition(unique_id_t id, otter_thread_t thread_type,
   *new = (trace_location_def_t){.id = id,
                                 .thread_type = thread_type,
                                 .events = 0,
+                                .numa_node = trace_numa_current_node(),
                                 .ref = get_unique_loc_ref(),
                                 .type = loc_type,
                                 .location_group = loc_grp,
                                 .rgn_stack = stack_create(),
-                                .rgn_defs = queue_create(),
+                                .rgn_defs = chunk_queue_create(0),
                                 .rgn_defs_stack = stack_create(),
+                                .rgn_defs_pool = stack_create(),
+                                .dependences = NULL,
+                                .dependences_capacity = 0,
+                                .mutexes = NULL,
+                                .perf = NULL,
+                                .sink = trace_sink_get(),
+                                .sink_data = NULL,
                                 .attributes = OTF2_AttributeList_New(),
                                 .evt_writer = NULL,
                                 .def_writer = NULL};
@@ -63,6 +83,10 @@ trace_new_location_definition(unique_id_t id, otter_thread_t thread_type,
   new->evt_writer = OTF2_Archive_GetEvtWriter(state.archive.instance, new->ref);
   new->def_writer = OTF2_Archive_GetDefWriter(state.archive.instance, new->ref);
 
+  if (new->sink->location_open != NULL) {
+    new->sink_data = new->sink->location_open(new);
+  }
+
   /* Thread location definition is written at thread-end (once all events
      counted) */
 
@@ -70,29 +94,58 @@ trace_new_location_definition(unique_id_t id, otter_thread_t thread_type,
   LOG_DEBUG("[t=%lu] %-18s %p", id, "rgn_stack:", new->rgn_stack);
   LOG_DEBUG("[t=%lu] %-18s %p", id, "rgn_defs:", new->rgn_defs);
   LOG_DEBUG("[t=%lu] %-18s %p", id, "rgn_defs_stack:", new->rgn_defs_stack);
+  LOG_DEBUG("[t=%lu] %-18s %p", id, "rgn_defs_pool:", new->rgn_defs_pool);
 
   return new;
 }
 
+static void trace_location_destroy_rgn_def_queue(otter_chunk_queue_t *q) {
+  chunk_queue_destroy(q, false, NULL);
+}
+
 void trace_destroy_location(trace_location_def_t *loc) {
   if (loc == NULL)
     return;
+  /* The sink may write its last events, and correct their count, on close */
+  if (loc->sink->location_close != NULL) {
+    loc->sink->location_close(loc, loc->sink_data);
+    loc->sink_data = NULL;
+  }
   trace_write_location_definition(loc);
   LOG_DEBUG("[t=%lu] destroying rgn_stack %p", loc->id, loc->rgn_stack);
   stack_destroy(loc->rgn_stack, false, NULL);
   if (loc->rgn_defs) {
     LOG_DEBUG("[t=%lu] destroying rgn_defs %p", loc->id, loc->rgn_defs);
-    queue_destroy(loc->rgn_defs, false, NULL);
+    chunk_queue_destroy(loc->rgn_defs, false, NULL);
   }
   LOG_DEBUG("[t=%lu] destroying rgn_defs_stack %p", loc->id,
             loc->rgn_defs_stack);
   stack_destroy(loc->rgn_defs_stack, false, NULL);
+  LOG_DEBUG("[t=%lu] destroying rgn_defs_pool %p", loc->id,
+            loc->rgn_defs_pool);
+  stack_destroy(loc->rgn_defs_pool, true,
+                (data_destructor_t)trace_location_destroy_rgn_def_queue);
+  free(loc->dependences);
+  if (loc->mutexes) {
+    trace_mutex_table_finalise(loc->mutexes);
+  }
+  trace_perf_group_close(loc->perf);
   OTF2_AttributeList_Delete(loc->attributes);
   LOG_DEBUG("[t=%lu] destroying location", loc->id);
   free(loc);
   return;
 }
 
+/**
+ * @brief Detach a location from the thread it represents when that thread
+ * exits, so that the location can be reused by another thread. Closes the
+ * location's perf counters, which measure the thread that opened them.
+ */
+void trace_location_release_thread(trace_location_def_t *loc) {
+  trace_perf_group_close(loc->perf);
+  loc->perf = NULL;
+}
+
 void trace_write_location_definition(trace_location_def_t *loc) {
   if (loc == NULL) {
     LOG_ERROR("null pointer");
@@ -101,10 +154,10 @@ void trace_write_location_definition(trace_location_def_t *loc) {
 
   char location_name[default_name_buf_sz + 1] = {0};
   OTF2_StringRef location_name_ref = get_unique_str_ref();
-  snprintf(location_name, default_name_buf_sz, "Thread %lu", loc->id);
+  trace_location_get_name(loc, location_name, default_name_buf_sz);
 
   LOG_DEBUG("[t=%lu] locking global def writer", loc->id);
-  pthread_mutex_lock(&state.global_def_writer.lock);
+  trace_lock(&state.global_def_writer.lock);
 
   OTF2_GlobalDefWriter_WriteString(state.global_def_writer.instance,
                                    location_name_ref, location_name);
@@ -115,7 +168,7 @@ void trace_write_location_definition(trace_location_def_t *loc) {
                                      loc->location_group);
 
   LOG_DEBUG("[t=%lu] unlocking global def writer", loc->id);
-  pthread_mutex_unlock(&state.global_def_writer.lock);
+  trace_unlock(&state.global_def_writer.lock);
   return;
 }
 
@@ -124,21 +177,42 @@ void trace_write_location_definition(trace_location_def_t *loc) {
  */
 bool trace_location_get_region_def(trace_location_def_t *loc,
                                    trace_region_def_t **rgn) {
-  return queue_pop(loc->rgn_defs, (data_item_t *)rgn);
+  return chunk_queue_pop(loc->rgn_defs, (data_item_t *)rgn);
 }
 
 bool trace_location_store_region_def(trace_location_def_t *loc,
                                      trace_region_def_t *rgn) {
   /* Add region definition to location's region definition queue */
-  return queue_push(loc->rgn_defs, (data_item_t){.ptr = rgn});
+  return chunk_queue_push(loc->rgn_defs, (data_item_t){.ptr = rgn});
 }
 
 size_t trace_location_get_num_region_def(trace_location_def_t *loc) {
-  return queue_length(loc->rgn_defs);
+  return chunk_queue_length(loc->rgn_defs);
 }
 
 unique_id_t trace_location_get_id(trace_location_def_t *loc) { return loc->id; }
 
+OTF2_LocationRef trace_location_get_ref(trace_location_def_t *loc) {
+  return loc->ref;
+}
+
+OTF2_LocationType trace_location_get_type(trace_location_def_t *loc) {
+  return loc->type;
+}
+
+OTF2_LocationGroupRef trace_location_get_group(trace_location_def_t *loc) {
+  return loc->location_group;
+}
+
+void trace_location_get_name(trace_location_def_t *loc, char *name,
+                             size_t size) {
+  snprintf(name, size, "Thread %lu", loc->id);
+}
+
+int trace_location_get_numa_node(trace_location_def_t *loc) {
+  return loc->numa_node;
+}
+
 otter_thread_t trace_location_get_thread_type(trace_location_def_t *loc) {
   return loc->thread_type;
 }
@@ -156,11 +230,78 @@ void trace_location_get_otf2(trace_location_def_t *loc,
   return;
 }
 
+/**
+ * @brief Get the location's buffer for holding the dependences of a task while
+ * they are recorded, growing it if needed to hold at least n dependences.
+ *
+ * The buffer is owned by the location and re-used on every call, so it is only
+ * valid until the next call for the same location.
+ */
+otter_dependence_t *
+trace_location_get_dependence_buffer(trace_location_def_t *loc, size_t n) {
+  if (n > loc->dependences_capacity) {
+    size_t capacity = loc->dependences_capacity ? loc->dependences_capacity : 8;
+    while (capacity < n) {
+      capacity *= 2;
+    }
+    otter_dependence_t *dependences =
+        realloc(loc->dependences, capacity * sizeof(*dependences));
+    if (dependences == NULL) {
+      LOG_ERROR("[t=%lu] failed to grow dependence buffer to %lu", loc->id,
+                capacity);
+      return NULL;
+    }
+    loc->dependences = dependences;
+    loc->dependences_capacity = capacity;
+  }
+  return loc->dependences;
+}
+
+/**
+ * @brief Get the table of mutex wait & hold times for this location, creating
+ * it on first use.
+ */
+trace_mutex_table_t *trace_location_get_mutex_table(trace_location_def_t *loc) {
+  if (loc->mutexes == NULL) {
+    loc->mutexes = trace_mutex_table_new();
+  }
+  return loc->mutexes;
+}
+
+/**
+ * @brief Get this location's perf counters, opening them on first use. Must be
+ * called by the thread the location represents as the counters measure the
+ * calling thread.
+ */
+trace_perf_group_t *trace_location_get_perf_group(trace_location_def_t *loc) {
+  if (loc->perf == NULL) {
+    loc->perf = trace_perf_group_open();
+  }
+  return loc->perf;
+}
+
+const trace_sink_t *trace_location_get_sink(trace_location_def_t *loc) {
+  return loc->sink;
+}
+
+void *trace_location_get_sink_data(trace_location_def_t *loc) {
+  return loc->sink_data;
+}
+
 void trace_location_inc_event_count(trace_location_def_t *loc) {
   loc->events++;
   return;
 }
 
+/**
+ * @brief Override the number of events the location's definition reports, for
+ * a sink which writes a different number of events than were recorded.
+ */
+void trace_location_set_event_count(trace_location_def_t *loc,
+                                    uint64_t events) {
+  loc->events = events;
+}
+
 /**
  * @brief Indicate to a location that it is entering a new region which will
  * inherit from this location all region definitions it encounters inside this
@@ -169,11 +310,17 @@ void trace_location_inc_event_count(trace_location_def_t *loc) {
  * Definitions for regions encountered inside this region will be stored and
  * should be handed off to said region upon leaving it.
  *
+ * The queue which collects these definitions is taken from the location's pool
+ * of spare queues, so a location only allocates a new queue when it enters a
+ * region nested deeper than any it has entered before.
+ *
  * @param loc
  */
 void trace_location_enter_region_def_scope(trace_location_def_t *loc) {
   stack_push(loc->rgn_defs_stack, (data_item_t){.ptr = loc->rgn_defs});
-  loc->rgn_defs = queue_create();
+  if (!stack_pop(loc->rgn_defs_pool, (data_item_t *)&loc->rgn_defs)) {
+    loc->rgn_defs = chunk_queue_create(0);
+  }
   return;
 }
 
@@ -181,15 +328,19 @@ void trace_location_enter_region_def_scope(trace_location_def_t *loc) {
  * @brief Indicate to a location that it is leaving a region which inherits all
  * region definitions stored by the location during this region.
  *
+ * The stored definitions are spliced onto the region's queue in O(1) and the
+ * emptied queue is returned to the location's pool for re-use. The caller must
+ * hold the region's lock.
+ *
  * @param loc
  * @param rgn
  */
 void trace_location_leave_region_def_scope(trace_location_def_t *loc,
                                            trace_region_def_t *rgn) {
-  if (!queue_append(trace_region_get_rgn_def_queue(rgn), loc->rgn_defs)) {
+  if (!chunk_queue_append(trace_region_get_rgn_def_queue(rgn), loc->rgn_defs)) {
     LOG_ERROR("error appending items to queue");
   }
-  queue_destroy(loc->rgn_defs, false, NULL);
+  stack_push(loc->rgn_defs_pool, (data_item_t){.ptr = loc->rgn_defs});
   stack_pop(loc->rgn_defs_stack, (data_item_t *)&loc->rgn_defs);
 }
 
@@ -0,0 +1,145 @@
+/**
+ * @file trace-loop.c
+ * @author Adam Tuft
+ * @brief Aggregates the times of a loop's iterations in its workshare region,
+ * optionally recording every Nth iteration as an event.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <otf2/otf2.h>
+
+#include "public/debug.h"
+#include "public/otter-environment-variables.h"
+#include "public/otter-trace/trace-loop.h"
+
+#include "trace-attribute-lookup.h"
+#include "trace-attributes.h"
+#include "trace-check-error-code.h"
+#include "trace-sink.h"
+#include "trace-timestamp.h"
+
+/* record every Nth iteration of each loop as an event, none if 0 */
+static uint64_t loop_sample = 0;
+
+/* the upper bound in ns of each histogram bin but the last */
+static const uint64_t loop_bin_bound[OTTER_LOOP_HISTOGRAM_BINS - 1] = {
+    100, 1000, 10000, 100000, 1000000, 10000000, 100000000};
+
+static const attr_name_enum_t loop_bin_attr[OTTER_LOOP_HISTOGRAM_BINS] = {
+    attr_loop_iterations_under_100ns, attr_loop_iterations_under_1us,
+    attr_loop_iterations_under_10us,  attr_loop_iterations_under_100us,
+    attr_loop_iterations_under_1ms,   attr_loop_iterations_under_10ms,
+    attr_loop_iterations_under_100ms, attr_loop_iterations_over_100ms};
+
+void trace_loop_initialise(otter_opt_t *opt) {
+  loop_sample = 0;
+  if (opt->loop_sample == NULL || opt->loop_sample[0] == '\0')
+    return;
+  char *end = NULL;
+  unsigned long long every = strtoull(opt->loop_sample, &end, 10);
+  if (end == opt->loop_sample || *end != '\0' || every == 0) {
+    fprintf(stderr, "invalid value for %s (ignored): %s\n",
+            ENV_VAR_LOOP_SAMPLE, opt->loop_sample);
+    return;
+  }
+  loop_sample = every;
+  fprintf(stderr, "%-30s every %llu iteration%s\n", "Loop iteration events:",
+          every, every == 1 ? "" : "s");
+}
+
+void trace_loop_add_attributes(const trace_loop_stats_t *stats,
+                               OTF2_AttributeList *attributes) {
+  OTF2_ErrorCode err = OTF2_SUCCESS;
+  err = OTF2_AttributeList_AddUint64(attributes, attr_loop_iterations,
+                                     stats->iterations);
+  CHECK_OTF2_ERROR_CODE(err);
+  err = OTF2_AttributeList_AddUint64(attributes, attr_loop_total_time,
+                                     stats->total_time);
+  CHECK_OTF2_ERROR_CODE(err);
+  err = OTF2_AttributeList_AddUint64(attributes, attr_loop_min_time,
+                                     stats->min_time);
+  CHECK_OTF2_ERROR_CODE(err);
+  err = OTF2_AttributeList_AddUint64(attributes, attr_loop_max_time,
+                                     stats->max_time);
+  CHECK_OTF2_ERROR_CODE(err);
+  for (int bin = 0; bin < OTTER_LOOP_HISTOGRAM_BINS; bin++) {
+    err = OTF2_AttributeList_AddUint64(attributes, loop_bin_attr[bin],
+                                       stats->histogram[bin]);
+    CHECK_OTF2_ERROR_CODE(err);
+  }
+}
+
+static void trace_loop_write_iteration(trace_location_def_t *self,
+                                       trace_region_def_t *loop,
+                                       uint64_t index, uint64_t duration,
+                                       uint64_t time) {
+  OTF2_ErrorCode err = OTF2_SUCCESS;
+  OTF2_AttributeList *attributes = NULL;
+  trace_location_get_otf2(self, &attributes, NULL, NULL);
+
+  err = OTF2_AttributeList_AddUint64(
+      attributes, attr_encountering_task_id,
+      trace_region_get_encountering_task_id(loop));
+  CHECK_OTF2_ERROR_CODE(err);
+
+  err = OTF2_AttributeList_AddStringRef(
+      attributes, attr_event_type,
+      attr_label_ref[attr_event_type_loop_iteration]);
+  CHECK_OTF2_ERROR_CODE(err);
+
+  err = OTF2_AttributeList_AddStringRef(attributes, attr_endpoint,
+                                        attr_label_ref[attr_endpoint_discrete]);
+  CHECK_OTF2_ERROR_CODE(err);
+
+  err = OTF2_AttributeList_AddUint64(attributes, attr_loop_iteration, index);
+  CHECK_OTF2_ERROR_CODE(err);
+
+  err = OTF2_AttributeList_AddUint64(attributes, attr_loop_iteration_time,
+                                     duration);
+  CHECK_OTF2_ERROR_CODE(err);
+
+  err = trace_sink_enter(self, attributes, time, OTF2_UNDEFINED_REGION);
+  CHECK_OTF2_ERROR_CODE(err);
+
+  trace_location_inc_event_count(self);
+}
+
+void trace_event_loop_iteration_begin(trace_location_def_t *self,
+                                      trace_region_def_t *loop) {
+  trace_loop_stats_t *stats = trace_region_get_loop_stats(loop);
+  if (stats == NULL)
+    return;
+  LOG_WARN_IF((stats->start_time != 0),
+              "loop iteration %lu began before the previous one ended",
+              stats->iterations);
+  stats->start_time = get_timestamp();
+}
+
+void trace_event_loop_iteration_end(trace_location_def_t *self,
+                                    trace_region_def_t *loop) {
+  uint64_t time = get_timestamp();
+  trace_loop_stats_t *stats = trace_region_get_loop_stats(loop);
+  if (stats == NULL)
+    return;
+  if (stats->start_time == 0) {
+    LOG_WARN("loop iteration ended without beginning");
+    return;
+  }
+  uint64_t duration = time - stats->start_time;
+  uint64_t index = stats->iterations++;
+  stats->start_time = 0;
+  stats->total_time += duration;
+  if (index == 0 || duration < stats->min_time)
+    stats->min_time = duration;
+  if (duration > stats->max_time)
+    stats->max_time = duration;
+  int bin = 0;
+  while (bin < OTTER_LOOP_HISTOGRAM_BINS - 1 && duration >= loop_bin_bound[bin])
+    bin++;
+  stats->histogram[bin]++;
+  if (loop_sample != 0 && index % loop_sample == 0) {
+    trace_loop_write_iteration(self, loop, index, duration, time);
+  }
+}
@@ -0,0 +1,433 @@
+/**
+ * @file trace-memory.c
+ * @author Adam Tuft
+ * @brief An arena which provides the chunks used by OTF2's event & definition
+ * buffers. Chunks are carved from mmap'd slabs, optionally backed by huge
+ * pages, and are recycled when a buffer is flushed rather than returned to the
+ * system. When a memory budget is set and a buffer would exceed it, the
+ * allocation is refused which causes OTF2 to flush that buffer.
+ *
+ * On a NUMA machine, each node has its own chunks, carved from slabs bound to
+ * that node. A buffer takes its chunks from the node of the thread which first
+ * allocated for it, which is the thread writing the location's events.
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/mman.h>
+
+#include <otf2/otf2.h>
+
+#include "public/debug.h"
+#include "public/otter-environment-variables.h"
+#include "public/otter-trace/trace-numa.h"
+
+#include "trace-check-error-code.h"
+#include "trace-memory.h"
+#include "trace-state.h"
+
+enum { huge_page_size = 2 * 1024 * 1024 };
+
+typedef enum {
+  huge_pages_off,
+  huge_pages_thp,
+  huge_pages_hugetlb,
+} trace_huge_pages_t;
+
+typedef struct trace_memory_slab_t trace_memory_slab_t;
+struct trace_memory_slab_t {
+  trace_memory_slab_t *next;
+  void *base;
+  size_t size;
+};
+
+/* Free chunks of one size on one node, linked through their first word */
+typedef struct trace_memory_class_t trace_memory_class_t;
+struct trace_memory_class_t {
+  trace_memory_class_t *next;
+  uint64_t chunk_size;
+  int node;
+  void *free;
+};
+
+/* The chunks held by one OTF2 buffer, stored in its perBufferData */
+typedef struct {
+  uint64_t chunk_size;
+  int node;
+  size_t count;
+  size_t capacity;
+  void **chunks;
+} trace_memory_buffer_t;
+
+struct trace_memory_arena_t {
+  uint64_t budget; /* 0 if unlimited */
+  trace_huge_pages_t huge_pages;
+  trace_memory_slab_t *slabs;
+  trace_memory_class_t *classes;
+  uint64_t in_use;
+  uint64_t peak;
+  uint64_t mapped;
+  uint64_t flushes;        /* buffers flushed before the archive was closed */
+  uint64_t budget_flushes; /* of which were forced by the budget */
+  uint64_t over_budget;    /* chunks granted to empty buffers over budget */
+  int nodes;
+  struct {
+    uint64_t in_use;
+    uint64_t peak;
+    uint64_t mapped;
+    uint64_t bound; /* of mapped, bytes bound to the node */
+  } *node;
+};
+
+static uint64_t event_chunk_size = OTF2_CHUNK_SIZE_EVENTS_DEFAULT;
+static uint64_t def_chunk_size = OTF2_CHUNK_SIZE_DEFINITIONS_DEFAULT;
+
+static const char *huge_pages_name(trace_huge_pages_t huge_pages) {
+  switch (huge_pages) {
+  case huge_pages_thp:
+    return "thp";
+  case huge_pages_hugetlb:
+    return "hugetlb";
+  default:
+    return "off";
+  }
+}
+
+uint64_t trace_memory_parse_size(const char *name, const char *value,
+                                 uint64_t fallback) {
+  if (value == NULL || value[0] == '\0')
+    return fallback;
+  char *end = NULL;
+  errno = 0;
+  uint64_t size = strtoull(value, &end, 10);
+  if (errno != 0 || end == value)
+    goto invalid;
+  switch (*end) {
+  case 'k':
+  case 'K':
+    size <<= 10;
+    end++;
+    break;
+  case 'm':
+  case 'M':
+    size <<= 20;
+    end++;
+    break;
+  case 'g':
+  case 'G':
+    size <<= 30;
+    end++;
+    break;
+  }
+  if (*end != '\0')
+    goto invalid;
+  return size;
+
+invalid:
+  fprintf(stderr, "invalid value for %s (ignored): %s\n", name, value);
+  return fallback;
+}
+
+static uint64_t trace_memory_parse_chunk_size(const char *name,
+                                              const char *value,
+                                              uint64_t fallback) {
+  uint64_t size = trace_memory_parse_size(name, value, fallback);
+  if (size < OTF2_CHUNK_SIZE_MIN || size > OTF2_CHUNK_SIZE_MAX) {
+    fprintf(stderr, "%s must be between %d and %d bytes (ignored): %s\n", name,
+            OTF2_CHUNK_SIZE_MIN, OTF2_CHUNK_SIZE_MAX, value);
+    return fallback;
+  }
+  return size;
+}
+
+static trace_huge_pages_t trace_memory_parse_huge_pages(const char *value) {
+  if (value == NULL || value[0] == '\0' || strcasecmp(value, "off") == 0)
+    return huge_pages_off;
+  if (strcasecmp(value, "thp") == 0)
+    return huge_pages_thp;
+  if (strcasecmp(value, "hugetlb") == 0)
+    return huge_pages_hugetlb;
+  fprintf(stderr, "invalid value for %s (ignored): %s\n", ENV_VAR_HUGE_PAGES,
+          value);
+  return huge_pages_off;
+}
+
+void trace_memory_initialise(otter_opt_t *opt) {
+  event_chunk_size = trace_memory_parse_chunk_size(
+      ENV_VAR_EVENT_CHUNK_SIZE, opt->event_chunk_size,
+      OTF2_CHUNK_SIZE_EVENTS_DEFAULT);
+  def_chunk_size =
+      trace_memory_parse_chunk_size(ENV_VAR_DEF_CHUNK_SIZE, opt->def_chunk_size,
+                                    OTF2_CHUNK_SIZE_DEFINITIONS_DEFAULT);
+
+  trace_memory_arena_t *arena = malloc(sizeof(*arena));
+  if (arena == NULL) {
+    LOG_ERROR("failed to create memory arena, OTF2 will use malloc");
+    return;
+  }
+  *arena = (trace_memory_arena_t){
+      .budget = trace_memory_parse_size(ENV_VAR_BUFFER_BUDGET,
+                                        opt->buffer_budget, 0),
+      .huge_pages = trace_memory_parse_huge_pages(opt->huge_pages),
+      .slabs = NULL,
+      .classes = NULL,
+      .nodes = trace_numa_nodes()};
+  arena->node = calloc(arena->nodes, sizeof(*arena->node));
+  if (arena->node == NULL) {
+    LOG_ERROR("failed to create memory arena, OTF2 will use malloc");
+    free(arena);
+    return;
+  }
+
+  trace_lock(&state.memory.lock);
+  state.memory.instance = arena;
+  trace_unlock(&state.memory.lock);
+}
+
+uint64_t trace_memory_event_chunk_size(void) { return event_chunk_size; }
+
+uint64_t trace_memory_def_chunk_size(void) { return def_chunk_size; }
+
+static void *trace_memory_map(trace_memory_arena_t *arena, size_t size) {
+  const int prot = PROT_READ | PROT_WRITE;
+  const int flags = MAP_PRIVATE | MAP_ANONYMOUS;
+
+  if (arena->huge_pages == huge_pages_hugetlb) {
+    void *base = mmap(NULL, size, prot, flags | MAP_HUGETLB, -1, 0);
+    if (base != MAP_FAILED)
+      return base;
+    fprintf(stderr, "huge pages unavailable (%s), using thp instead\n",
+            strerror(errno));
+    arena->huge_pages = huge_pages_thp;
+  }
+
+  if (arena->huge_pages == huge_pages_thp) {
+    /* over-map so the slab can be aligned to a huge page boundary */
+    size_t padded = size + huge_page_size;
+    char *raw = mmap(NULL, padded, prot, flags, -1, 0);
+    if (raw == MAP_FAILED)
+      return NULL;
+    char *base = (char *)(((uintptr_t)raw + huge_page_size - 1) &
+                          ~((uintptr_t)huge_page_size - 1));
+    if (base > raw)
+      munmap(raw, base - raw);
+    if (raw + padded > base + size)
+      munmap(base + size, (raw + padded) - (base + size));
+    madvise(base, size, MADV_HUGEPAGE);
+    return base;
+  }
+
+  void *base = mmap(NULL, size, prot, flags, -1, 0);
+  return base == MAP_FAILED ? NULL : base;
+}
+
+static trace_memory_class_t *trace_memory_get_class(trace_memory_arena_t *arena,
+                                                    uint64_t chunk_size,
+                                                    int node) {
+  trace_memory_class_t *class = arena->classes;
+  while (class != NULL &&
+         (class->chunk_size != chunk_size || class->node != node)) {
+    class = class->next;
+  }
+  if (class == NULL) {
+    class = malloc(sizeof(*class));
+    if (class == NULL)
+      return NULL;
+    *class = (trace_memory_class_t){.next = arena->classes,
+                                    .chunk_size = chunk_size,
+                                    .node = node,
+                                    .free = NULL};
+    arena->classes = class;
+  }
+  return class;
+}
+
+/* Carve a new slab into chunks of the class' size */
+static bool trace_memory_refill(trace_memory_arena_t *arena,
+                                trace_memory_class_t *class) {
+  size_t size = (class->chunk_size + huge_page_size - 1) &
+                ~((size_t)huge_page_size - 1);
+  trace_memory_slab_t *slab = malloc(sizeof(*slab));
+  if (slab == NULL)
+    return false;
+  slab->base = trace_memory_map(arena, size);
+  if (slab->base == NULL) {
+    LOG_ERROR("failed to map %lu bytes: %s", size, strerror(errno));
+    free(slab);
+    return false;
+  }
+  /* Bound before the chunks are linked, which touches every one of them */
+  if (trace_numa_bind(slab->base, size, class->node))
+    arena->node[class->node].bound += size;
+  slab->size = size;
+  slab->next = arena->slabs;
+  arena->slabs = slab;
+  arena->mapped += size;
+  arena->node[class->node].mapped += size;
+  for (size_t offset = 0; offset + class->chunk_size <= size;
+       offset += class->chunk_size) {
+    void *chunk = (char *)slab->base + offset;
+    *(void **)chunk = class->free;
+    class->free = chunk;
+  }
+  return true;
+}
+
+static void *trace_memory_allocate(void *user_data, OTF2_FileType file_type,
+                                   OTF2_LocationRef location,
+                                   void **per_buffer_data,
+                                   uint64_t chunk_size) {
+  trace_memory_arena_t *arena = (trace_memory_arena_t *)user_data;
+  trace_memory_buffer_t *buffer = *per_buffer_data;
+
+  if (buffer == NULL) {
+    buffer = calloc(1, sizeof(*buffer));
+    if (buffer == NULL)
+      return NULL;
+    buffer->chunk_size = chunk_size;
+    buffer->node = trace_numa_current_node();
+    *per_buffer_data = buffer;
+  }
+
+  if (buffer->count == buffer->capacity) {
+    size_t capacity = buffer->capacity ? 2 * buffer->capacity : 8;
+    void **chunks = realloc(buffer->chunks, capacity * sizeof(*chunks));
+    if (chunks == NULL)
+      return NULL;
+    buffer->chunks = chunks;
+    buffer->capacity = capacity;
+  }
+
+  void *chunk = NULL;
+  trace_lock(&state.memory.lock);
+  bool over_budget =
+      arena->budget != 0 && arena->in_use + chunk_size > arena->budget;
+  if (over_budget && buffer->count > 0) {
+    /* Refusing the chunk makes OTF2 flush this buffer and release its chunks
+       before asking again. An empty buffer is always granted a chunk so that
+       every location can make progress. */
+    arena->budget_flushes++;
+  } else {
+    trace_memory_class_t *class =
+        trace_memory_get_class(arena, chunk_size, buffer->node);
+    if (class != NULL &&
+        (class->free != NULL || trace_memory_refill(arena, class))) {
+      chunk = class->free;
+      class->free = *(void **)chunk;
+      arena->in_use += chunk_size;
+      if (arena->in_use > arena->peak)
+        arena->peak = arena->in_use;
+      arena->node[buffer->node].in_use += chunk_size;
+      if (arena->node[buffer->node].in_use > arena->node[buffer->node].peak)
+        arena->node[buffer->node].peak = arena->node[buffer->node].in_use;
+      if (over_budget)
+        arena->over_budget++;
+    }
+  }
+  trace_unlock(&state.memory.lock);
+
+  if (chunk != NULL)
+    buffer->chunks[buffer->count++] = chunk;
+  return chunk;
+}
+
+static void trace_memory_free_all(void *user_data, OTF2_FileType file_type,
+                                  OTF2_LocationRef location,
+                                  void **per_buffer_data, bool final) {
+  trace_memory_arena_t *arena = (trace_memory_arena_t *)user_data;
+  trace_memory_buffer_t *buffer = *per_buffer_data;
+  if (buffer == NULL)
+    return;
+
+  trace_lock(&state.memory.lock);
+  trace_memory_class_t *class =
+      trace_memory_get_class(arena, buffer->chunk_size, buffer->node);
+  for (size_t k = 0; k < buffer->count && class != NULL; k++) {
+    *(void **)buffer->chunks[k] = class->free;
+    class->free = buffer->chunks[k];
+  }
+  arena->in_use -= buffer->count * buffer->chunk_size;
+  arena->node[buffer->node].in_use -= buffer->count * buffer->chunk_size;
+  if (!final)
+    arena->flushes++;
+  trace_unlock(&state.memory.lock);
+
+  buffer->count = 0;
+  if (final) {
+    free(buffer->chunks);
+    free(buffer);
+    *per_buffer_data = NULL;
+  }
+}
+
+void trace_memory_set_callbacks(OTF2_Archive *archive) {
+  static const OTF2_MemoryCallbacks callbacks = {
+      .otf2_allocate = trace_memory_allocate,
+      .otf2_free_all = trace_memory_free_all};
+  if (state.memory.instance == NULL)
+    return;
+  OTF2_ErrorCode err = OTF2_Archive_SetMemoryCallbacks(archive, &callbacks,
+                                                       state.memory.instance);
+  CHECK_OTF2_ERROR_CODE(err);
+}
+
+void trace_memory_finalise(void) {
+  trace_lock(&state.memory.lock);
+  trace_memory_arena_t *arena = state.memory.instance;
+  state.memory.instance = NULL;
+  trace_unlock(&state.memory.lock);
+
+  if (arena == NULL)
+    return;
+
+  fprintf(stderr, "\nOTF2 BUFFERS:\n");
+  fprintf(stderr, "%-30s %lu KiB\n", "Peak in use:", arena->peak >> 10);
+  fprintf(stderr, "%-30s %lu KiB\n", "Mapped:", arena->mapped >> 10);
+  if (arena->budget != 0) {
+    fprintf(stderr, "%-30s %lu KiB\n", "Budget:", arena->budget >> 10);
+  } else {
+    fprintf(stderr, "%-30s %s\n", "Budget:", "unlimited");
+  }
+  fprintf(stderr, "%-30s %lu/%lu KiB\n", "Chunk size (events/defs):",
+          event_chunk_size >> 10, def_chunk_size >> 10);
+  fprintf(stderr, "%-30s %s\n", "Huge pages:",
+          huge_pages_name(arena->huge_pages));
+  fprintf(stderr, "%-30s %lu (%lu forced by budget)\n", "Flushes:",
+          arena->flushes, arena->budget_flushes);
+  if (arena->over_budget != 0) {
+    fprintf(stderr, "%-30s %lu\n", "Chunks granted over budget:",
+            arena->over_budget);
+  }
+  if (arena->nodes > 1) {
+    fprintf(stderr, "%-30s %d\n", "NUMA nodes:", arena->nodes);
+    for (int node = 0; node < arena->nodes; node++) {
+      if (arena->node[node].mapped == 0)
+        continue;
+      char label[64];
+      snprintf(label, sizeof(label), "Node %d peak/mapped:", node);
+      fprintf(stderr, "%-30s %lu/%lu KiB (%lu KiB bound)\n", label,
+              arena->node[node].peak >> 10, arena->node[node].mapped >> 10,
+              arena->node[node].bound >> 10);
+    }
+  }
+
+  while (arena->slabs != NULL) {
+    trace_memory_slab_t *slab = arena->slabs;
+    arena->slabs = slab->next;
+    munmap(slab->base, slab->size);
+    free(slab);
+  }
+  while (arena->classes != NULL) {
+    trace_memory_class_t *class = arena->classes;
+    arena->classes = class->next;
+    free(class);
+  }
+  free(arena->node);
+  free(arena);
+}
@@ -0,0 +1,41 @@
+/**
+ * @file trace-memory.h
+ * @author Adam Tuft
+ * @brief Private interface to the arena which provides the chunks used by
+ * OTF2's event & definition buffers.
+ * @version 0.1
+ * @date 2026-10-19
+ *
+ * @copyright Copyright (c) 2026
+ *
+ */
+
+#if !defined(OTTER_TRACE_MEMORY_H)
+#define OTTER_TRACE_MEMORY_H
+
+#include "public/otter-common.h"
+#include <otf2/OTF2_Archive.h>
+#include <stdint.h>
+
+typedef struct trace_memory_arena_t trace_memory_arena_t;
+
+/* Parse the memory options and create the arena */
+void trace_memory_initialise(otter_opt_t *opt);
+
+/* Parse a size in bytes with an optional K, M or G suffix, returning fallback
+   if value is unset or invalid. An invalid value is reported against name. */
+uint64_t trace_memory_parse_size(const char *name, const char *value,
+                                 uint64_t fallback);
+
+/* Chunk sizes to pass to OTF2_Archive_Open */
+uint64_t trace_memory_event_chunk_size(void);
+uint64_t trace_memory_def_chunk_size(void);
+
+/* Have OTF2 allocate its buffer chunks from the arena */
+void trace_memory_set_callbacks(OTF2_Archive *archive);
+
+/* Report memory & flush statistics and release the arena. Must be called
+   after the archive is closed. */
+void trace_memory_finalise(void);
+
+#endif // OTTER_TRACE_MEMORY_H
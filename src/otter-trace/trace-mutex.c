@@ -0,0 +1,364 @@
+/**
+ * @file trace-mutex.c
+ * @author Adam Tuft
+ * @brief Aggregates the time each thread spends waiting for and holding each
+ * mutex it encounters, optionally recording each acquisition & release as an
+ * event, and reports the most contended mutexes when the trace is finalised.
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <otf2/otf2.h>
+
+#include "public/debug.h"
+#include "public/otter-trace/trace-mutex.h"
+
+#include "trace-attribute-lookup.h"
+#include "trace-attributes.h"
+#include "trace-check-error-code.h"
+#include "trace-sink.h"
+#include "trace-state.h"
+#include "trace-static-constants.h"
+#include "trace-timestamp.h"
+#include "trace-types-as-labels.h"
+
+/* the number of mutexes summarised on stderr at finalisation */
+enum { mutex_report_top_n = 10 };
+
+typedef struct {
+  bool used;
+  uint64_t wait_id;
+  otter_mutex_kind_t kind;
+  const void *codeptr_ra; /* where the mutex was first initialised/acquired */
+  uint64_t acquisitions;
+  uint64_t wait_total;
+  uint64_t wait_max;
+  uint64_t hold_total;
+  uint64_t hold_max;
+  uint64_t acquire_time;  /* time of a pending acquire, otherwise 0 */
+  uint64_t acquired_time; /* time the mutex was acquired, if held */
+  uint32_t order;         /* the thread's acquisition order when acquired */
+} trace_mutex_stats_t;
+
+/* An open-addressing hash table keyed by wait ID */
+struct trace_mutex_table_t {
+  trace_mutex_stats_t *entries;
+  size_t capacity; /* always a power of 2 */
+  size_t count;
+  uint32_t acquisition_order;
+};
+
+static bool record_mutex_events = false;
+static char mutex_report_path[default_name_buf_sz + 1] = {0};
+
+static inline size_t mutex_table_slot(uint64_t wait_id, size_t capacity) {
+  /* Fibonacci hashing spreads the aligned addresses used as wait IDs */
+  return (size_t)((wait_id * 0x9E3779B97F4A7C15ULL) >> 32) & (capacity - 1);
+}
+
+static bool mutex_table_grow(trace_mutex_table_t *table) {
+  size_t capacity = table->capacity ? table->capacity * 2 : 64;
+  trace_mutex_stats_t *entries = calloc(capacity, sizeof(*entries));
+  if (entries == NULL) {
+    LOG_ERROR("failed to grow mutex table to %lu entries", capacity);
+    return false;
+  }
+  for (size_t k = 0; k < table->capacity; k++) {
+    if (!table->entries[k].used)
+      continue;
+    size_t slot = mutex_table_slot(table->entries[k].wait_id, capacity);
+    while (entries[slot].used) {
+      slot = (slot + 1) & (capacity - 1);
+    }
+    entries[slot] = table->entries[k];
+  }
+  free(table->entries);
+  table->entries = entries;
+  table->capacity = capacity;
+  return true;
+}
+
+/* Get the stats for a wait ID, inserting an empty entry if not found */
+static trace_mutex_stats_t *mutex_table_lookup(trace_mutex_table_t *table,
+                                               otter_mutex_kind_t kind,
+                                               uint64_t wait_id,
+                                               const void *codeptr_ra) {
+  if (2 * (table->count + 1) > table->capacity) {
+    if (!mutex_table_grow(table))
+      return NULL;
+  }
+  size_t slot = mutex_table_slot(wait_id, table->capacity);
+  while (table->entries[slot].used) {
+    if (table->entries[slot].wait_id == wait_id)
+      return &table->entries[slot];
+    slot = (slot + 1) & (table->capacity - 1);
+  }
+  table->entries[slot] = (trace_mutex_stats_t){
+      .used = true, .wait_id = wait_id, .kind = kind, .codeptr_ra = codeptr_ra};
+  table->count++;
+  return &table->entries[slot];
+}
+
+trace_mutex_table_t *trace_mutex_table_new(void) {
+  trace_mutex_table_t *table = malloc(sizeof(*table));
+  if (table == NULL) {
+    LOG_ERROR("failed to create mutex table");
+    return NULL;
+  }
+  *table = (trace_mutex_table_t){
+      .entries = NULL, .capacity = 0, .count = 0, .acquisition_order = 0};
+  return table;
+}
+
+static void trace_mutex_table_delete(trace_mutex_table_t *table) {
+  if (table == NULL)
+    return;
+  free(table->entries);
+  free(table);
+}
+
+static void trace_mutex_table_merge(trace_mutex_table_t *dest,
+                                    trace_mutex_table_t *src) {
+  for (size_t k = 0; k < src->capacity; k++) {
+    trace_mutex_stats_t *from = &src->entries[k];
+    if (!from->used)
+      continue;
+    trace_mutex_stats_t *into =
+        mutex_table_lookup(dest, from->kind, from->wait_id, from->codeptr_ra);
+    if (into == NULL)
+      return;
+    into->acquisitions += from->acquisitions;
+    into->wait_total += from->wait_total;
+    into->hold_total += from->hold_total;
+    if (from->wait_max > into->wait_max)
+      into->wait_max = from->wait_max;
+    if (from->hold_max > into->hold_max)
+      into->hold_max = from->hold_max;
+  }
+}
+
+void trace_mutex_table_finalise(trace_mutex_table_t *table) {
+  if (table == NULL)
+    return;
+  pthread_mutex_lock(&state.mutexes.lock);
+  if (state.mutexes.instance != NULL) {
+    trace_mutex_table_merge(state.mutexes.instance, table);
+  } else {
+    LOG_WARN("mutex statistics discarded after finalisation");
+  }
+  pthread_mutex_unlock(&state.mutexes.lock);
+  trace_mutex_table_delete(table);
+}
+
+void trace_mutex_initialise(otter_opt_t *opt) {
+  record_mutex_events = opt->record_mutex_events;
+  snprintf(mutex_report_path, default_name_buf_sz, "%s/%s/aux/mutexes.csv",
+           opt->tracepath, opt->archive_name);
+  pthread_mutex_lock(&state.mutexes.lock);
+  state.mutexes.instance = trace_mutex_table_new();
+  pthread_mutex_unlock(&state.mutexes.lock);
+}
+
+static int compare_wait_total_desc(const void *a, const void *b) {
+  const trace_mutex_stats_t *lhs = *(const trace_mutex_stats_t *const *)a;
+  const trace_mutex_stats_t *rhs = *(const trace_mutex_stats_t *const *)b;
+  return (lhs->wait_total < rhs->wait_total) -
+         (lhs->wait_total > rhs->wait_total);
+}
+
+static const char *mutex_kind_name(otter_mutex_kind_t kind) {
+  switch (kind) {
+  case otter_mutex_lock:
+    return "lock";
+  case otter_mutex_test_lock:
+    return "test_lock";
+  case otter_mutex_nest_lock:
+    return "nest_lock";
+  case otter_mutex_test_nest_lock:
+    return "test_nest_lock";
+  case otter_mutex_critical:
+    return "critical";
+  case otter_mutex_atomic:
+    return "atomic";
+  case otter_mutex_ordered:
+    return "ordered";
+  default:
+    return "unknown";
+  }
+}
+
+void trace_mutex_finalise(void) {
+  pthread_mutex_lock(&state.mutexes.lock);
+  trace_mutex_table_t *table = state.mutexes.instance;
+  state.mutexes.instance = NULL;
+  pthread_mutex_unlock(&state.mutexes.lock);
+
+  if (table == NULL || table->count == 0) {
+    trace_mutex_table_delete(table);
+    return;
+  }
+
+  /* sort mutexes by total wait time, most contended first */
+  trace_mutex_stats_t **sorted = malloc(table->count * sizeof(*sorted));
+  if (sorted == NULL) {
+    LOG_ERROR("failed to allocate mutex report");
+    trace_mutex_table_delete(table);
+    return;
+  }
+  size_t n = 0;
+  for (size_t k = 0; k < table->capacity; k++) {
+    if (table->entries[k].used)
+      sorted[n++] = &table->entries[k];
+  }
+  qsort(sorted, n, sizeof(*sorted), compare_wait_total_desc);
+
+  FILE *report = fopen(mutex_report_path, "w");
+  if (report == NULL) {
+    LOG_ERROR("Error opening file %s: %s", mutex_report_path, strerror(errno));
+  } else {
+    fprintf(report, "wait_id,kind,codeptr_ra,acquisitions,wait_total_ns,"
+                    "wait_max_ns,hold_total_ns,hold_max_ns\n");
+    for (size_t k = 0; k < n; k++) {
+      trace_mutex_stats_t *m = sorted[k];
+      fprintf(report, "0x%lx,%s,%p,%lu,%lu,%lu,%lu,%lu\n", m->wait_id,
+              mutex_kind_name(m->kind), m->codeptr_ra, m->acquisitions,
+              m->wait_total, m->wait_max, m->hold_total, m->hold_max);
+    }
+    fclose(report);
+  }
+
+  fprintf(stderr, "\nMUTEX CONTENTION (top %d of %lu by total wait):\n",
+          mutex_report_top_n, n);
+  fprintf(stderr, "%18s %14s %18s %12s %14s %14s\n", "wait id", "kind",
+          "codeptr_ra", "acquired", "wait (ns)", "max wait (ns)");
+  for (size_t k = 0; k < n && k < mutex_report_top_n; k++) {
+    trace_mutex_stats_t *m = sorted[k];
+    fprintf(stderr, "%#18lx %14s %18p %12lu %14lu %14lu\n", m->wait_id,
+            mutex_kind_name(m->kind), m->codeptr_ra, m->acquisitions,
+            m->wait_total, m->wait_max);
+  }
+
+  free(sorted);
+  trace_mutex_table_delete(table);
+}
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+/*   WRITE EVENTS                                                            */
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+static void trace_mutex_write_event(trace_location_def_t *self,
+                                    trace_mutex_stats_t *mutex,
+                                    attr_label_enum_t event_type,
+                                    uint64_t time) {
+  OTF2_ErrorCode err = OTF2_SUCCESS;
+  OTF2_AttributeList *attributes = NULL;
+  trace_location_get_otf2(self, &attributes, NULL, NULL);
+
+  err = OTF2_AttributeList_AddUint64(attributes, attr_mutex_wait_id,
+                                     mutex->wait_id);
+  CHECK_OTF2_ERROR_CODE(err);
+
+  err = OTF2_AttributeList_AddStringRef(
+      attributes, attr_mutex_kind,
+      attr_label_ref[mutex_kind_as_label(mutex->kind)]);
+  CHECK_OTF2_ERROR_CODE(err);
+
+  err = OTF2_AttributeList_AddStringRef(attributes, attr_event_type,
+                                        attr_label_ref[event_type]);
+  CHECK_OTF2_ERROR_CODE(err);
+
+  err = OTF2_AttributeList_AddStringRef(attributes, attr_endpoint,
+                                        attr_label_ref[attr_endpoint_discrete]);
+  CHECK_OTF2_ERROR_CODE(err);
+
+  if (event_type == attr_event_type_mutex_acquired) {
+    err = OTF2_AttributeList_AddUint64(
+        attributes, attr_mutex_wait_time,
+        mutex->acquire_time ? time - mutex->acquire_time : 0);
+    CHECK_OTF2_ERROR_CODE(err);
+    err = trace_sink_acquire_lock(self, attributes, time,
+                                  (uint32_t)mutex->wait_id, mutex->order);
+  } else {
+    err = OTF2_AttributeList_AddUint64(attributes, attr_mutex_hold_time,
+                                       time - mutex->acquired_time);
+    CHECK_OTF2_ERROR_CODE(err);
+    err = trace_sink_release_lock(self, attributes, time,
+                                  (uint32_t)mutex->wait_id, mutex->order);
+  }
+  CHECK_OTF2_ERROR_CODE(err);
+
+  trace_location_inc_event_count(self);
+}
+
+void trace_event_lock_init(trace_location_def_t *self, otter_mutex_kind_t kind,
+                           uint64_t wait_id, const void *codeptr_ra) {
+  trace_mutex_table_t *table = trace_location_get_mutex_table(self);
+  trace_mutex_stats_t *mutex =
+      mutex_table_lookup(table, kind, wait_id, codeptr_ra);
+  if (mutex == NULL)
+    return;
+  /* prefer the site which initialised a lock over where it was acquired */
+  mutex->codeptr_ra = codeptr_ra;
+}
+
+void trace_event_mutex_acquire(trace_location_def_t *self,
+                               otter_mutex_kind_t kind, uint64_t wait_id,
+                               const void *codeptr_ra) {
+  trace_mutex_table_t *table = trace_location_get_mutex_table(self);
+  trace_mutex_stats_t *mutex =
+      mutex_table_lookup(table, kind, wait_id, codeptr_ra);
+  if (mutex == NULL)
+    return;
+  mutex->acquire_time = get_timestamp();
+}
+
+void trace_event_mutex_acquired(trace_location_def_t *self,
+                                otter_mutex_kind_t kind, uint64_t wait_id,
+                                const void *codeptr_ra) {
+  uint64_t time = get_timestamp();
+  trace_mutex_table_t *table = trace_location_get_mutex_table(self);
+  trace_mutex_stats_t *mutex =
+      mutex_table_lookup(table, kind, wait_id, codeptr_ra);
+  if (mutex == NULL)
+    return;
+  uint64_t wait = mutex->acquire_time ? time - mutex->acquire_time : 0;
+  mutex->acquisitions++;
+  mutex->wait_total += wait;
+  if (wait > mutex->wait_max)
+    mutex->wait_max = wait;
+  mutex->order = table->acquisition_order++;
+  if (record_mutex_events) {
+    trace_mutex_write_event(self, mutex, attr_event_type_mutex_acquired, time);
+  }
+  mutex->acquire_time = 0;
+  mutex->acquired_time = time;
+}
+
+void trace_event_mutex_released(trace_location_def_t *self,
+                                otter_mutex_kind_t kind, uint64_t wait_id,
+                                const void *codeptr_ra) {
+  uint64_t time = get_timestamp();
+  trace_mutex_table_t *table = trace_location_get_mutex_table(self);
+  trace_mutex_stats_t *mutex =
+      mutex_table_lookup(table, kind, wait_id, codeptr_ra);
+  if (mutex == NULL)
+    return;
+  if (mutex->acquired_time == 0) {
+    /* released by a thread other than the one which acquired it */
+    return;
+  }
+  uint64_t hold = time - mutex->acquired_time;
+  mutex->hold_total += hold;
+  if (hold > mutex->hold_max)
+    mutex->hold_max = hold;
+  if (record_mutex_events) {
+    trace_mutex_write_event(self, mutex, attr_event_type_mutex_released, time);
+  }
+  mutex->acquired_time = 0;
+}
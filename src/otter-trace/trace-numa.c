@@ -0,0 +1,98 @@
+/**
+ * @file trace-numa.c
+ * @author Adam Tuft
+ * @brief Finds the NUMA nodes of the machine and the node the calling thread is
+ * running on, and binds memory to a node, using sysfs, getcpu and mbind.
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "public/debug.h"
+#include "public/otter-trace/trace-numa.h"
+
+#define NUMA_POSSIBLE_NODES "/sys/devices/system/node/possible"
+#define NUMA_MAX_NODES 1024
+#define NUMA_MPOL_PREFERRED 1 /* from linux/mempolicy.h */
+
+static struct {
+  int nodes;
+  pthread_once_t once;
+} numa = {.nodes = 1, .once = PTHREAD_ONCE_INIT};
+
+/* The possible nodes are listed as ranges, e.g. "0-3" or "0,2-3". Nodes are
+   numbered from 0, so the highest is one less than the number of nodes. */
+static void numa_read_nodes(void) {
+  FILE *in = fopen(NUMA_POSSIBLE_NODES, "r");
+  if (in == NULL)
+    return;
+  char line[256] = {0};
+  char *read = fgets(line, sizeof(line), in);
+  fclose(in);
+  if (read == NULL)
+    return;
+  long highest = -1;
+  for (char *p = line; *p != '\0' && *p != '\n';) {
+    char *end = NULL;
+    long node = strtol(p, &end, 10);
+    if (end == p || node < 0)
+      return;
+    if (node > highest)
+      highest = node;
+    p = end;
+    if (*p == '-' || *p == ',')
+      p++;
+  }
+  if (highest >= NUMA_MAX_NODES) {
+    LOG_WARN("%ld NUMA nodes, using the first %d", highest + 1,
+             NUMA_MAX_NODES);
+    highest = NUMA_MAX_NODES - 1;
+  }
+  if (highest >= 0)
+    numa.nodes = (int)highest + 1;
+}
+
+int trace_numa_nodes(void) {
+  pthread_once(&numa.once, numa_read_nodes);
+  return numa.nodes;
+}
+
+int trace_numa_current_node(void) {
+  if (trace_numa_nodes() == 1)
+    return 0;
+  unsigned cpu = 0;
+  unsigned node = 0;
+  if (syscall(SYS_getcpu, &cpu, &node, NULL) != 0 ||
+      node >= (unsigned)numa.nodes)
+    return 0;
+  return (int)node;
+}
+
+bool trace_numa_bind(void *addr, size_t length, int node) {
+#if defined(SYS_mbind)
+  if (trace_numa_nodes() == 1 || node < 0 || node >= numa.nodes)
+    return false;
+  unsigned long mask[NUMA_MAX_NODES / (CHAR_BIT * sizeof(unsigned long))] = {
+      0};
+  const size_t bits = CHAR_BIT * sizeof(unsigned long);
+  mask[node / bits] = 1ul << (node % bits);
+  /* Preferred rather than bound, so that a full node falls back to another
+     instead of failing the allocation */
+  if (syscall(SYS_mbind, addr, length, NUMA_MPOL_PREFERRED, mask,
+              (unsigned long)NUMA_MAX_NODES + 1, 0) != 0) {
+    LOG_DEBUG("mbind to node %d failed: %s", node, strerror(errno));
+    return false;
+  }
+  return true;
+#else
+  return false;
+#endif
+}
@@ -16,6 +16,7 @@
 #include "public/otter-environment-variables.h"
 #include "public/otter-trace/trace-location.h"
 #include "public/otter-trace/trace-ompt.h"
+#include "public/otter-trace/trace-perf.h"
 #include "public/types/queue.h"
 #include "public/types/stack.h"
 
@@ -23,6 +24,7 @@
 #include "trace-attribute-lookup.h"
 #include "trace-attributes.h"
 #include "trace-check-error-code.h"
+#include "trace-sink.h"
 #include "trace-static-constants.h"
 #include "trace-timestamp.h"
 #include "trace-types-as-labels.h"
@@ -35,9 +37,7 @@
 void trace_event_thread_begin(trace_location_def_t *self) {
   OTF2_ErrorCode err = OTF2_SUCCESS;
   OTF2_AttributeList *attributes = NULL;
-  OTF2_EvtWriter *evt_writer = NULL;
-  OTF2_DefWriter *def_writer = NULL;
-  trace_location_get_otf2(self, &attributes, &evt_writer, &def_writer);
+  trace_location_get_otf2(self, &attributes, NULL, NULL);
   unique_id_t thread_id = trace_location_get_id(self);
   otter_thread_t thread_type = trace_location_get_thread_type(self);
 
@@ -61,8 +61,7 @@ void trace_event_thread_begin(trace_location_def_t *self) {
                                         attr_label_ref[attr_endpoint_enter]);
   CHECK_OTF2_ERROR_CODE(err);
 
-  err = OTF2_EvtWriter_ThreadBegin(evt_writer, attributes, get_timestamp(),
-                                   OTF2_UNDEFINED_COMM, thread_id);
+  err = trace_sink_thread_begin(self, attributes, get_timestamp(), thread_id);
   CHECK_OTF2_ERROR_CODE(err);
 
   trace_location_inc_event_count(self);
@@ -73,9 +72,7 @@ void trace_event_thread_begin(trace_location_def_t *self) {
 void trace_event_thread_end(trace_location_def_t *self) {
   OTF2_ErrorCode err = OTF2_SUCCESS;
   OTF2_AttributeList *attributes = NULL;
-  OTF2_EvtWriter *evt_writer = NULL;
-  OTF2_DefWriter *def_writer = NULL;
-  trace_location_get_otf2(self, &attributes, &evt_writer, &def_writer);
+  trace_location_get_otf2(self, &attributes, NULL, NULL);
   unique_id_t thread_id = trace_location_get_id(self);
   otter_thread_t thread_type = trace_location_get_thread_type(self);
 
@@ -98,8 +95,7 @@ void trace_event_thread_end(trace_location_def_t *self) {
                                         attr_label_ref[attr_endpoint_leave]);
   CHECK_OTF2_ERROR_CODE(err);
 
-  err = OTF2_EvtWriter_ThreadEnd(evt_writer, attributes, get_timestamp(),
-                                 OTF2_UNDEFINED_COMM, thread_id);
+  err = trace_sink_thread_end(self, attributes, get_timestamp(), thread_id);
   CHECK_OTF2_ERROR_CODE(err);
 
   trace_location_inc_event_count(self);
@@ -113,8 +109,7 @@ void trace_event_enter(trace_location_def_t *self, trace_region_def_t *region) {
   OTF2_ErrorCode err = OTF2_SUCCESS;
   attr_label_enum_t event_type_label = 0;
   OTF2_AttributeList *attributes = NULL;
-  OTF2_EvtWriter *evt_writer = NULL;
-  trace_location_get_otf2(self, &attributes, &evt_writer, NULL);
+  trace_location_get_otf2(self, &attributes, NULL, NULL);
 
   if (trace_region_is_type(region, trace_region_parallel)) {
     trace_location_enter_region_def_scope(self);
@@ -173,8 +168,9 @@ void trace_event_enter(trace_location_def_t *self, trace_region_def_t *region) {
   trace_add_region_type_attributes(region, attributes);
 
   /* Record the event */
-  OTF2_EvtWriter_Enter(evt_writer, attributes, get_timestamp(),
-                       trace_region_get_ref(region));
+  err = trace_sink_enter(self, attributes, get_timestamp(),
+                         trace_region_get_ref(region));
+  CHECK_OTF2_ERROR_CODE(err);
 
   trace_location_enter_region(self, region);
 
@@ -190,8 +186,7 @@ void trace_event_enter(trace_location_def_t *self, trace_region_def_t *region) {
 void trace_event_leave(trace_location_def_t *self) {
   OTF2_ErrorCode err = OTF2_SUCCESS;
   OTF2_AttributeList *attributes = NULL;
-  OTF2_EvtWriter *evt_writer = NULL;
-  trace_location_get_otf2(self, &attributes, &evt_writer, NULL);
+  trace_location_get_otf2(self, &attributes, NULL, NULL);
 
   trace_region_def_t *region = NULL;
   trace_location_leave_region(self, &region);
@@ -250,8 +245,9 @@ void trace_event_leave(trace_location_def_t *self) {
   trace_add_region_type_attributes(region, attributes);
 
   /* Record the event */
-  OTF2_EvtWriter_Leave(evt_writer, attributes, get_timestamp(),
-                       trace_region_get_ref(region));
+  err = trace_sink_leave(self, attributes, get_timestamp(),
+                         trace_region_get_ref(region));
+  CHECK_OTF2_ERROR_CODE(err);
 
   if (trace_region_is_type(region, trace_region_parallel)) {
     trace_location_leave_region_def_scope(self, region);
@@ -278,8 +274,7 @@ void trace_event_task_create(trace_location_def_t *self,
                              trace_region_def_t *region) {
   OTF2_ErrorCode err = OTF2_SUCCESS;
   OTF2_AttributeList *attributes = NULL;
-  OTF2_EvtWriter *evt_writer = NULL;
-  trace_location_get_otf2(self, &attributes, &evt_writer, NULL);
+  trace_location_get_otf2(self, &attributes, NULL, NULL);
 
   unique_id_t encountering_task_id =
       trace_region_get_encountering_task_id(region);
@@ -368,9 +363,8 @@ void trace_event_task_create(trace_location_def_t *self,
       attr_label_ref[task_status_as_label(attr.task.task_status)]);
   CHECK_OTF2_ERROR_CODE(err);
 
-  OTF2_EvtWriter_ThreadTaskCreate(evt_writer, attributes, get_timestamp(),
-                                  OTF2_UNDEFINED_COMM, OTF2_UNDEFINED_UINT32,
-                                  0);
+  err = trace_sink_task_create(self, attributes, get_timestamp());
+  CHECK_OTF2_ERROR_CODE(err);
 
   trace_location_inc_event_count(self);
 
@@ -398,8 +392,7 @@ void trace_event_task_switch(trace_location_def_t *self,
 
   OTF2_ErrorCode err = OTF2_SUCCESS;
   OTF2_AttributeList *attributes = NULL;
-  OTF2_EvtWriter *evt_writer = NULL;
-  trace_location_get_otf2(self, &attributes, &evt_writer, NULL);
+  trace_location_get_otf2(self, &attributes, NULL, NULL);
 
   trace_region_set_task_status(prior_task, prior_status);
 
@@ -454,9 +447,88 @@ void trace_event_task_switch(trace_location_def_t *self,
       attributes, attr_event_type, attr_label_ref[attr_event_type_task_switch]);
   CHECK_OTF2_ERROR_CODE(err);
 
-  OTF2_EvtWriter_ThreadTaskSwitch(evt_writer, attributes, get_timestamp(),
-                                  OTF2_UNDEFINED_COMM, OTF2_UNDEFINED_UINT32,
-                                  0); /* creating thread, generation number */
+  trace_perf_add_counters(self, attributes);
+
+  err = trace_sink_task_switch(self, attributes, get_timestamp());
+  CHECK_OTF2_ERROR_CODE(err);
+
+  return;
+}
+
+void trace_event_task_dependences(trace_location_def_t *self,
+                                  trace_region_def_t *task,
+                                  const otter_dependence_t *dependences,
+                                  int ndependences) {
+  OTF2_ErrorCode err = OTF2_SUCCESS;
+  OTF2_AttributeList *attributes = NULL;
+  trace_location_get_otf2(self, &attributes, NULL, NULL);
+
+  trace_region_attr_t task_attr = trace_region_get_attributes(task);
+
+  /* Record one event per dependence so each carries its own variable & type */
+  for (int n = 0; n < ndependences; n++) {
+    err = OTF2_AttributeList_AddUint64(attributes, attr_unique_id,
+                                       task_attr.task.id);
+    CHECK_OTF2_ERROR_CODE(err);
+
+    err = OTF2_AttributeList_AddUint64(attributes, attr_dependence_variable,
+                                       dependences[n].variable);
+    CHECK_OTF2_ERROR_CODE(err);
+
+    err = OTF2_AttributeList_AddStringRef(
+        attributes, attr_dependence_type,
+        attr_label_ref[dependence_type_as_label(dependences[n].type)]);
+    CHECK_OTF2_ERROR_CODE(err);
+
+    err = OTF2_AttributeList_AddStringRef(
+        attributes, attr_endpoint, attr_label_ref[attr_endpoint_discrete]);
+    CHECK_OTF2_ERROR_CODE(err);
+
+    err = OTF2_AttributeList_AddStringRef(
+        attributes, attr_event_type,
+        attr_label_ref[attr_event_type_task_dependence]);
+    CHECK_OTF2_ERROR_CODE(err);
+
+    err = trace_sink_task_create(self, attributes, get_timestamp());
+    CHECK_OTF2_ERROR_CODE(err);
+
+    trace_location_inc_event_count(self);
+  }
+
+  return;
+}
+
+void trace_event_task_dependence(trace_location_def_t *self,
+                                 trace_region_def_t *source_task,
+                                 trace_region_def_t *sink_task) {
+  OTF2_ErrorCode err = OTF2_SUCCESS;
+  OTF2_AttributeList *attributes = NULL;
+  trace_location_get_otf2(self, &attributes, NULL, NULL);
+
+  trace_region_attr_t source_attr = trace_region_get_attributes(source_task);
+  trace_region_attr_t sink_attr = trace_region_get_attributes(sink_task);
+
+  err = OTF2_AttributeList_AddUint64(attributes, attr_dependence_source_task_id,
+                                     source_attr.task.id);
+  CHECK_OTF2_ERROR_CODE(err);
+
+  err = OTF2_AttributeList_AddUint64(attributes, attr_dependence_sink_task_id,
+                                     sink_attr.task.id);
+  CHECK_OTF2_ERROR_CODE(err);
+
+  err = OTF2_AttributeList_AddStringRef(attributes, attr_endpoint,
+                                        attr_label_ref[attr_endpoint_discrete]);
+  CHECK_OTF2_ERROR_CODE(err);
+
+  err = OTF2_AttributeList_AddStringRef(
+      attributes, attr_event_type,
+      attr_label_ref[attr_event_type_task_dependence_pair]);
+  CHECK_OTF2_ERROR_CODE(err);
+
+  err = trace_sink_task_create(self, attributes, get_timestamp());
+  CHECK_OTF2_ERROR_CODE(err);
+
+  trace_location_inc_event_count(self);
 
   return;
 }
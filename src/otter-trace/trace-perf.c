@@ -0,0 +1,233 @@
+/**
+ * @file trace-perf.c
+ * @author Adam Tuft
+ * @brief Opens the performance counters requested in OTTER_PERF_EVENTS as a
+ * per-thread perf_event group and attaches the change in each counter since a
+ * thread's previous task event to that event's attributes.
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <linux/perf_event.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <otf2/otf2.h>
+
+#include "public/debug.h"
+#include "public/otter-trace/trace-perf.h"
+
+#include "trace-attributes.h"
+#include "trace-check-error-code.h"
+
+typedef struct {
+  const char *name;
+  uint32_t type;
+  uint64_t config;
+  attr_name_enum_t attr;
+} trace_perf_event_t;
+
+/* The counters which may be requested, using the names given by perf-list */
+static const trace_perf_event_t perf_events[] = {
+    {"cycles", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES, attr_perf_cycles},
+    {"instructions", PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS,
+     attr_perf_instructions},
+    {"cache-references", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_REFERENCES,
+     attr_perf_cache_references},
+    {"cache-misses", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES,
+     attr_perf_cache_misses},
+    {"branches", PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_INSTRUCTIONS,
+     attr_perf_branches},
+    {"branch-misses", PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES,
+     attr_perf_branch_misses},
+    {"task-clock", PERF_TYPE_SOFTWARE, PERF_COUNT_SW_TASK_CLOCK,
+     attr_perf_task_clock},
+    {"context-switches", PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CONTEXT_SWITCHES,
+     attr_perf_context_switches},
+    {"cpu-migrations", PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CPU_MIGRATIONS,
+     attr_perf_cpu_migrations},
+    {"page-faults", PERF_TYPE_SOFTWARE, PERF_COUNT_SW_PAGE_FAULTS,
+     attr_perf_page_faults},
+};
+
+enum { perf_max_events = sizeof(perf_events) / sizeof(perf_events[0]) };
+
+struct trace_perf_group_t {
+  int leader;
+  size_t count;
+  int fd[perf_max_events];
+  attr_name_enum_t attr[perf_max_events];
+  uint64_t previous[perf_max_events];
+};
+
+/* The counters opened for each thread. Written only during initialisation. */
+static const trace_perf_event_t *perf_selected[perf_max_events];
+static size_t perf_num_selected = 0;
+
+static int perf_event_open(struct perf_event_attr *attr, int group_fd) {
+  /* count the calling thread on any cpu */
+  return (int)syscall(SYS_perf_event_open, attr, 0, -1, group_fd,
+                      PERF_FLAG_FD_CLOEXEC);
+}
+
+static int trace_perf_open_event(const trace_perf_event_t *event,
+                                 int group_fd) {
+  struct perf_event_attr attr;
+  memset(&attr, 0, sizeof(attr));
+  attr.size = sizeof(attr);
+  attr.type = event->type;
+  attr.config = event->config;
+  attr.read_format = PERF_FORMAT_GROUP;
+  attr.disabled = group_fd == -1 ? 1 : 0; /* the leader enables the group */
+  attr.exclude_hv = 1;
+  int fd = perf_event_open(&attr, group_fd);
+  if (fd == -1 && (errno == EACCES || errno == EPERM)) {
+    /* perf_event_paranoid >= 2 (the usual case in containers) only permits
+       counting in user space */
+    attr.exclude_kernel = 1;
+    fd = perf_event_open(&attr, group_fd);
+  }
+  return fd;
+}
+
+trace_perf_group_t *trace_perf_group_open(void) {
+  if (perf_num_selected == 0)
+    return NULL;
+
+  trace_perf_group_t *group = malloc(sizeof(*group));
+  if (group == NULL) {
+    LOG_ERROR("failed to allocate perf counter group");
+    return NULL;
+  }
+  group->leader = -1;
+  group->count = 0;
+
+  for (size_t k = 0; k < perf_num_selected; k++) {
+    int fd = trace_perf_open_event(perf_selected[k], group->leader);
+    if (fd == -1) {
+      LOG_WARN("failed to open perf counter %s: %s", perf_selected[k]->name,
+               strerror(errno));
+      continue;
+    }
+    if (group->leader == -1)
+      group->leader = fd;
+    group->fd[group->count] = fd;
+    group->attr[group->count] = perf_selected[k]->attr;
+    group->previous[group->count] = 0;
+    group->count++;
+  }
+
+  if (group->count == 0) {
+    free(group);
+    return NULL;
+  }
+
+  ioctl(group->leader, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+  ioctl(group->leader, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+  return group;
+}
+
+void trace_perf_group_close(trace_perf_group_t *group) {
+  if (group == NULL)
+    return;
+  /* close members before the leader */
+  for (size_t k = group->count; k > 0; k--) {
+    close(group->fd[k - 1]);
+  }
+  free(group);
+}
+
+static bool trace_perf_group_read(trace_perf_group_t *group,
+                                  uint64_t *values) {
+  /* PERF_FORMAT_GROUP layout: { u64 nr; u64 values[nr]; } */
+  uint64_t buf[1 + perf_max_events];
+  ssize_t expect = (ssize_t)((1 + group->count) * sizeof(uint64_t));
+  if (read(group->leader, buf, sizeof(buf)) < expect || buf[0] != group->count)
+    return false;
+  memcpy(values, &buf[1], group->count * sizeof(uint64_t));
+  return true;
+}
+
+void trace_perf_add_counters(trace_location_def_t *self,
+                             OTF2_AttributeList *attributes) {
+  if (perf_num_selected == 0)
+    return;
+  trace_perf_group_t *group = trace_location_get_perf_group(self);
+  if (group == NULL)
+    return;
+  uint64_t values[perf_max_events];
+  if (!trace_perf_group_read(group, values)) {
+    LOG_WARN("failed to read perf counters");
+    return;
+  }
+  OTF2_ErrorCode err = OTF2_SUCCESS;
+  for (size_t k = 0; k < group->count; k++) {
+    err = OTF2_AttributeList_AddUint64(attributes, group->attr[k],
+                                       values[k] - group->previous[k]);
+    CHECK_OTF2_ERROR_CODE(err);
+    group->previous[k] = values[k];
+  }
+}
+
+static const trace_perf_event_t *trace_perf_lookup_event(const char *name) {
+  for (size_t k = 0; k < perf_max_events; k++) {
+    if (strcmp(name, perf_events[k].name) == 0)
+      return &perf_events[k];
+  }
+  return NULL;
+}
+
+void trace_perf_initialise(otter_opt_t *opt) {
+  perf_num_selected = 0;
+  if (opt->perf_events == NULL || opt->perf_events[0] == '\0')
+    return;
+
+  char *events = strdup(opt->perf_events);
+  if (events == NULL) {
+    LOG_ERROR("failed to copy %s", opt->perf_events);
+    return;
+  }
+  char *saveptr = NULL;
+  for (char *name = strtok_r(events, ", ", &saveptr); name != NULL;
+       name = strtok_r(NULL, ", ", &saveptr)) {
+    const trace_perf_event_t *event = trace_perf_lookup_event(name);
+    if (event == NULL) {
+      fprintf(stderr, "perf counter not recognised (ignored): %s\n", name);
+      continue;
+    }
+    bool duplicate = false;
+    for (size_t k = 0; k < perf_num_selected; k++) {
+      duplicate = duplicate || perf_selected[k] == event;
+    }
+    if (!duplicate)
+      perf_selected[perf_num_selected++] = event;
+  }
+  free(events);
+
+  /* Probe each counter on this thread so that counters which can't be opened
+     here (e.g. hardware counters in a VM) are reported once rather than by
+     every thread */
+  size_t available = 0;
+  for (size_t k = 0; k < perf_num_selected; k++) {
+    int fd = trace_perf_open_event(perf_selected[k], -1);
+    if (fd == -1) {
+      fprintf(stderr, "perf counter unavailable (ignored): %s (%s)\n",
+              perf_selected[k]->name, strerror(errno));
+      continue;
+    }
+    close(fd);
+    perf_selected[available++] = perf_selected[k];
+  }
+  perf_num_selected = available;
+
+  fprintf(stderr, "%-30s", "Perf counters:");
+  for (size_t k = 0; k < perf_num_selected; k++) {
+    fprintf(stderr, "%s%s", k ? "," : " ", perf_selected[k]->name);
+  }
+  fprintf(stderr, "%s\n", perf_num_selected ? "" : " none");
+}
@@ -1,6 +1,7 @@
 #include "public/otter-trace/trace-region-def.h"
+#include "public/otter-trace/trace-loop.h"
 #include "public/otter-trace/trace-ompt.h"
-#include "public/types/queue.h"
+#include "public/types/chunk-queue.h"
 #include "public/types/stack.h"
 #include <assert.h>
 #include <otf2/OTF2_Definitions.h>
@@ -11,11 +12,17 @@
 #include "trace-attribute-lookup.h"
 #include "trace-attributes.h"
 #include "trace-check-error-code.h"
+#include "trace-sink.h"
 #include "trace-state.h"
 #include "trace-static-constants.h"
 #include "trace-types-as-labels.h"
 #include "trace-unique-refs.h"
 
+static const char *label_names[n_attr_label_defined] = {
+#define INCLUDE_LABEL(Name, Label) [attr_##Name##_##Label] = #Label,
+#include "trace-attribute-defs.h"
+};
+
 /* Store values needed to register region definition (tasks, parallel regions,
    workshare constructs etc.) with OTF2 */
 typedef struct trace_region_def_t {
@@ -60,7 +67,7 @@ trace_new_parallel_region(unique_id_t id, unique_id_t master,
                         .ref_count = 0,
                         .enter_count = 0,
                         .lock_rgn = PTHREAD_MUTEX_INITIALIZER,
-                        .rgn_defs = queue_create()}};
+                        .rgn_defs = chunk_queue_create(0)}};
   return new;
 }
 
@@ -76,10 +83,10 @@ trace_region_def_t *trace_new_phase_region(otter_phase_region_t type,
                               .attr.phase = {.type = type, .name = 0}};
 
   if (phase_name != NULL) {
-    pthread_mutex_lock(&state.strings.lock);
+    trace_lock(&state.strings.lock);
     new->attr.phase.name =
         string_registry_insert(state.strings.instance, phase_name);
-    pthread_mutex_unlock(&state.strings.lock);
+    trace_unlock(&state.strings.lock);
   } else {
     new->attr.phase.name = 0;
   }
@@ -166,12 +173,12 @@ trace_new_task_region(trace_region_def_t *parent_task_region, unique_id_t id,
   new->encountering_task_id = new->attr.task.parent_id;
 
   if (src_location != NULL) {
-    pthread_mutex_lock(&state.strings.lock);
+    trace_lock(&state.strings.lock);
     new->attr.task.source_file_name_ref =
         string_registry_insert(state.strings.instance, src_location->file);
     new->attr.task.source_func_name_ref =
         string_registry_insert(state.strings.instance, src_location->func);
-    pthread_mutex_unlock(&state.strings.lock);
+    trace_unlock(&state.strings.lock);
     new->attr.task.source_line_number = src_location->line;
   } else {
     new->attr.task.source_file_name_ref = 0;
@@ -216,7 +223,9 @@ trace_new_workshare_region(otter_work_t wstype, uint64_t count,
                               .type = trace_region_workshare,
                               .encountering_task_id = encountering_task_id,
                               .rgn_stack = NULL,
-                              .attr.wshare = {.type = wstype, .count = count}};
+                              .attr.wshare = {.type = wstype,
+                                              .count = count,
+                                              .loop = NULL}};
   return new;
 }
 
@@ -233,7 +242,7 @@ void trace_destroy_parallel_region(trace_region_def_t *rgn) {
     abort();
   }
 
-  size_t n_defs = queue_length(rgn->attr.parallel.rgn_defs);
+  size_t n_defs = chunk_queue_length(rgn->attr.parallel.rgn_defs);
   LOG_DEBUG("[parallel=%lu] writing nested region definitions (%lu)",
             rgn->attr.parallel.id, n_defs);
 
@@ -243,7 +252,7 @@ void trace_destroy_parallel_region(trace_region_def_t *rgn) {
   /* write region's nested region definitions */
   trace_region_def_t *r = NULL;
   int count = 0;
-  while (queue_pop(rgn->attr.parallel.rgn_defs, (data_item_t *)&r)) {
+  while (chunk_queue_pop(rgn->attr.parallel.rgn_defs, (data_item_t *)&r)) {
     LOG_DEBUG("[parallel=%lu] writing region definition %d/%lu (region %3u)",
               rgn->attr.parallel.id, count + 1, n_defs, r->ref);
     count++;
@@ -279,7 +288,7 @@ void trace_destroy_parallel_region(trace_region_def_t *rgn) {
 
   /* destroy parallel region once all locations are done with it
      and all definitions written */
-  queue_destroy(rgn->attr.parallel.rgn_defs, false, NULL);
+  chunk_queue_destroy(rgn->attr.parallel.rgn_defs, false, NULL);
   LOG_DEBUG("region %p (parallel id %lu)", rgn, rgn->attr.parallel.id);
   free(rgn);
   return;
@@ -308,6 +317,7 @@ void trace_destroy_task_region(trace_region_def_t *rgn) {
 
 void trace_destroy_workshare_region(trace_region_def_t *rgn) {
   LOG_DEBUG("region %p", rgn);
+  free(rgn->attr.wshare.loop);
   free(rgn);
 }
 
@@ -457,6 +467,9 @@ void trace_add_workshare_attributes(trace_region_def_t *rgn,
   r = OTF2_AttributeList_AddUint64(attributes, attr_workshare_count,
                                    rgn->attr.wshare.count);
   CHECK_OTF2_ERROR_CODE(r);
+  if (rgn->attr.wshare.loop != NULL) {
+    trace_loop_add_attributes(rgn->attr.wshare.loop, attributes);
+  }
   return;
 }
 
@@ -478,7 +491,21 @@ trace_region_type_t trace_region_get_type(trace_region_def_t *region) {
   return region->type;
 }
 
-otter_queue_t *trace_region_get_rgn_def_queue(trace_region_def_t *region) {
+trace_loop_stats_t *trace_region_get_loop_stats(trace_region_def_t *region) {
+  if (region->type != trace_region_workshare) {
+    LOG_ERROR("invalid region type %d", region->type);
+    return NULL;
+  }
+  if (region->attr.wshare.loop == NULL) {
+    region->attr.wshare.loop = calloc(1, sizeof(*region->attr.wshare.loop));
+    LOG_ERROR_IF((region->attr.wshare.loop == NULL),
+                 "failed to allocate loop statistics");
+  }
+  return region->attr.wshare.loop;
+}
+
+otter_chunk_queue_t *
+trace_region_get_rgn_def_queue(trace_region_def_t *region) {
   // This operation is only valid for parallel regions
   assert(region->type == trace_region_parallel);
   return region->attr.parallel.rgn_defs;
@@ -516,12 +543,12 @@ bool trace_region_is_shared(trace_region_def_t *region) {
 
 void trace_region_lock(trace_region_def_t *region) {
   assert(trace_region_is_shared(region));
-  pthread_mutex_lock(&region->attr.parallel.lock_rgn);
+  trace_lock(&region->attr.parallel.lock_rgn);
 }
 
 void trace_region_unlock(trace_region_def_t *region) {
   assert(trace_region_is_shared(region));
-  pthread_mutex_unlock(&region->attr.parallel.lock_rgn);
+  trace_unlock(&region->attr.parallel.lock_rgn);
 }
 
 void trace_region_inc_ref_count(trace_region_def_t *region) {
@@ -545,75 +572,72 @@ void trace_region_write_definition(trace_region_def_t *region) {
   LOG_DEBUG("writing region definition %3u (type=%3d, role=%3u) %p",
             region->ref, region->type, region->role, region);
 
-  pthread_mutex_lock(&state.global_def_writer.lock);
+  trace_lock(&state.global_def_writer.lock);
   OTF2_GlobalDefWriter *writer = state.global_def_writer.instance;
 
+  /* A region is named by a label, or by a string of its own */
+  char region_name[default_name_buf_sz + 1] = {0};
+  OTF2_StringRef region_name_ref = OTF2_UNDEFINED_STRING;
+  attr_label_enum_t label = n_attr_label_defined;
+  OTF2_Paradigm paradigm = OTF2_PARADIGM_UNKNOWN;
+
   switch (region->type) {
   case trace_region_parallel: {
-    char region_name[default_name_buf_sz + 1] = {0};
     snprintf(region_name, default_name_buf_sz, "Parallel Region %lu",
              region->attr.parallel.id);
-    OTF2_StringRef region_name_ref = get_unique_str_ref();
-    OTF2_GlobalDefWriter_WriteString(writer, region_name_ref, region_name);
-    OTF2_GlobalDefWriter_WriteRegion(
-        writer, region->ref, region_name_ref, 0,
-        0, /* canonical name, description */
-        region->role, OTF2_PARADIGM_UNKNOWN, OTF2_REGION_FLAG_NONE, 0, 0,
-        0); /* source file, begin line no., end line no. */
     break;
   }
   case trace_region_workshare: {
-    OTF2_GlobalDefWriter_WriteRegion(
-        writer, region->ref,
-        attr_label_ref[work_type_as_label(region->attr.wshare.type)], 0, 0,
-        region->role, OTF2_PARADIGM_UNKNOWN, OTF2_REGION_FLAG_NONE, 0, 0,
-        0); /* source file, begin line no., end line no. */
+    label = work_type_as_label(region->attr.wshare.type);
     break;
   }
   case trace_region_master: {
-    OTF2_GlobalDefWriter_WriteRegion(
-        writer, region->ref, attr_label_ref[attr_region_type_master], 0, 0,
-        region->role, OTF2_PARADIGM_UNKNOWN, OTF2_REGION_FLAG_NONE, 0, 0,
-        0); /* source file, begin line no., end line no. */
+    label = attr_region_type_master;
     break;
   }
   case trace_region_synchronise: {
-    OTF2_GlobalDefWriter_WriteRegion(
-        writer, region->ref,
-        attr_label_ref[sync_type_as_label(region->attr.sync.type)], 0, 0,
-        region->role, OTF2_PARADIGM_UNKNOWN, OTF2_REGION_FLAG_NONE, 0, 0,
-        0); /* source file, begin line no., end line no. */
+    label = sync_type_as_label(region->attr.sync.type);
     break;
   }
   case trace_region_task: {
-    char task_name[default_name_buf_sz + 1] = {0};
-    snprintf(task_name, default_name_buf_sz, "%s task %lu",
+    snprintf(region_name, default_name_buf_sz, "%s task %lu",
              region->attr.task.type == otter_task_initial    ? "initial"
              : region->attr.task.type == otter_task_implicit ? "implicit"
              : region->attr.task.type == otter_task_explicit ? "explicit"
              : region->attr.task.type == otter_task_target   ? "target"
                                                              : "??",
              region->attr.task.id);
-    OTF2_StringRef task_name_ref = get_unique_str_ref();
-    OTF2_GlobalDefWriter_WriteString(writer, task_name_ref, task_name);
-    OTF2_GlobalDefWriter_WriteRegion(
-        writer, region->ref, task_name_ref, 0,
-        0, /* canonical name, description */
-        region->role, OTF2_PARADIGM_OPENMP, OTF2_REGION_FLAG_NONE, 0, 0,
-        0); /* source file, begin line no., end line no. */
+    paradigm = OTF2_PARADIGM_OPENMP;
     break;
   }
   case trace_region_phase: {
-    OTF2_GlobalDefWriter_WriteRegion(
-        writer, region->ref, attr_label_ref[attr_region_type_generic_phase], 0,
-        0, region->role, OTF2_PARADIGM_UNKNOWN, OTF2_REGION_FLAG_NONE, 0, 0,
-        0); /* source file, begin line no., end line no. */
+    label = attr_region_type_generic_phase;
     break;
   }
   default: {
     LOG_ERROR("unexpected region type %d", region->type);
+    trace_unlock(&state.global_def_writer.lock);
+    return;
   }
   }
-  pthread_mutex_unlock(&state.global_def_writer.lock);
+
+  if (label != n_attr_label_defined) {
+    region_name_ref = attr_label_ref[label];
+    snprintf(region_name, default_name_buf_sz, "%s", label_names[label]);
+  } else {
+    region_name_ref = get_unique_str_ref();
+    OTF2_GlobalDefWriter_WriteString(writer, region_name_ref, region_name);
+  }
+  OTF2_GlobalDefWriter_WriteRegion(
+      writer, region->ref, region_name_ref, 0,
+      0, /* canonical name, description */
+      region->role, paradigm, OTF2_REGION_FLAG_NONE, 0, 0,
+      0); /* source file, begin line no., end line no. */
+
+  if (trace_sink_get()->define_region != NULL)
+    trace_sink_get()->define_region(region->ref, region_name, region->role,
+                                    paradigm);
+
+  trace_unlock(&state.global_def_writer.lock);
   return;
 }
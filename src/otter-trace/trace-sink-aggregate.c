@@ -0,0 +1,229 @@
+/**
+ * @file trace-sink-aggregate.c
+ * @author Adam Tuft
+ * @brief A sink which writes no events but counts them per location, by record
+ * and by event type. The counts are merged when a location is destroyed and
+ * reported when the trace is finalised.
+ */
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <otf2/otf2.h>
+
+#include "public/debug.h"
+
+#include "trace-attribute-lookup.h"
+#include "trace-attributes.h"
+#include "trace-sink.h"
+
+typedef enum {
+  record_thread_begin,
+  record_thread_end,
+  record_enter,
+  record_leave,
+  record_task_create,
+  record_task_switch,
+  record_acquire_lock,
+  record_release_lock,
+  n_records
+} aggregate_record_t;
+
+static const char *record_names[n_records] = {
+    [record_thread_begin] = "ThreadBegin",
+    [record_thread_end] = "ThreadEnd",
+    [record_enter] = "Enter",
+    [record_leave] = "Leave",
+    [record_task_create] = "ThreadTaskCreate",
+    [record_task_switch] = "ThreadTaskSwitch",
+    [record_acquire_lock] = "ThreadAcquireLock",
+    [record_release_lock] = "ThreadReleaseLock"};
+
+static const char *label_names[n_attr_label_defined] = {
+#define INCLUDE_LABEL(Name, Label) [attr_##Name##_##Label] = #Label,
+#include "trace-attribute-defs.h"
+};
+
+typedef struct {
+  uint64_t records[n_records];
+  uint64_t event_types[n_attr_label_defined];
+  OTF2_TimeStamp first;
+  OTF2_TimeStamp last;
+} aggregate_stats_t;
+
+static struct {
+  aggregate_stats_t *instance;
+  pthread_mutex_t lock;
+} totals = {NULL, PTHREAD_MUTEX_INITIALIZER};
+
+/* The event_type label refs are allocated consecutively, so a label is found
+   from its ref by offset, checked against the lookup table */
+static attr_label_enum_t event_type_label(OTF2_AttributeList *attributes) {
+  OTF2_StringRef ref = OTF2_UNDEFINED_STRING;
+  if (OTF2_AttributeList_GetStringRef(attributes, attr_event_type, &ref) !=
+      OTF2_SUCCESS)
+    return n_attr_label_defined;
+  OTF2_StringRef offset = ref - attr_label_ref[0];
+  if (offset < n_attr_label_defined && attr_label_ref[offset] == ref)
+    return (attr_label_enum_t)offset;
+  for (int k = 0; k < n_attr_label_defined; k++) {
+    if (attr_label_ref[k] == ref)
+      return (attr_label_enum_t)k;
+  }
+  return n_attr_label_defined;
+}
+
+static OTF2_ErrorCode aggregate_count(trace_location_def_t *loc,
+                                      OTF2_AttributeList *attributes,
+                                      OTF2_TimeStamp time,
+                                      aggregate_record_t record) {
+  aggregate_stats_t *stats = trace_location_get_sink_data(loc);
+  if (stats != NULL) {
+    stats->records[record]++;
+    attr_label_enum_t label = event_type_label(attributes);
+    if (label != n_attr_label_defined)
+      stats->event_types[label]++;
+    if (stats->first == 0)
+      stats->first = time;
+    stats->last = time;
+  }
+  return OTF2_AttributeList_RemoveAllAttributes(attributes);
+}
+
+static void *aggregate_location_open(trace_location_def_t *loc) {
+  aggregate_stats_t *stats = calloc(1, sizeof(*stats));
+  LOG_ERROR_IF(stats == NULL, "failed to allocate event counts");
+  return stats;
+}
+
+static void aggregate_merge(aggregate_stats_t *dest, aggregate_stats_t *src) {
+  for (int k = 0; k < n_records; k++) {
+    dest->records[k] += src->records[k];
+  }
+  for (int k = 0; k < n_attr_label_defined; k++) {
+    dest->event_types[k] += src->event_types[k];
+  }
+  if (src->first != 0 && (dest->first == 0 || src->first < dest->first))
+    dest->first = src->first;
+  if (src->last > dest->last)
+    dest->last = src->last;
+}
+
+static void aggregate_location_close(trace_location_def_t *loc, void *data) {
+  aggregate_stats_t *stats = data;
+  if (stats == NULL)
+    return;
+  pthread_mutex_lock(&totals.lock);
+  if (totals.instance == NULL)
+    totals.instance = calloc(1, sizeof(*totals.instance));
+  if (totals.instance != NULL)
+    aggregate_merge(totals.instance, stats);
+  pthread_mutex_unlock(&totals.lock);
+  free(stats);
+}
+
+static void aggregate_finalise(void) {
+  pthread_mutex_lock(&totals.lock);
+  aggregate_stats_t *stats = totals.instance;
+  totals.instance = NULL;
+  pthread_mutex_unlock(&totals.lock);
+
+  if (stats == NULL)
+    return;
+
+  uint64_t total = 0;
+  for (int k = 0; k < n_records; k++) {
+    total += stats->records[k];
+  }
+  double seconds = (stats->last - stats->first) / 1e9;
+
+  fprintf(stderr, "\nEVENTS (aggregate sink):\n");
+  fprintf(stderr, "%-30s %lu\n", "Total:", total);
+  if (seconds > 0)
+    fprintf(stderr, "%-30s %.0f\n", "Events/s:", total / seconds);
+  fprintf(stderr, "By record:\n");
+  for (int k = 0; k < n_records; k++) {
+    if (stats->records[k] != 0)
+      fprintf(stderr, "  %-28s %lu\n", record_names[k], stats->records[k]);
+  }
+  bool typed = false;
+  for (int k = 0; k < n_attr_label_defined; k++) {
+    if (stats->event_types[k] == 0)
+      continue;
+    if (!typed)
+      fprintf(stderr, "By event type:\n");
+    typed = true;
+    fprintf(stderr, "  %-28s %lu\n", label_names[k], stats->event_types[k]);
+  }
+  free(stats);
+}
+
+static OTF2_ErrorCode aggregate_thread_begin(trace_location_def_t *loc,
+                                             OTF2_AttributeList *attributes,
+                                             OTF2_TimeStamp time,
+                                             uint64_t thread_id) {
+  return aggregate_count(loc, attributes, time, record_thread_begin);
+}
+
+static OTF2_ErrorCode aggregate_thread_end(trace_location_def_t *loc,
+                                           OTF2_AttributeList *attributes,
+                                           OTF2_TimeStamp time,
+                                           uint64_t thread_id) {
+  return aggregate_count(loc, attributes, time, record_thread_end);
+}
+
+static OTF2_ErrorCode aggregate_enter(trace_location_def_t *loc,
+                                      OTF2_AttributeList *attributes,
+                                      OTF2_TimeStamp time,
+                                      OTF2_RegionRef region) {
+  return aggregate_count(loc, attributes, time, record_enter);
+}
+
+static OTF2_ErrorCode aggregate_leave(trace_location_def_t *loc,
+                                      OTF2_AttributeList *attributes,
+                                      OTF2_TimeStamp time,
+                                      OTF2_RegionRef region) {
+  return aggregate_count(loc, attributes, time, record_leave);
+}
+
+static OTF2_ErrorCode aggregate_task_create(trace_location_def_t *loc,
+                                            OTF2_AttributeList *attributes,
+                                            OTF2_TimeStamp time) {
+  return aggregate_count(loc, attributes, time, record_task_create);
+}
+
+static OTF2_ErrorCode aggregate_task_switch(trace_location_def_t *loc,
+                                            OTF2_AttributeList *attributes,
+                                            OTF2_TimeStamp time) {
+  return aggregate_count(loc, attributes, time, record_task_switch);
+}
+
+static OTF2_ErrorCode aggregate_acquire_lock(trace_location_def_t *loc,
+                                             OTF2_AttributeList *attributes,
+                                             OTF2_TimeStamp time,
+                                             uint32_t lock_id, uint32_t order) {
+  return aggregate_count(loc, attributes, time, record_acquire_lock);
+}
+
+static OTF2_ErrorCode aggregate_release_lock(trace_location_def_t *loc,
+                                             OTF2_AttributeList *attributes,
+                                             OTF2_TimeStamp time,
+                                             uint32_t lock_id, uint32_t order) {
+  return aggregate_count(loc, attributes, time, record_release_lock);
+}
+
+const trace_sink_t trace_sink_aggregate = {
+    .name = "aggregate",
+    .location_open = aggregate_location_open,
+    .location_close = aggregate_location_close,
+    .thread_begin = aggregate_thread_begin,
+    .thread_end = aggregate_thread_end,
+    .enter = aggregate_enter,
+    .leave = aggregate_leave,
+    .task_create = aggregate_task_create,
+    .task_switch = aggregate_task_switch,
+    .acquire_lock = aggregate_acquire_lock,
+    .release_lock = aggregate_release_lock,
+    .finalise = aggregate_finalise};
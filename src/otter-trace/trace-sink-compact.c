@@ -0,0 +1,1174 @@
+/**
+ * @file trace-sink-compact.c
+ * @author Adam Tuft
+ * @brief A sink which writes events in Otter's compact format (see
+ * trace-compact.h) instead of OTF2. Each location appends to its own file
+ * through a window mapped with mmap, which is moved along the file as it
+ * fills. The schema and string table are written when the trace is finalised.
+ * otter-compact2otf2 converts the result to OTF2.
+ *
+ * With OTTER_SEGMENT_PHASES=N, every Nth phase begins a new segment in its own
+ * directory. Rather than stop the other threads, each location closes its file
+ * and opens one in the new segment the next time it records an event. The
+ * thread beginning the phase closes the files of locations which aren't
+ * recording at that moment, so an idle thread doesn't hold a segment open. A
+ * segment is complete, with its schema and definitions written and its entry
+ * added to the manifest, once no location has a file open in it.
+ *
+ * With OTTER_COMPACT_SHARED=N, locations instead share N stream files per
+ * segment, so a process with hundreds of threads writes N files rather than
+ * hundreds. Each location fills a private block and, when it is full, reserves
+ * the block's place in its stream with an atomic add to the stream's end and
+ * writes it there with pwrite, so no lock is taken. On a NUMA machine, a
+ * location writes to the stream of the node it was created on, so that each
+ * node can have a stream of its own. The blocks are separated into locations
+ * again by otter-compact2otf2.
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <otf2/otf2.h>
+
+#include "public/debug.h"
+#include "public/otter-environment-variables.h"
+#include "public/otter-trace/trace-compact.h"
+#include "public/otter-trace/trace-label.h"
+#include "public/otter-trace/trace-numa.h"
+#include "public/otter-trace/trace-segment.h"
+
+#include "trace-archive.h"
+#include "trace-attribute-lookup.h"
+#include "trace-attributes.h"
+#include "trace-sink.h"
+#include "trace-state.h"
+#include "trace-static-constants.h"
+#include "trace-timestamp.h"
+
+#define COMPACT_WINDOW_SIZE (4 * 1024 * 1024)
+#define COMPACT_BLOCK_SIZE (64 * 1024)
+
+/* An event's attribute count is written before its attributes are filtered */
+_Static_assert(n_attr_defined < 0x80, "attribute count must fit one byte");
+
+static const OTF2_Type attribute_types[n_attr_defined] = {
+#define INCLUDE_ATTRIBUTE(Type, Name, Desc) [attr_##Name] = Type,
+#include "trace-attribute-defs.h"
+};
+
+static const char *attribute_names[n_attr_defined] = {
+#define INCLUDE_ATTRIBUTE(Type, Name, Desc) [attr_##Name] = #Name,
+#include "trace-attribute-defs.h"
+};
+
+static const char *attribute_descriptions[n_attr_defined] = {
+#define INCLUDE_ATTRIBUTE(Type, Name, Desc) [attr_##Name] = Desc,
+#include "trace-attribute-defs.h"
+};
+
+static const char *label_names[n_attr_label_defined] = {
+#define INCLUDE_LABEL(Name, Label) [attr_##Name##_##Label] = #Label,
+#include "trace-attribute-defs.h"
+};
+
+/* A stream shared by locations. Blocks are appended at `end`, which is
+   advanced atomically by the location writing each block. */
+typedef struct {
+  int fd;
+  uint64_t end;
+  uint64_t events;
+  uint64_t blocks;
+} compact_stream_t;
+
+/* A location's definition, kept by each segment it writes to */
+typedef struct {
+  uint64_t ref;
+  OTF2_LocationType type;
+  OTF2_LocationGroupRef group;
+  char name[32];
+} compact_location_t;
+
+/* A region's definition, kept once the region has ended */
+typedef struct {
+  uint64_t ref;
+  char *name;
+  OTF2_RegionRole role;
+  OTF2_Paradigm paradigm;
+} compact_region_t;
+
+/* In a segmented trace, `lock` is held while the location records an event
+   and while another thread closes the file at a segment boundary */
+typedef struct compact_file_t {
+  int fd;
+  bool is_open;
+  unsigned char *window; /* mapping of the file from window_offset, or the
+                            block being filled when writing to a stream */
+  uint64_t window_offset;
+  size_t pos; /* write position within the window */
+  compact_stream_t *stream; /* NULL if the location has its own file */
+  uint64_t stream_index;
+  uint32_t block_events;
+  OTF2_TimeStamp last_time;
+  uint64_t last_value[n_attr_defined];
+  otter_compact_header_t header;
+  uint64_t dropped;
+  uint64_t segment;
+  uint64_t first_task; /* range of the tasks created in this file */
+  uint64_t last_task;
+  compact_location_t location;
+  pthread_mutex_t lock;
+  struct compact_file_t *next;
+} compact_file_t;
+
+typedef struct {
+  char *name;
+  uint64_t start_time;
+  uint64_t events;
+  uint64_t first_task;
+  uint64_t last_task;
+  uint32_t files;
+  uint32_t open; /* files still being written */
+  bool complete;
+  compact_stream_t *streams; /* OTTER_COMPACT_SHARED streams, or NULL */
+  struct {
+    compact_location_t *items;
+    size_t count;
+    size_t capacity;
+  } locations; /* which have written to the segment */
+} compact_segment_t;
+
+static struct {
+  char dir[PATH_MAX];
+  size_t page_size;
+  pthread_once_t dir_once;
+  bool dir_ok;
+  uint64_t shared; /* streams per segment, 0 for a file per location */
+  uint64_t ticks_per_second;
+  const char *event_model_name;
+  const char *location_group_name;
+  /* Every location's file, for closing idle files at a segment boundary. Lock
+     order is files.lock, then a file's lock, then segments.lock. */
+  struct {
+    compact_file_t *head;
+    pthread_mutex_t lock;
+  } files;
+  /* Regions defined so far, which every later segment's definitions include.
+     Taken with the global definition writer's lock held, so no other lock is
+     taken with this one. */
+  struct {
+    compact_region_t *items;
+    size_t count;
+    size_t capacity;
+    pthread_mutex_t lock;
+  } regions;
+  struct {
+    uint64_t files;
+    uint64_t events;
+    uint64_t bytes;
+    uint64_t blocks;
+    uint64_t dropped;
+    pthread_mutex_t lock;
+  } totals;
+  /* Segments are only added at phase boundaries, so a lock is cheap enough.
+     The current segment is also read without it by every event. */
+  struct {
+    uint64_t every; /* phases per segment, 0 if not segmented */
+    uint64_t phases;
+    uint64_t current;
+    compact_segment_t *items;
+    size_t count;
+    size_t capacity;
+    pthread_mutex_t lock;
+  } segments;
+} compact = {.dir = {0},
+             .page_size = 4096,
+             .dir_once = PTHREAD_ONCE_INIT,
+             .dir_ok = false,
+             .shared = 0,
+             .ticks_per_second = 1000000000,
+             .event_model_name = NULL,
+             .location_group_name = NULL,
+             .files = {NULL, PTHREAD_MUTEX_INITIALIZER},
+             .regions = {NULL, 0, 0, PTHREAD_MUTEX_INITIALIZER},
+             .totals = {0, 0, 0, 0, 0, PTHREAD_MUTEX_INITIALIZER},
+             .segments = {0, 0, 0, NULL, 0, 0, PTHREAD_MUTEX_INITIALIZER}};
+
+/* The directory holding a segment's files. An unsegmented trace has one
+   segment, which is the compact directory itself. */
+static void compact_segment_dir(uint64_t segment, char *dir, size_t size) {
+  if (compact.segments.every == 0) {
+    snprintf(dir, size, "%s", compact.dir);
+  } else {
+    char name[64];
+    snprintf(name, sizeof(name), OTTER_COMPACT_SEGMENT_DIR_FMT,
+             (unsigned long)segment);
+    snprintf(dir, size, "%s/%s", compact.dir, name);
+  }
+}
+
+/* Open a segment's shared streams. A stream which can't be opened has fd -1
+   and its locations' events are dropped. */
+static compact_stream_t *compact_streams_open(const char *dir, uint64_t count) {
+  compact_stream_t *streams = calloc(count, sizeof(*streams));
+  if (streams == NULL) {
+    LOG_ERROR("failed to allocate compact trace streams");
+    return NULL;
+  }
+  for (uint64_t k = 0; k < count; k++) {
+    char name[64];
+    char path[PATH_MAX];
+    snprintf(name, sizeof(name), OTTER_COMPACT_SHARED_FILE_FMT,
+             (unsigned long)k);
+    snprintf(path, sizeof(path), "%s/%s", dir, name);
+    streams[k].end = sizeof(otter_compact_header_t);
+    streams[k].fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (streams[k].fd == -1)
+      LOG_ERROR("failed to open %s: %s", path, strerror(errno));
+  }
+  return streams;
+}
+
+/* Write the headers of a segment's shared streams once no location is writing
+   to them. Returns the number of streams written. */
+static uint32_t compact_streams_close(compact_stream_t *streams,
+                                      uint64_t count) {
+  uint32_t files = 0;
+  for (uint64_t k = 0; k < count; k++) {
+    compact_stream_t *stream = &streams[k];
+    if (stream->fd == -1)
+      continue;
+    otter_compact_header_t header = {.magic = OTTER_COMPACT_MAGIC,
+                                     .version = OTTER_COMPACT_VERSION,
+                                     .kind = otter_compact_file_shared,
+                                     .location = k,
+                                     .count = stream->events,
+                                     .length = stream->end - sizeof(header)};
+    if (pwrite(stream->fd, &header, sizeof(header), 0) != sizeof(header))
+      LOG_ERROR("failed to complete compact stream %lu: %s", (unsigned long)k,
+                strerror(errno));
+    close(stream->fd);
+    stream->fd = -1;
+    trace_lock(&compact.totals.lock);
+    compact.totals.files++;
+    compact.totals.bytes += stream->end;
+    compact.totals.blocks += stream->blocks;
+    trace_unlock(&compact.totals.lock);
+    files++;
+  }
+  return files;
+}
+
+/* Add a segment and make its directory. Called with the segments lock held. */
+static bool compact_segment_add(const char *name) {
+  if (compact.segments.count == compact.segments.capacity) {
+    size_t capacity =
+        compact.segments.capacity ? 2 * compact.segments.capacity : 16;
+    compact_segment_t *items =
+        realloc(compact.segments.items, capacity * sizeof(*items));
+    if (items == NULL) {
+      LOG_ERROR("failed to allocate compact trace segment");
+      return false;
+    }
+    compact.segments.items = items;
+    compact.segments.capacity = capacity;
+  }
+  uint64_t index = compact.segments.count;
+  char dir[PATH_MAX];
+  compact_segment_dir(index, dir, sizeof(dir));
+  if (compact.segments.every != 0 && mkdir(dir, 0755) == -1 &&
+      errno != EEXIST) {
+    LOG_ERROR("failed to create %s: %s", dir, strerror(errno));
+    return false;
+  }
+  compact_stream_t *streams = NULL;
+  if (compact.shared != 0 &&
+      (streams = compact_streams_open(dir, compact.shared)) == NULL)
+    return false;
+  compact.segments.items[index] =
+      (compact_segment_t){.name = name ? strdup(name) : NULL,
+                          .start_time = get_timestamp(),
+                          .first_task = UINT64_MAX,
+                          .last_task = 0,
+                          .streams = streams};
+  compact.segments.count++;
+  return true;
+}
+
+static void compact_initialise(otter_opt_t *opt) {
+  snprintf(compact.dir, sizeof(compact.dir), "%s/%s/%s", opt->tracepath,
+           opt->archive_name, OTTER_COMPACT_DIR);
+  long page_size = sysconf(_SC_PAGESIZE);
+  if (page_size > 0)
+    compact.page_size = (size_t)page_size;
+  fprintf(stderr, "%-30s %s\n", "Compact trace path:", compact.dir);
+
+  /* For each segment's definitions, as the archive defines them */
+  trace_archive_event_model_names(opt->event_model, &compact.event_model_name,
+                                  &compact.location_group_name);
+  struct timespec res;
+  if (clock_getres(CLOCK_MONOTONIC, &res) == 0 && res.tv_nsec > 0)
+    compact.ticks_per_second = 1000000000 / res.tv_nsec;
+
+  compact.segments.every = 0;
+  if (opt->segment_phases != NULL && opt->segment_phases[0] != '\0') {
+    char *end = NULL;
+    unsigned long long every = strtoull(opt->segment_phases, &end, 10);
+    if (end == opt->segment_phases || *end != '\0' || every == 0) {
+      fprintf(stderr, "invalid value for %s (ignored): %s\n",
+              ENV_VAR_SEGMENT_PHASES, opt->segment_phases);
+    } else {
+      compact.segments.every = every;
+      fprintf(stderr, "%-30s every %llu phase%s\n",
+              "Compact trace segments:", every, every == 1 ? "" : "s");
+    }
+  }
+
+  compact.shared = 0;
+  if (opt->compact_shared != NULL && opt->compact_shared[0] != '\0') {
+    char *end = NULL;
+    unsigned long long shared = strtoull(opt->compact_shared, &end, 10);
+    if (end == opt->compact_shared || *end != '\0' || shared == 0) {
+      fprintf(stderr, "invalid value for %s (ignored): %s\n",
+              ENV_VAR_COMPACT_SHARED, opt->compact_shared);
+    } else {
+      compact.shared = shared;
+      fprintf(stderr, "%-30s %llu\n", "Compact trace streams:", shared);
+    }
+  }
+}
+
+/* The archive directory is created by OTF2 when the archive is opened, which
+   happens after the sink is initialised, so the compact directory is made when
+   the first location is opened */
+static void compact_make_dir(void) {
+  char parent[PATH_MAX];
+  snprintf(parent, sizeof(parent), "%s", compact.dir);
+  char *slash = strrchr(parent, '/');
+  if (slash != NULL)
+    *slash = '\0';
+  if (mkdir(parent, 0755) == -1 && errno != EEXIST) {
+    LOG_ERROR("failed to create %s: %s", parent, strerror(errno));
+    return;
+  }
+  if (mkdir(compact.dir, 0755) == -1 && errno != EEXIST) {
+    LOG_ERROR("failed to create %s: %s", compact.dir, strerror(errno));
+    return;
+  }
+  /* Segment 0 holds the events before the first phase */
+  trace_lock(&compact.segments.lock);
+  compact.dir_ok = compact_segment_add(NULL);
+  trace_unlock(&compact.segments.lock);
+}
+
+/* Map the window starting at the page holding file offset `offset`, extending
+   the file to cover it */
+static bool compact_map_window(compact_file_t *file, uint64_t offset) {
+  uint64_t window_offset = offset & ~(uint64_t)(compact.page_size - 1);
+  if (ftruncate(file->fd, window_offset + COMPACT_WINDOW_SIZE) == -1) {
+    LOG_ERROR("failed to extend compact event file: %s", strerror(errno));
+    return false;
+  }
+  if (file->window != NULL)
+    munmap(file->window, COMPACT_WINDOW_SIZE);
+  file->window = mmap(NULL, COMPACT_WINDOW_SIZE, PROT_READ | PROT_WRITE,
+                      MAP_SHARED, file->fd, window_offset);
+  if (file->window == MAP_FAILED) {
+    LOG_ERROR("failed to map compact event file: %s", strerror(errno));
+    file->window = NULL;
+    return false;
+  }
+  file->window_offset = window_offset;
+  file->pos = offset - window_offset;
+  return true;
+}
+
+typedef struct {
+  FILE *out;
+  uint32_t n_strings;
+} compact_schema_writer_t;
+
+static void compact_write_string(const char *string, OTF2_StringRef ref,
+                                 void *data) {
+  compact_schema_writer_t *writer = data;
+  otter_compact_string_t entry = {.ref = ref, .length = strlen(string)};
+  fwrite(&entry, sizeof(entry), 1, writer->out);
+  fwrite(string, 1, entry.length, writer->out);
+  writer->n_strings++;
+}
+
+static void compact_write_schema(const char *dir) {
+  /* The schema's string table must define every label used so far */
+  trace_label_flush();
+
+  char path[PATH_MAX];
+  snprintf(path, sizeof(path), "%s/%s", dir, OTTER_COMPACT_SCHEMA_FILE);
+  compact_schema_writer_t writer = {.out = fopen(path, "wb"), .n_strings = 0};
+  if (writer.out == NULL) {
+    LOG_ERROR("failed to open %s: %s", path, strerror(errno));
+    return;
+  }
+
+  /* Written again once the strings are counted */
+  otter_compact_header_t header = {.magic = OTTER_COMPACT_MAGIC,
+                                   .version = OTTER_COMPACT_VERSION,
+                                   .kind = otter_compact_file_schema,
+                                   .location = 0,
+                                   .count = 0,
+                                   .length = 0};
+  otter_compact_schema_t schema = {.n_attributes = n_attr_defined,
+                                   .n_strings = 0};
+  fwrite(&header, sizeof(header), 1, writer.out);
+  fwrite(&schema, sizeof(schema), 1, writer.out);
+
+  for (int k = 0; k < n_attr_defined; k++) {
+    otter_compact_attribute_t entry = {
+        .ref = k,
+        .type = attribute_types[k],
+        .unused = 0,
+        .name_length = strlen(attribute_names[k])};
+    fwrite(&entry, sizeof(entry), 1, writer.out);
+    fwrite(attribute_names[k], 1, entry.name_length, writer.out);
+  }
+
+  /* Labels are written to the archive directly, other strings through the
+     registry */
+  for (int k = 0; k < n_attr_label_defined; k++) {
+    compact_write_string(label_names[k], attr_label_ref[k], &writer);
+  }
+  trace_lock(&state.strings.lock);
+  string_registry_apply(state.strings.instance, compact_write_string, &writer);
+  trace_unlock(&state.strings.lock);
+
+  header.length = ftell(writer.out) - sizeof(header);
+  schema.n_strings = writer.n_strings;
+  rewind(writer.out);
+  fwrite(&header, sizeof(header), 1, writer.out);
+  fwrite(&schema, sizeof(schema), 1, writer.out);
+  if (fclose(writer.out) != 0)
+    LOG_ERROR("failed to write %s: %s", path, strerror(errno));
+}
+
+static void compact_put_definition(FILE *out, uint64_t *count,
+                                   otter_compact_definition_kind_t kind,
+                                   uint64_t ref, uint64_t arg0, uint64_t arg1,
+                                   uint64_t arg2, const char *name,
+                                   const char *text) {
+  size_t name_length = name ? strlen(name) : 0;
+  size_t text_length = text ? strlen(text) : 0;
+  otter_compact_definition_t entry = {
+      .kind = kind,
+      .name_length = name_length < UINT16_MAX ? name_length : UINT16_MAX,
+      .text_length = text_length < UINT16_MAX ? text_length : UINT16_MAX,
+      .ref = ref,
+      .arg = {arg0, arg1, arg2}};
+  fwrite(&entry, sizeof(entry), 1, out);
+  fwrite(name, 1, entry.name_length, out);
+  fwrite(text, 1, entry.text_length, out);
+  (*count)++;
+}
+
+/* Write the definitions a segment's events need, so that it can be converted
+   without the archive. Called with the segments lock held. */
+static void compact_write_definitions(const char *dir, uint64_t index) {
+  compact_segment_t *segment = &compact.segments.items[index];
+  char path[PATH_MAX];
+  snprintf(path, sizeof(path), "%s/%s", dir, OTTER_COMPACT_DEFINITIONS_FILE);
+  FILE *out = fopen(path, "wb");
+  if (out == NULL) {
+    LOG_ERROR("failed to open %s: %s", path, strerror(errno));
+    return;
+  }
+  otter_compact_header_t header = {.magic = OTTER_COMPACT_MAGIC,
+                                   .version = OTTER_COMPACT_VERSION,
+                                   .kind = otter_compact_file_definitions,
+                                   .location = 0,
+                                   .count = 0,
+                                   .length = 0};
+  fwrite(&header, sizeof(header), 1, out);
+
+  uint64_t *count = &header.count;
+  compact_put_definition(out, count, otter_compact_definition_clock, 0,
+                         compact.ticks_per_second, segment->start_time,
+                         get_timestamp() - segment->start_time, NULL, NULL);
+  compact_put_definition(out, count, otter_compact_definition_property, 0, 0,
+                         0, 0, "OTTER::EVENT_MODEL", compact.event_model_name);
+  compact_put_definition(out, count, otter_compact_definition_system_tree_node,
+                         DEFAULT_SYSTEM_TREE, OTF2_UNDEFINED_SYSTEM_TREE_NODE,
+                         0, 0, "System Tree", "node");
+  compact_put_definition(out, count, otter_compact_definition_location_group,
+                         DEFAULT_LOCATION_GRP, OTF2_LOCATION_GROUP_TYPE_PROCESS,
+                         DEFAULT_SYSTEM_TREE, 0, compact.location_group_name,
+                         NULL);
+  for (int k = 0; k < n_attr_defined; k++) {
+    compact_put_definition(out, count, otter_compact_definition_attribute, k,
+                           attribute_types[k], 0, 0, attribute_names[k],
+                           attribute_descriptions[k]);
+  }
+  for (size_t k = 0; k < segment->locations.count; k++) {
+    compact_location_t *location = &segment->locations.items[k];
+    compact_put_definition(out, count, otter_compact_definition_location,
+                           location->ref, location->type, location->group, 0,
+                           location->name, NULL);
+  }
+  trace_lock(&compact.regions.lock);
+  for (size_t k = 0; k < compact.regions.count; k++) {
+    compact_region_t *region = &compact.regions.items[k];
+    compact_put_definition(out, count, otter_compact_definition_region,
+                           region->ref, region->role, region->paradigm, 0,
+                           region->name, NULL);
+  }
+  trace_unlock(&compact.regions.lock);
+
+  header.length = ftell(out) - sizeof(header);
+  rewind(out);
+  fwrite(&header, sizeof(header), 1, out);
+  if (fclose(out) != 0)
+    LOG_ERROR("failed to write %s: %s", path, strerror(errno));
+}
+
+/* Replace the manifest with one listing every complete segment. Called with
+   the segments lock held. */
+static void compact_write_manifest(void) {
+  char path[PATH_MAX];
+  char tmp_path[PATH_MAX];
+  snprintf(path, sizeof(path), "%s/%s", compact.dir,
+           OTTER_COMPACT_MANIFEST_FILE);
+  snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path);
+  FILE *out = fopen(tmp_path, "wb");
+  if (out == NULL) {
+    LOG_ERROR("failed to open %s: %s", tmp_path, strerror(errno));
+    return;
+  }
+  otter_compact_header_t header = {.magic = OTTER_COMPACT_MAGIC,
+                                   .version = OTTER_COMPACT_VERSION,
+                                   .kind = otter_compact_file_manifest,
+                                   .location = 0,
+                                   .count = 0,
+                                   .length = 0};
+  fwrite(&header, sizeof(header), 1, out);
+  for (size_t k = 0; k < compact.segments.count; k++) {
+    compact_segment_t *segment = &compact.segments.items[k];
+    if (!segment->complete)
+      continue;
+    otter_compact_segment_t entry = {
+        .index = k,
+        .start_time = segment->start_time,
+        .events = segment->events,
+        .first_task = segment->first_task,
+        .last_task = segment->last_task,
+        .files = segment->files,
+        .name_length = segment->name ? strlen(segment->name) : 0};
+    fwrite(&entry, sizeof(entry), 1, out);
+    fwrite(segment->name, 1, entry.name_length, out);
+    header.count++;
+  }
+  header.length = ftell(out) - sizeof(header);
+  rewind(out);
+  fwrite(&header, sizeof(header), 1, out);
+  /* Renamed into place so that a reader never sees a partial manifest */
+  if (fclose(out) != 0 || rename(tmp_path, path) != 0)
+    LOG_ERROR("failed to write %s: %s", path, strerror(errno));
+}
+
+/* Write a segment's schema and definitions once no location is writing to it,
+   then list it in the manifest. Called with the segments lock held. */
+static void compact_segment_complete(uint64_t index) {
+  compact_segment_t *segment = &compact.segments.items[index];
+  if (segment->complete)
+    return;
+  char dir[PATH_MAX];
+  compact_segment_dir(index, dir, sizeof(dir));
+  compact_write_schema(dir);
+  compact_write_definitions(dir, index);
+  free(segment->locations.items);
+  segment->locations.items = NULL;
+  segment->locations.count = segment->locations.capacity = 0;
+  if (segment->streams != NULL) {
+    segment->files += compact_streams_close(segment->streams, compact.shared);
+    free(segment->streams);
+    segment->streams = NULL;
+  }
+  segment->complete = true;
+  if (compact.segments.every != 0)
+    compact_write_manifest();
+}
+
+static void compact_file_close(compact_file_t *file);
+
+/* Try to take a location's file from another thread, which fails if the
+   location is recording an event */
+static bool compact_file_trylock(compact_file_t *file) {
+  return state.single_threaded || pthread_mutex_trylock(&file->lock) == 0;
+}
+
+/* Close the files left in an old segment by locations which aren't recording
+   right now. Each reopens its file in the current segment when it next records
+   an event, so an idle location doesn't hold the old segment open. */
+static void compact_close_idle_files(void) {
+  uint64_t current =
+      __atomic_load_n(&compact.segments.current, __ATOMIC_ACQUIRE);
+  trace_lock(&compact.files.lock);
+  for (compact_file_t *file = compact.files.head; file != NULL;
+       file = file->next) {
+    if (!compact_file_trylock(file))
+      continue;
+    if (file->is_open && file->segment != current)
+      compact_file_close(file);
+    trace_unlock(&file->lock);
+  }
+  trace_unlock(&compact.files.lock);
+}
+
+void trace_segment_phase_begin(const char *name) {
+  if (compact.segments.every == 0 || !compact.dir_ok)
+    return;
+  bool added = false;
+  trace_lock(&compact.segments.lock);
+  if (compact.segments.phases++ % compact.segments.every == 0 &&
+      compact_segment_add(name)) {
+    uint64_t previous = compact.segments.current;
+    __atomic_store_n(&compact.segments.current, compact.segments.count - 1,
+                     __ATOMIC_RELEASE);
+    if (compact.segments.items[previous].open == 0)
+      compact_segment_complete(previous);
+    added = true;
+  }
+  trace_unlock(&compact.segments.lock);
+  if (added)
+    compact_close_idle_files();
+}
+
+/* Append the location's block to its stream and start the next. The block's
+   place is reserved by advancing the stream's end, so locations writing to the
+   same stream never wait for each other. */
+static void compact_block_commit(compact_file_t *file) {
+  if (file->block_events == 0)
+    return;
+  compact_stream_t *stream = file->stream;
+  otter_compact_block_t *block = (otter_compact_block_t *)file->window;
+  *block = (otter_compact_block_t){
+      .location = file->header.location,
+      .events = file->block_events,
+      .length = file->pos - sizeof(*block)};
+  bool ok = stream->fd != -1;
+  if (ok) {
+    uint64_t offset =
+        __atomic_fetch_add(&stream->end, file->pos, __ATOMIC_RELAXED);
+    for (size_t done = 0; ok && done < file->pos;) {
+      ssize_t n = pwrite(stream->fd, file->window + done, file->pos - done,
+                         offset + done);
+      ok = n > 0;
+      done += ok ? n : 0;
+    }
+    if (!ok)
+      LOG_ERROR("failed to write compact stream block for location %lu: %s",
+                (unsigned long)file->header.location, strerror(errno));
+  }
+  if (ok) {
+    __atomic_fetch_add(&stream->events, file->block_events, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&stream->blocks, 1, __ATOMIC_RELAXED);
+  } else {
+    file->dropped += file->block_events;
+    file->header.count -= file->block_events;
+  }
+  file->pos = sizeof(*block);
+  file->block_events = 0;
+}
+
+/* Finish the file being written and account for it in its segment */
+static void compact_file_close(compact_file_t *file) {
+  file->is_open = false;
+  uint64_t end = 0;
+  if (file->stream != NULL) {
+    compact_block_commit(file);
+    file->stream = NULL;
+  } else if (file->fd != -1) {
+    end = file->window_offset + file->pos;
+    if (file->window != NULL)
+      munmap(file->window, COMPACT_WINDOW_SIZE);
+    file->window = NULL;
+    file->header.length = end - sizeof(file->header);
+    if (ftruncate(file->fd, end) == -1 ||
+        pwrite(file->fd, &file->header, sizeof(file->header), 0) !=
+            sizeof(file->header)) {
+      LOG_ERROR("failed to complete compact event file for location %lu: %s",
+                (unsigned long)file->header.location, strerror(errno));
+    }
+    close(file->fd);
+    file->fd = -1;
+  }
+
+  trace_lock(&compact.totals.lock);
+  compact.totals.files += end != 0;
+  compact.totals.events += file->header.count;
+  compact.totals.bytes += end;
+  compact.totals.dropped += file->dropped;
+  trace_unlock(&compact.totals.lock);
+  file->dropped = 0;
+
+  trace_lock(&compact.segments.lock);
+  compact_segment_t *segment = &compact.segments.items[file->segment];
+  segment->files += end != 0;
+  segment->events += file->header.count;
+  if (file->first_task < segment->first_task)
+    segment->first_task = file->first_task;
+  if (file->first_task <= file->last_task &&
+      file->last_task > segment->last_task)
+    segment->last_task = file->last_task;
+  if (--segment->open == 0 && file->segment != compact.segments.current)
+    compact_segment_complete(file->segment);
+  trace_unlock(&compact.segments.lock);
+}
+
+/* Add a location to those defined in a segment. Called with the segments
+   lock held. */
+static void compact_segment_add_location(compact_segment_t *segment,
+                                         const compact_location_t *location) {
+  if (segment->locations.count == segment->locations.capacity) {
+    size_t capacity =
+        segment->locations.capacity ? 2 * segment->locations.capacity : 16;
+    compact_location_t *items =
+        realloc(segment->locations.items, capacity * sizeof(*items));
+    if (items == NULL) {
+      LOG_ERROR("failed to allocate compact segment location %lu",
+                (unsigned long)location->ref);
+      return;
+    }
+    segment->locations.items = items;
+    segment->locations.capacity = capacity;
+  }
+  segment->locations.items[segment->locations.count++] = *location;
+}
+
+/* Start the location's file in the current segment */
+static void compact_file_open(compact_file_t *file) {
+  trace_lock(&compact.segments.lock);
+  file->segment = compact.segments.current;
+  compact_segment_t *segment = &compact.segments.items[file->segment];
+  segment->open++;
+  compact_segment_add_location(segment, &file->location);
+  trace_unlock(&compact.segments.lock);
+  file->is_open = true;
+
+  file->header.count = 0;
+  file->header.length = 0;
+  file->window_offset = 0;
+  file->pos = 0;
+  file->last_time = 0;
+  memset(file->last_value, 0, sizeof(file->last_value));
+  file->first_task = UINT64_MAX;
+  file->last_task = 0;
+
+  /* The block buffer is kept from one segment to the next */
+  if (compact.shared != 0) {
+    trace_lock(&compact.segments.lock);
+    file->stream =
+        &compact.segments.items[file->segment].streams[file->stream_index];
+    trace_unlock(&compact.segments.lock);
+    file->pos = sizeof(otter_compact_block_t);
+    file->block_events = 0;
+    return;
+  }
+  file->window = NULL;
+
+  char dir[PATH_MAX];
+  char path[PATH_MAX];
+  char name[64];
+  compact_segment_dir(file->segment, dir, sizeof(dir));
+  snprintf(name, sizeof(name), OTTER_COMPACT_EVENT_FILE_FMT,
+           (unsigned long)file->header.location);
+  snprintf(path, sizeof(path), "%s/%s", dir, name);
+  file->fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+  if (file->fd == -1) {
+    LOG_ERROR("failed to open %s: %s", path, strerror(errno));
+    return;
+  }
+  if (!compact_map_window(file, sizeof(file->header))) {
+    close(file->fd);
+    file->fd = -1;
+  }
+}
+
+/* The stream a location writes to: its node's, if there are several nodes */
+static uint64_t compact_stream_index(trace_location_def_t *loc) {
+  if (trace_numa_nodes() > 1)
+    return (uint64_t)trace_location_get_numa_node(loc) % compact.shared;
+  return trace_location_get_ref(loc) % compact.shared;
+}
+
+static void *compact_location_open(trace_location_def_t *loc) {
+  pthread_once(&compact.dir_once, compact_make_dir);
+  if (!compact.dir_ok)
+    return NULL;
+
+  compact_file_t *file = calloc(1, sizeof(*file));
+  if (file == NULL) {
+    LOG_ERROR("failed to allocate compact event file");
+    return NULL;
+  }
+  file->header = (otter_compact_header_t){
+      .magic = OTTER_COMPACT_MAGIC,
+      .version = OTTER_COMPACT_VERSION,
+      .kind = otter_compact_file_events,
+      .location = trace_location_get_ref(loc),
+      .count = 0,
+      .length = 0};
+  file->location = (compact_location_t){.ref = trace_location_get_ref(loc),
+                                        .type = trace_location_get_type(loc),
+                                        .group = trace_location_get_group(loc)};
+  trace_location_get_name(loc, file->location.name,
+                          sizeof(file->location.name));
+  if (compact.shared != 0) {
+    file->stream_index = compact_stream_index(loc);
+    file->window = malloc(COMPACT_BLOCK_SIZE);
+    if (file->window == NULL) {
+      LOG_ERROR("failed to allocate compact stream block");
+      free(file);
+      return NULL;
+    }
+  }
+  pthread_mutex_init(&file->lock, NULL);
+  compact_file_open(file);
+  trace_lock(&compact.files.lock);
+  file->next = compact.files.head;
+  compact.files.head = file;
+  trace_unlock(&compact.files.lock);
+  return file;
+}
+
+static void compact_location_close(trace_location_def_t *loc, void *data) {
+  compact_file_t *file = data;
+  if (file == NULL)
+    return;
+  trace_lock(&compact.files.lock);
+  compact_file_t **link = &compact.files.head;
+  while (*link != NULL && *link != file)
+    link = &(*link)->next;
+  if (*link != NULL)
+    *link = file->next;
+  trace_unlock(&compact.files.lock);
+  if (file->is_open)
+    compact_file_close(file);
+  pthread_mutex_destroy(&file->lock);
+  if (compact.shared != 0)
+    free(file->window);
+  free(file);
+}
+
+static void compact_define_region(OTF2_RegionRef ref, const char *name,
+                                  OTF2_RegionRole role,
+                                  OTF2_Paradigm paradigm) {
+  trace_lock(&compact.regions.lock);
+  if (compact.regions.count == compact.regions.capacity) {
+    size_t capacity =
+        compact.regions.capacity ? 2 * compact.regions.capacity : 64;
+    compact_region_t *items =
+        realloc(compact.regions.items, capacity * sizeof(*items));
+    if (items != NULL) {
+      compact.regions.items = items;
+      compact.regions.capacity = capacity;
+    }
+  }
+  char *copy = strdup(name);
+  if (copy != NULL && compact.regions.count < compact.regions.capacity) {
+    compact.regions.items[compact.regions.count++] = (compact_region_t){
+        .ref = ref, .name = copy, .role = role, .paradigm = paradigm};
+  } else {
+    LOG_ERROR("failed to store compact region definition %u", ref);
+    free(copy);
+  }
+  trace_unlock(&compact.regions.lock);
+}
+
+static unsigned char *compact_put_attributes(compact_file_t *file,
+                                             unsigned char *p,
+                                             OTF2_AttributeList *attributes) {
+  uint32_t n = OTF2_AttributeList_GetNumberOfElements(attributes);
+  unsigned char *count = p++;
+  *count = 0;
+  for (uint32_t k = 0; k < n; k++) {
+    OTF2_AttributeRef ref;
+    OTF2_Type type;
+    OTF2_AttributeValue value;
+    if (OTF2_AttributeList_GetAttributeByIndex(attributes, k, &ref, &type,
+                                               &value) != OTF2_SUCCESS ||
+        ref >= n_attr_defined)
+      continue;
+    uint64_t bits = 0;
+    switch (type) {
+    case OTF2_TYPE_UINT8:
+      bits = value.uint8;
+      break;
+    case OTF2_TYPE_UINT16:
+      bits = value.uint16;
+      break;
+    case OTF2_TYPE_UINT32:
+      bits = value.uint32;
+      break;
+    case OTF2_TYPE_INT8:
+      bits = (uint64_t)(int64_t)value.int8;
+      break;
+    case OTF2_TYPE_INT16:
+      bits = (uint64_t)(int64_t)value.int16;
+      break;
+    case OTF2_TYPE_INT32:
+      bits = (uint64_t)(int64_t)value.int32;
+      break;
+    case OTF2_TYPE_STRING:
+      bits = value.stringRef;
+      break;
+    case OTF2_TYPE_FLOAT:
+      memcpy(&bits, &value.float32, sizeof(value.float32));
+      break;
+    default:
+      bits = value.uint64;
+      break;
+    }
+    (*count)++;
+    if (bits == file->last_value[ref]) {
+      p = otter_compact_put_varint(p, (ref << 1) | 1);
+      continue;
+    }
+    p = otter_compact_put_varint(p, ref << 1);
+    /* Decoded by the schema's type */
+    if (attribute_types[ref] == OTF2_TYPE_FLOAT) {
+      memcpy(p, &value.float32, sizeof(value.float32));
+      p += sizeof(value.float32);
+    } else if (attribute_types[ref] == OTF2_TYPE_DOUBLE) {
+      memcpy(p, &value.float64, sizeof(value.float64));
+      p += sizeof(value.float64);
+    } else {
+      p = otter_compact_put_varint(
+          p, otter_compact_zigzag(bits - file->last_value[ref]));
+    }
+    file->last_value[ref] = bits;
+  }
+  return p;
+}
+
+static void compact_put_event(compact_file_t *file,
+                              OTF2_AttributeList *attributes,
+                              OTF2_TimeStamp time, otter_compact_record_t record,
+                              uint64_t arg0, uint64_t arg1) {
+  uint64_t task;
+  if (record == otter_compact_record_task_create &&
+      OTF2_AttributeList_GetUint64(attributes, attr_unique_id, &task) ==
+          OTF2_SUCCESS) {
+    /* a batch creates tasks with consecutive IDs from unique_id */
+    uint64_t tasks = 1;
+    OTF2_AttributeList_GetUint64(attributes, attr_task_batch_size, &tasks);
+    if (task < file->first_task)
+      file->first_task = task;
+    if (task + tasks - 1 > file->last_task)
+      file->last_task = task + tasks - 1;
+  }
+
+  size_t max = OTTER_COMPACT_EVENT_MAX(
+      OTF2_AttributeList_GetNumberOfElements(attributes));
+  if (file->stream != NULL && COMPACT_BLOCK_SIZE - file->pos < max)
+    compact_block_commit(file);
+  if (file->stream == NULL &&
+      (file->window == NULL ||
+       (COMPACT_WINDOW_SIZE - file->pos < max &&
+        !compact_map_window(file, file->window_offset + file->pos)))) {
+    file->dropped++;
+    return;
+  }
+
+  unsigned char *p = file->window + file->pos;
+  *p++ = (unsigned char)record;
+  uint64_t delta = time - file->last_time;
+  uint32_t delta32 =
+      delta < OTTER_COMPACT_TIME_ESCAPE ? delta : OTTER_COMPACT_TIME_ESCAPE;
+  memcpy(p, &delta32, sizeof(delta32));
+  p += sizeof(delta32);
+  if (delta32 == OTTER_COMPACT_TIME_ESCAPE) {
+    memcpy(p, &time, sizeof(time));
+    p += sizeof(time);
+  }
+  file->last_time = time;
+
+  switch (record) {
+  case otter_compact_record_thread_begin:
+  case otter_compact_record_thread_end:
+  case otter_compact_record_enter:
+  case otter_compact_record_leave:
+    p = otter_compact_put_varint(p, arg0);
+    break;
+  case otter_compact_record_acquire_lock:
+  case otter_compact_record_release_lock:
+    p = otter_compact_put_varint(p, arg0);
+    p = otter_compact_put_varint(p, arg1);
+    break;
+  default:
+    break;
+  }
+
+  p = compact_put_attributes(file, p, attributes);
+  file->pos = p - file->window;
+  file->header.count++;
+  file->block_events++;
+}
+
+static OTF2_ErrorCode compact_record(trace_location_def_t *loc,
+                                     OTF2_AttributeList *attributes,
+                                     OTF2_TimeStamp time,
+                                     otter_compact_record_t record,
+                                     uint64_t arg0, uint64_t arg1) {
+  compact_file_t *file = trace_location_get_sink_data(loc);
+  if (file == NULL)
+    return OTF2_AttributeList_RemoveAllAttributes(attributes);
+  bool segmented = compact.segments.every != 0;
+  if (segmented) {
+    trace_lock(&file->lock);
+    if (!file->is_open ||
+        file->segment !=
+            __atomic_load_n(&compact.segments.current, __ATOMIC_ACQUIRE)) {
+      if (file->is_open)
+        compact_file_close(file);
+      compact_file_open(file);
+    }
+  }
+  compact_put_event(file, attributes, time, record, arg0, arg1);
+  if (segmented)
+    trace_unlock(&file->lock);
+  return OTF2_AttributeList_RemoveAllAttributes(attributes);
+}
+
+static void compact_finalise(void) {
+  if (!compact.dir_ok)
+    return;
+
+  /* Every location has closed its file by now */
+  trace_lock(&compact.segments.lock);
+  uint64_t segments = compact.segments.count;
+  for (size_t k = 0; k < compact.segments.count; k++) {
+    compact_segment_complete(k);
+  }
+  for (size_t k = 0; k < compact.segments.count; k++) {
+    free(compact.segments.items[k].name);
+  }
+  free(compact.segments.items);
+  compact.segments.items = NULL;
+  compact.segments.count = compact.segments.capacity = 0;
+  trace_unlock(&compact.segments.lock);
+
+  trace_lock(&compact.regions.lock);
+  for (size_t k = 0; k < compact.regions.count; k++) {
+    free(compact.regions.items[k].name);
+  }
+  free(compact.regions.items);
+  compact.regions.items = NULL;
+  compact.regions.count = compact.regions.capacity = 0;
+  trace_unlock(&compact.regions.lock);
+
+  trace_lock(&compact.totals.lock);
+  uint64_t events = compact.totals.events;
+  uint64_t bytes = compact.totals.bytes;
+  fprintf(stderr, "\nCOMPACT TRACE:\n");
+  fprintf(stderr, "%-30s %s\n", "Directory:", compact.dir);
+  if (compact.segments.every != 0)
+    fprintf(stderr, "%-30s %lu\n", "Segments:", segments);
+  if (compact.shared != 0) {
+    fprintf(stderr, "%-30s %lu\n", "Shared streams:", compact.totals.files);
+    fprintf(stderr, "%-30s %lu\n", "Stream blocks:", compact.totals.blocks);
+  } else {
+    fprintf(stderr, "%-30s %lu\n", "Event files:", compact.totals.files);
+  }
+  fprintf(stderr, "%-30s %lu\n", "Events:", events);
+  fprintf(stderr, "%-30s %lu\n", "Bytes:", bytes);
+  if (events > 0)
+    fprintf(stderr, "%-30s %.1f\n", "Bytes/event:", (double)bytes / events);
+  if (compact.totals.dropped > 0)
+    fprintf(stderr, "%-30s %lu\n", "Dropped:", compact.totals.dropped);
+  trace_unlock(&compact.totals.lock);
+}
+
+static OTF2_ErrorCode compact_thread_begin(trace_location_def_t *loc,
+                                           OTF2_AttributeList *attributes,
+                                           OTF2_TimeStamp time,
+                                           uint64_t thread_id) {
+  return compact_record(loc, attributes, time,
+                        otter_compact_record_thread_begin, thread_id, 0);
+}
+
+static OTF2_ErrorCode compact_thread_end(trace_location_def_t *loc,
+                                         OTF2_AttributeList *attributes,
+                                         OTF2_TimeStamp time,
+                                         uint64_t thread_id) {
+  return compact_record(loc, attributes, time, otter_compact_record_thread_end,
+                        thread_id, 0);
+}
+
+static OTF2_ErrorCode compact_enter(trace_location_def_t *loc,
+                                    OTF2_AttributeList *attributes,
+                                    OTF2_TimeStamp time,
+                                    OTF2_RegionRef region) {
+  return compact_record(loc, attributes, time, otter_compact_record_enter,
+                        region, 0);
+}
+
+static OTF2_ErrorCode compact_leave(trace_location_def_t *loc,
+                                    OTF2_AttributeList *attributes,
+                                    OTF2_TimeStamp time,
+                                    OTF2_RegionRef region) {
+  return compact_record(loc, attributes, time, otter_compact_record_leave,
+                        region, 0);
+}
+
+static OTF2_ErrorCode compact_task_create(trace_location_def_t *loc,
+                                          OTF2_AttributeList *attributes,
+                                          OTF2_TimeStamp time) {
+  return compact_record(loc, attributes, time,
+                        otter_compact_record_task_create, 0, 0);
+}
+
+static OTF2_ErrorCode compact_task_switch(trace_location_def_t *loc,
+                                          OTF2_AttributeList *attributes,
+                                          OTF2_TimeStamp time) {
+  return compact_record(loc, attributes, time,
+                        otter_compact_record_task_switch, 0, 0);
+}
+
+static OTF2_ErrorCode compact_acquire_lock(trace_location_def_t *loc,
+                                           OTF2_AttributeList *attributes,
+                                           OTF2_TimeStamp time,
+                                           uint32_t lock_id, uint32_t order) {
+  return compact_record(loc, attributes, time,
+                        otter_compact_record_acquire_lock, lock_id, order);
+}
+
+static OTF2_ErrorCode compact_release_lock(trace_location_def_t *loc,
+                                           OTF2_AttributeList *attributes,
+                                           OTF2_TimeStamp time,
+                                           uint32_t lock_id, uint32_t order) {
+  return compact_record(loc, attributes, time,
+                        otter_compact_record_release_lock, lock_id, order);
+}
+
+const trace_sink_t trace_sink_compact = {
+    .name = "compact",
+    .initialise = compact_initialise,
+    .location_open = compact_location_open,
+    .location_close = compact_location_close,
+    .thread_begin = compact_thread_begin,
+    .thread_end = compact_thread_end,
+    .enter = compact_enter,
+    .leave = compact_leave,
+    .task_create = compact_task_create,
+    .task_switch = compact_task_switch,
+    .acquire_lock = compact_acquire_lock,
+    .release_lock = compact_release_lock,
+    .define_region = compact_define_region,
+    .finalise = compact_finalise};
@@ -0,0 +1,534 @@
+/**
+ * @file trace-sink-flight.c
+ * @author Adam Tuft
+ * @brief A flight recorder: each location keeps its most recent events, bounded
+ * by size and optionally by age, in a ring buffer and writes nothing while the
+ * program runs. A dump, requested by SIGUSR1, otterTraceDump() or the phase
+ * named by OTTER_FLIGHT_DUMP_PHASE, makes each location write its ring to the
+ * OTF2 archive the next time it records an event or when it is destroyed.
+ * Eviction can separate a region's Enter from its Leave, so a dump synthesises
+ * the endpoints missing from its window to keep every region balanced.
+ */
+
+#define _GNU_SOURCE
+
+#include <pthread.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <otf2/otf2.h>
+
+#include "public/debug.h"
+#include "public/otter-environment-variables.h"
+#include "public/otter-trace/trace-flight.h"
+
+#include "trace-attribute-lookup.h"
+#include "trace-attributes.h"
+#include "trace-check-error-code.h"
+#include "trace-memory.h"
+#include "trace-sink.h"
+
+#define FLIGHT_DEFAULT_SIZE (4 * 1024 * 1024)
+#define FLIGHT_MAX_ATTRIBUTES UINT8_MAX
+
+typedef enum {
+  flight_record_thread_begin,
+  flight_record_thread_end,
+  flight_record_enter,
+  flight_record_leave,
+  flight_record_task_create,
+  flight_record_task_switch,
+  flight_record_acquire_lock,
+  flight_record_release_lock
+} flight_record_kind_t;
+
+/* An event in the ring, followed by its attributes */
+typedef struct {
+  uint32_t size; /* bytes, including attributes */
+  uint8_t kind;  /* flight_record_kind_t */
+  uint8_t n_attributes;
+  uint16_t unused;
+  OTF2_TimeStamp time;
+  uint64_t arg[2]; /* thread ID, region, or lock ID & order */
+} flight_record_t;
+
+typedef struct {
+  OTF2_AttributeRef ref;
+  OTF2_Type type;
+  OTF2_AttributeValue value;
+} flight_attribute_t;
+
+/* A location's ring. Positions increase monotonically and are reduced modulo
+   the capacity to index the buffer, so a record may wrap around its end. */
+typedef struct {
+  char *buffer;
+  uint64_t capacity;
+  uint64_t head; /* where the next record is written */
+  uint64_t tail; /* the oldest record */
+  uint64_t dumps_seen;
+  uint64_t recorded;
+  uint64_t overwritten;
+  uint64_t dumped;
+  uint64_t synthesised;
+} flight_ring_t;
+
+/* Positions of records in a ring */
+typedef struct {
+  uint64_t *items;
+  size_t count;
+  size_t capacity;
+} flight_positions_t;
+
+static struct {
+  bool enabled;
+  uint64_t size;
+  uint64_t window; /* ns, 0 for no limit */
+  const char *dump_phase;
+  uint64_t dumps_requested;
+} flight = {false, FLIGHT_DEFAULT_SIZE, 0, NULL, 0};
+
+static struct {
+  uint64_t recorded;
+  uint64_t overwritten;
+  uint64_t dumped;
+  uint64_t synthesised;
+  uint64_t rings_dumped;
+  pthread_mutex_t lock;
+} totals = {0, 0, 0, 0, 0, PTHREAD_MUTEX_INITIALIZER};
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+/*   DUMP REQUESTS                                                           */
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+void trace_flight_dump(void) {
+  if (flight.enabled)
+    __atomic_add_fetch(&flight.dumps_requested, 1, __ATOMIC_RELAXED);
+}
+
+void trace_flight_phase_begin(const char *name) {
+  if (flight.enabled && flight.dump_phase != NULL && name != NULL &&
+      strcmp(name, flight.dump_phase) == 0)
+    trace_flight_dump();
+}
+
+static void flight_signal_handler(int signum) { trace_flight_dump(); }
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+/*   RING                                                                    */
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+static void flight_ring_write(flight_ring_t *ring, uint64_t pos,
+                              const void *data, size_t size) {
+  uint64_t offset = pos % ring->capacity;
+  size_t first = size;
+  if (offset + size > ring->capacity)
+    first = ring->capacity - offset;
+  memcpy(&ring->buffer[offset], data, first);
+  memcpy(&ring->buffer[0], (const char *)data + first, size - first);
+}
+
+static void flight_ring_read(flight_ring_t *ring, uint64_t pos, void *data,
+                             size_t size) {
+  uint64_t offset = pos % ring->capacity;
+  size_t first = size;
+  if (offset + size > ring->capacity)
+    first = ring->capacity - offset;
+  memcpy(data, &ring->buffer[offset], first);
+  memcpy((char *)data + first, &ring->buffer[0], size - first);
+}
+
+/* Drop the oldest record */
+static void flight_ring_evict(flight_ring_t *ring) {
+  flight_record_t record;
+  flight_ring_read(ring, ring->tail, &record, sizeof(record));
+  ring->tail += record.size;
+  ring->overwritten++;
+}
+
+static void flight_ring_push(flight_ring_t *ring,
+                             OTF2_AttributeList *attributes,
+                             OTF2_TimeStamp time, flight_record_kind_t kind,
+                             uint64_t arg0, uint64_t arg1) {
+  uint32_t n_attributes = OTF2_AttributeList_GetNumberOfElements(attributes);
+  if (n_attributes > FLIGHT_MAX_ATTRIBUTES)
+    n_attributes = FLIGHT_MAX_ATTRIBUTES;
+  flight_record_t record = {
+      .size = sizeof(record) + n_attributes * sizeof(flight_attribute_t),
+      .kind = (uint8_t)kind,
+      .n_attributes = (uint8_t)n_attributes,
+      .unused = 0,
+      .time = time,
+      .arg = {arg0, arg1}};
+  if (record.size > ring->capacity) {
+    ring->overwritten++;
+    return;
+  }
+
+  while (ring->head - ring->tail + record.size > ring->capacity)
+    flight_ring_evict(ring);
+  if (flight.window != 0) {
+    while (ring->tail != ring->head) {
+      flight_record_t oldest;
+      flight_ring_read(ring, ring->tail, &oldest, sizeof(oldest));
+      if (oldest.time + flight.window >= time)
+        break;
+      flight_ring_evict(ring);
+    }
+  }
+
+  uint64_t pos = ring->head;
+  flight_ring_write(ring, pos, &record, sizeof(record));
+  pos += sizeof(record);
+  for (uint32_t k = 0; k < n_attributes; k++) {
+    flight_attribute_t attribute;
+    OTF2_AttributeList_GetAttributeByIndex(attributes, k, &attribute.ref,
+                                           &attribute.type, &attribute.value);
+    flight_ring_write(ring, pos, &attribute, sizeof(attribute));
+    pos += sizeof(attribute);
+  }
+  ring->head = pos;
+  ring->recorded++;
+}
+
+static OTF2_ErrorCode flight_replay(trace_location_def_t *loc,
+                                    OTF2_AttributeList *attributes,
+                                    flight_record_t *record) {
+  switch (record->kind) {
+  case flight_record_thread_begin:
+    return trace_sink_otf2.thread_begin(loc, attributes, record->time,
+                                        record->arg[0]);
+  case flight_record_thread_end:
+    return trace_sink_otf2.thread_end(loc, attributes, record->time,
+                                      record->arg[0]);
+  case flight_record_enter:
+    return trace_sink_otf2.enter(loc, attributes, record->time,
+                                 (OTF2_RegionRef)record->arg[0]);
+  case flight_record_leave:
+    return trace_sink_otf2.leave(loc, attributes, record->time,
+                                 (OTF2_RegionRef)record->arg[0]);
+  case flight_record_task_create:
+    return trace_sink_otf2.task_create(loc, attributes, record->time);
+  case flight_record_task_switch:
+    return trace_sink_otf2.task_switch(loc, attributes, record->time);
+  case flight_record_acquire_lock:
+    return trace_sink_otf2.acquire_lock(loc, attributes, record->time,
+                                        (uint32_t)record->arg[0],
+                                        (uint32_t)record->arg[1]);
+  case flight_record_release_lock:
+    return trace_sink_otf2.release_lock(loc, attributes, record->time,
+                                        (uint32_t)record->arg[0],
+                                        (uint32_t)record->arg[1]);
+  }
+  return OTF2_AttributeList_RemoveAllAttributes(attributes);
+}
+
+static bool flight_positions_push(flight_positions_t *list, uint64_t pos) {
+  if (list->count == list->capacity) {
+    size_t capacity = list->capacity == 0 ? 16 : 2 * list->capacity;
+    uint64_t *items = realloc(list->items, capacity * sizeof(*items));
+    if (items == NULL)
+      return false;
+    list->items = items;
+    list->capacity = capacity;
+  }
+  list->items[list->count++] = pos;
+  return true;
+}
+
+/* Read the record at pos and add its attributes to the list. If endpoint is
+   not NULL it replaces the record's own attr_endpoint. */
+static void flight_ring_read_record(flight_ring_t *ring, uint64_t pos,
+                                    flight_record_t *record,
+                                    OTF2_AttributeList *attributes,
+                                    const OTF2_StringRef *endpoint) {
+  flight_ring_read(ring, pos, record, sizeof(*record));
+  pos += sizeof(*record);
+  for (uint8_t k = 0; k < record->n_attributes; k++) {
+    flight_attribute_t attribute;
+    flight_ring_read(ring, pos, &attribute, sizeof(attribute));
+    pos += sizeof(attribute);
+    if (endpoint != NULL && attribute.ref == attr_endpoint)
+      continue;
+    OTF2_AttributeList_AddAttribute(attributes, attribute.ref, attribute.type,
+                                    attribute.value);
+  }
+  if (endpoint != NULL)
+    OTF2_AttributeList_AddStringRef(attributes, attr_endpoint, *endpoint);
+}
+
+/* Find the regions whose Enter was evicted (orphans, innermost first) and
+   those whose Leave hasn't been recorded yet (open, outermost first). Events
+   outside a defined region are discrete and need no partner. */
+static bool flight_ring_find_unpaired(flight_ring_t *ring,
+                                      flight_positions_t *orphans,
+                                      flight_positions_t *open) {
+  for (uint64_t pos = ring->tail; pos != ring->head;) {
+    flight_record_t record;
+    flight_ring_read(ring, pos, &record, sizeof(record));
+    if (record.arg[0] != OTF2_UNDEFINED_REGION) {
+      if (record.kind == flight_record_enter) {
+        if (!flight_positions_push(open, pos))
+          return false;
+      } else if (record.kind == flight_record_leave) {
+        if (open->count > 0) {
+          open->count--;
+        } else if (!flight_positions_push(orphans, pos)) {
+          return false;
+        }
+      }
+    }
+    pos += record.size;
+  }
+  return true;
+}
+
+/* Write the ring's events to the location's event writer and empty it. An
+   orphaned Leave gets an Enter at the start of the window and an open Enter
+   gets a Leave at its end, each copying its partner's attributes. */
+static void flight_ring_dump(trace_location_def_t *loc, flight_ring_t *ring) {
+  if (ring->tail == ring->head)
+    return;
+  OTF2_AttributeList *attributes = OTF2_AttributeList_New();
+  flight_positions_t orphans = {NULL, 0, 0};
+  flight_positions_t open = {NULL, 0, 0};
+  if (!flight_ring_find_unpaired(ring, &orphans, &open)) {
+    LOG_ERROR("failed to allocate flight recorder dump, regions may be "
+              "unbalanced");
+    orphans.count = open.count = 0;
+  }
+
+  flight_record_t record;
+  flight_ring_read(ring, ring->tail, &record, sizeof(record));
+  OTF2_TimeStamp first = record.time, last = record.time;
+
+  uint64_t dumped = 0, synthesised = 0;
+  OTF2_ErrorCode err = OTF2_SUCCESS;
+  for (size_t k = orphans.count; k > 0; k--) {
+    flight_ring_read_record(ring, orphans.items[k - 1], &record, attributes,
+                            &attr_label_ref[attr_endpoint_enter]);
+    err = trace_sink_otf2.enter(loc, attributes, first,
+                                (OTF2_RegionRef)record.arg[0]);
+    CHECK_OTF2_ERROR_CODE(err);
+    synthesised++;
+  }
+
+  while (ring->tail != ring->head) {
+    flight_ring_read_record(ring, ring->tail, &record, attributes, NULL);
+    err = flight_replay(loc, attributes, &record);
+    CHECK_OTF2_ERROR_CODE(err);
+    last = record.time;
+    ring->tail += record.size;
+    dumped++;
+  }
+
+  for (size_t k = open.count; k > 0; k--) {
+    flight_ring_read_record(ring, open.items[k - 1], &record, attributes,
+                            &attr_label_ref[attr_endpoint_leave]);
+    err = trace_sink_otf2.leave(loc, attributes, last,
+                                (OTF2_RegionRef)record.arg[0]);
+    CHECK_OTF2_ERROR_CODE(err);
+    synthesised++;
+  }
+
+  free(orphans.items);
+  free(open.items);
+  OTF2_AttributeList_Delete(attributes);
+  ring->dumped += dumped;
+  ring->synthesised += synthesised;
+  LOG_DEBUG("[t=%lu] dumped %lu events (%lu synthesised)",
+            trace_location_get_id(loc), dumped, synthesised);
+}
+
+static OTF2_ErrorCode flight_record(trace_location_def_t *loc,
+                                    OTF2_AttributeList *attributes,
+                                    OTF2_TimeStamp time,
+                                    flight_record_kind_t kind, uint64_t arg0,
+                                    uint64_t arg1) {
+  flight_ring_t *ring = trace_location_get_sink_data(loc);
+  if (ring != NULL) {
+    flight_ring_push(ring, attributes, time, kind, arg0, arg1);
+    uint64_t requested =
+        __atomic_load_n(&flight.dumps_requested, __ATOMIC_RELAXED);
+    if (requested != ring->dumps_seen) {
+      ring->dumps_seen = requested;
+      flight_ring_dump(loc, ring);
+    }
+  }
+  return OTF2_AttributeList_RemoveAllAttributes(attributes);
+}
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+/*   SINK                                                                    */
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+static void flight_initialise(otter_opt_t *opt) {
+  flight.size = trace_memory_parse_size(ENV_VAR_FLIGHT_SIZE, opt->flight_size,
+                                        FLIGHT_DEFAULT_SIZE);
+  if (flight.size < 2 * sizeof(flight_record_t)) {
+    fprintf(stderr, "%s is too small (ignored): %s\n", ENV_VAR_FLIGHT_SIZE,
+            opt->flight_size);
+    flight.size = FLIGHT_DEFAULT_SIZE;
+  }
+  flight.window = 0;
+  if (opt->flight_seconds != NULL && opt->flight_seconds[0] != '\0') {
+    char *end = NULL;
+    double seconds = strtod(opt->flight_seconds, &end);
+    if (end == opt->flight_seconds || *end != '\0' || seconds <= 0) {
+      fprintf(stderr, "invalid value for %s (ignored): %s\n",
+              ENV_VAR_FLIGHT_SECONDS, opt->flight_seconds);
+    } else {
+      flight.window = (uint64_t)(seconds * 1e9);
+    }
+  }
+  flight.dump_phase = opt->flight_dump_phase;
+  if (flight.dump_phase != NULL && flight.dump_phase[0] == '\0')
+    flight.dump_phase = NULL;
+  flight.dumps_requested = 0;
+  flight.enabled = true;
+
+  struct sigaction action = {.sa_handler = flight_signal_handler,
+                             .sa_flags = SA_RESTART};
+  sigemptyset(&action.sa_mask);
+  if (sigaction(SIGUSR1, &action, NULL) != 0)
+    LOG_ERROR("failed to install SIGUSR1 handler");
+
+  fprintf(stderr, "%-30s %lu KiB per thread\n",
+          "Flight recorder:", flight.size >> 10);
+  if (flight.window != 0)
+    fprintf(stderr, "%-30s %.3f s\n", "Flight recorder window:",
+            flight.window / 1e9);
+  fprintf(stderr, "%-30s SIGUSR1, otterTraceDump()%s%s\n",
+          "Flight recorder dumps on:", flight.dump_phase ? ", phase " : "",
+          flight.dump_phase ? flight.dump_phase : "");
+}
+
+static void *flight_location_open(trace_location_def_t *loc) {
+  flight_ring_t *ring = calloc(1, sizeof(*ring));
+  if (ring != NULL)
+    ring->buffer = malloc(flight.size);
+  if (ring == NULL || ring->buffer == NULL) {
+    LOG_ERROR("failed to allocate flight recorder ring");
+    free(ring);
+    return NULL;
+  }
+  ring->capacity = flight.size;
+  /* Only dumps requested after the location is created apply to it */
+  ring->dumps_seen = __atomic_load_n(&flight.dumps_requested, __ATOMIC_RELAXED);
+  return ring;
+}
+
+static void flight_location_close(trace_location_def_t *loc, void *data) {
+  flight_ring_t *ring = data;
+  if (ring == NULL)
+    return;
+  /* A dump this location hasn't yet seen still applies to its ring */
+  uint64_t requested =
+      __atomic_load_n(&flight.dumps_requested, __ATOMIC_RELAXED);
+  if (requested != ring->dumps_seen)
+    flight_ring_dump(loc, ring);
+  /* The location definition counts only the events written to the archive */
+  trace_location_set_event_count(loc, ring->dumped + ring->synthesised);
+  pthread_mutex_lock(&totals.lock);
+  totals.recorded += ring->recorded;
+  totals.overwritten += ring->overwritten;
+  totals.dumped += ring->dumped;
+  totals.synthesised += ring->synthesised;
+  if (ring->dumped != 0)
+    totals.rings_dumped++;
+  pthread_mutex_unlock(&totals.lock);
+  free(ring->buffer);
+  free(ring);
+}
+
+static void flight_finalise(void) {
+  struct sigaction action = {.sa_handler = SIG_DFL};
+  sigemptyset(&action.sa_mask);
+  sigaction(SIGUSR1, &action, NULL);
+  flight.enabled = false;
+
+  pthread_mutex_lock(&totals.lock);
+  fprintf(stderr, "\nFLIGHT RECORDER:\n");
+  fprintf(stderr, "%-30s %lu\n", "Dumps requested:", flight.dumps_requested);
+  fprintf(stderr, "%-30s %lu\n", "Events recorded:", totals.recorded);
+  fprintf(stderr, "%-30s %lu\n", "Events overwritten:", totals.overwritten);
+  fprintf(stderr, "%-30s %lu (from %lu threads)\n",
+          "Events dumped:", totals.dumped, totals.rings_dumped);
+  fprintf(stderr, "%-30s %lu\n", "Region endpoints synthesised:",
+          totals.synthesised);
+  pthread_mutex_unlock(&totals.lock);
+}
+
+static OTF2_ErrorCode flight_thread_begin(trace_location_def_t *loc,
+                                          OTF2_AttributeList *attributes,
+                                          OTF2_TimeStamp time,
+                                          uint64_t thread_id) {
+  return flight_record(loc, attributes, time, flight_record_thread_begin,
+                       thread_id, 0);
+}
+
+static OTF2_ErrorCode flight_thread_end(trace_location_def_t *loc,
+                                        OTF2_AttributeList *attributes,
+                                        OTF2_TimeStamp time,
+                                        uint64_t thread_id) {
+  return flight_record(loc, attributes, time, flight_record_thread_end,
+                       thread_id, 0);
+}
+
+static OTF2_ErrorCode flight_enter(trace_location_def_t *loc,
+                                   OTF2_AttributeList *attributes,
+                                   OTF2_TimeStamp time, OTF2_RegionRef region) {
+  return flight_record(loc, attributes, time, flight_record_enter, region, 0);
+}
+
+static OTF2_ErrorCode flight_leave(trace_location_def_t *loc,
+                                   OTF2_AttributeList *attributes,
+                                   OTF2_TimeStamp time, OTF2_RegionRef region) {
+  return flight_record(loc, attributes, time, flight_record_leave, region, 0);
+}
+
+static OTF2_ErrorCode flight_task_create(trace_location_def_t *loc,
+                                         OTF2_AttributeList *attributes,
+                                         OTF2_TimeStamp time) {
+  return flight_record(loc, attributes, time, flight_record_task_create, 0, 0);
+}
+
+static OTF2_ErrorCode flight_task_switch(trace_location_def_t *loc,
+                                         OTF2_AttributeList *attributes,
+                                         OTF2_TimeStamp time) {
+  return flight_record(loc, attributes, time, flight_record_task_switch, 0, 0);
+}
+
+static OTF2_ErrorCode flight_acquire_lock(trace_location_def_t *loc,
+                                          OTF2_AttributeList *attributes,
+                                          OTF2_TimeStamp time, uint32_t lock_id,
+                                          uint32_t order) {
+  return flight_record(loc, attributes, time, flight_record_acquire_lock,
+                       lock_id, order);
+}
+
+static OTF2_ErrorCode flight_release_lock(trace_location_def_t *loc,
+                                          OTF2_AttributeList *attributes,
+                                          OTF2_TimeStamp time, uint32_t lock_id,
+                                          uint32_t order) {
+  return flight_record(loc, attributes, time, flight_record_release_lock,
+                       lock_id, order);
+}
+
+const trace_sink_t trace_sink_flight = {
+    .name = "flight",
+    .initialise = flight_initialise,
+    .location_open = flight_location_open,
+    .location_close = flight_location_close,
+    .thread_begin = flight_thread_begin,
+    .thread_end = flight_thread_end,
+    .enter = flight_enter,
+    .leave = flight_leave,
+    .task_create = flight_task_create,
+    .task_switch = flight_task_switch,
+    .acquire_lock = flight_acquire_lock,
+    .release_lock = flight_release_lock,
+    .define_string = NULL,
+    .finalise = flight_finalise};
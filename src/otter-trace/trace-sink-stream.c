@@ -0,0 +1,542 @@
+/**
+ * @file trace-sink-stream.c
+ * @author Adam Tuft
+ * @brief A sink which writes every event to the OTF2 archive and also streams
+ * it to a live consumer through the Unix-domain socket or named pipe given by
+ * OTTER_STREAM_PATH. Each location batches its events into frames (see
+ * trace-stream.h) which are written without blocking. A flusher thread sends
+ * any batch left waiting by an idle or blocked thread. If the consumer is
+ * absent or can't keep up, a frame is dropped and counted rather than stalling
+ * the application.
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <otf2/otf2.h>
+
+#include "public/debug.h"
+#include "public/otter-environment-variables.h"
+#include "public/otter-trace/trace-stream.h"
+
+#include "trace-attribute-lookup.h"
+#include "trace-attributes.h"
+#include "trace-sink.h"
+
+/* Flush a location's batch once its oldest event is this old */
+#define STREAM_FLUSH_INTERVAL_NS 100000000
+/* How often the flusher thread looks for batches to flush */
+#define STREAM_FLUSHER_PERIOD_NS (STREAM_FLUSH_INTERVAL_NS / 2)
+/* Interval between attempts to reach an absent consumer */
+#define STREAM_RECONNECT_INTERVAL_NS 1000000000
+
+#define STREAM_BATCH_MAX                                                       \
+  ((OTTER_STREAM_FRAME_MAX - sizeof(otter_stream_frame_header_t)) /            \
+   sizeof(otter_stream_event_t))
+
+/* One frame of events, held by each location. The lock is shared only with
+   the flusher thread, so the location's own thread rarely waits for it. */
+typedef struct stream_batch_t {
+  otter_stream_frame_header_t header;
+  otter_stream_event_t events[STREAM_BATCH_MAX];
+  uint64_t oldest;
+  pthread_mutex_t lock;
+  struct stream_batch_t *next;
+} stream_batch_t;
+
+typedef struct {
+  OTF2_StringRef ref;
+  char *string;
+} stream_string_t;
+
+static const char *label_names[n_attr_label_defined] = {
+#define INCLUDE_LABEL(Name, Label) [attr_##Name##_##Label] = #Label,
+#include "trace-attribute-defs.h"
+};
+
+/* The connection to the consumer and the strings it must be sent, which are
+   replayed whenever the connection is re-established. The flusher thread runs
+   alongside the serial event model too, so stream.lock is always taken. */
+static struct {
+  char path[sizeof(((struct sockaddr_un *)0)->sun_path)];
+  int fd;
+  bool is_fifo;
+  bool finalised;
+  uint64_t last_attempt;
+  uint64_t connections;
+  uint64_t sent;
+  uint64_t dropped;
+  struct {
+    stream_string_t *items;
+    size_t count;
+    size_t capacity;
+    size_t sent;
+  } strings;
+  pthread_mutex_t lock;
+} stream = {.path = {0},
+            .fd = -1,
+            .is_fifo = false,
+            .finalised = false,
+            .last_attempt = 0,
+            .connections = 0,
+            .sent = 0,
+            .dropped = 0,
+            .strings = {NULL, 0, 0, 0},
+            .lock = PTHREAD_MUTEX_INITIALIZER};
+
+/* The open batches, which the flusher thread visits every period. Lock order
+   is flusher.lock, then a batch's lock, then stream.lock. */
+static struct {
+  stream_batch_t *batches;
+  pthread_t thread;
+  pthread_cond_t wake;
+  bool running;
+  pthread_mutex_t lock;
+} flusher = {.batches = NULL,
+             .running = false,
+             .lock = PTHREAD_MUTEX_INITIALIZER};
+
+static pthread_once_t labels_once = PTHREAD_ONCE_INIT;
+
+static uint64_t stream_now(void) {
+  struct timespec time;
+  clock_gettime(CLOCK_MONOTONIC, &time);
+  return time.tv_sec * (uint64_t)1000000000 + time.tv_nsec;
+}
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+/*   CONNECTION                                                              */
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+/* Open the consumer's pipe or connect to its socket. Requires stream.lock. */
+static bool stream_connect(void) {
+  uint64_t now = stream_now();
+  if (stream.last_attempt != 0 &&
+      now - stream.last_attempt < STREAM_RECONNECT_INTERVAL_NS)
+    return false;
+  stream.last_attempt = now;
+
+  struct stat info;
+  if (stat(stream.path, &info) != 0)
+    return false;
+
+  if (S_ISFIFO(info.st_mode)) {
+    /* Fails with ENXIO until the consumer opens the pipe for reading */
+    stream.fd = open(stream.path, O_WRONLY | O_NONBLOCK | O_CLOEXEC);
+    stream.is_fifo = true;
+  } else if (S_ISSOCK(info.st_mode)) {
+    stream.fd = socket(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+    stream.is_fifo = false;
+    struct sockaddr_un addr = {.sun_family = AF_UNIX};
+    strncpy(addr.sun_path, stream.path, sizeof(addr.sun_path) - 1);
+    if (stream.fd != -1 &&
+        connect(stream.fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+      close(stream.fd);
+      stream.fd = -1;
+    }
+  }
+
+  if (stream.fd == -1)
+    return false;
+
+  LOG_DEBUG("connected to stream consumer at %s", stream.path);
+  stream.connections++;
+  stream.strings.sent = 0;
+  return true;
+}
+
+static void stream_disconnect(void) {
+  if (stream.fd != -1)
+    close(stream.fd);
+  stream.fd = -1;
+}
+
+/* Write to the pipe without taking SIGPIPE if the consumer has gone */
+static ssize_t stream_write_fifo(const void *frame, size_t length) {
+  sigset_t sigpipe, previous;
+  sigemptyset(&sigpipe);
+  sigaddset(&sigpipe, SIGPIPE);
+  pthread_sigmask(SIG_BLOCK, &sigpipe, &previous);
+  ssize_t written = write(stream.fd, frame, length);
+  int saved_errno = errno;
+  if (written == -1 && errno == EPIPE) {
+    struct timespec no_wait = {0, 0};
+    sigtimedwait(&sigpipe, NULL, &no_wait);
+  }
+  pthread_sigmask(SIG_SETMASK, &previous, NULL);
+  errno = saved_errno;
+  return written;
+}
+
+/* Write one whole frame without blocking. Requires stream.lock. */
+static bool stream_send(const void *frame, size_t length) {
+  if (stream.finalised)
+    return false;
+  if (stream.fd == -1 && !stream_connect())
+    return false;
+  ssize_t written = stream.is_fifo
+                        ? stream_write_fifo(frame, length)
+                        : send(stream.fd, frame, length,
+                               MSG_DONTWAIT | MSG_NOSIGNAL);
+  if (written == (ssize_t)length)
+    return true;
+  if (written == -1 && (errno == EAGAIN || errno == EWOULDBLOCK))
+    return false; /* consumer is slow, try again with the next frame */
+  LOG_DEBUG("lost stream consumer: %s", strerror(errno));
+  stream_disconnect();
+  return false;
+}
+
+/* Send the strings the consumer hasn't yet received. Requires stream.lock. */
+static bool stream_send_strings(void) {
+  static char frame[OTTER_STREAM_FRAME_MAX];
+  const size_t max_length = OTTER_STREAM_FRAME_MAX -
+                            sizeof(otter_stream_frame_header_t) -
+                            sizeof(otter_stream_string_t);
+  while (stream.strings.sent < stream.strings.count) {
+    otter_stream_frame_header_t header = {.magic = OTTER_STREAM_MAGIC,
+                                          .version = OTTER_STREAM_VERSION,
+                                          .kind = otter_stream_frame_strings,
+                                          .length = sizeof(header),
+                                          .count = 0,
+                                          .dropped = stream.dropped};
+    size_t next = stream.strings.sent;
+    for (; next < stream.strings.count; next++) {
+      stream_string_t *item = &stream.strings.items[next];
+      otter_stream_string_t record = {.ref = item->ref,
+                                      .length = strlen(item->string)};
+      if (record.length > max_length)
+        record.length = max_length;
+      if (header.length + sizeof(record) + record.length >
+          OTTER_STREAM_FRAME_MAX)
+        break;
+      memcpy(&frame[header.length], &record, sizeof(record));
+      memcpy(&frame[header.length + sizeof(record)], item->string,
+             record.length);
+      header.length += sizeof(record) + record.length;
+      header.count++;
+    }
+    memcpy(&frame[0], &header, sizeof(header));
+    if (!stream_send(frame, header.length))
+      return false;
+    stream.strings.sent = next;
+  }
+  return true;
+}
+
+static void stream_add_string(OTF2_StringRef ref, const char *string) {
+  pthread_mutex_lock(&stream.lock);
+  if (stream.strings.count == stream.strings.capacity) {
+    size_t capacity =
+        stream.strings.capacity == 0 ? 256 : 2 * stream.strings.capacity;
+    stream_string_t *items =
+        realloc(stream.strings.items, capacity * sizeof(*items));
+    if (items != NULL) {
+      stream.strings.items = items;
+      stream.strings.capacity = capacity;
+    }
+  }
+  char *copy = strdup(string);
+  if (copy != NULL && stream.strings.count < stream.strings.capacity) {
+    stream.strings.items[stream.strings.count++] =
+        (stream_string_t){.ref = ref, .string = copy};
+  } else {
+    LOG_ERROR("failed to store stream string: %s", string);
+    free(copy);
+  }
+  pthread_mutex_unlock(&stream.lock);
+}
+
+/* The label refs are defined with the archive, after the sink is chosen */
+static void stream_add_labels(void) {
+  for (int k = 0; k < n_attr_label_defined; k++) {
+    stream_add_string(attr_label_ref[k], label_names[k]);
+  }
+}
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+/*   BATCHING                                                                */
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+/* Send the batch. Requires batch->lock. */
+static void stream_flush(stream_batch_t *batch) {
+  if (batch->header.count == 0)
+    return;
+  pthread_mutex_lock(&stream.lock);
+  batch->header.length = sizeof(batch->header) +
+                         batch->header.count * sizeof(otter_stream_event_t);
+  batch->header.dropped = stream.dropped;
+  if (stream_send_strings() && stream_send(batch, batch->header.length)) {
+    stream.sent += batch->header.count;
+  } else {
+    stream.dropped += batch->header.count;
+  }
+  pthread_mutex_unlock(&stream.lock);
+  batch->header.count = 0;
+}
+
+static OTF2_ErrorCode stream_record(trace_location_def_t *loc,
+                                    OTF2_AttributeList *attributes,
+                                    OTF2_TimeStamp time,
+                                    otter_stream_record_t record) {
+  stream_batch_t *batch = trace_location_get_sink_data(loc);
+  if (batch == NULL)
+    return OTF2_SUCCESS;
+  pthread_mutex_lock(&batch->lock);
+  otter_stream_event_t *event = &batch->events[batch->header.count++];
+  *event = (otter_stream_event_t){
+      .time = time,
+      .location = (uint32_t)trace_location_get_id(loc),
+      .tasks = 1,
+      .record = (uint8_t)record};
+  OTF2_AttributeList_GetUint64(attributes, attr_unique_id, &event->unique_id);
+  OTF2_AttributeList_GetUint64(attributes, attr_encountering_task_id,
+                               &event->encountering_task_id);
+  OTF2_AttributeList_GetStringRef(attributes, attr_event_type,
+                                  &event->event_type);
+  OTF2_AttributeList_GetStringRef(attributes, attr_task_label,
+                                  &event->task_label);
+  uint64_t tasks = 1;
+  if (OTF2_AttributeList_GetUint64(attributes, attr_task_batch_size, &tasks) ==
+      OTF2_SUCCESS)
+    event->tasks = tasks > UINT32_MAX ? UINT32_MAX : (uint32_t)tasks;
+  if (batch->header.count == 1)
+    batch->oldest = stream_now();
+  if (batch->header.count == STREAM_BATCH_MAX ||
+      record == otter_stream_record_thread_end)
+    stream_flush(batch);
+  pthread_mutex_unlock(&batch->lock);
+  return OTF2_SUCCESS;
+}
+
+/* Send each batch whose oldest event has waited too long. A batch whose thread
+   is recording right now is skipped, as that thread will check it. */
+static void *stream_flusher(void *arg) {
+  pthread_mutex_lock(&flusher.lock);
+  while (flusher.running) {
+    uint64_t now = stream_now();
+    for (stream_batch_t *batch = flusher.batches; batch != NULL;
+         batch = batch->next) {
+      if (pthread_mutex_trylock(&batch->lock) != 0)
+        continue;
+      if (batch->header.count > 0 &&
+          now - batch->oldest >= STREAM_FLUSH_INTERVAL_NS)
+        stream_flush(batch);
+      pthread_mutex_unlock(&batch->lock);
+    }
+    struct timespec deadline;
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    deadline.tv_nsec += STREAM_FLUSHER_PERIOD_NS;
+    if (deadline.tv_nsec >= 1000000000) {
+      deadline.tv_sec++;
+      deadline.tv_nsec -= 1000000000;
+    }
+    pthread_cond_timedwait(&flusher.wake, &flusher.lock, &deadline);
+  }
+  pthread_mutex_unlock(&flusher.lock);
+  return NULL;
+}
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+/*   SINK                                                                    */
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+static void stream_initialise(otter_opt_t *opt) {
+  const char *path = opt->stream_path != NULL && opt->stream_path[0] != '\0'
+                         ? opt->stream_path
+                         : DEFAULT_STREAM_PATH;
+  if (strlen(path) >= sizeof(stream.path)) {
+    fprintf(stderr, "%s is too long (truncated): %s\n", ENV_VAR_STREAM_PATH,
+            path);
+  }
+  strncpy(stream.path, path, sizeof(stream.path) - 1);
+  fprintf(stderr, "%-30s %s\n", "Stream path:", stream.path);
+
+  pthread_condattr_t attr;
+  pthread_condattr_init(&attr);
+  pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+  pthread_cond_init(&flusher.wake, &attr);
+  pthread_condattr_destroy(&attr);
+  flusher.running = true;
+  if (pthread_create(&flusher.thread, NULL, stream_flusher, NULL) != 0) {
+    LOG_WARN("failed to start stream flusher thread, a batch will wait for "
+             "its thread's next event");
+    flusher.running = false;
+  }
+}
+
+static void *stream_location_open(trace_location_def_t *loc) {
+  pthread_once(&labels_once, stream_add_labels);
+  stream_batch_t *batch = calloc(1, sizeof(*batch));
+  if (batch == NULL) {
+    LOG_ERROR("failed to allocate stream batch");
+    return NULL;
+  }
+  batch->header = (otter_stream_frame_header_t){
+      .magic = OTTER_STREAM_MAGIC,
+      .version = OTTER_STREAM_VERSION,
+      .kind = otter_stream_frame_events};
+  pthread_mutex_init(&batch->lock, NULL);
+  pthread_mutex_lock(&flusher.lock);
+  batch->next = flusher.batches;
+  flusher.batches = batch;
+  pthread_mutex_unlock(&flusher.lock);
+  return batch;
+}
+
+static void stream_location_close(trace_location_def_t *loc, void *data) {
+  stream_batch_t *batch = data;
+  if (batch == NULL)
+    return;
+  pthread_mutex_lock(&flusher.lock);
+  stream_batch_t **link = &flusher.batches;
+  while (*link != NULL && *link != batch)
+    link = &(*link)->next;
+  if (*link != NULL)
+    *link = batch->next;
+  pthread_mutex_unlock(&flusher.lock);
+  pthread_mutex_lock(&batch->lock);
+  stream_flush(batch);
+  pthread_mutex_unlock(&batch->lock);
+  pthread_mutex_destroy(&batch->lock);
+  free(batch);
+}
+
+static void stream_define_string(OTF2_StringRef ref, const char *string) {
+  stream_add_string(ref, string);
+}
+
+static void stream_finalise(void) {
+  pthread_mutex_lock(&flusher.lock);
+  bool running = flusher.running;
+  flusher.running = false;
+  pthread_cond_signal(&flusher.wake);
+  pthread_mutex_unlock(&flusher.lock);
+  if (running)
+    pthread_join(flusher.thread, NULL);
+
+  /* Send what the flusher would have sent for locations not yet closed */
+  pthread_mutex_lock(&flusher.lock);
+  for (stream_batch_t *batch = flusher.batches; batch != NULL;
+       batch = batch->next) {
+    pthread_mutex_lock(&batch->lock);
+    stream_flush(batch);
+    pthread_mutex_unlock(&batch->lock);
+  }
+  pthread_mutex_unlock(&flusher.lock);
+
+  pthread_mutex_lock(&stream.lock);
+  otter_stream_frame_header_t end = {.magic = OTTER_STREAM_MAGIC,
+                                     .version = OTTER_STREAM_VERSION,
+                                     .kind = otter_stream_frame_end,
+                                     .length = sizeof(end),
+                                     .count = 0,
+                                     .dropped = stream.dropped};
+  if (stream.fd != -1)
+    stream_send(&end, sizeof(end));
+  stream_disconnect();
+  stream.finalised = true;
+
+  fprintf(stderr, "\nSTREAM:\n");
+  fprintf(stderr, "%-30s %s\n", "Path:", stream.path);
+  fprintf(stderr, "%-30s %lu\n", "Connections:", stream.connections);
+  fprintf(stderr, "%-30s %lu\n", "Events sent:", stream.sent);
+  fprintf(stderr, "%-30s %lu\n", "Events dropped:", stream.dropped);
+
+  for (size_t k = 0; k < stream.strings.count; k++) {
+    free(stream.strings.items[k].string);
+  }
+  free(stream.strings.items);
+  stream.strings.items = NULL;
+  stream.strings.count = stream.strings.capacity = stream.strings.sent = 0;
+  pthread_mutex_unlock(&stream.lock);
+}
+
+static OTF2_ErrorCode stream_thread_begin(trace_location_def_t *loc,
+                                          OTF2_AttributeList *attributes,
+                                          OTF2_TimeStamp time,
+                                          uint64_t thread_id) {
+  stream_record(loc, attributes, time, otter_stream_record_thread_begin);
+  return trace_sink_otf2.thread_begin(loc, attributes, time, thread_id);
+}
+
+static OTF2_ErrorCode stream_thread_end(trace_location_def_t *loc,
+                                        OTF2_AttributeList *attributes,
+                                        OTF2_TimeStamp time,
+                                        uint64_t thread_id) {
+  stream_record(loc, attributes, time, otter_stream_record_thread_end);
+  return trace_sink_otf2.thread_end(loc, attributes, time, thread_id);
+}
+
+static OTF2_ErrorCode stream_enter(trace_location_def_t *loc,
+                                   OTF2_AttributeList *attributes,
+                                   OTF2_TimeStamp time, OTF2_RegionRef region) {
+  stream_record(loc, attributes, time, otter_stream_record_enter);
+  return trace_sink_otf2.enter(loc, attributes, time, region);
+}
+
+static OTF2_ErrorCode stream_leave(trace_location_def_t *loc,
+                                   OTF2_AttributeList *attributes,
+                                   OTF2_TimeStamp time, OTF2_RegionRef region) {
+  stream_record(loc, attributes, time, otter_stream_record_leave);
+  return trace_sink_otf2.leave(loc, attributes, time, region);
+}
+
+static OTF2_ErrorCode stream_task_create(trace_location_def_t *loc,
+                                         OTF2_AttributeList *attributes,
+                                         OTF2_TimeStamp time) {
+  stream_record(loc, attributes, time, otter_stream_record_task_create);
+  return trace_sink_otf2.task_create(loc, attributes, time);
+}
+
+static OTF2_ErrorCode stream_task_switch(trace_location_def_t *loc,
+                                         OTF2_AttributeList *attributes,
+                                         OTF2_TimeStamp time) {
+  stream_record(loc, attributes, time, otter_stream_record_task_switch);
+  return trace_sink_otf2.task_switch(loc, attributes, time);
+}
+
+static OTF2_ErrorCode stream_acquire_lock(trace_location_def_t *loc,
+                                          OTF2_AttributeList *attributes,
+                                          OTF2_TimeStamp time, uint32_t lock_id,
+                                          uint32_t order) {
+  stream_record(loc, attributes, time, otter_stream_record_acquire_lock);
+  return trace_sink_otf2.acquire_lock(loc, attributes, time, lock_id, order);
+}
+
+static OTF2_ErrorCode stream_release_lock(trace_location_def_t *loc,
+                                          OTF2_AttributeList *attributes,
+                                          OTF2_TimeStamp time, uint32_t lock_id,
+                                          uint32_t order) {
+  stream_record(loc, attributes, time, otter_stream_record_release_lock);
+  return trace_sink_otf2.release_lock(loc, attributes, time, lock_id, order);
+}
+
+const trace_sink_t trace_sink_stream = {
+    .name = "stream",
+    .initialise = stream_initialise,
+    .location_open = stream_location_open,
+    .location_close = stream_location_close,
+    .thread_begin = stream_thread_begin,
+    .thread_end = stream_thread_end,
+    .enter = stream_enter,
+    .leave = stream_leave,
+    .task_create = stream_task_create,
+    .task_switch = stream_task_switch,
+    .acquire_lock = stream_acquire_lock,
+    .release_lock = stream_release_lock,
+    .define_string = stream_define_string,
+    .finalise = stream_finalise};
@@ -0,0 +1,180 @@
+/**
+ * @file trace-sink.c
+ * @author Adam Tuft
+ * @brief Selects the sink which receives events and defines the OTF2 sink,
+ * which writes events to the archive, and the null sink, which discards them to
+ * measure the cost of instrumentation alone.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+
+#include <otf2/otf2.h>
+
+#include "public/debug.h"
+#include "public/otter-environment-variables.h"
+
+#include "trace-sink.h"
+
+static const trace_sink_t *selected_sink = &trace_sink_otf2;
+
+void trace_sink_initialise(otter_opt_t *opt) {
+  static const trace_sink_t *sinks[] = {
+      &trace_sink_otf2,   &trace_sink_null,   &trace_sink_aggregate,
+      &trace_sink_stream, &trace_sink_flight, &trace_sink_compact};
+  selected_sink = &trace_sink_otf2;
+  if (opt->sink != NULL && opt->sink[0] != '\0') {
+    const trace_sink_t *sink = NULL;
+    for (size_t k = 0; k < sizeof(sinks) / sizeof(sinks[0]); k++) {
+      if (strcasecmp(opt->sink, sinks[k]->name) == 0)
+        sink = sinks[k];
+    }
+    if (sink != NULL) {
+      selected_sink = sink;
+    } else {
+      fprintf(stderr, "invalid value for %s (ignored): %s\n", ENV_VAR_SINK,
+              opt->sink);
+    }
+  }
+  fprintf(stderr, "%-30s %s\n", "Event sink:", selected_sink->name);
+  if (selected_sink->initialise != NULL)
+    selected_sink->initialise(opt);
+}
+
+const trace_sink_t *trace_sink_get(void) { return selected_sink; }
+
+void trace_sink_finalise(void) {
+  if (selected_sink->finalise != NULL)
+    selected_sink->finalise();
+}
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+/*   OTF2 SINK                                                               */
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+static OTF2_EvtWriter *otf2_evt_writer(trace_location_def_t *loc) {
+  OTF2_EvtWriter *evt_writer = NULL;
+  trace_location_get_otf2(loc, NULL, &evt_writer, NULL);
+  return evt_writer;
+}
+
+static OTF2_ErrorCode otf2_thread_begin(trace_location_def_t *loc,
+                                        OTF2_AttributeList *attributes,
+                                        OTF2_TimeStamp time,
+                                        uint64_t thread_id) {
+  return OTF2_EvtWriter_ThreadBegin(otf2_evt_writer(loc), attributes, time,
+                                    OTF2_UNDEFINED_COMM, thread_id);
+}
+
+static OTF2_ErrorCode otf2_thread_end(trace_location_def_t *loc,
+                                      OTF2_AttributeList *attributes,
+                                      OTF2_TimeStamp time, uint64_t thread_id) {
+  return OTF2_EvtWriter_ThreadEnd(otf2_evt_writer(loc), attributes, time,
+                                  OTF2_UNDEFINED_COMM, thread_id);
+}
+
+static OTF2_ErrorCode otf2_enter(trace_location_def_t *loc,
+                                 OTF2_AttributeList *attributes,
+                                 OTF2_TimeStamp time, OTF2_RegionRef region) {
+  return OTF2_EvtWriter_Enter(otf2_evt_writer(loc), attributes, time, region);
+}
+
+static OTF2_ErrorCode otf2_leave(trace_location_def_t *loc,
+                                 OTF2_AttributeList *attributes,
+                                 OTF2_TimeStamp time, OTF2_RegionRef region) {
+  return OTF2_EvtWriter_Leave(otf2_evt_writer(loc), attributes, time, region);
+}
+
+static OTF2_ErrorCode otf2_task_create(trace_location_def_t *loc,
+                                       OTF2_AttributeList *attributes,
+                                       OTF2_TimeStamp time) {
+  return OTF2_EvtWriter_ThreadTaskCreate(
+      otf2_evt_writer(loc), attributes, time, OTF2_UNDEFINED_COMM,
+      OTF2_UNDEFINED_UINT32, 0); /* creating thread, generation number */
+}
+
+static OTF2_ErrorCode otf2_task_switch(trace_location_def_t *loc,
+                                       OTF2_AttributeList *attributes,
+                                       OTF2_TimeStamp time) {
+  return OTF2_EvtWriter_ThreadTaskSwitch(
+      otf2_evt_writer(loc), attributes, time, OTF2_UNDEFINED_COMM,
+      OTF2_UNDEFINED_UINT32, 0); /* creating thread, generation number */
+}
+
+static OTF2_ErrorCode otf2_acquire_lock(trace_location_def_t *loc,
+                                        OTF2_AttributeList *attributes,
+                                        OTF2_TimeStamp time, uint32_t lock_id,
+                                        uint32_t order) {
+  return OTF2_EvtWriter_ThreadAcquireLock(otf2_evt_writer(loc), attributes,
+                                          time, OTF2_PARADIGM_OPENMP, lock_id,
+                                          order);
+}
+
+static OTF2_ErrorCode otf2_release_lock(trace_location_def_t *loc,
+                                        OTF2_AttributeList *attributes,
+                                        OTF2_TimeStamp time, uint32_t lock_id,
+                                        uint32_t order) {
+  return OTF2_EvtWriter_ThreadReleaseLock(otf2_evt_writer(loc), attributes,
+                                          time, OTF2_PARADIGM_OPENMP, lock_id,
+                                          order);
+}
+
+const trace_sink_t trace_sink_otf2 = {.name = "otf2",
+                                      .initialise = NULL,
+                                      .location_open = NULL,
+                                      .location_close = NULL,
+                                      .thread_begin = otf2_thread_begin,
+                                      .thread_end = otf2_thread_end,
+                                      .enter = otf2_enter,
+                                      .leave = otf2_leave,
+                                      .task_create = otf2_task_create,
+                                      .task_switch = otf2_task_switch,
+                                      .acquire_lock = otf2_acquire_lock,
+                                      .release_lock = otf2_release_lock,
+                                      .define_string = NULL,
+                                      .finalise = NULL};
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+/*   NULL SINK                                                               */
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+static OTF2_ErrorCode null_thread(trace_location_def_t *loc,
+                                  OTF2_AttributeList *attributes,
+                                  OTF2_TimeStamp time, uint64_t thread_id) {
+  return OTF2_AttributeList_RemoveAllAttributes(attributes);
+}
+
+static OTF2_ErrorCode null_region(trace_location_def_t *loc,
+                                  OTF2_AttributeList *attributes,
+                                  OTF2_TimeStamp time, OTF2_RegionRef region) {
+  return OTF2_AttributeList_RemoveAllAttributes(attributes);
+}
+
+static OTF2_ErrorCode null_task(trace_location_def_t *loc,
+                                OTF2_AttributeList *attributes,
+                                OTF2_TimeStamp time) {
+  return OTF2_AttributeList_RemoveAllAttributes(attributes);
+}
+
+static OTF2_ErrorCode null_lock(trace_location_def_t *loc,
+                                OTF2_AttributeList *attributes,
+                                OTF2_TimeStamp time, uint32_t lock_id,
+                                uint32_t order) {
+  return OTF2_AttributeList_RemoveAllAttributes(attributes);
+}
+
+const trace_sink_t trace_sink_null = {.name = "null",
+                                      .initialise = NULL,
+                                      .location_open = NULL,
+                                      .location_close = NULL,
+                                      .thread_begin = null_thread,
+                                      .thread_end = null_thread,
+                                      .enter = null_region,
+                                      .leave = null_region,
+                                      .task_create = null_task,
+                                      .task_switch = null_task,
+                                      .acquire_lock = null_lock,
+                                      .release_lock = null_lock,
+                                      .define_string = NULL,
+                                      .finalise = NULL};
@@ -0,0 +1,146 @@
+/**
+ * @file trace-sink.h
+ * @author Adam Tuft
+ * @brief Private interface to the sink which receives each event recorded by a
+ * location. The sink is chosen once at initialisation with OTTER_SINK and each
+ * location holds a pointer to it. An event's attributes are passed in the
+ * location's attribute list, which the sink must leave empty afterwards as
+ * OTF2's event writers do.
+ * @version 0.1
+ * @date 2026-10-19
+ *
+ * @copyright Copyright (c) 2026
+ *
+ */
+
+#if !defined(OTTER_TRACE_SINK_H)
+#define OTTER_TRACE_SINK_H
+
+#include "public/otter-common.h"
+#include "public/otter-trace/trace-location.h"
+#include <otf2/otf2.h>
+#include <stdint.h>
+
+typedef struct trace_sink_t {
+  const char *name;
+
+  /* Called once when the sink is selected. May be NULL. */
+  void (*initialise)(otter_opt_t *opt);
+
+  /* Create & destroy any per-location state the sink needs, returned by
+     trace_location_get_sink_data(). May be NULL. */
+  void *(*location_open)(trace_location_def_t *loc);
+  void (*location_close)(trace_location_def_t *loc, void *data);
+
+  /* Event records */
+  OTF2_ErrorCode (*thread_begin)(trace_location_def_t *loc,
+                                 OTF2_AttributeList *attributes,
+                                 OTF2_TimeStamp time, uint64_t thread_id);
+  OTF2_ErrorCode (*thread_end)(trace_location_def_t *loc,
+                               OTF2_AttributeList *attributes,
+                               OTF2_TimeStamp time, uint64_t thread_id);
+  OTF2_ErrorCode (*enter)(trace_location_def_t *loc,
+                          OTF2_AttributeList *attributes, OTF2_TimeStamp time,
+                          OTF2_RegionRef region);
+  OTF2_ErrorCode (*leave)(trace_location_def_t *loc,
+                          OTF2_AttributeList *attributes, OTF2_TimeStamp time,
+                          OTF2_RegionRef region);
+  OTF2_ErrorCode (*task_create)(trace_location_def_t *loc,
+                                OTF2_AttributeList *attributes,
+                                OTF2_TimeStamp time);
+  OTF2_ErrorCode (*task_switch)(trace_location_def_t *loc,
+                                OTF2_AttributeList *attributes,
+                                OTF2_TimeStamp time);
+  OTF2_ErrorCode (*acquire_lock)(trace_location_def_t *loc,
+                                 OTF2_AttributeList *attributes,
+                                 OTF2_TimeStamp time, uint32_t lock_id,
+                                 uint32_t order);
+  OTF2_ErrorCode (*release_lock)(trace_location_def_t *loc,
+                                 OTF2_AttributeList *attributes,
+                                 OTF2_TimeStamp time, uint32_t lock_id,
+                                 uint32_t order);
+
+  /* Called with the strings lock held when get_string_ref() registers a new
+     string. May be NULL. */
+  void (*define_string)(OTF2_StringRef ref, const char *string);
+
+  /* Called with the global definition writer's lock held when a region's
+     definition is written, which is when the region is destroyed. May be
+     NULL. */
+  void (*define_region)(OTF2_RegionRef ref, const char *name,
+                        OTF2_RegionRole role, OTF2_Paradigm paradigm);
+
+  /* Called once when the trace is finalised. May be NULL. */
+  void (*finalise)(void);
+} trace_sink_t;
+
+/* The available sinks */
+extern const trace_sink_t trace_sink_otf2;
+extern const trace_sink_t trace_sink_null;
+extern const trace_sink_t trace_sink_aggregate;
+extern const trace_sink_t trace_sink_stream;
+extern const trace_sink_t trace_sink_flight;
+extern const trace_sink_t trace_sink_compact;
+
+/* Select the sink named by opt->sink (default "otf2") */
+void trace_sink_initialise(otter_opt_t *opt);
+const trace_sink_t *trace_sink_get(void);
+void trace_sink_finalise(void);
+
+/* Pass an event to the location's sink */
+
+static inline OTF2_ErrorCode trace_sink_thread_begin(
+    trace_location_def_t *loc, OTF2_AttributeList *attributes,
+    OTF2_TimeStamp time, uint64_t thread_id) {
+  return trace_location_get_sink(loc)->thread_begin(loc, attributes, time,
+                                                    thread_id);
+}
+
+static inline OTF2_ErrorCode trace_sink_thread_end(
+    trace_location_def_t *loc, OTF2_AttributeList *attributes,
+    OTF2_TimeStamp time, uint64_t thread_id) {
+  return trace_location_get_sink(loc)->thread_end(loc, attributes, time,
+                                                  thread_id);
+}
+
+static inline OTF2_ErrorCode trace_sink_enter(trace_location_def_t *loc,
+                                              OTF2_AttributeList *attributes,
+                                              OTF2_TimeStamp time,
+                                              OTF2_RegionRef region) {
+  return trace_location_get_sink(loc)->enter(loc, attributes, time, region);
+}
+
+static inline OTF2_ErrorCode trace_sink_leave(trace_location_def_t *loc,
+                                              OTF2_AttributeList *attributes,
+                                              OTF2_TimeStamp time,
+                                              OTF2_RegionRef region) {
+  return trace_location_get_sink(loc)->leave(loc, attributes, time, region);
+}
+
+static inline OTF2_ErrorCode
+trace_sink_task_create(trace_location_def_t *loc,
+                       OTF2_AttributeList *attributes, OTF2_TimeStamp time) {
+  return trace_location_get_sink(loc)->task_create(loc, attributes, time);
+}
+
+static inline OTF2_ErrorCode
+trace_sink_task_switch(trace_location_def_t *loc,
+                       OTF2_AttributeList *attributes, OTF2_TimeStamp time) {
+  return trace_location_get_sink(loc)->task_switch(loc, attributes, time);
+}
+
+static inline OTF2_ErrorCode trace_sink_acquire_lock(
+    trace_location_def_t *loc, OTF2_AttributeList *attributes,
+    OTF2_TimeStamp time, uint32_t lock_id, uint32_t order) {
+  return trace_location_get_sink(loc)->acquire_lock(loc, attributes, time,
+                                                    lock_id, order);
+}
+
+static inline OTF2_ErrorCode trace_sink_release_lock(
+    trace_location_def_t *loc, OTF2_AttributeList *attributes,
+    OTF2_TimeStamp time, uint32_t lock_id, uint32_t order) {
+  return trace_location_get_sink(loc)->release_lock(loc, attributes, time,
+                                                    lock_id, order);
+}
+
+#endif // OTTER_TRACE_SINK_H
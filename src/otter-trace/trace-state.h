@@ -13,10 +13,13 @@
 #if !defined(OTTER_TRACE_STATE_IMPL_H)
 #define OTTER_TRACE_STATE_IMPL_H
 
+#include "public/otter-trace/trace-mutex.h"
+#include "trace-memory.h"
 #include "public/types/string_value_registry.hpp"
 #include <otf2/OTF2_Archive.h>
 #include <otf2/OTF2_GlobalDefWriter.h>
 #include <pthread.h>
+#include <stdbool.h>
 
 typedef struct trace_state_t {
   struct {
@@ -31,16 +34,56 @@ typedef struct trace_state_t {
     string_registry *instance;
     pthread_mutex_t lock;
   } strings;
+  struct {
+    trace_mutex_table_t *instance;
+    pthread_mutex_t lock;
+  } mutexes;
+  struct {
+    trace_memory_arena_t *instance;
+    pthread_mutex_t lock;
+  } memory;
+  // Set for the serial event model, which records events from one thread
+  // only, so that the locks below and the atomic ref counters are skipped.
+  // Fixed when the trace is initialised.
+  bool single_threaded;
 } trace_state_t;
 
 #if defined(OTTER_TRACE_STATE_GLOBAL_DECL)
 trace_state_t state = {
     {NULL},                            // archive
     {NULL, PTHREAD_MUTEX_INITIALIZER}, // global_def_writer
-    {NULL, PTHREAD_MUTEX_INITIALIZER}  // strings
+    {NULL, PTHREAD_MUTEX_INITIALIZER}, // strings
+    {NULL, PTHREAD_MUTEX_INITIALIZER}, // mutexes
+    {NULL, PTHREAD_MUTEX_INITIALIZER}, // memory
+    false                              // single_threaded
 };
 #else
 extern trace_state_t state;
 #endif
 
+// Lock and unlock a mutex guarding state shared between threads, unless only
+// one thread records events
+static inline void trace_lock(pthread_mutex_t *lock) {
+  if (!state.single_threaded)
+    pthread_mutex_lock(lock);
+}
+
+static inline void trace_unlock(pthread_mutex_t *lock) {
+  if (!state.single_threaded)
+    pthread_mutex_unlock(lock);
+}
+
+// Take the next value of a counter shared between threads
+static inline uint64_t trace_next_u64(uint64_t *counter) {
+  if (state.single_threaded)
+    return (*counter)++;
+  return __sync_fetch_and_add(counter, 1L);
+}
+
+static inline uint32_t trace_next_u32(uint32_t *counter) {
+  if (state.single_threaded)
+    return (*counter)++;
+  return __sync_fetch_and_add(counter, 1);
+}
+
 #endif // OTTER_TRACE_STATE_IMPL_H
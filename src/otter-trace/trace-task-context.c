@@ -16,11 +16,29 @@
 #include <assert.h>
 #include <limits.h>
 #include <otf2/otf2.h>
+#include <pthread.h>
 #include <stdint.h>
 #include <stdlib.h>
 
+#include "public/otter-trace/trace-task-graph.h"
+#include "trace-timestamp.h"
+
 #define TASK_ID_UNDEFINED OTF2_UNDEFINED_UINT64
 
+/* Sibling tasks with the same label and flavour, created between two of their
+   parent's synchronisations, which are recorded as their first member */
+typedef struct coarse_group {
+  pthread_mutex_t lock;
+  unique_id_t parent_id;
+  unique_id_t representative_id;
+  otter_string_ref_t label;
+  int flavour;
+  trace_coarse_group_attr_t attr;
+  uint64_t outstanding; // members which haven't ended
+  bool closed;          // the parent has synchronised or ended
+  struct coarse_group *next;
+} coarse_group;
+
 struct otter_task_context {
   unique_id_t task_context_id;
   unique_id_t parent_task_context_id;
@@ -30,6 +48,13 @@ struct otter_task_context {
   int flavour;
   otter_src_ref_t init_location;
   otter_string_ref_t label;
+  coarse_group *group;       // the group this task was coarsened into
+  bool folded;               // whether this task is in another's group
+  coarse_group *open_groups; // groups of this task's children
+  pthread_mutex_t children_lock;
+  trace_template_ref_t template_ref; // where this task is in a phase's graph
+  bool started;                      // whether this task's start was recorded
+  uint32_t references;               // holders which must release this task
 };
 
 otter_task_context *otterTaskContext_alloc(void) {
@@ -40,13 +65,22 @@ otter_task_context *otterTaskContext_alloc(void) {
 
 static unique_id_t unique_id = 0;
 
-void otterTaskContext_init(otter_task_context *task, otter_task_context *parent,
-                           int flavour, otter_src_ref_t init_location) {
+static void task_context_init(otter_task_context *task, unique_id_t id,
+                              otter_task_context *parent, int flavour,
+                              otter_src_ref_t init_location) {
   assert(task != NULL);
-  task->task_context_id = __sync_fetch_and_add(&unique_id, 1L);
+  task->task_context_id = id;
   task->flavour = flavour;
   task->init_location = init_location;
   task->label = OTTER_STRING_UNDEFINED;
+  task->task_start_time = 0;
+  task->group = NULL;
+  task->folded = false;
+  task->open_groups = NULL;
+  pthread_mutex_init(&task->children_lock, NULL);
+  task->template_ref = (trace_template_ref_t){0, 0, 0};
+  task->started = false;
+  task->references = 1;
   if (parent == NULL) {
     task->parent_task_context_id = TASK_ID_UNDEFINED;
   } else {
@@ -55,11 +89,142 @@ void otterTaskContext_init(otter_task_context *task, otter_task_context *parent,
   LOG_DEBUG("initialised task context %p: %lu", task, task->task_context_id);
 }
 
+void otterTaskContext_init(otter_task_context *task, otter_task_context *parent,
+                           int flavour, otter_src_ref_t init_location) {
+  task_context_init(task, __sync_fetch_and_add(&unique_id, 1L), parent,
+                    flavour, init_location);
+}
+
+unique_id_t otterTaskContext_init_batch(otter_task_context **tasks, size_t n,
+                                        otter_task_context *parent,
+                                        int flavour,
+                                        otter_src_ref_t init_location) {
+  assert(n > 0);
+  unique_id_t first = __sync_fetch_and_add(&unique_id, (unique_id_t)n);
+  for (size_t k = 0; k < n; k++) {
+    task_context_init(tasks[k], first + k, parent, flavour, init_location);
+  }
+  return first;
+}
+
 void otterTaskContext_delete(otter_task_context *const task) {
   LOG_DEBUG("delete task context %p: %lu", task, task->task_context_id);
+  pthread_mutex_destroy(&task->children_lock);
   free(task);
 }
 
+void otterTaskContext_acquire(otter_task_context *task) {
+  if (task != NULL)
+    __atomic_fetch_add(&task->references, 1, __ATOMIC_RELAXED);
+}
+
+bool otterTaskContext_release(otter_task_context *task) {
+  return task != NULL &&
+         __atomic_sub_fetch(&task->references, 1, __ATOMIC_ACQ_REL) == 0;
+}
+
+// Coarsening
+
+bool otterTaskContext_coarsen(otter_task_context *task,
+                              otter_task_context *parent) {
+  if (task == NULL || parent == NULL)
+    return false;
+  pthread_mutex_lock(&parent->children_lock);
+  coarse_group *group = parent->open_groups;
+  while (group != NULL &&
+         (group->label != task->label || group->flavour != task->flavour)) {
+    group = group->next;
+  }
+  if (group == NULL) {
+    group = malloc(sizeof(coarse_group));
+    if (group == NULL) {
+      // Record the task as usual rather than fail to create it
+      LOG_ERROR("failed to allocate a group for task %lu",
+                task->task_context_id);
+      pthread_mutex_unlock(&parent->children_lock);
+      return false;
+    }
+    pthread_mutex_init(&group->lock, NULL);
+    group->parent_id = otterTaskContext_get_graph_id(parent);
+    group->representative_id = task->task_context_id;
+    group->label = task->label;
+    group->flavour = task->flavour;
+    group->attr = (trace_coarse_group_attr_t){0, 0, UINT64_MAX, 0};
+    group->outstanding = 0;
+    group->closed = false;
+    group->next = parent->open_groups;
+    parent->open_groups = group;
+  }
+  pthread_mutex_lock(&group->lock);
+  group->outstanding++;
+  pthread_mutex_unlock(&group->lock);
+  pthread_mutex_unlock(&parent->children_lock);
+  task->group = group;
+  task->folded = group->representative_id != task->task_context_id;
+  LOG_DEBUG("task %lu coarsened into %lu", task->task_context_id,
+            group->representative_id);
+  return task->folded;
+}
+
+static void coarse_group_complete(coarse_group *group,
+                                  trace_location_def_t *location) {
+  // A group of one is just its representative, which needs no summary. No
+  // location means tracing is stopped
+  if (location != NULL && group->attr.tasks > 1) {
+    trace_graph_event_task_coarsened(location, group->parent_id,
+                                     group->representative_id, group->attr);
+  }
+  pthread_mutex_destroy(&group->lock);
+  free(group);
+}
+
+void otterTaskContext_coarse_start(otter_task_context *task) {
+  if (task != NULL && task->group != NULL)
+    task->task_start_time = get_timestamp();
+}
+
+void otterTaskContext_coarse_end(otter_task_context *task,
+                                 trace_location_def_t *location) {
+  if (task == NULL || task->group == NULL)
+    return;
+  coarse_group *group = task->group;
+  uint64_t time = task->task_start_time == 0
+                      ? 0
+                      : get_timestamp() - task->task_start_time;
+  pthread_mutex_lock(&group->lock);
+  group->attr.tasks++;
+  group->attr.total_time += time;
+  if (time < group->attr.min_time)
+    group->attr.min_time = time;
+  if (time > group->attr.max_time)
+    group->attr.max_time = time;
+  bool complete = --group->outstanding == 0 && group->closed;
+  pthread_mutex_unlock(&group->lock);
+  task->group = NULL;
+  if (complete)
+    coarse_group_complete(group, location);
+}
+
+void otterTaskContext_close_coarse_groups(otter_task_context *task,
+                                          trace_location_def_t *location) {
+  if (task == NULL)
+    return;
+  pthread_mutex_lock(&task->children_lock);
+  coarse_group *group = task->open_groups;
+  task->open_groups = NULL;
+  pthread_mutex_unlock(&task->children_lock);
+  while (group != NULL) {
+    coarse_group *next = group->next;
+    pthread_mutex_lock(&group->lock);
+    group->closed = true;
+    bool complete = group->outstanding == 0;
+    pthread_mutex_unlock(&group->lock);
+    if (complete)
+      coarse_group_complete(group, location);
+    group = next;
+  }
+}
+
 // Getters
 
 unique_id_t
@@ -77,6 +242,27 @@ otterTaskContext_get_parent_task_context_id(const otter_task_context *task) {
   return task == NULL ? 0 : task->parent_task_context_id;
 }
 
+unique_id_t otterTaskContext_get_graph_id(const otter_task_context *task) {
+  LOG_DEBUG("otterTaskContext_get_graph_id %p", task);
+  if (task == NULL)
+    return TASK_ID_UNDEFINED;
+  return task->folded && task->group != NULL ? task->group->representative_id
+                                             : task->task_context_id;
+}
+
+bool otterTaskContext_is_folded(const otter_task_context *task) {
+  return task != NULL && task->folded;
+}
+
+bool otterTaskContext_is_started(const otter_task_context *task) {
+  return task != NULL && task->started;
+}
+
+void otterTaskContext_set_started(otter_task_context *task) {
+  if (task != NULL)
+    task->started = true;
+}
+
 int otterTaskContext_get_task_flavour(const otter_task_context *task) {
   LOG_DEBUG("otterTaskContext_get_task_flavour %p", task);
   return task == NULL ? INT_MAX : task->flavour;
@@ -94,6 +280,17 @@ otterTaskContext_get_task_label_ref(const otter_task_context *task) {
   return task == NULL ? OTTER_STRING_UNDEFINED : task->label;
 }
 
+trace_template_ref_t
+otterTaskContext_get_template_ref(const otter_task_context *task) {
+  return task == NULL ? (trace_template_ref_t){0, 0, 0} : task->template_ref;
+}
+
+void otterTaskContext_set_template_ref(otter_task_context *task,
+                                       trace_template_ref_t ref) {
+  if (task != NULL)
+    task->template_ref = ref;
+}
+
 void otterTaskContext_set_task_label_ref(otter_task_context *task,
                                          otter_string_ref_t label) {
   LOG_DEBUG("otterTaskContext_set_task_label_ref %p", task);
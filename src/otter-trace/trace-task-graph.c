@@ -18,6 +18,7 @@
 #include "public/otter-common.h"
 #include "public/otter-environment-variables.h"
 #include "public/otter-trace/trace-task-context-interface.h"
+#include "public/otter-trace/trace-perf.h"
 #include "public/otter-trace/trace-task-graph.h"
 #include "public/otter-trace/trace-thread-data.h"
 #include "public/types/queue.h"
@@ -26,6 +27,7 @@
 #include "trace-attribute-lookup.h"
 #include "trace-attributes.h"
 #include "trace-check-error-code.h"
+#include "trace-sink.h"
 #include "trace-state.h"
 #include "trace-timestamp.h"
 #include "trace-types-as-labels.h"
@@ -66,18 +68,16 @@ static inline void *get_user_code_return_address(void) {
   return NULL;
 }
 
-void trace_graph_event_task_create(trace_location_def_t *location,
-                                   unique_id_t encountering_task_id,
-                                   unique_id_t new_task_id,
-                                   otter_string_ref_t task_label,
-                                   otter_src_ref_t create_ref) {
-  LOG_DEBUG("record task-graph event: task create");
+/* Record the creation of n tasks with consecutive IDs from new_task_id, as a
+   task-create event if n is 1 and otherwise as one task-create-batch event */
+static void task_create_event(trace_location_def_t *location,
+                              unique_id_t encountering_task_id,
+                              unique_id_t new_task_id, uint64_t n,
+                              otter_string_ref_t task_label,
+                              otter_src_ref_t create_ref) {
 
   OTF2_ErrorCode err = OTF2_SUCCESS;
   OTF2_AttributeList *attr = OTF2_AttributeList_New();
-  OTF2_EvtWriter *event_writer = NULL;
-
-  trace_location_get_otf2(location, NULL, &event_writer, NULL);
 
   err = OTF2_AttributeList_AddUint64(attr, attr_encountering_task_id,
                                      encountering_task_id);
@@ -104,18 +104,43 @@ void trace_graph_event_task_create(trace_location_def_t *location,
   err = OTF2_AttributeList_AddStringRef(attr, attr_task_label, task_label);
   CHECK_OTF2_ERROR_CODE(err);
 
+  if (n > 1) {
+    err = OTF2_AttributeList_AddUint64(attr, attr_task_batch_size, n);
+    CHECK_OTF2_ERROR_CODE(err);
+  }
+
   err = OTF2_AttributeList_AddStringRef(
-      attr, attr_event_type, attr_label_ref[attr_event_type_task_create]);
+      attr, attr_event_type,
+      attr_label_ref[n > 1 ? attr_event_type_task_create_batch
+                           : attr_event_type_task_create]);
   CHECK_OTF2_ERROR_CODE(err);
 
-  err = OTF2_EvtWriter_ThreadTaskCreate(event_writer, attr, get_timestamp(),
-                                        OTF2_UNDEFINED_COMM,
-                                        OTF2_UNDEFINED_UINT32, 0);
+  err = trace_sink_task_create(location, attr, get_timestamp());
   CHECK_OTF2_ERROR_CODE(err);
 
   OTF2_AttributeList_Delete(attr);
 }
 
+void trace_graph_event_task_create(trace_location_def_t *location,
+                                   unique_id_t encountering_task_id,
+                                   unique_id_t new_task_id,
+                                   otter_string_ref_t task_label,
+                                   otter_src_ref_t create_ref) {
+  LOG_DEBUG("record task-graph event: task create");
+  task_create_event(location, encountering_task_id, new_task_id, 1, task_label,
+                    create_ref);
+}
+
+void trace_graph_event_task_create_batch(trace_location_def_t *location,
+                                         unique_id_t encountering_task_id,
+                                         unique_id_t first_task_id, uint64_t n,
+                                         otter_string_ref_t task_label,
+                                         otter_src_ref_t create_ref) {
+  LOG_DEBUG("record task-graph event: task create batch (%lu tasks)", n);
+  task_create_event(location, encountering_task_id, first_task_id, n,
+                    task_label, create_ref);
+}
+
 /**
  * @brief Record a task-enter event with these attributes:
  *  - encountering task (the task entered)
@@ -123,27 +148,33 @@ void trace_graph_event_task_create(trace_location_def_t *location,
  *  - endpoint i.e. enter
  *  - source location
  *
+ * For n > 1 tasks with consecutive IDs, the event is a task-enter-batch event
+ * which also records n.
+ *
  * @param location
  * @param encountering_task_id
+ * @param n
  * @param start_ref
  */
-void trace_graph_event_task_begin(trace_location_def_t *location,
-                                  unique_id_t encountering_task_id,
-                                  otter_src_ref_t start_ref) {
-  LOG_DEBUG("record task-graph event: task begin");
-
+static void task_begin_event(trace_location_def_t *location,
+                             unique_id_t encountering_task_id, uint64_t n,
+                             otter_src_ref_t start_ref) {
   OTF2_ErrorCode err = OTF2_SUCCESS;
   OTF2_AttributeList *attr = OTF2_AttributeList_New();
-  OTF2_EvtWriter *event_writer = NULL;
-
-  trace_location_get_otf2(location, NULL, &event_writer, NULL);
 
   err = OTF2_AttributeList_AddUint64(attr, attr_encountering_task_id,
                                      encountering_task_id);
   CHECK_OTF2_ERROR_CODE(err);
 
+  if (n > 1) {
+    err = OTF2_AttributeList_AddUint64(attr, attr_task_batch_size, n);
+    CHECK_OTF2_ERROR_CODE(err);
+  }
+
   err = OTF2_AttributeList_AddStringRef(
-      attr, attr_event_type, attr_label_ref[attr_event_type_task_enter]);
+      attr, attr_event_type,
+      attr_label_ref[n > 1 ? attr_event_type_task_enter_batch
+                           : attr_event_type_task_enter]);
   CHECK_OTF2_ERROR_CODE(err);
 
   err = OTF2_AttributeList_AddStringRef(attr, attr_endpoint,
@@ -159,15 +190,29 @@ void trace_graph_event_task_begin(trace_location_def_t *location,
   err = OTF2_AttributeList_AddInt32(attr, attr_source_line, start_ref.line);
   CHECK_OTF2_ERROR_CODE(err);
 
+  trace_perf_add_counters(location, attr);
+
   // Record event
-  err = OTF2_EvtWriter_ThreadTaskSwitch(
-      event_writer, attr, get_timestamp(), OTF2_UNDEFINED_COMM,
-      OTF2_UNDEFINED_UINT32, 0); /* creating thread, generation number */
+  err = trace_sink_task_switch(location, attr, get_timestamp());
   CHECK_OTF2_ERROR_CODE(err);
 
   OTF2_AttributeList_Delete(attr);
 }
 
+void trace_graph_event_task_begin(trace_location_def_t *location,
+                                  unique_id_t encountering_task_id,
+                                  otter_src_ref_t start_ref) {
+  LOG_DEBUG("record task-graph event: task begin");
+  task_begin_event(location, encountering_task_id, 1, start_ref);
+}
+
+void trace_graph_event_task_begin_batch(trace_location_def_t *location,
+                                        unique_id_t first_task_id, uint64_t n,
+                                        otter_src_ref_t start_ref) {
+  LOG_DEBUG("record task-graph event: task begin batch (%lu tasks)", n);
+  task_begin_event(location, first_task_id, n, start_ref);
+}
+
 /**
  * @brief Record a task-complete event with these attributes:
  *  - encountering task (the task completed)
@@ -175,27 +220,33 @@ void trace_graph_event_task_begin(trace_location_def_t *location,
  *  - endpoint i.e. leave
  *  - source location
  *
+ * For n > 1 tasks with consecutive IDs, the event is a task-leave-batch event
+ * which also records n.
+ *
  * @param location
  * @param encountering_task_id
+ * @param n
  * @param end_ref
  */
-void trace_graph_event_task_end(trace_location_def_t *location,
-                                unique_id_t encountering_task_id,
-                                otter_src_ref_t end_ref) {
-  LOG_DEBUG("record task-graph event: task leave");
-
+static void task_end_event(trace_location_def_t *location,
+                           unique_id_t encountering_task_id, uint64_t n,
+                           otter_src_ref_t end_ref) {
   OTF2_ErrorCode err = OTF2_SUCCESS;
   OTF2_AttributeList *attr = OTF2_AttributeList_New();
-  OTF2_EvtWriter *event_writer = NULL;
-
-  trace_location_get_otf2(location, NULL, &event_writer, NULL);
 
   err = OTF2_AttributeList_AddUint64(attr, attr_encountering_task_id,
                                      encountering_task_id);
   CHECK_OTF2_ERROR_CODE(err);
 
+  if (n > 1) {
+    err = OTF2_AttributeList_AddUint64(attr, attr_task_batch_size, n);
+    CHECK_OTF2_ERROR_CODE(err);
+  }
+
   err = OTF2_AttributeList_AddStringRef(
-      attr, attr_event_type, attr_label_ref[attr_event_type_task_leave]);
+      attr, attr_event_type,
+      attr_label_ref[n > 1 ? attr_event_type_task_leave_batch
+                           : attr_event_type_task_leave]);
   CHECK_OTF2_ERROR_CODE(err);
 
   OTF2_AttributeList_AddStringRef(attr, attr_endpoint,
@@ -210,9 +261,81 @@ void trace_graph_event_task_end(trace_location_def_t *location,
   err = OTF2_AttributeList_AddInt32(attr, attr_source_line, end_ref.line);
   CHECK_OTF2_ERROR_CODE(err);
 
-  err = OTF2_EvtWriter_ThreadTaskSwitch(
-      event_writer, attr, get_timestamp(), OTF2_UNDEFINED_COMM,
-      OTF2_UNDEFINED_UINT32, 0); /* creating thread, generation number */
+  trace_perf_add_counters(location, attr);
+
+  err = trace_sink_task_switch(location, attr, get_timestamp());
+  CHECK_OTF2_ERROR_CODE(err);
+
+  OTF2_AttributeList_Delete(attr);
+}
+
+void trace_graph_event_task_end(trace_location_def_t *location,
+                                unique_id_t encountering_task_id,
+                                otter_src_ref_t end_ref) {
+  LOG_DEBUG("record task-graph event: task leave");
+  task_end_event(location, encountering_task_id, 1, end_ref);
+}
+
+void trace_graph_event_task_end_batch(trace_location_def_t *location,
+                                      unique_id_t first_task_id, uint64_t n,
+                                      otter_src_ref_t end_ref) {
+  LOG_DEBUG("record task-graph event: task leave batch (%lu tasks)", n);
+  task_end_event(location, first_task_id, n, end_ref);
+}
+
+/**
+ * @brief Record a discrete task-coarsened event with these attributes:
+ *  - encountering task (the parent of the coarsened tasks)
+ *  - unique ID of the representative task
+ *  - event type i.e. task-coarsened
+ *  - endpoint i.e. discrete
+ *  - the number of tasks in the group and their total, min & max durations
+ *
+ */
+void trace_graph_event_task_coarsened(trace_location_def_t *location,
+                                      unique_id_t encountering_task_id,
+                                      unique_id_t representative_task_id,
+                                      trace_coarse_group_attr_t group_attr) {
+  LOG_DEBUG("record task-graph event: %lu tasks coarsened into %lu",
+            group_attr.tasks, representative_task_id);
+
+  OTF2_ErrorCode err = OTF2_SUCCESS;
+  OTF2_AttributeList *attr = OTF2_AttributeList_New();
+
+  err = OTF2_AttributeList_AddUint64(attr, attr_encountering_task_id,
+                                     encountering_task_id);
+  CHECK_OTF2_ERROR_CODE(err);
+
+  err = OTF2_AttributeList_AddUint64(attr, attr_unique_id,
+                                     representative_task_id);
+  CHECK_OTF2_ERROR_CODE(err);
+
+  err = OTF2_AttributeList_AddStringRef(
+      attr, attr_event_type, attr_label_ref[attr_event_type_task_coarsened]);
+  CHECK_OTF2_ERROR_CODE(err);
+
+  err = OTF2_AttributeList_AddStringRef(attr, attr_endpoint,
+                                        attr_label_ref[attr_endpoint_discrete]);
+  CHECK_OTF2_ERROR_CODE(err);
+
+  err = OTF2_AttributeList_AddUint64(attr, attr_coarsened_tasks,
+                                     group_attr.tasks);
+  CHECK_OTF2_ERROR_CODE(err);
+
+  err = OTF2_AttributeList_AddUint64(attr, attr_coarsened_total_time,
+                                     group_attr.total_time);
+  CHECK_OTF2_ERROR_CODE(err);
+
+  err = OTF2_AttributeList_AddUint64(attr, attr_coarsened_min_time,
+                                     group_attr.min_time);
+  CHECK_OTF2_ERROR_CODE(err);
+
+  err = OTF2_AttributeList_AddUint64(attr, attr_coarsened_max_time,
+                                     group_attr.max_time);
+  CHECK_OTF2_ERROR_CODE(err);
+
+  err = trace_sink_enter(location, attr, get_timestamp(),
+                         OTF2_UNDEFINED_REGION);
   CHECK_OTF2_ERROR_CODE(err);
 
   OTF2_AttributeList_Delete(attr);
@@ -236,9 +359,6 @@ void trace_graph_synchronise_tasks(trace_location_def_t *location,
 
   OTF2_ErrorCode err = OTF2_SUCCESS;
   OTF2_AttributeList *attr = OTF2_AttributeList_New();
-  OTF2_EvtWriter *event_writer = NULL;
-
-  trace_location_get_otf2(location, NULL, &event_writer, NULL);
 
   err = OTF2_AttributeList_AddUint64(attr, attr_encountering_task_id,
                                      encountering_task_id);
@@ -287,12 +407,12 @@ void trace_graph_synchronise_tasks(trace_location_def_t *location,
   switch (endpoint) {
   case otter_endpoint_enter:
   case otter_endpoint_discrete:
-    err = OTF2_EvtWriter_Enter(event_writer, attr, get_timestamp(),
-                               OTF2_UNDEFINED_REGION);
+    err = trace_sink_enter(location, attr, get_timestamp(),
+                           OTF2_UNDEFINED_REGION);
     break;
   case otter_endpoint_leave:
-    err = OTF2_EvtWriter_Leave(event_writer, attr, get_timestamp(),
-                               OTF2_UNDEFINED_REGION);
+    err = trace_sink_leave(location, attr, get_timestamp(),
+                           OTF2_UNDEFINED_REGION);
     break;
   }
   CHECK_OTF2_ERROR_CODE(err);
@@ -0,0 +1,768 @@
+/**
+ * @file trace-template.c
+ * @author Adam Tuft
+ * @brief Records the task graph of each phase, writing each distinct graph once
+ * as a template and each phase as a reference to its template plus the times
+ * of its tasks. See trace-template.h for the file format.
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include "public/debug.h"
+#include "public/threads.h"
+#include "public/otter-trace/trace-compact.h"
+#include "public/otter-trace/trace-template.h"
+
+#include "trace-static-constants.h"
+#include "trace-timestamp.h"
+
+/* A task recorded in the open phase, by the order in which it was created */
+typedef struct {
+  uint64_t parent;
+  otter_string_ref_t label;
+  int flavour;
+  uint32_t epoch;
+  uint32_t syncs; /* sync regions this task has begun */
+  uint64_t sync_hash;
+  unique_id_t id;
+  uint64_t location; /* ref of the location which started it, plus 1 */
+  uint64_t create;
+  uint64_t start;
+  uint64_t end;
+  uint64_t hash; /* of the subtree rooted at this task */
+} template_node_t;
+
+typedef struct {
+  uint64_t node;
+  otter_endpoint_t endpoint;
+  bool descendants;
+  uint64_t time;
+} template_sync_event_t;
+
+typedef enum {
+  template_entry_create,
+  template_entry_start,
+  template_entry_end,
+  template_entry_sync
+} template_entry_kind_t;
+
+/* An event of the open phase in a thread's log. For a create, task is the
+   parent and value the new task's unique ID. For a start, value is the
+   location's ref and for a sync, the endpoint and descendants flag */
+typedef struct {
+  uint64_t time;
+  uint64_t value;
+  trace_template_ref_t task;
+  otter_string_ref_t label;
+  int32_t flavour;
+  uint32_t kind; /* template_entry_kind_t */
+} template_entry_t;
+
+/* Each thread appends the events of the open phase to its own log. Its lock is
+   otherwise taken only by the thread ending the phase, so is uncontended. A
+   log left by a thread which has exited is taken over by the next new thread */
+typedef struct {
+  pthread_mutex_t lock;
+  uint32_t id;
+  bool released;
+  struct {
+    template_entry_t *items;
+    size_t count, capacity;
+  } entries;
+} template_log_t;
+
+/* A template already written, kept to match later phases against */
+typedef struct {
+  otter_template_t def;
+  otter_template_task_t *tasks;
+  otter_template_sync_t *syncs;
+  uint64_t phases;
+} stored_template_t;
+
+/* templates.lock is taken only to begin & end a phase and to add a log */
+static struct {
+  bool enabled;
+  char dir[default_name_buf_sz + 1];
+  char path[default_name_buf_sz + 1];
+  FILE *file;
+  pthread_mutex_t lock;
+  pthread_key_t key; /* releases a thread's log when it exits */
+  uint64_t phase;    /* the open phase, or 0 if none */
+  uint64_t phase_task_id;
+  uint64_t phase_start;
+  uint64_t last_phase;
+  struct {
+    template_log_t **items;
+    size_t count, capacity;
+  } logs;
+  struct {
+    template_node_t *items;
+    size_t count, capacity;
+  } nodes;
+  struct {
+    template_sync_event_t *items;
+    size_t count, capacity;
+  } syncs;
+  struct {
+    stored_template_t *items;
+    size_t count, capacity;
+  } templates;
+  uint64_t phases;
+  uint64_t tasks;
+  uint64_t late_events; /* for tasks whose phase had already ended */
+  uint64_t bytes;
+} templates = {.lock = PTHREAD_MUTEX_INITIALIZER};
+
+static thread_local template_log_t *thread_log = NULL;
+
+static inline uint64_t template_mix(uint64_t hash, uint64_t value) {
+  hash ^= value + UINT64_C(0x9e3779b97f4a7c15) + (hash << 6) + (hash >> 2);
+  hash ^= hash >> 30;
+  hash *= UINT64_C(0xbf58476d1ce4e5b9);
+  hash ^= hash >> 27;
+  hash *= UINT64_C(0x94d049bb133111eb);
+  hash ^= hash >> 31;
+  return hash;
+}
+
+static bool template_grow(void **items, size_t *capacity, size_t count,
+                          size_t size) {
+  if (count < *capacity)
+    return true;
+  size_t grown = *capacity == 0 ? 1024 : 2 * *capacity;
+  void *larger = realloc(*items, grown * size);
+  if (larger == NULL) {
+    LOG_ERROR("failed to grow phase graph to %lu entries", grown);
+    return false;
+  }
+  *items = larger;
+  *capacity = grown;
+  return true;
+}
+
+static bool template_write(const void *data, size_t length) {
+  if (fwrite(data, 1, length, templates.file) != length) {
+    LOG_ERROR("failed to write %s: %s", templates.path, strerror(errno));
+    return false;
+  }
+  templates.bytes += length;
+  return true;
+}
+
+static void template_write_header(void) {
+  otter_template_header_t header = {.magic = OTTER_TEMPLATE_MAGIC,
+                                    .version = OTTER_TEMPLATE_VERSION,
+                                    .templates = templates.templates.count,
+                                    .phases = templates.phases};
+  if (fseek(templates.file, 0, SEEK_SET) != 0 ||
+      fwrite(&header, sizeof(header), 1, templates.file) != 1 ||
+      fseek(templates.file, 0, SEEK_END) != 0) {
+    LOG_ERROR("failed to write %s: %s", templates.path, strerror(errno));
+  }
+}
+
+static void template_log_release(void *data) {
+  template_log_t *log = data;
+  pthread_mutex_lock(&templates.lock);
+  log->released = true;
+  pthread_mutex_unlock(&templates.lock);
+}
+
+/* The calling thread's log, taking over a released log if there is one */
+static template_log_t *template_thread_log(void) {
+  if (thread_log != NULL)
+    return thread_log;
+  template_log_t *log = NULL;
+  pthread_mutex_lock(&templates.lock);
+  for (size_t k = 0; k < templates.logs.count && log == NULL; k++) {
+    if (templates.logs.items[k]->released)
+      log = templates.logs.items[k];
+  }
+  if (log != NULL) {
+    log->released = false;
+  } else if (template_grow((void **)&templates.logs.items,
+                           &templates.logs.capacity, templates.logs.count,
+                           sizeof(template_log_t *)) &&
+             (log = calloc(1, sizeof(template_log_t))) != NULL) {
+    pthread_mutex_init(&log->lock, NULL);
+    log->id = (uint32_t)++templates.logs.count;
+    templates.logs.items[log->id - 1] = log;
+  } else {
+    LOG_ERROR("failed to allocate a phase graph log");
+  }
+  pthread_mutex_unlock(&templates.lock);
+  if (log != NULL)
+    pthread_setspecific(templates.key, log);
+  thread_log = log;
+  return log;
+}
+
+void trace_template_initialise(otter_opt_t *opt) {
+  templates.enabled = opt->phase_templates;
+  if (!templates.enabled)
+    return;
+  snprintf(templates.dir, default_name_buf_sz, "%s/%s", opt->tracepath,
+           opt->archive_name);
+  snprintf(templates.path, default_name_buf_sz, "%s/%s", templates.dir,
+           OTTER_TEMPLATE_FILE);
+  pthread_key_create(&templates.key, template_log_release);
+  fprintf(stderr, "%-30s %s\n", "Phase template path:", templates.path);
+}
+
+trace_template_ref_t trace_template_phase_begin(unique_id_t phase_task_id) {
+  if (!templates.enabled)
+    return (trace_template_ref_t){0, 0, 0};
+  pthread_mutex_lock(&templates.lock);
+  /* Depending on the sink, the archive directory may not exist yet */
+  if (templates.file == NULL && templates.last_phase == 0) {
+    if (mkdir(templates.dir, 0755) == -1 && errno != EEXIST)
+      LOG_ERROR("failed to create %s: %s", templates.dir, strerror(errno));
+    templates.file = fopen(templates.path, "w+");
+    if (templates.file == NULL) {
+      LOG_ERROR("failed to create %s: %s", templates.path, strerror(errno));
+    } else {
+      template_write_header();
+      templates.bytes = sizeof(otter_template_header_t);
+    }
+  }
+  /* Only one phase is recorded at a time. A phase begun while another is open
+     (concurrently or nested) is recorded as usual, or as a task of the open
+     phase if it was created within it */
+  if (templates.file == NULL || templates.phase != 0) {
+    pthread_mutex_unlock(&templates.lock);
+    return (trace_template_ref_t){0, 0, 0};
+  }
+  templates.phase_task_id = phase_task_id;
+  templates.phase_start = get_timestamp();
+  __atomic_store_n(&templates.phase, ++templates.last_phase, __ATOMIC_SEQ_CST);
+  trace_template_ref_t ref = {templates.phase, 0, 0};
+  pthread_mutex_unlock(&templates.lock);
+  return ref;
+}
+
+/* Called with the log's lock held. The thread ending a phase closes it before
+   it takes each log's lock, so an event logged for the phase is always seen */
+static inline bool template_open(trace_template_ref_t ref) {
+  if (ref.phase == 0)
+    return false;
+  if (ref.phase != __atomic_load_n(&templates.phase, __ATOMIC_SEQ_CST)) {
+    __atomic_fetch_add(&templates.late_events, 1, __ATOMIC_RELAXED);
+    return false;
+  }
+  return true;
+}
+
+static bool template_log(template_entry_t entry, trace_template_ref_t *ref) {
+  template_log_t *log = template_thread_log();
+  if (log == NULL)
+    return false;
+  pthread_mutex_lock(&log->lock);
+  bool recorded = template_open(entry.task) &&
+                  log->entries.count < UINT32_MAX &&
+                  template_grow((void **)&log->entries.items,
+                                &log->entries.capacity, log->entries.count,
+                                sizeof(template_entry_t));
+  if (recorded) {
+    size_t index = log->entries.count++;
+    log->entries.items[index] = entry;
+    if (ref != NULL)
+      *ref = (trace_template_ref_t){entry.task.phase, log->id,
+                                    (uint32_t)index};
+  }
+  pthread_mutex_unlock(&log->lock);
+  return recorded;
+}
+
+bool trace_template_task_create(trace_template_ref_t parent,
+                                otter_string_ref_t label, int flavour,
+                                unique_id_t id, trace_template_ref_t *task) {
+  *task = (trace_template_ref_t){0, 0, 0};
+  if (!templates.enabled || parent.phase == 0)
+    return false;
+  return template_log((template_entry_t){.time = get_timestamp(),
+                                         .value = id,
+                                         .task = parent,
+                                         .label = label,
+                                         .flavour = flavour,
+                                         .kind = template_entry_create},
+                      task);
+}
+
+/* The phase task's times are kept, but its events are written as usual */
+bool trace_template_task_start(trace_template_ref_t task,
+                               trace_location_def_t *location) {
+  if (!templates.enabled || task.phase == 0)
+    return false;
+  return template_log(
+             (template_entry_t){.time = get_timestamp(),
+                                .value = trace_location_get_ref(location),
+                                .task = task,
+                                .kind = template_entry_start},
+             NULL) &&
+         task.log != 0;
+}
+
+bool trace_template_task_end(trace_template_ref_t task) {
+  if (!templates.enabled || task.phase == 0)
+    return false;
+  return template_log((template_entry_t){.time = get_timestamp(),
+                                         .task = task,
+                                         .kind = template_entry_end},
+                      NULL) &&
+         task.log != 0;
+}
+
+bool trace_template_sync(trace_template_ref_t task, otter_endpoint_t endpoint,
+                         bool descendants) {
+  if (!templates.enabled || task.phase == 0)
+    return false;
+  return template_log(
+      (template_entry_t){.time = get_timestamp(),
+                         .value = (uint64_t)endpoint << 1 | descendants,
+                         .task = task,
+                         .kind = template_entry_sync},
+      NULL);
+}
+
+/* A logged event of the closed phase, for replaying the logs in time order */
+typedef struct {
+  const template_entry_t *entry;
+  uint32_t log;
+  uint32_t index;
+} template_replay_t;
+
+static int compare_replay(const void *a, const void *b) {
+  const template_replay_t *x = a, *y = b;
+  if (x->entry->time != y->entry->time)
+    return x->entry->time < y->entry->time ? -1 : 1;
+  if (x->log != y->log)
+    return x->log < y->log ? -1 : 1;
+  return x->index < y->index ? -1 : x->index > y->index;
+}
+
+/* Build the closed phase's graph from the threads' logs, emptying them. The
+   phase must already be closed, so no thread adds to its log meanwhile */
+static bool template_build(void) {
+  size_t total = 0;
+  size_t *first = calloc(templates.logs.count + 1, sizeof(size_t));
+  if (first == NULL) {
+    LOG_ERROR("failed to allocate phase %lu", templates.last_phase);
+    return false;
+  }
+  for (size_t k = 0; k < templates.logs.count; k++) {
+    template_log_t *log = templates.logs.items[k];
+    pthread_mutex_lock(&log->lock);
+    first[k] = total;
+    total += log->entries.count;
+  }
+  first[templates.logs.count] = total;
+  template_replay_t *replay = malloc((total + 1) * sizeof(template_replay_t));
+  uint64_t *node_of = malloc((total + 1) * sizeof(uint64_t));
+  bool ok = replay != NULL && node_of != NULL;
+  if (!ok)
+    LOG_ERROR("failed to allocate phase graph of %lu events", total);
+  for (size_t k = 0; ok && k < templates.logs.count; k++) {
+    template_log_t *log = templates.logs.items[k];
+    for (size_t e = 0; e < log->entries.count; e++) {
+      replay[first[k] + e] =
+          (template_replay_t){&log->entries.items[e], (uint32_t)k + 1,
+                              (uint32_t)e};
+    }
+  }
+  if (ok)
+    qsort(replay, total, sizeof(template_replay_t), compare_replay);
+
+  /* Number the tasks before replaying, as a parent created at the same time
+     as its child by another thread may sort after it */
+  templates.nodes.count = 0;
+  templates.syncs.count = 0;
+  ok = ok && template_grow((void **)&templates.nodes.items,
+                           &templates.nodes.capacity, 0,
+                           sizeof(template_node_t));
+  if (ok) {
+    templates.nodes.items[0] = (template_node_t){
+        .parent = OTTER_TEMPLATE_NO_TASK,
+        .id = templates.phase_task_id,
+        .create = templates.phase_start,
+        .start = templates.phase_start};
+    templates.nodes.count = 1;
+  }
+  for (size_t r = 0; ok && r < total; r++) {
+    const template_replay_t *event = &replay[r];
+    if (event->entry->kind != template_entry_create)
+      continue;
+    ok = template_grow((void **)&templates.nodes.items,
+                       &templates.nodes.capacity, templates.nodes.count,
+                       sizeof(template_node_t));
+    if (ok) {
+      node_of[first[event->log - 1] + event->index] = templates.nodes.count;
+      templates.nodes.items[templates.nodes.count++] = (template_node_t){
+          .label = event->entry->label,
+          .flavour = event->entry->flavour,
+          .id = event->entry->value,
+          .create = event->entry->time};
+    }
+  }
+  for (size_t r = 0; ok && r < total; r++) {
+    const template_entry_t *entry = replay[r].entry;
+    /* Logs only hold refs to tasks logged in the same phase */
+    uint64_t task =
+        entry->task.log == 0
+            ? 0
+            : node_of[first[entry->task.log - 1] + entry->task.entry];
+    if (entry->kind == template_entry_create) {
+      uint64_t node = node_of[first[replay[r].log - 1] + replay[r].index];
+      templates.nodes.items[node].parent = task;
+      templates.nodes.items[node].epoch = templates.nodes.items[task].syncs;
+      continue;
+    }
+    template_node_t *node = &templates.nodes.items[task];
+    if (entry->kind == template_entry_start) {
+      node->start = entry->time;
+      node->location = entry->value + 1;
+    } else if (entry->kind == template_entry_end) {
+      node->end = entry->time;
+    } else {
+      ok = template_grow((void **)&templates.syncs.items,
+                         &templates.syncs.capacity, templates.syncs.count,
+                         sizeof(template_sync_event_t));
+      if (!ok)
+        break;
+      otter_endpoint_t endpoint = (otter_endpoint_t)(entry->value >> 1);
+      bool descendants = (entry->value & 1) != 0;
+      templates.syncs.items[templates.syncs.count++] =
+          (template_sync_event_t){task, endpoint, descendants, entry->time};
+      node->sync_hash =
+          template_mix(node->sync_hash, (uint64_t)endpoint << 1 | descendants);
+      if (endpoint != otter_endpoint_leave)
+        node->syncs++;
+    }
+  }
+
+  for (size_t k = 0; k < templates.logs.count; k++) {
+    template_log_t *log = templates.logs.items[k];
+    log->entries.count = 0;
+    pthread_mutex_unlock(&log->lock);
+  }
+  free(first);
+  free(replay);
+  free(node_of);
+  return ok;
+}
+
+/* Children are ordered by the hash of their subtree, so identical siblings are
+   interchangeable and the order in which threads created them doesn't
+   matter */
+typedef struct {
+  uint64_t hash;
+  uint64_t node;
+} template_child_t;
+
+static int compare_child(const void *a, const void *b) {
+  const template_child_t *x = a, *y = b;
+  if (x->hash != y->hash)
+    return x->hash < y->hash ? -1 : 1;
+  return 0;
+}
+
+/* The canonical form of the open phase's graph. order[i] is the node at
+   canonical index i, and canonical[n] the canonical index of node n */
+typedef struct {
+  otter_template_t def;
+  otter_template_task_t *tasks;
+  otter_template_sync_t *syncs;
+  uint64_t *order;
+  uint64_t *canonical;
+  uint64_t *sync_order;
+} template_form_t;
+
+static void template_form_free(template_form_t *form) {
+  free(form->tasks);
+  free(form->syncs);
+  free(form->order);
+  free(form->canonical);
+  free(form->sync_order);
+}
+
+static bool template_canonicalise(template_form_t *form) {
+  const size_t n = templates.nodes.count;
+  const size_t s = templates.syncs.count;
+  template_node_t *nodes = templates.nodes.items;
+  *form = (template_form_t){0};
+  uint64_t *first_child = calloc(n + 1, sizeof(uint64_t));
+  template_child_t *children = malloc(n * sizeof(template_child_t));
+  uint64_t *stack = malloc(n * sizeof(uint64_t));
+  form->tasks = calloc(n, sizeof(otter_template_task_t));
+  form->syncs = calloc(s + 1, sizeof(otter_template_sync_t));
+  form->order = malloc(n * sizeof(uint64_t));
+  form->canonical = malloc(n * sizeof(uint64_t));
+  form->sync_order = malloc((s + 1) * sizeof(uint64_t));
+  uint64_t *sync_first = calloc(n + 1, sizeof(uint64_t));
+  bool ok = first_child && children && stack && form->tasks && form->syncs &&
+            form->order && form->canonical && form->sync_order && sync_first;
+  if (!ok) {
+    LOG_ERROR("failed to allocate phase graph of %lu tasks", n);
+    goto exit;
+  }
+
+  for (size_t k = 1; k < n; k++) {
+    first_child[nodes[k].parent + 1]++;
+  }
+  for (size_t k = 0; k < n; k++) {
+    first_child[k + 1] += first_child[k];
+  }
+  for (size_t k = 1; k < n; k++) {
+    children[first_child[nodes[k].parent]++].node = k;
+  }
+  for (size_t k = n; k > 0; k--) {
+    first_child[k] = first_child[k - 1];
+  }
+  first_child[0] = 0;
+
+  /* Tasks in breadth-first order, so that hashing them in reverse hashes each
+     task's children before it */
+  size_t reached = 0;
+  form->order[reached++] = 0;
+  for (size_t r = 0; r < reached; r++) {
+    uint64_t k = form->order[r];
+    for (uint64_t c = first_child[k]; c < first_child[k + 1]; c++) {
+      form->order[reached++] = children[c].node;
+    }
+  }
+  if (reached != n) {
+    LOG_ERROR("phase graph has %lu tasks outside the phase", n - reached);
+    ok = false;
+    goto exit;
+  }
+  for (size_t r = n; r-- > 0;) {
+    uint64_t k = form->order[r];
+    template_node_t *node = &nodes[k];
+    uint64_t hash = template_mix(0, node->label);
+    hash = template_mix(hash, (uint64_t)(uint32_t)node->flavour);
+    hash = template_mix(hash, node->epoch);
+    hash = template_mix(hash, node->sync_hash);
+    hash = template_mix(hash, first_child[k + 1] - first_child[k]);
+    for (uint64_t c = first_child[k]; c < first_child[k + 1]; c++) {
+      children[c].hash = nodes[children[c].node].hash;
+    }
+    qsort(&children[first_child[k]], first_child[k + 1] - first_child[k],
+          sizeof(template_child_t), compare_child);
+    for (uint64_t c = first_child[k]; c < first_child[k + 1]; c++) {
+      hash = template_mix(hash, children[c].hash);
+    }
+    node->hash = hash;
+  }
+
+  /* Number the tasks depth-first, each task's children in hash order */
+  size_t depth = 0;
+  uint64_t next = 0;
+  stack[depth++] = 0;
+  while (depth > 0) {
+    uint64_t k = stack[--depth];
+    form->canonical[k] = next;
+    form->order[next++] = k;
+    for (uint64_t c = first_child[k + 1]; c-- > first_child[k];) {
+      stack[depth++] = children[c].node;
+    }
+  }
+  for (size_t i = 0; i < n; i++) {
+    const template_node_t *node = &nodes[form->order[i]];
+    form->tasks[i] = (otter_template_task_t){
+        .parent =
+            i == 0 ? OTTER_TEMPLATE_NO_TASK : form->canonical[node->parent],
+        .label = node->label,
+        .flavour = node->flavour,
+        .epoch = node->epoch};
+  }
+
+  /* Group the syncs by canonical task, keeping each task's own order */
+  template_sync_event_t *events = templates.syncs.items;
+  for (size_t e = 0; e < s; e++) {
+    sync_first[form->canonical[events[e].node] + 1]++;
+  }
+  for (size_t i = 0; i < n; i++) {
+    sync_first[i + 1] += sync_first[i];
+  }
+  for (size_t e = 0; e < s; e++) {
+    uint64_t slot = sync_first[form->canonical[events[e].node]]++;
+    form->sync_order[slot] = e;
+    form->syncs[slot] = (otter_template_sync_t){
+        .task = form->canonical[events[e].node],
+        .endpoint = (uint8_t)events[e].endpoint,
+        .descendants = events[e].descendants};
+  }
+  form->def = (otter_template_t){.hash = nodes[0].hash,
+                                 .n_tasks = n,
+                                 .n_syncs = s};
+
+exit:
+  free(first_child);
+  free(children);
+  free(stack);
+  free(sync_first);
+  if (!ok)
+    template_form_free(form);
+  return ok;
+}
+
+static stored_template_t *template_find(const template_form_t *form) {
+  for (size_t t = 0; t < templates.templates.count; t++) {
+    stored_template_t *stored = &templates.templates.items[t];
+    if (stored->def.hash == form->def.hash &&
+        stored->def.n_tasks == form->def.n_tasks &&
+        stored->def.n_syncs == form->def.n_syncs &&
+        memcmp(stored->tasks, form->tasks,
+               form->def.n_tasks * sizeof(otter_template_task_t)) == 0 &&
+        memcmp(stored->syncs, form->syncs,
+               form->def.n_syncs * sizeof(otter_template_sync_t)) == 0)
+      return stored;
+  }
+  return NULL;
+}
+
+/* Write a new template, which takes ownership of the form's tasks & syncs */
+static stored_template_t *template_store(template_form_t *form) {
+  if (!template_grow((void **)&templates.templates.items,
+                     &templates.templates.capacity, templates.templates.count,
+                     sizeof(stored_template_t)))
+    return NULL;
+  form->def.id = templates.templates.count;
+  size_t tasks_length = form->def.n_tasks * sizeof(otter_template_task_t);
+  size_t syncs_length = form->def.n_syncs * sizeof(otter_template_sync_t);
+  otter_template_record_t record = {
+      .kind = otter_template_record_template,
+      .length = sizeof(otter_template_t) + tasks_length + syncs_length};
+  if (!template_write(&record, sizeof(record)) ||
+      !template_write(&form->def, sizeof(form->def)) ||
+      !template_write(form->tasks, tasks_length) ||
+      !template_write(form->syncs, syncs_length))
+    return NULL;
+  stored_template_t *stored =
+      &templates.templates.items[templates.templates.count++];
+  *stored = (stored_template_t){form->def, form->tasks, form->syncs, 0};
+  form->tasks = NULL;
+  form->syncs = NULL;
+  return stored;
+}
+
+static bool template_write_phase(const stored_template_t *stored,
+                                 const template_form_t *form) {
+  const template_node_t *nodes = templates.nodes.items;
+  const template_sync_event_t *events = templates.syncs.items;
+  const size_t n = form->def.n_tasks;
+  const size_t s = form->def.n_syncs;
+  unsigned char *times = malloc((5 * n + s) * 10);
+  if (times == NULL) {
+    LOG_ERROR("failed to allocate times of phase %lu", templates.last_phase);
+    return false;
+  }
+  const uint64_t start_time = nodes[0].start;
+  unsigned char *p = times;
+  unique_id_t previous = templates.phase_task_id;
+  for (size_t i = 0; i < n; i++) {
+    const template_node_t *node = &nodes[form->order[i]];
+    uint64_t create = node->create > start_time ? node->create : start_time;
+    uint64_t start = node->start > start_time ? node->start : start_time;
+    p = otter_compact_put_varint(p, otter_compact_zigzag(node->id - previous));
+    p = otter_compact_put_varint(p, node->location);
+    p = otter_compact_put_varint(p, create - start_time);
+    p = otter_compact_put_varint(p, start - start_time);
+    p = otter_compact_put_varint(p, node->end >= start ? node->end - start + 1
+                                                       : 0);
+    previous = node->id;
+  }
+  for (size_t e = 0; e < s; e++) {
+    uint64_t time = events[form->sync_order[e]].time;
+    p = otter_compact_put_varint(p, time > start_time ? time - start_time : 0);
+  }
+  otter_template_phase_t phase = {stored->def.id, templates.phase_task_id,
+                                  start_time};
+  otter_template_record_t record = {
+      .kind = otter_template_record_phase,
+      .length = sizeof(phase) + (uint64_t)(p - times)};
+  bool ok = template_write(&record, sizeof(record)) &&
+            template_write(&phase, sizeof(phase)) &&
+            template_write(times, p - times);
+  free(times);
+  return ok;
+}
+
+void trace_template_phase_end(trace_template_ref_t phase) {
+  if (!templates.enabled || phase.phase == 0 || phase.log != 0)
+    return;
+  pthread_mutex_lock(&templates.lock);
+  if (templates.phase != phase.phase) {
+    pthread_mutex_unlock(&templates.lock);
+    return;
+  }
+  /* Events for the phase's tasks from now on are recorded as usual */
+  __atomic_store_n(&templates.phase, 0, __ATOMIC_SEQ_CST);
+  template_form_t form;
+  if (template_build() && template_canonicalise(&form)) {
+    stored_template_t *stored = template_find(&form);
+    if (stored == NULL)
+      stored = template_store(&form);
+    if (stored != NULL && template_write_phase(stored, &form)) {
+      stored->phases++;
+      templates.phases++;
+      templates.tasks += form.def.n_tasks - 1;
+    }
+    template_form_free(&form);
+  }
+  pthread_mutex_unlock(&templates.lock);
+}
+
+void trace_template_finalise(void) {
+  if (!templates.enabled)
+    return;
+  trace_template_phase_end((trace_template_ref_t){templates.phase, 0, 0});
+  pthread_mutex_lock(&templates.lock);
+  if (templates.file != NULL) {
+    template_write_header();
+    if (fclose(templates.file) != 0)
+      LOG_ERROR("failed to write %s: %s", templates.path, strerror(errno));
+    templates.file = NULL;
+  }
+  fprintf(stderr, "%-30s %lu for %lu phases\n", "Phase templates:",
+          (unsigned long)templates.templates.count,
+          (unsigned long)templates.phases);
+  fprintf(stderr, "%-30s %lu\n", "Templated tasks:",
+          (unsigned long)templates.tasks);
+  fprintf(stderr, "%-30s %lu\n", "Phase template bytes:",
+          (unsigned long)templates.bytes);
+  if (templates.late_events != 0)
+    fprintf(stderr, "%-30s %lu (recorded as events)\n",
+            "Events after phase ended:", (unsigned long)templates.late_events);
+  for (size_t t = 0; t < templates.templates.count; t++) {
+    free(templates.templates.items[t].tasks);
+    free(templates.templates.items[t].syncs);
+  }
+  for (size_t k = 0; k < templates.logs.count; k++) {
+    pthread_mutex_destroy(&templates.logs.items[k]->lock);
+    free(templates.logs.items[k]->entries.items);
+    free(templates.logs.items[k]);
+  }
+  free(templates.logs.items);
+  free(templates.templates.items);
+  free(templates.nodes.items);
+  free(templates.syncs.items);
+  templates.logs.items = NULL;
+  templates.templates.items = NULL;
+  templates.nodes.items = NULL;
+  templates.syncs.items = NULL;
+  templates.logs.count = templates.logs.capacity = 0;
+  templates.templates.count = templates.templates.capacity = 0;
+  templates.nodes.count = templates.nodes.capacity = 0;
+  templates.syncs.count = templates.syncs.capacity = 0;
+  /* Threads still running keep pointers to their freed logs */
+  pthread_key_delete(templates.key);
+  templates.enabled = false;
+  pthread_mutex_unlock(&templates.lock);
+}
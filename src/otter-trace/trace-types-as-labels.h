@@ -98,6 +98,50 @@ thread_type_as_label(otter_thread_t thread_type) {
   }
 }
 
+static inline attr_label_enum_t
+dependence_type_as_label(otter_dependence_type_t dependence_type) {
+  switch (dependence_type) {
+  case otter_dependence_type_in:
+    return attr_dependence_type_in;
+  case otter_dependence_type_out:
+    return attr_dependence_type_out;
+  case otter_dependence_type_inout:
+    return attr_dependence_type_inout;
+  case otter_dependence_type_mutexinoutset:
+    return attr_dependence_type_mutexinoutset;
+  case otter_dependence_type_source:
+    return attr_dependence_type_source;
+  case otter_dependence_type_sink:
+    return attr_dependence_type_sink;
+  case otter_dependence_type_inoutset:
+    return attr_dependence_type_inoutset;
+  default:
+    return attr_label_string_not_defined;
+  }
+}
+
+static inline attr_label_enum_t
+mutex_kind_as_label(otter_mutex_kind_t mutex_kind) {
+  switch (mutex_kind) {
+  case otter_mutex_lock:
+    return attr_mutex_kind_lock;
+  case otter_mutex_test_lock:
+    return attr_mutex_kind_test_lock;
+  case otter_mutex_nest_lock:
+    return attr_mutex_kind_nest_lock;
+  case otter_mutex_test_nest_lock:
+    return attr_mutex_kind_test_nest_lock;
+  case otter_mutex_critical:
+    return attr_mutex_kind_critical;
+  case otter_mutex_atomic:
+    return attr_mutex_kind_atomic;
+  case otter_mutex_ordered:
+    return attr_mutex_kind_ordered;
+  default:
+    return attr_label_string_not_defined;
+  }
+}
+
 static inline attr_label_enum_t
 region_type_as_label(trace_region_type_t region_type,
                      trace_region_attr_t attr) {
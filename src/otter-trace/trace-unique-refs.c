@@ -1,4 +1,5 @@
 #include "trace-unique-refs.h"
+#include "trace-state.h"
 #include <stdint.h>
 
 /* Different kinds of unique IDs */
@@ -12,12 +13,12 @@ typedef enum {
 
 static uint64_t get_unique_uint64_ref(trace_ref_type_t ref_type) {
   static uint64_t id[NUM_REF_TYPES] = {0};
-  return __sync_fetch_and_add(&id[ref_type], 1L);
+  return trace_next_u64(&id[ref_type]);
 }
 
 static uint32_t get_unique_uint32_ref(trace_ref_type_t ref_type) {
   static uint32_t id[NUM_REF_TYPES] = {0};
-  return __sync_fetch_and_add(&id[ref_type], 1);
+  return trace_next_u32(&id[ref_type]);
 }
 
 OTF2_RegionRef get_unique_rgn_ref(void) {
@@ -0,0 +1,200 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "public/debug.h"
+#include "public/types/chunk-queue.h"
+
+typedef struct chunk_t chunk_t;
+
+/* Items in [head, tail) are live. A chunk in a queue's list is never empty
+   except for a lone chunk in an otherwise empty queue. */
+struct chunk_t {
+  chunk_t *next;
+  size_t capacity;
+  size_t head;
+  size_t tail;
+  data_item_t items[];
+};
+
+struct otter_chunk_queue_t {
+  chunk_t *head;
+  chunk_t *tail;
+  chunk_t *spare;
+  size_t chunk_items;
+  size_t length;
+};
+
+static chunk_t *chunk_queue_get_chunk(otter_chunk_queue_t *q) {
+  chunk_t *chunk = q->spare;
+  if (chunk != NULL) {
+    q->spare = chunk->next;
+  } else {
+    chunk = malloc(sizeof(*chunk) + q->chunk_items * sizeof(data_item_t));
+    if (chunk == NULL) {
+      LOG_ERROR("chunk creation failed for queue %p", q);
+      return NULL;
+    }
+    chunk->capacity = q->chunk_items;
+  }
+  chunk->next = NULL;
+  chunk->head = chunk->tail = 0;
+  return chunk;
+}
+
+static void chunk_queue_put_spare(otter_chunk_queue_t *q, chunk_t *chunk) {
+  chunk->next = q->spare;
+  q->spare = chunk;
+}
+
+static void chunk_list_free(chunk_t *chunk) {
+  while (chunk != NULL) {
+    chunk_t *next = chunk->next;
+    free(chunk);
+    chunk = next;
+  }
+}
+
+otter_chunk_queue_t *chunk_queue_create(size_t chunk_items) {
+  otter_chunk_queue_t *q = malloc(sizeof(*q));
+  if (q == NULL) {
+    LOG_ERROR("failed to create chunk queue");
+    return NULL;
+  }
+  LOG_DEBUG("%p", q);
+  q->head = q->tail = q->spare = NULL;
+  q->chunk_items =
+      chunk_items == 0 ? OTTER_CHUNK_QUEUE_DEFAULT_CHUNK_ITEMS : chunk_items;
+  q->length = 0;
+  return q;
+}
+
+bool chunk_queue_push(otter_chunk_queue_t *q, data_item_t item) {
+  if (q == NULL) {
+    LOG_WARN("chunk queue is null, can't add item");
+    return false;
+  }
+
+  if (q->tail == NULL || q->tail->tail == q->tail->capacity) {
+    chunk_t *chunk = chunk_queue_get_chunk(q);
+    if (chunk == NULL) {
+      return false;
+    }
+    if (q->tail == NULL) {
+      q->head = q->tail = chunk;
+    } else {
+      q->tail->next = chunk;
+      q->tail = chunk;
+    }
+  }
+
+  q->tail->items[q->tail->tail++] = item;
+  q->length += 1;
+
+  LOG_DEBUG("%p[%lu]=%p", q, q->length - 1, item.ptr);
+
+  return true;
+}
+
+bool chunk_queue_pop(otter_chunk_queue_t *q, data_item_t *dest) {
+  if (q == NULL) {
+    LOG_WARN("chunk queue is null");
+    return false;
+  }
+
+  if (q->length == 0) {
+    LOG_DEBUG("%p is empty", q);
+    return false;
+  }
+
+  chunk_t *chunk = q->head;
+  if (dest != NULL)
+    *dest = chunk->items[chunk->head];
+  chunk->head++;
+  q->length -= 1;
+  LOG_WARN_IF(dest == NULL, "chunk queue popped item without returning value "
+                            "(null destination pointer)");
+
+  if (chunk->head == chunk->tail) {
+    if (chunk == q->tail) {
+      /* keep the only chunk in place and re-use it from the start */
+      chunk->head = chunk->tail = 0;
+    } else {
+      q->head = chunk->next;
+      chunk_queue_put_spare(q, chunk);
+    }
+  }
+
+  return true;
+}
+
+bool chunk_queue_peek(otter_chunk_queue_t *q, data_item_t *dest) {
+  if (q == NULL) {
+    LOG_WARN("chunk queue is null");
+    return false;
+  }
+
+  if (q->length == 0) {
+    LOG_DEBUG("%p is empty", q);
+    return false;
+  }
+
+  if (dest != NULL)
+    *dest = q->head->items[q->head->head];
+  return true;
+}
+
+size_t chunk_queue_length(otter_chunk_queue_t *q) {
+  return (q == NULL) ? 0 : q->length;
+}
+
+bool chunk_queue_is_empty(otter_chunk_queue_t *q) {
+  return (q == NULL) ? true : (q->length == 0);
+}
+
+void chunk_queue_destroy(otter_chunk_queue_t *q, bool items,
+                         data_destructor_t destructor) {
+  if (q == NULL)
+    return;
+  LOG_WARN_IF((q->length != 0 && items == false),
+              "destroying chunk queue %p (len=%lu) without destroying items "
+              "may cause memory leak",
+              q, q->length);
+  if (items) {
+    data_item_t d = {.ptr = NULL};
+    while (chunk_queue_pop(q, &d)) {
+      destructor != NULL ? destructor(d.ptr) : free(d.ptr);
+    }
+  }
+  chunk_list_free(q->head);
+  chunk_list_free(q->spare);
+  LOG_DEBUG("%p", q);
+  free(q);
+  return;
+}
+
+/* transfer items from r to q by linking r's chunks after q's tail chunk */
+bool chunk_queue_append(otter_chunk_queue_t *q, otter_chunk_queue_t *r) {
+  if ((q == NULL) || (r == NULL))
+    return false;
+
+  if (r->length == 0)
+    return true;
+
+  if (q->length == 0) {
+    /* q holds at most one empty chunk which would break the invariant that
+       chunks in the list are non-empty */
+    if (q->head != NULL)
+      chunk_queue_put_spare(q, q->head);
+    q->head = r->head;
+  } else {
+    q->tail->next = r->head;
+  }
+
+  q->tail = r->tail;
+  q->length += r->length;
+  r->head = r->tail = NULL;
+  r->length = 0;
+
+  return true;
+}
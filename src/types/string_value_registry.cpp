@@ -2,11 +2,14 @@
 #include <cassert>
 #include <string>
 #include <unordered_map>
+#include <utility>
+#include <vector>
 
 struct string_registry {
   using mapping = std::unordered_map<std::string, uint32_t>;
   using mapped_type = mapping::mapped_type;
   mapping label_map;
+  std::vector<std::pair<std::string, uint32_t>> extra_labels;
   labeller_fn *get_label;
   const mapped_type default_label{};
 };
@@ -24,6 +27,9 @@ void string_registry_apply(string_registry *registry,
   for (auto &[key, value] : registry->label_map) {
     callback(key.c_str(), value, data);
   }
+  for (auto &[key, value] : registry->extra_labels) {
+    callback(key.c_str(), value, data);
+  }
 }
 
 void string_registry_delete(string_registry *registry) {
@@ -32,11 +38,26 @@ void string_registry_delete(string_registry *registry) {
 }
 
 uint32_t string_registry_insert(string_registry *registry, const char *str) {
+  int is_new = 0;
+  return string_registry_insert_new(registry, str, &is_new);
+}
+
+uint32_t string_registry_insert_new(string_registry *registry, const char *str,
+                                    int *is_new) {
   assert(registry != NULL);
-  auto label = registry->label_map[str];
-  if (label == registry->default_label) {
+  auto &label = registry->label_map[str];
+  *is_new = (label == registry->default_label);
+  if (*is_new) {
     label = registry->get_label();
-    registry->label_map[str] = label;
   }
   return label;
 }
+
+void string_registry_insert_label(string_registry *registry, const char *str,
+                                  uint32_t label) {
+  assert(registry != NULL);
+  auto [entry, inserted] = registry->label_map.try_emplace(str, label);
+  if (!inserted && entry->second != label) {
+    registry->extra_labels.emplace_back(str, label);
+  }
+}
@@ -0,0 +1,237 @@
+#include "public/types/chunk-queue.h"
+#include <gtest/gtest.h>
+
+void mock_data_destructor(void *ptr);
+
+static int count_destructor_calls;
+
+namespace {
+class ChunkQueueTestFxt : public testing::Test {
+protected:
+  otter_chunk_queue_t *q1;
+  otter_chunk_queue_t *q2;
+  otter_chunk_queue_t *q3;
+
+  void SetUp() override {
+    q1 = chunk_queue_create(0);
+    q2 = chunk_queue_create(0);
+    q3 = chunk_queue_create(4); // small chunks to exercise chunk boundaries
+    count_destructor_calls = 0;
+  }
+
+  virtual void TearDown() override {
+    chunk_queue_destroy(q1, false, nullptr);
+    chunk_queue_destroy(q2, false, nullptr);
+    chunk_queue_destroy(q3, false, nullptr);
+    count_destructor_calls = 0;
+  }
+};
+} // namespace
+
+// Helper functions
+void mock_data_destructor(void *ptr) { count_destructor_calls++; }
+
+TEST_F(ChunkQueueTestFxt, IsNonNull) {
+  ASSERT_NE(q1, nullptr);
+  ASSERT_NE(q2, nullptr);
+  ASSERT_NE(q3, nullptr);
+}
+
+// Push
+
+TEST_F(ChunkQueueTestFxt, PushNullQueueIsFalse) {
+  data_item_t item{.value = 1};
+  ASSERT_FALSE(chunk_queue_push(nullptr, item));
+}
+
+TEST_F(ChunkQueueTestFxt, PushNonNullQueueIsTrue) {
+  data_item_t item{.value = 1};
+  ASSERT_TRUE(chunk_queue_push(q1, item));
+}
+
+// Pop
+
+TEST_F(ChunkQueueTestFxt, PopNullQueueIsFalse) {
+  data_item_t item;
+  ASSERT_FALSE(chunk_queue_pop(nullptr, &item));
+}
+
+TEST_F(ChunkQueueTestFxt, PopNonNullEmptyQueueIsFalse) {
+  data_item_t item;
+  ASSERT_FALSE(chunk_queue_pop(q1, &item));
+}
+
+TEST_F(ChunkQueueTestFxt, PopNonNullNonEmptyQueueIsTrue) {
+  data_item_t item1{.value = 1};
+  ASSERT_TRUE(chunk_queue_push(q1, item1));
+  data_item_t item2;
+  ASSERT_TRUE(chunk_queue_pop(q1, &item2));
+}
+
+// Peek
+
+TEST_F(ChunkQueueTestFxt, PeekDoesNotRemoveItem) {
+  data_item_t item1{.value = 1};
+  data_item_t item2{.value = 0};
+  ASSERT_TRUE(chunk_queue_push(q1, item1));
+  ASSERT_TRUE(chunk_queue_peek(q1, &item2));
+  ASSERT_EQ(item2.value, 1);
+  ASSERT_EQ(chunk_queue_length(q1), 1);
+}
+
+// Length
+
+TEST_F(ChunkQueueTestFxt, LengthNullQueueIsZero) {
+  ASSERT_EQ(chunk_queue_length(nullptr), 0);
+}
+
+TEST_F(ChunkQueueTestFxt, LengthNonNullEmptyQueueIsZero) {
+  ASSERT_EQ(chunk_queue_length(q1), 0);
+}
+
+TEST_F(ChunkQueueTestFxt, LengthAcrossChunksMatches) {
+  for (uint64_t i = 0; i < 10; i++) {
+    ASSERT_TRUE(chunk_queue_push(q3, data_item_t{.value = i}));
+  }
+  ASSERT_EQ(chunk_queue_length(q3), 10);
+}
+
+// Is empty
+
+TEST_F(ChunkQueueTestFxt, NullQueueIsEmpty) {
+  ASSERT_TRUE(chunk_queue_is_empty(nullptr));
+}
+
+TEST_F(ChunkQueueTestFxt, IsCreatedEmpty) {
+  ASSERT_TRUE(chunk_queue_is_empty(q1));
+}
+
+TEST_F(ChunkQueueTestFxt, NonNullNonZeroLengthQueueNotEmpty) {
+  data_item_t item{.value = 1};
+  ASSERT_TRUE(chunk_queue_push(q1, item));
+  ASSERT_FALSE(chunk_queue_is_empty(q1));
+}
+
+// Destroy items
+
+TEST_F(ChunkQueueTestFxt, DestroyItemsTrueCallsItemDestructor) {
+  otter_chunk_queue_t *q4 = chunk_queue_create(2);
+  for (uint64_t i = 0; i < 5; i++) {
+    ASSERT_TRUE(chunk_queue_push(q4, data_item_t{.value = i}));
+  }
+  chunk_queue_destroy(q4, true, &mock_data_destructor);
+  ASSERT_EQ(count_destructor_calls, 5);
+}
+
+TEST_F(ChunkQueueTestFxt, DestroyItemsFalseDoesntCallItemDestructor) {
+  otter_chunk_queue_t *q4 = chunk_queue_create(2);
+  for (uint64_t i = 0; i < 5; i++) {
+    ASSERT_TRUE(chunk_queue_push(q4, data_item_t{.value = i}));
+  }
+  chunk_queue_destroy(q4, false, &mock_data_destructor);
+  ASSERT_EQ(count_destructor_calls, 0);
+}
+
+// Append
+
+TEST_F(ChunkQueueTestFxt, AppendToFromNullQueueIsFalse) {
+  ASSERT_FALSE(chunk_queue_append(q1, nullptr));
+  ASSERT_FALSE(chunk_queue_append(nullptr, q1));
+}
+
+TEST_F(ChunkQueueTestFxt, AppendFromEmptyQueueIsTrue) {
+  ASSERT_TRUE(chunk_queue_append(q1, q2));
+}
+
+TEST_F(ChunkQueueTestFxt, LengthOfDestAfterAppendMatches) {
+  for (uint64_t i = 0; i < 3; i++) {
+    ASSERT_TRUE(chunk_queue_push(q1, data_item_t{.value = i}));
+    ASSERT_TRUE(chunk_queue_push(q2, data_item_t{.value = i}));
+  }
+  ASSERT_TRUE(chunk_queue_append(q2, q1));
+  ASSERT_EQ(chunk_queue_length(q2), 6);
+}
+
+TEST_F(ChunkQueueTestFxt, LengthOfSrcAfterAppendIsZero) {
+  for (uint64_t i = 0; i < 3; i++) {
+    ASSERT_TRUE(chunk_queue_push(q1, data_item_t{.value = i}));
+  }
+  ASSERT_TRUE(chunk_queue_append(q2, q1));
+  ASSERT_EQ(chunk_queue_length(q1), 0);
+  ASSERT_TRUE(chunk_queue_is_empty(q1));
+}
+
+TEST_F(ChunkQueueTestFxt, SrcIsReusableAfterAppend) {
+  data_item_t item{.value = 0};
+  ASSERT_TRUE(chunk_queue_push(q1, data_item_t{.value = 1}));
+  ASSERT_TRUE(chunk_queue_append(q2, q1));
+  ASSERT_TRUE(chunk_queue_push(q1, data_item_t{.value = 2}));
+  ASSERT_EQ(chunk_queue_length(q1), 1);
+  ASSERT_TRUE(chunk_queue_pop(q1, &item));
+  ASSERT_EQ(item.value, 2);
+}
+
+TEST_F(ChunkQueueTestFxt, AppendToDrainedQueueKeepsOrder) {
+  otter_chunk_queue_t *q4 = chunk_queue_create(4);
+  data_item_t item{.value = 0};
+  ASSERT_TRUE(chunk_queue_push(q3, data_item_t{.value = 99}));
+  ASSERT_TRUE(chunk_queue_pop(q3, &item));
+  for (uint64_t i = 0; i < 6; i++) {
+    ASSERT_TRUE(chunk_queue_push(q4, data_item_t{.value = i}));
+  }
+  ASSERT_TRUE(chunk_queue_append(q3, q4));
+  for (uint64_t i = 0; i < 6; i++) {
+    ASSERT_TRUE(chunk_queue_pop(q3, &item));
+    ASSERT_EQ(item.value, i);
+  }
+  ASSERT_FALSE(chunk_queue_pop(q3, &item));
+  chunk_queue_destroy(q4, false, nullptr);
+}
+
+// Item Order
+
+TEST_F(ChunkQueueTestFxt, ItemsReturnedFIFO) {
+  data_item_t item{.value = 0};
+  for (uint64_t i = 1; i <= 3; i++) {
+    ASSERT_TRUE(chunk_queue_push(q1, data_item_t{.value = i}));
+  }
+  for (uint64_t i = 1; i <= 3; i++) {
+    ASSERT_TRUE(chunk_queue_pop(q1, &item));
+    ASSERT_EQ(item.value, i);
+  }
+}
+
+TEST_F(ChunkQueueTestFxt, ItemsReturnedFIFOAcrossChunks) {
+  data_item_t item{.value = 0};
+  for (uint64_t i = 0; i < 3; i++) {
+    ASSERT_TRUE(chunk_queue_push(q3, data_item_t{.value = i}));
+  }
+  ASSERT_TRUE(chunk_queue_pop(q3, &item));
+  ASSERT_EQ(item.value, 0);
+  for (uint64_t i = 3; i < 11; i++) {
+    ASSERT_TRUE(chunk_queue_push(q3, data_item_t{.value = i}));
+  }
+  for (uint64_t i = 1; i < 11; i++) {
+    ASSERT_TRUE(chunk_queue_pop(q3, &item));
+    ASSERT_EQ(item.value, i);
+  }
+  ASSERT_TRUE(chunk_queue_is_empty(q3));
+}
+
+TEST_F(ChunkQueueTestFxt, ItemsReturnedFIFOAfterAppend) {
+  data_item_t item{.value = 0};
+  for (uint64_t i = 0; i < 5; i++) {
+    ASSERT_TRUE(chunk_queue_push(q3, data_item_t{.value = i}));
+  }
+  otter_chunk_queue_t *q4 = chunk_queue_create(4);
+  for (uint64_t i = 5; i < 11; i++) {
+    ASSERT_TRUE(chunk_queue_push(q4, data_item_t{.value = i}));
+  }
+  ASSERT_TRUE(chunk_queue_append(q3, q4));
+  ASSERT_TRUE(chunk_queue_push(q3, data_item_t{.value = 11}));
+  for (uint64_t i = 0; i < 12; i++) {
+    ASSERT_TRUE(chunk_queue_pop(q3, &item));
+    ASSERT_EQ(item.value, i);
+  }
+  chunk_queue_destroy(q4, false, nullptr);
+}
@@ -211,3 +211,43 @@ TEST_F(TestStringRegistry_C, ArgOutlivesScope) {
   ASSERT_EQ(inserted, 3);
   ASSERT_EQ(deleted, 0);
 }
+
+TEST_F(TestStringRegistry_C, InsertNewReportsNewKeysOnly) {
+  t = string_registry_make(mock_labeller);
+  int is_new = 0;
+  TestStringRegistry::label_type id1 =
+      string_registry_insert_new(t, "foo", &is_new);
+  ASSERT_TRUE(is_new);
+  TestStringRegistry::label_type id2 =
+      string_registry_insert_new(t, "foo", &is_new);
+  ASSERT_FALSE(is_new);
+  ASSERT_EQ(id1, id2);
+  string_registry_insert_new(t, "bar", &is_new);
+  ASSERT_TRUE(is_new);
+  ASSERT_EQ(inserted, 2);
+  TestStringRegistry::SafeDelete(t, nullptr, nullptr);
+}
+
+TEST_F(TestStringRegistry_C, InsertLabelUsesGivenLabel) {
+  t = string_registry_make(mock_labeller);
+  string_registry_insert_label(t, "foo", 42);
+  int is_new = 0;
+  TestStringRegistry::label_type id =
+      string_registry_insert_new(t, "foo", &is_new);
+  ASSERT_FALSE(is_new);
+  ASSERT_EQ(id, 42);
+  ASSERT_EQ(inserted, 0);
+  TestStringRegistry::SafeDelete(t, nullptr, nullptr);
+}
+
+TEST_F(TestStringRegistry_C, InsertLabelKeepsExistingLabel) {
+  int count = 0;
+  t = string_registry_make(mock_labeller);
+  TestStringRegistry::label_type id = string_registry_insert(t, "foo");
+  string_registry_insert_label(t, "foo", 42);
+  string_registry_insert_label(t, "foo", id);
+  ASSERT_EQ(string_registry_insert(t, "foo"), id);
+  TestStringRegistry::SafeDelete(t, mock_deleter_cstr_increments_int_ptr,
+                                 (void *)&count);
+  ASSERT_EQ(count, 2);
+}
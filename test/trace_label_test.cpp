@@ -0,0 +1,117 @@
+extern "C" {
+#include "public/otter-trace/trace-label.h"
+}
+#include <cstdarg>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cwchar>
+#include <gtest/gtest.h>
+#include <string>
+
+namespace {
+
+/* Format a label with the deferred-label formatter and with vsnprintf */
+::testing::AssertionResult formats_as_vsnprintf(const char *format, ...) {
+  char expected[256] = {0};
+  char actual[256] = {0};
+  va_list args, copy;
+  va_start(args, format);
+  va_copy(copy, args);
+  vsnprintf(expected, sizeof(expected), format, args);
+  bool captured = trace_label_format(actual, sizeof(actual), format, copy);
+  va_end(copy);
+  va_end(args);
+  if (!captured)
+    return ::testing::AssertionFailure()
+           << "\"" << format << "\" was not captured";
+  if (std::string(expected) != actual)
+    return ::testing::AssertionFailure()
+           << "\"" << format << "\" gave \"" << actual << "\", expected \""
+           << expected << "\"";
+  return ::testing::AssertionSuccess();
+}
+
+bool is_captured(const char *format, ...) {
+  char out[256];
+  va_list args;
+  va_start(args, format);
+  bool captured = trace_label_format(out, sizeof(out), format, args);
+  va_end(args);
+  return captured;
+}
+
+} // namespace
+
+TEST(TraceLabelFormat, PlainText) {
+  EXPECT_TRUE(formats_as_vsnprintf("task"));
+  EXPECT_TRUE(formats_as_vsnprintf(""));
+}
+
+TEST(TraceLabelFormat, Percent) {
+  EXPECT_TRUE(formats_as_vsnprintf("%%"));
+  EXPECT_TRUE(formats_as_vsnprintf("100%% of %d%%", 7));
+  EXPECT_TRUE(formats_as_vsnprintf("%%d %d %%s", 3));
+}
+
+TEST(TraceLabelFormat, Flags) {
+  EXPECT_TRUE(formats_as_vsnprintf("[%5d]", 42));
+  EXPECT_TRUE(formats_as_vsnprintf("[%-5d]", 42));
+  EXPECT_TRUE(formats_as_vsnprintf("[%+d]", 42));
+  EXPECT_TRUE(formats_as_vsnprintf("[% d]", 42));
+  EXPECT_TRUE(formats_as_vsnprintf("[%05d]", -42));
+  EXPECT_TRUE(formats_as_vsnprintf("[%#x %#o %#X]", 255u, 8u, 255u));
+  EXPECT_TRUE(formats_as_vsnprintf("[%-+8.3f]", 3.14159));
+  EXPECT_TRUE(formats_as_vsnprintf("[%#g]", 1.0));
+}
+
+TEST(TraceLabelFormat, StarWidthAndPrecision) {
+  EXPECT_TRUE(formats_as_vsnprintf("[%*d]", 6, 42));
+  EXPECT_TRUE(formats_as_vsnprintf("[%*d]", -6, 42));
+  EXPECT_TRUE(formats_as_vsnprintf("[%-*d]", 6, 42));
+  EXPECT_TRUE(formats_as_vsnprintf("[%.*f]", 2, 3.14159));
+  EXPECT_TRUE(formats_as_vsnprintf("[%*.*f]", 10, 3, 3.14159));
+  EXPECT_TRUE(formats_as_vsnprintf("[%.*d]", -1, 42));
+  EXPECT_TRUE(formats_as_vsnprintf("[%.*s]", 3, "abcdef"));
+  EXPECT_TRUE(formats_as_vsnprintf("[%*s]", 8, "abc"));
+}
+
+TEST(TraceLabelFormat, LengthModifiers) {
+  EXPECT_TRUE(formats_as_vsnprintf("%hhd %hhu", 300, 300));
+  EXPECT_TRUE(formats_as_vsnprintf("%hd %hu", 70000, 70000));
+  EXPECT_TRUE(formats_as_vsnprintf("%ld %lu", -1L, 1UL << 40));
+  EXPECT_TRUE(formats_as_vsnprintf("%lld %llu %llx", -(1LL << 50),
+                                   ~0ULL, 0xdeadbeefcafeULL));
+  EXPECT_TRUE(formats_as_vsnprintf("%zu %zx", (size_t)12345, (size_t)255));
+  EXPECT_TRUE(formats_as_vsnprintf("%jd %ju", (intmax_t)-7, (uintmax_t)7));
+  EXPECT_TRUE(formats_as_vsnprintf("%td", (ptrdiff_t)-3));
+  EXPECT_TRUE(formats_as_vsnprintf("%lf %f", 2.5, 0.125));
+}
+
+TEST(TraceLabelFormat, Conversions) {
+  EXPECT_TRUE(formats_as_vsnprintf("%d %i %u", -5, 6, 7u));
+  EXPECT_TRUE(formats_as_vsnprintf("%x %X %o", 0xabcu, 0xabcu, 8u));
+  EXPECT_TRUE(formats_as_vsnprintf("%e %E %g %G", 1e10, 1e-10, 0.5, 1e20));
+  EXPECT_TRUE(formats_as_vsnprintf("%a %A", 1.5, 0.25));
+  EXPECT_TRUE(formats_as_vsnprintf("%c%c", 'o', 'k'));
+  EXPECT_TRUE(formats_as_vsnprintf("%p", (void *)0x1234));
+  EXPECT_TRUE(formats_as_vsnprintf("fib(%d) of %s at %p", 10, "solver",
+                                   (void *)&is_captured));
+}
+
+TEST(TraceLabelFormat, Strings) {
+  EXPECT_TRUE(formats_as_vsnprintf("%s", "label"));
+  EXPECT_TRUE(formats_as_vsnprintf("[%10s|%-10s]", "right", "left"));
+  EXPECT_TRUE(formats_as_vsnprintf("%s", (const char *)NULL));
+  EXPECT_TRUE(formats_as_vsnprintf("[%8s]", (const char *)NULL));
+  EXPECT_TRUE(formats_as_vsnprintf("%s and %s", "", "b"));
+}
+
+TEST(TraceLabelFormat, Uncapturable) {
+  int n = 0;
+  EXPECT_FALSE(is_captured("%n", &n));
+  EXPECT_FALSE(is_captured("%1$d", 1));
+  EXPECT_FALSE(is_captured("%Lf", (long double)1.0));
+  EXPECT_FALSE(is_captured("%ls", L"wide"));
+  EXPECT_FALSE(is_captured("%lc", (wint_t)'w'));
+}